@@ -0,0 +1,22 @@
+#version 300 es
+
+uniform vec4 vs_params[12];
+layout(location = 0) in vec2 vertexCorner;
+layout(location = 1) in vec4 instancePositionSize;
+layout(location = 2) in vec4 instanceOriginRotation;
+out vec2 tcoord;
+layout(location = 3) in vec4 instanceTCoord;
+out vec4 color;
+layout(location = 4) in vec4 instanceColor;
+
+void main()
+{
+    vec2 _28 = (vertexCorner * instancePositionSize.zw) - instanceOriginRotation.xy;
+    float _37 = sin(instanceOriginRotation.z);
+    float _42 = cos(instanceOriginRotation.z);
+    gl_Position = ((mat4(vs_params[0], vs_params[1], vs_params[2], vs_params[3]) * mat4(vs_params[4], vs_params[5], vs_params[6], vs_params[7])) * mat4(vs_params[8], vs_params[9], vs_params[10], vs_params[11])) * vec4(instancePositionSize.xy + vec2((_28.x * _42) - (_28.y * _37), (_28.x * _37) + (_28.y * _42)), 0.0, 1.0);
+    tcoord = mix(instanceTCoord.xy, instanceTCoord.zw, vertexCorner);
+    color = instanceColor;
+    gl_PointSize = 1.0;
+}
+
@@ -0,0 +1,59 @@
+cbuffer vs_params : register(b0)
+{
+    row_major float4x4 _56_projectionMatrix : packoffset(c0);
+    row_major float4x4 _56_viewMatrix : packoffset(c4);
+    row_major float4x4 _56_modelMatrix : packoffset(c8);
+};
+
+
+static float4 gl_Position;
+static float gl_PointSize;
+static float2 vertexCorner;
+static float4 instancePositionSize;
+static float4 instanceOriginRotation;
+static float2 tcoord;
+static float4 instanceTCoord;
+static float4 color;
+static float4 instanceColor;
+
+struct SPIRV_Cross_Input
+{
+    float2 vertexCorner : TEXCOORD0;
+    float4 instancePositionSize : TEXCOORD1;
+    float4 instanceOriginRotation : TEXCOORD2;
+    float4 instanceTCoord : TEXCOORD3;
+    float4 instanceColor : TEXCOORD4;
+};
+
+struct SPIRV_Cross_Output
+{
+    float2 tcoord : TEXCOORD0;
+    float4 color : TEXCOORD1;
+    float4 gl_Position : SV_Position;
+};
+
+void vert_main()
+{
+    float2 _28 = (vertexCorner * instancePositionSize.zw) - instanceOriginRotation.xy;
+    float _37 = sin(instanceOriginRotation.z);
+    float _42 = cos(instanceOriginRotation.z);
+    gl_Position = mul(float4(instancePositionSize.xy + float2((_28.x * _42) - (_28.y * _37), (_28.x * _37) + (_28.y * _42)), 0.0f, 1.0f), mul(_56_modelMatrix, mul(_56_viewMatrix, _56_projectionMatrix)));
+    tcoord = lerp(instanceTCoord.xy, instanceTCoord.zw, vertexCorner);
+    color = instanceColor;
+    gl_PointSize = 1.0f;
+}
+
+SPIRV_Cross_Output main(SPIRV_Cross_Input stage_input)
+{
+    vertexCorner = stage_input.vertexCorner;
+    instancePositionSize = stage_input.instancePositionSize;
+    instanceOriginRotation = stage_input.instanceOriginRotation;
+    instanceTCoord = stage_input.instanceTCoord;
+    instanceColor = stage_input.instanceColor;
+    vert_main();
+    SPIRV_Cross_Output stage_output;
+    stage_output.gl_Position = gl_Position;
+    stage_output.tcoord = tcoord;
+    stage_output.color = color;
+    return stage_output;
+}
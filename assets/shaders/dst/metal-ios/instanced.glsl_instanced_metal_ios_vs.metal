@@ -0,0 +1,42 @@
+#include <metal_stdlib>
+#include <simd/simd.h>
+
+using namespace metal;
+
+struct vs_params
+{
+    float4x4 projectionMatrix;
+    float4x4 viewMatrix;
+    float4x4 modelMatrix;
+};
+
+struct main0_out
+{
+    float2 tcoord [[user(locn0)]];
+    float4 color [[user(locn1)]];
+    float4 gl_Position [[position]];
+    float gl_PointSize [[point_size]];
+};
+
+struct main0_in
+{
+    float2 vertexCorner [[attribute(0)]];
+    float4 instancePositionSize [[attribute(1)]];
+    float4 instanceOriginRotation [[attribute(2)]];
+    float4 instanceTCoord [[attribute(3)]];
+    float4 instanceColor [[attribute(4)]];
+};
+
+vertex main0_out main0(main0_in in [[stage_in]], constant vs_params& _56 [[buffer(0)]])
+{
+    main0_out out = {};
+    float2 _28 = (in.vertexCorner * in.instancePositionSize.zw) - in.instanceOriginRotation.xy;
+    float _37 = sin(in.instanceOriginRotation.z);
+    float _42 = cos(in.instanceOriginRotation.z);
+    out.gl_Position = ((_56.projectionMatrix * _56.viewMatrix) * _56.modelMatrix) * float4(in.instancePositionSize.xy + float2((_28.x * _42) - (_28.y * _37), (_28.x * _37) + (_28.y * _42)), 0.0, 1.0);
+    out.tcoord = mix(in.instanceTCoord.xy, in.instanceTCoord.zw, in.vertexCorner);
+    out.color = in.instanceColor;
+    out.gl_PointSize = 1.0;
+    return out;
+}
+
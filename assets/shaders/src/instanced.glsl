@@ -0,0 +1,44 @@
+#pragma sokol @vs vs
+in vec2 vertexCorner;
+in vec4 instancePositionSize;
+in vec4 instanceOriginRotation;
+in vec4 instanceTCoord;
+in vec4 instanceColor;
+
+out vec2 tcoord;
+out vec4 color;
+
+uniform vs_params {
+    mat4 projectionMatrix;
+    mat4 viewMatrix;
+    mat4 modelMatrix;
+};
+
+void main(void) {
+    // Expand the corner of the unit quad to the corner of the sprite and rotate it around the origin
+    vec2 local = vertexCorner * instancePositionSize.zw - instanceOriginRotation.xy;
+    float s = sin(instanceOriginRotation.z);
+    float c = cos(instanceOriginRotation.z);
+    vec2 pos = instancePositionSize.xy + vec2(local.x * c - local.y * s, local.x * s + local.y * c);
+    gl_Position = projectionMatrix * viewMatrix * modelMatrix * vec4(pos, 0.0, 1.0);
+    tcoord = mix(instanceTCoord.xy, instanceTCoord.zw, vertexCorner);
+    color = instanceColor;
+    gl_PointSize = 1.0;
+}
+#pragma sokol @end
+
+#pragma sokol @fs fs
+
+uniform texture2D tex0;
+uniform sampler smp;
+in vec2 tcoord;
+in vec4 color;
+out vec4 fragColor;
+
+void main(void) {
+    vec4 texcolor = texture(sampler2D(tex0, smp), tcoord);
+    fragColor = color * texcolor;
+}
+#pragma sokol @end
+
+#pragma sokol @program instanced vs fs
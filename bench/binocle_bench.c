@@ -0,0 +1,243 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#include "binocle_bench.h"
+#include "binocle_gd.h"
+#include "binocle_log.h"
+#include "binocle_sdl.h"
+#include "backend/binocle_material.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sokol_time.h>
+
+#define BINOCLE_BENCH_TEXTURE_SIZE (256)
+
+typedef struct binocle_bench_scenario {
+  const char *name;
+  void (*run)(binocle_bench_t *bench);
+} binocle_bench_scenario;
+
+static const binocle_bench_scenario binocle_bench_scenarios[] = {
+  {"ecs", binocle_bench_ecs},
+  {"sprite", binocle_bench_sprite},
+  {"gd", binocle_bench_gd},
+  {"collision", binocle_bench_collision},
+  {"audio", binocle_bench_audio},
+  {"atlas", binocle_bench_atlas},
+  {"lua", binocle_bench_lua},
+};
+
+void binocle_bench_seed(binocle_bench_t *bench, uint64_t seed) {
+  bench->rng_state = seed != 0 ? seed : 0x9E3779B97F4A7C15ull;
+}
+
+uint32_t binocle_bench_rand(binocle_bench_t *bench) {
+  uint64_t x = bench->rng_state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  bench->rng_state = x;
+  return (uint32_t)((x * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+float binocle_bench_randf(binocle_bench_t *bench, float min, float max) {
+  return min + (max - min) * ((float)binocle_bench_rand(bench) / (float)UINT32_MAX);
+}
+
+void binocle_bench_start(binocle_bench_t *bench, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(bench->name, sizeof(bench->name), fmt, args);
+  va_end(args);
+  bench->elapsed_ticks = 0;
+  bench->allocs.count = 0;
+  bench->allocs.bytes = 0;
+  bench->running = false;
+  binocle_bench_resume(bench);
+}
+
+void binocle_bench_pause(binocle_bench_t *bench) {
+  if (!bench->running) {
+    return;
+  }
+  uint64_t ticks = stm_since(bench->start_ticks);
+  binocle_bench_alloc_stats allocs = binocle_bench_get_alloc_stats();
+  bench->elapsed_ticks += ticks;
+  bench->allocs.count += allocs.count - bench->start_allocs.count;
+  bench->allocs.bytes += allocs.bytes - bench->start_allocs.bytes;
+  bench->running = false;
+}
+
+void binocle_bench_resume(binocle_bench_t *bench) {
+  if (bench->running) {
+    return;
+  }
+  bench->running = true;
+  bench->start_allocs = binocle_bench_get_alloc_stats();
+  bench->start_ticks = stm_now();
+}
+
+void binocle_bench_stop(binocle_bench_t *bench, uint64_t ops) {
+  binocle_bench_pause(bench);
+  if (ops == 0) {
+    ops = 1;
+  }
+
+  double ns_per_op = stm_ns(bench->elapsed_ticks) / (double)ops;
+  for (size_t i = 0 ; i < bench->num_results ; i++) {
+    binocle_bench_result *result = &bench->results[i];
+    if (strcmp(result->name, bench->name) == 0) {
+      // Repetitions keep the best time, the allocations don't change from one run to the next
+      if (ns_per_op < result->ns_per_op) {
+        result->ns_per_op = ns_per_op;
+      }
+      return;
+    }
+  }
+
+  if (bench->num_results >= bench->results_capacity) {
+    size_t new_capacity = bench->results_capacity + bench->results_capacity / 2; // grow by x1.5
+    if (new_capacity < 16) {
+      new_capacity = 16;
+    }
+    binocle_bench_result *results = realloc(bench->results, sizeof(binocle_bench_result) * new_capacity);
+    if (results == NULL) {
+      binocle_log_error("binocle_bench_stop(): Cannot store the result of %s", bench->name);
+      return;
+    }
+    bench->results = results;
+    bench->results_capacity = new_capacity;
+  }
+  binocle_bench_result *result = &bench->results[bench->num_results++];
+  memcpy(result->name, bench->name, sizeof(result->name));
+  result->ops = ops;
+  result->ns_per_op = ns_per_op;
+  result->allocs_per_op = (double)bench->allocs.count / (double)ops;
+  result->bytes_per_op = (double)bench->allocs.bytes / (double)ops;
+}
+
+static struct binocle_material *binocle_bench_create_material(sg_shader shader, uint8_t shade) {
+  size_t size = BINOCLE_BENCH_TEXTURE_SIZE * BINOCLE_BENCH_TEXTURE_SIZE * 4;
+  uint8_t *pixels = malloc(size);
+  memset(pixels, shade, size);
+  sg_image_desc desc = {
+    .width = BINOCLE_BENCH_TEXTURE_SIZE,
+    .height = BINOCLE_BENCH_TEXTURE_SIZE,
+    .pixel_format = SG_PIXELFORMAT_RGBA8,
+    .data.subimage[0][0] = {.ptr = pixels, .size = size},
+    .label = "bench-texture",
+  };
+  binocle_material *material = binocle_material_new();
+  material->albedo_texture = sg_make_image(&desc);
+  material->shader = shader;
+  free(pixels);
+  return material;
+}
+
+static void binocle_bench_setup_gd(binocle_bench_t *bench) {
+  bench->gd = binocle_gd_new();
+  binocle_gd_init(&bench->gd, NULL);
+
+  // The dummy backend doesn't compile anything, so the shaders only need their layout
+  sg_shader_desc offscreen_desc = binocle_gd_create_offscreen_shader_desc("bench-offscreen-shader", NULL, NULL);
+  sg_shader offscreen_shader = sg_make_shader(&offscreen_desc);
+  sg_shader display_shader = sg_make_shader(&(sg_shader_desc){
+    .label = "bench-display-shader",
+    .attrs[0].name = "position",
+    .vs.uniform_blocks[0] = {
+      .size = sizeof(float) * 16,
+      .layout = SG_UNIFORMLAYOUT_STD140,
+      .uniforms[0] = {.name = "vs_params", .type = SG_UNIFORMTYPE_FLOAT4, .array_count = 4},
+    },
+    .fs.images[0] = {.used = true, .image_type = SG_IMAGETYPE_2D, .sample_type = SG_IMAGESAMPLETYPE_FLOAT},
+    .fs.samplers[0] = {.used = true, .sampler_type = SG_SAMPLERTYPE_FILTERING},
+    .fs.image_sampler_pairs[0] = {.used = true, .glsl_name = "tex0_smp", .image_slot = 0, .sampler_slot = 0},
+    .fs.uniform_blocks[0] = {
+      .size = sizeof(float) * 8,
+      .layout = SG_UNIFORMLAYOUT_STD140,
+      .uniforms[0] = {.name = "fs_params", .type = SG_UNIFORMTYPE_FLOAT4, .array_count = 2},
+    },
+  });
+  binocle_gd_setup_default_pipeline(&bench->gd, 1280, 720, offscreen_shader, display_shader);
+  sg_shader_desc instanced_desc = binocle_gd_create_instanced_shader_desc("bench-instanced-shader", NULL, NULL);
+  binocle_gd_setup_instanced_pipeline(&bench->gd, sg_make_shader(&instanced_desc));
+
+  bench->material = binocle_bench_create_material(offscreen_shader, 0xff);
+  bench->other_material = binocle_bench_create_material(offscreen_shader, 0x80);
+}
+
+static void binocle_bench_print_usage(void) {
+  printf("Usage: binocle_bench [options]\n"
+         "  --filter <text>       only run the scenarios whose name contains text\n"
+         "  --quick               cap the size of the scenarios\n"
+         "  --repetitions <n>     run each scenario n times and report the best time (default: 3)\n"
+         "  --data-dir <path>     the folder with the assets, ending with a slash\n"
+         "  --csv                 print the results as CSV\n");
+}
+
+int main(int argc, char *argv[]) {
+  // This must come before anything gets allocated through SDL
+  binocle_bench_install_alloc_hooks();
+  stm_setup();
+  // The engine logs every asset it loads, which would bury the results
+  SDL_SetLogPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN);
+
+  binocle_bench_t bench = {0};
+  bench.repetitions = 3;
+  bench.data_dir = BINOCLE_BENCH_DATA_DIR;
+  bool csv = false;
+
+  for (int i = 1 ; i < argc ; i++) {
+    if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      bench.filter = argv[++i];
+    } else if (strcmp(argv[i], "--quick") == 0) {
+      bench.quick = true;
+    } else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc) {
+      int repetitions = atoi(argv[++i]);
+      bench.repetitions = repetitions > 0 ? (uint32_t)repetitions : 1;
+    } else if (strcmp(argv[i], "--data-dir") == 0 && i + 1 < argc) {
+      bench.data_dir = argv[++i];
+    } else if (strcmp(argv[i], "--csv") == 0) {
+      csv = true;
+    } else {
+      binocle_bench_print_usage();
+      return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+    }
+  }
+
+  binocle_bench_setup_gd(&bench);
+
+  size_t num_scenarios = sizeof(binocle_bench_scenarios) / sizeof(binocle_bench_scenarios[0]);
+  for (size_t i = 0 ; i < num_scenarios ; i++) {
+    const binocle_bench_scenario *scenario = &binocle_bench_scenarios[i];
+    if (bench.filter != NULL && strstr(scenario->name, bench.filter) == NULL) {
+      continue;
+    }
+    for (uint32_t r = 0 ; r < bench.repetitions ; r++) {
+      scenario->run(&bench);
+    }
+  }
+
+  if (csv) {
+    printf("name,ops,ns_per_op,allocs_per_op,bytes_per_op\n");
+  } else {
+    printf("%-40s %12s %14s %12s %14s\n", "name", "ops", "ns/op", "allocs/op", "bytes/op");
+  }
+  for (size_t i = 0 ; i < bench.num_results ; i++) {
+    const binocle_bench_result *result = &bench.results[i];
+    printf(csv ? "%s,%llu,%.3f,%.4f,%.2f\n" : "%-40s %12llu %14.3f %12.4f %14.2f\n", result->name,
+           (unsigned long long)result->ops, result->ns_per_op, result->allocs_per_op, result->bytes_per_op);
+  }
+
+  binocle_material_destroy(bench.material);
+  binocle_material_destroy(bench.other_material);
+  binocle_gd_destroy(&bench.gd);
+  sg_shutdown();
+  free(bench.results);
+  return 0;
+}
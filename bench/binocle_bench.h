@@ -0,0 +1,149 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#ifndef BINOCLE_BENCH_H
+#define BINOCLE_BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "binocle_gd.h"
+
+#define BINOCLE_BENCH_MAX_NAME_LENGTH (64)
+
+struct binocle_material;
+
+/**
+ * The allocations made since the benchmark started, as counted by the wrappers in binocle_bench_alloc.h
+ */
+typedef struct binocle_bench_alloc_stats {
+  /// The number of calls to malloc, calloc and realloc
+  uint64_t count;
+  /// The bytes requested by those calls
+  uint64_t bytes;
+} binocle_bench_alloc_stats;
+
+/**
+ * The outcome of a measurement
+ */
+typedef struct binocle_bench_result {
+  char name[BINOCLE_BENCH_MAX_NAME_LENGTH];
+  /// The number of operations performed while measuring
+  uint64_t ops;
+  /// The best time of all the repetitions
+  double ns_per_op;
+  double allocs_per_op;
+  double bytes_per_op;
+} binocle_bench_result;
+
+/**
+ * The state of the benchmark runner, shared by all the scenarios
+ */
+typedef struct binocle_bench_t {
+  /// Only the scenarios whose name contains this string are run. NULL runs them all.
+  const char *filter;
+  /// Caps the size of the scenarios so that they complete in a few seconds
+  bool quick;
+  /// The number of times each scenario is run. The best time is reported.
+  uint32_t repetitions;
+  /// The folder with the assets, ending with a slash
+  const char *data_dir;
+
+  /// The graphics device, set up on the dummy backend with the default pipeline
+  binocle_gd gd;
+  /// A material with a 256x256 texture and the default offscreen shader
+  struct binocle_material *material;
+  /// The same as material with a different texture, to break the batches
+  struct binocle_material *other_material;
+
+  uint64_t rng_state;
+
+  char name[BINOCLE_BENCH_MAX_NAME_LENGTH];
+  bool running;
+  uint64_t start_ticks;
+  uint64_t elapsed_ticks;
+  binocle_bench_alloc_stats start_allocs;
+  binocle_bench_alloc_stats allocs;
+
+  binocle_bench_result *results;
+  size_t num_results;
+  size_t results_capacity;
+} binocle_bench_t;
+
+/**
+ * \brief Resets the random number generator so that a scenario gets the same numbers at each run
+ * @param bench the benchmark runner
+ * @param seed the seed. Zero is replaced by a fixed non zero value.
+ */
+void binocle_bench_seed(binocle_bench_t *bench, uint64_t seed);
+
+/**
+ * \brief Gets the next random number (xorshift64*)
+ * @param bench the benchmark runner
+ * @return the random number
+ */
+uint32_t binocle_bench_rand(binocle_bench_t *bench);
+
+/**
+ * \brief Gets a random number in the given range
+ * @param bench the benchmark runner
+ * @param min the minimum value
+ * @param max the maximum value
+ * @return the random number
+ */
+float binocle_bench_randf(binocle_bench_t *bench, float min, float max);
+
+/**
+ * \brief Starts measuring time and allocations
+ * @param bench the benchmark runner
+ * @param fmt the printf-like format of the name of the measurement
+ */
+void binocle_bench_start(binocle_bench_t *bench, const char *fmt, ...);
+
+/**
+ * \brief Stops counting time and allocations, for example to leave out the setup of the next step
+ * @param bench the benchmark runner
+ */
+void binocle_bench_pause(binocle_bench_t *bench);
+
+/**
+ * \brief Resumes counting time and allocations after \ref binocle_bench_pause
+ * @param bench the benchmark runner
+ */
+void binocle_bench_resume(binocle_bench_t *bench);
+
+/**
+ * \brief Ends the measurement and records its result
+ * @param bench the benchmark runner
+ * @param ops the number of operations performed since \ref binocle_bench_start. The time and the allocations are
+ * reported per operation.
+ */
+void binocle_bench_stop(binocle_bench_t *bench, uint64_t ops);
+
+/**
+ * \brief Gets the allocations counted so far
+ * @return the allocations
+ */
+binocle_bench_alloc_stats binocle_bench_get_alloc_stats(void);
+
+/**
+ * \brief Routes the allocations of SDL and parson through the counting wrappers
+ * It must be called before anything gets allocated through SDL.
+ */
+void binocle_bench_install_alloc_hooks(void);
+
+/*
+ * The scenarios
+ */
+void binocle_bench_ecs(binocle_bench_t *bench);
+void binocle_bench_sprite(binocle_bench_t *bench);
+void binocle_bench_gd(binocle_bench_t *bench);
+void binocle_bench_collision(binocle_bench_t *bench);
+void binocle_bench_audio(binocle_bench_t *bench);
+void binocle_bench_atlas(binocle_bench_t *bench);
+void binocle_bench_lua(binocle_bench_t *bench);
+
+#endif //BINOCLE_BENCH_H
@@ -0,0 +1,58 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#include "binocle_bench.h"
+#include "binocle_bench_alloc.h"
+#include "binocle_sdl.h"
+#include <parson/parson.h>
+
+// The wrappers need the real allocator
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+
+static SDL_SpinLock binocle_bench_alloc_lock = 0;
+static binocle_bench_alloc_stats binocle_bench_allocs = {0};
+
+static void binocle_bench_count_alloc(size_t size) {
+  // The ECS scheduler allocates from its worker threads as well
+  SDL_LockSpinlock(&binocle_bench_alloc_lock);
+  binocle_bench_allocs.count++;
+  binocle_bench_allocs.bytes += size;
+  SDL_UnlockSpinlock(&binocle_bench_alloc_lock);
+}
+
+void *binocle_bench_malloc(size_t size) {
+  binocle_bench_count_alloc(size);
+  return malloc(size);
+}
+
+void *binocle_bench_calloc(size_t num, size_t size) {
+  binocle_bench_count_alloc(num * size);
+  return calloc(num, size);
+}
+
+void *binocle_bench_realloc(void *ptr, size_t size) {
+  binocle_bench_count_alloc(size);
+  return realloc(ptr, size);
+}
+
+void binocle_bench_free(void *ptr) {
+  free(ptr);
+}
+
+binocle_bench_alloc_stats binocle_bench_get_alloc_stats(void) {
+  SDL_LockSpinlock(&binocle_bench_alloc_lock);
+  binocle_bench_alloc_stats res = binocle_bench_allocs;
+  SDL_UnlockSpinlock(&binocle_bench_alloc_lock);
+  return res;
+}
+
+void binocle_bench_install_alloc_hooks(void) {
+  SDL_SetMemoryFunctions(binocle_bench_malloc, binocle_bench_calloc, binocle_bench_realloc, binocle_bench_free);
+  json_set_allocation_functions(binocle_bench_malloc, binocle_bench_free);
+}
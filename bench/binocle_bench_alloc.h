@@ -0,0 +1,29 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+/*
+ * This header is force-included in every source file of binocle_bench, so that the allocations made by the engine go
+ * through the counting wrappers below. The third party libraries linked as object files aren't rebuilt, so their own
+ * allocations are only counted when they let us replace the allocator (SDL, parson and Lua do).
+ */
+
+#ifndef BINOCLE_BENCH_ALLOC_H
+#define BINOCLE_BENCH_ALLOC_H
+
+#include <stddef.h>
+#include <stdlib.h>
+
+void *binocle_bench_malloc(size_t size);
+void *binocle_bench_calloc(size_t num, size_t size);
+void *binocle_bench_realloc(void *ptr, size_t size);
+void binocle_bench_free(void *ptr);
+
+#define malloc(size) binocle_bench_malloc(size)
+#define calloc(num, size) binocle_bench_calloc(num, size)
+#define realloc(ptr, size) binocle_bench_realloc(ptr, size)
+#define free(ptr) binocle_bench_free(ptr)
+
+#endif //BINOCLE_BENCH_ALLOC_H
@@ -0,0 +1,33 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#include "binocle_bench.h"
+#include "binocle_atlas.h"
+#include "binocle_log.h"
+#include <stdio.h>
+
+#define BINOCLE_BENCH_ATLAS_LOADS (20)
+
+void binocle_bench_atlas(binocle_bench_t *bench) {
+  char filename[1024];
+  snprintf(filename, sizeof(filename), "%s%s", bench->data_dir, "sheets/entities.json");
+  binocle_atlas_texturepacker_load_desc desc = {
+    .filename = filename,
+    .fs = BINOCLE_FS_SDL,
+  };
+
+  binocle_bench_start(bench, "atlas/load_texturepacker");
+  for (int i = 0 ; i < BINOCLE_BENCH_ATLAS_LOADS ; i++) {
+    binocle_atlas_texturepacker atlas = {0};
+    if (!binocle_atlas_load_texturepacker(&atlas, &desc)) {
+      binocle_log_error("binocle_bench_atlas(): Cannot load %s, use --data-dir to point to the assets", filename);
+      binocle_bench_pause(bench);
+      return;
+    }
+    binocle_atlas_destroy_texturepacker(&atlas);
+  }
+  binocle_bench_stop(bench, BINOCLE_BENCH_ATLAS_LOADS);
+}
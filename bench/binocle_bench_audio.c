@@ -0,0 +1,52 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#include "binocle_bench.h"
+#include "binocle_audio.h"
+
+#define BINOCLE_BENCH_AUDIO_VOICES (16)
+#define BINOCLE_BENCH_AUDIO_PERIOD_FRAMES (512)
+#define BINOCLE_BENCH_AUDIO_PERIODS (400)
+// The voices are sampled at a different rate than the device, so that the converter has to resample them
+#define BINOCLE_BENCH_AUDIO_VOICE_SAMPLE_RATE (22050)
+
+void binocle_bench_audio(binocle_bench_t *bench) {
+  // There's no device to open on a headless machine, so we act as the device and pull the mixed periods ourselves
+  binocle_audio audio = binocle_audio_new();
+  audio.device.sampleRate = BINOCLE_AUDIO_DEVICE_SAMPLE_RATE;
+  audio.device.playback.format = BINOCLE_AUDIO_DEVICE_FORMAT;
+  audio.device.playback.channels = BINOCLE_AUDIO_DEVICE_CHANNELS;
+  audio.device.pUserData = &audio;
+  ma_mutex_init(&audio.lock);
+
+  binocle_bench_seed(bench, 0xA0D10);
+  binocle_audio_buffer *voices[BINOCLE_BENCH_AUDIO_VOICES];
+  for (int i = 0 ; i < BINOCLE_BENCH_AUDIO_VOICES ; i++) {
+    ma_uint32 frames = BINOCLE_BENCH_AUDIO_VOICE_SAMPLE_RATE / 2;
+    voices[i] = binocle_audio_load_audio_buffer(&audio, ma_format_f32, 1, BINOCLE_BENCH_AUDIO_VOICE_SAMPLE_RATE, frames,
+                                                BINOCLE_AUDIO_BUFFER_USAGE_STATIC);
+    float *samples = (float *)voices[i]->data;
+    for (ma_uint32 s = 0 ; s < frames ; s++) {
+      samples[s] = binocle_bench_randf(bench, -1.0f, 1.0f);
+    }
+    voices[i]->looping = true;
+    voices[i]->pan = binocle_bench_randf(bench, 0.0f, 1.0f);
+    binocle_audio_set_audio_buffer_volume(voices[i], binocle_bench_randf(bench, 0.2f, 1.0f));
+    binocle_audio_play_audio_buffer(voices[i]);
+  }
+
+  float output[BINOCLE_BENCH_AUDIO_PERIOD_FRAMES * BINOCLE_AUDIO_DEVICE_CHANNELS];
+  binocle_bench_start(bench, "audio/mix/%d_voices", BINOCLE_BENCH_AUDIO_VOICES);
+  for (int i = 0 ; i < BINOCLE_BENCH_AUDIO_PERIODS ; i++) {
+    binocle_audio_on_send_audio_data_to_device(&audio.device, output, NULL, BINOCLE_BENCH_AUDIO_PERIOD_FRAMES);
+  }
+  binocle_bench_stop(bench, BINOCLE_BENCH_AUDIO_PERIOD_FRAMES * BINOCLE_BENCH_AUDIO_PERIODS);
+
+  for (int i = 0 ; i < BINOCLE_BENCH_AUDIO_VOICES ; i++) {
+    binocle_audio_unload_audio_buffer(&audio, voices[i]);
+  }
+  ma_mutex_uninit(&audio.lock);
+}
@@ -0,0 +1,293 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#include "binocle_bench.h"
+#include "binocle_collision.h"
+#include "binocle_collision_batch.h"
+#include <math.h>
+#include <stdlib.h>
+
+#define BINOCLE_BENCH_COLLISION_WORLD_SIZE (4096.0f)
+#define BINOCLE_BENCH_COLLISION_CELL_SIZE (64)
+
+static void binocle_bench_collision_run(binocle_bench_t *bench, binocle_spatial_hash_mode mode, uint32_t num_bodies) {
+  const char *name = mode == BINOCLE_SPATIAL_HASH_MODE_DENSE ? "spatial_hash_dense" : "spatial_hash";
+  binocle_collider *colliders = malloc(sizeof(binocle_collider) * num_bodies);
+  binocle_collider_hitbox *hitboxes = malloc(sizeof(binocle_collider_hitbox) * num_bodies);
+  binocle_spatial_hash spatial_hash;
+  if (mode == BINOCLE_SPATIAL_HASH_MODE_DENSE) {
+    spatial_hash = binocle_spatial_hash_new_dense(BINOCLE_BENCH_COLLISION_WORLD_SIZE, BINOCLE_BENCH_COLLISION_WORLD_SIZE,
+                                                  BINOCLE_BENCH_COLLISION_CELL_SIZE);
+  } else {
+    spatial_hash = binocle_spatial_hash_new(BINOCLE_BENCH_COLLISION_WORLD_SIZE, BINOCLE_BENCH_COLLISION_WORLD_SIZE,
+                                            BINOCLE_BENCH_COLLISION_CELL_SIZE);
+  }
+
+  binocle_bench_seed(bench, 0xC011);
+  for (uint32_t i = 0 ; i < num_bodies ; i++) {
+    kmAABB2 aabb;
+    float size = binocle_bench_randf(bench, 8.0f, 96.0f);
+    aabb.min.x = binocle_bench_randf(bench, 0.0f, BINOCLE_BENCH_COLLISION_WORLD_SIZE - 1.0f - size);
+    aabb.min.y = binocle_bench_randf(bench, 0.0f, BINOCLE_BENCH_COLLISION_WORLD_SIZE - 1.0f - size);
+    aabb.max.x = aabb.min.x + size;
+    aabb.max.y = aabb.min.y + size;
+    hitboxes[i] = binocle_collider_hitbox_new(aabb);
+    colliders[i] = binocle_collider_new();
+    colliders[i].hitbox = &hitboxes[i];
+  }
+
+  binocle_bench_start(bench, "%s/insert/%u", name, num_bodies);
+  for (uint32_t i = 0 ; i < num_bodies ; i++) {
+    binocle_spatial_hash_add_body(&spatial_hash, &colliders[i]);
+  }
+  binocle_bench_stop(bench, num_bodies);
+
+  binocle_collider_ptr_array_t neighbors;
+  da_init(neighbors);
+  binocle_bench_start(bench, "%s/query/%u", name, num_bodies);
+  for (uint32_t i = 0 ; i < num_bodies ; i++) {
+    binocle_spatial_hash_get_all_bodies_sharing_cells_with_body(&spatial_hash, &colliders[i], &neighbors, 0);
+  }
+  binocle_bench_stop(bench, num_bodies);
+  da_free(neighbors);
+
+  // The buffer is sized by a first call, as a game would do once and then reuse it
+  size_t max_pairs = binocle_spatial_hash_query_pairs(&spatial_hash, NULL, 0);
+  binocle_collider_pair *pairs = malloc(sizeof(binocle_collider_pair) * (max_pairs > 0 ? max_pairs : 1));
+  binocle_bench_start(bench, "%s/pairs/%u", name, num_bodies);
+  size_t num_pairs = binocle_spatial_hash_query_pairs(&spatial_hash, pairs, max_pairs);
+  binocle_bench_stop(bench, num_pairs);
+  free(pairs);
+
+  // Line of sight checks of 500 agents
+  binocle_ray rays[500];
+  binocle_ray_hit hits[500];
+  for (uint32_t i = 0 ; i < 500 ; i++) {
+    float angle = binocle_bench_randf(bench, 0.0f, 6.2831853f);
+    rays[i].origin.x = binocle_bench_randf(bench, 0.0f, BINOCLE_BENCH_COLLISION_WORLD_SIZE);
+    rays[i].origin.y = binocle_bench_randf(bench, 0.0f, BINOCLE_BENCH_COLLISION_WORLD_SIZE);
+    rays[i].direction.x = cosf(angle);
+    rays[i].direction.y = sinf(angle);
+    rays[i].max_distance = 512.0f;
+  }
+  binocle_bench_start(bench, "%s/ray_cast/%u", name, num_bodies);
+  binocle_spatial_hash_ray_cast_batch(&spatial_hash, rays, 500, 0, hits);
+  binocle_bench_stop(bench, 500);
+
+  binocle_bench_start(bench, "%s/update/%u", name, num_bodies);
+  for (uint32_t i = 0 ; i < num_bodies ; i++) {
+    // The bodies stay in the world, so that the dense grid doesn't pile them up in its border cells
+    binocle_collider_hitbox *hitbox = &hitboxes[i];
+    float dx = binocle_bench_randf(bench, -16.0f, 16.0f);
+    float dy = binocle_bench_randf(bench, -16.0f, 16.0f);
+    dx = fmaxf(-hitbox->aabb.min.x, fminf(dx, BINOCLE_BENCH_COLLISION_WORLD_SIZE - 1.0f - hitbox->aabb.max.x));
+    dy = fmaxf(-hitbox->aabb.min.y, fminf(dy, BINOCLE_BENCH_COLLISION_WORLD_SIZE - 1.0f - hitbox->aabb.max.y));
+    hitbox->aabb.min.x += dx;
+    hitbox->aabb.min.y += dy;
+    hitbox->aabb.max.x += dx;
+    hitbox->aabb.max.y += dy;
+    binocle_spatial_hash_update_body(&spatial_hash, &colliders[i]);
+  }
+  binocle_bench_stop(bench, num_bodies);
+
+  binocle_bench_start(bench, "%s/remove/%u", name, num_bodies);
+  for (uint32_t i = 0 ; i < num_bodies ; i++) {
+    binocle_spatial_hash_remove_body(&spatial_hash, &colliders[i]);
+  }
+  binocle_bench_stop(bench, num_bodies);
+
+  for (uint32_t i = 0 ; i < num_bodies ; i++) {
+    da_free(colliders[i].grid_index);
+  }
+  binocle_spatial_hash_destroy(&spatial_hash);
+  free(colliders);
+  free(hitboxes);
+}
+
+static void binocle_bench_collision_run_tree(binocle_bench_t *bench, uint32_t num_bodies) {
+  binocle_collider *colliders = malloc(sizeof(binocle_collider) * num_bodies);
+  binocle_collider_hitbox *hitboxes = malloc(sizeof(binocle_collider_hitbox) * num_bodies);
+  binocle_aabb_tree tree = binocle_aabb_tree_new(BINOCLE_AABB_TREE_DEFAULT_MARGIN);
+
+  // Mostly small bodies with a few huge ones, the case a single cell size can't fit
+  binocle_bench_seed(bench, 0xC011);
+  for (uint32_t i = 0 ; i < num_bodies ; i++) {
+    kmAABB2 aabb;
+    float size = i % 100 == 0 ? binocle_bench_randf(bench, 512.0f, 1024.0f) : binocle_bench_randf(bench, 8.0f, 96.0f);
+    aabb.min.x = binocle_bench_randf(bench, 0.0f, BINOCLE_BENCH_COLLISION_WORLD_SIZE - size);
+    aabb.min.y = binocle_bench_randf(bench, 0.0f, BINOCLE_BENCH_COLLISION_WORLD_SIZE - size);
+    aabb.max.x = aabb.min.x + size;
+    aabb.max.y = aabb.min.y + size;
+    hitboxes[i] = binocle_collider_hitbox_new(aabb);
+    colliders[i] = binocle_collider_new();
+    colliders[i].hitbox = &hitboxes[i];
+  }
+
+  binocle_bench_start(bench, "aabb_tree/insert/%u", num_bodies);
+  for (uint32_t i = 0 ; i < num_bodies ; i++) {
+    binocle_aabb_tree_add_body(&tree, &colliders[i]);
+  }
+  binocle_bench_stop(bench, num_bodies);
+
+  size_t max_pairs = binocle_aabb_tree_query_pairs(&tree, NULL, 0);
+  binocle_collider_pair *pairs = malloc(sizeof(binocle_collider_pair) * (max_pairs > 0 ? max_pairs : 1));
+  binocle_bench_start(bench, "aabb_tree/pairs/%u", num_bodies);
+  size_t num_pairs = binocle_aabb_tree_query_pairs(&tree, pairs, max_pairs);
+  binocle_bench_stop(bench, num_pairs);
+  free(pairs);
+
+  binocle_bench_start(bench, "aabb_tree/update/%u", num_bodies);
+  for (uint32_t i = 0 ; i < num_bodies ; i++) {
+    binocle_collider_hitbox *hitbox = &hitboxes[i];
+    float dx = binocle_bench_randf(bench, -2.0f, 2.0f);
+    float dy = binocle_bench_randf(bench, -2.0f, 2.0f);
+    hitbox->aabb.min.x += dx;
+    hitbox->aabb.min.y += dy;
+    hitbox->aabb.max.x += dx;
+    hitbox->aabb.max.y += dy;
+    binocle_aabb_tree_update_body(&tree, &colliders[i]);
+  }
+  binocle_bench_stop(bench, num_bodies);
+
+  binocle_bench_start(bench, "aabb_tree/ray_cast/%u", num_bodies);
+  for (uint32_t i = 0 ; i < 1000 ; i++) {
+    kmVec2 origin;
+    origin.x = binocle_bench_randf(bench, 0.0f, BINOCLE_BENCH_COLLISION_WORLD_SIZE);
+    origin.y = binocle_bench_randf(bench, 0.0f, BINOCLE_BENCH_COLLISION_WORLD_SIZE);
+    float angle = binocle_bench_randf(bench, 0.0f, 6.2831853f);
+    kmVec2 direction;
+    direction.x = cosf(angle);
+    direction.y = sinf(angle);
+    binocle_collider *hit_collider;
+    float hit_distance;
+    binocle_aabb_tree_ray_cast(&tree, origin, direction, BINOCLE_BENCH_COLLISION_WORLD_SIZE, 0, &hit_collider,
+                               &hit_distance);
+  }
+  binocle_bench_stop(bench, 1000);
+
+  binocle_bench_start(bench, "aabb_tree/remove/%u", num_bodies);
+  for (uint32_t i = 0 ; i < num_bodies ; i++) {
+    binocle_aabb_tree_remove_body(&tree, &colliders[i]);
+  }
+  binocle_bench_stop(bench, num_bodies);
+
+  binocle_aabb_tree_destroy(&tree);
+  free(colliders);
+  free(hitboxes);
+}
+
+static void binocle_bench_collision_run_narrowphase(binocle_bench_t *bench, uint32_t num_pairs) {
+  // Bullets against enemies: the pairs point at random shapes, as the ones found by a broadphase do
+  const uint32_t num_shapes = 4096;
+  float *x = malloc(sizeof(float) * num_shapes);
+  float *y = malloc(sizeof(float) * num_shapes);
+  float *radius = malloc(sizeof(float) * num_shapes);
+  float *min_x = malloc(sizeof(float) * num_shapes);
+  float *min_y = malloc(sizeof(float) * num_shapes);
+  float *max_x = malloc(sizeof(float) * num_shapes);
+  float *max_y = malloc(sizeof(float) * num_shapes);
+  binocle_collider_circle *circles = malloc(sizeof(binocle_collider_circle) * num_shapes);
+  binocle_collider_hitbox *hitboxes = malloc(sizeof(binocle_collider_hitbox) * num_shapes);
+  binocle_collision_index_pair *pairs = malloc(sizeof(binocle_collision_index_pair) * num_pairs);
+  uint32_t *hits = malloc(sizeof(uint32_t) * BINOCLE_COLLISION_BATCH_MASK_WORDS(num_pairs));
+
+  binocle_bench_seed(bench, 0xC011);
+  for (uint32_t i = 0 ; i < num_shapes ; i++) {
+    kmVec2 center;
+    center.x = binocle_bench_randf(bench, 0.0f, 512.0f);
+    center.y = binocle_bench_randf(bench, 0.0f, 512.0f);
+    circles[i] = binocle_collider_circle_new(binocle_bench_randf(bench, 2.0f, 32.0f), center);
+    x[i] = center.x;
+    y[i] = center.y;
+    radius[i] = circles[i].radius;
+    kmAABB2 aabb;
+    aabb.min.x = binocle_bench_randf(bench, 0.0f, 512.0f);
+    aabb.min.y = binocle_bench_randf(bench, 0.0f, 512.0f);
+    aabb.max.x = aabb.min.x + binocle_bench_randf(bench, 8.0f, 64.0f);
+    aabb.max.y = aabb.min.y + binocle_bench_randf(bench, 8.0f, 64.0f);
+    hitboxes[i] = binocle_collider_hitbox_new(aabb);
+    min_x[i] = aabb.min.x;
+    min_y[i] = aabb.min.y;
+    max_x[i] = aabb.max.x;
+    max_y[i] = aabb.max.y;
+  }
+  for (uint32_t i = 0 ; i < num_pairs ; i++) {
+    pairs[i].a = (uint32_t)binocle_bench_randf(bench, 0.0f, (float)(num_shapes - 1));
+    pairs[i].b = (uint32_t)binocle_bench_randf(bench, 0.0f, (float)(num_shapes - 1));
+  }
+  binocle_circle_soa circle_soa = {x, y, radius};
+  binocle_hitbox_soa hitbox_soa = {min_x, min_y, max_x, max_y};
+  // Keeps the compiler from dropping the scalar loops
+  volatile size_t sink = 0;
+
+  binocle_bench_start(bench, "narrowphase/circles/scalar/%u", num_pairs);
+  size_t count = 0;
+  for (uint32_t i = 0 ; i < num_pairs ; i++) {
+    count += binocle_collide_circle_to_circle(&circles[pairs[i].a], &circles[pairs[i].b]);
+  }
+  sink += count;
+  binocle_bench_stop(bench, num_pairs);
+
+  binocle_bench_start(bench, "narrowphase/circles/batch/%u", num_pairs);
+  sink += binocle_collide_circles_to_circles_batch(circle_soa, circle_soa, pairs, num_pairs, hits);
+  binocle_bench_stop(bench, num_pairs);
+
+  binocle_bench_start(bench, "narrowphase/hitboxes/scalar/%u", num_pairs);
+  count = 0;
+  for (uint32_t i = 0 ; i < num_pairs ; i++) {
+    count += binocle_collide_hitbox_to_hitbox(&hitboxes[pairs[i].a], &hitboxes[pairs[i].b]);
+  }
+  sink += count;
+  binocle_bench_stop(bench, num_pairs);
+
+  binocle_bench_start(bench, "narrowphase/hitboxes/batch/%u", num_pairs);
+  sink += binocle_collide_hitboxes_to_hitboxes_batch(hitbox_soa, hitbox_soa, pairs, num_pairs, hits);
+  binocle_bench_stop(bench, num_pairs);
+
+  binocle_bench_start(bench, "narrowphase/circle_hitbox/scalar/%u", num_pairs);
+  count = 0;
+  for (uint32_t i = 0 ; i < num_pairs ; i++) {
+    count += binocle_collide_circle_to_hitbox(&circles[pairs[i].a], &hitboxes[pairs[i].b]);
+  }
+  sink += count;
+  binocle_bench_stop(bench, num_pairs);
+
+  binocle_bench_start(bench, "narrowphase/circle_hitbox/batch/%u", num_pairs);
+  sink += binocle_collide_circles_to_hitboxes_batch(circle_soa, hitbox_soa, pairs, num_pairs, hits);
+  binocle_bench_stop(bench, num_pairs);
+
+  free(x);
+  free(y);
+  free(radius);
+  free(min_x);
+  free(min_y);
+  free(max_x);
+  free(max_y);
+  free(circles);
+  free(hitboxes);
+  free(pairs);
+  free(hits);
+}
+
+void binocle_bench_collision(binocle_bench_t *bench) {
+  const binocle_spatial_hash_mode modes[] = {BINOCLE_SPATIAL_HASH_MODE_HASH, BINOCLE_SPATIAL_HASH_MODE_DENSE};
+  for (size_t i = 0 ; i < sizeof(modes) / sizeof(modes[0]) ; i++) {
+    binocle_bench_collision_run(bench, modes[i], 1000);
+    binocle_bench_collision_run(bench, modes[i], 10000);
+    if (!bench->quick) {
+      binocle_bench_collision_run(bench, modes[i], 100000);
+    }
+  }
+  binocle_bench_collision_run_tree(bench, 1000);
+  binocle_bench_collision_run_tree(bench, 10000);
+  if (!bench->quick) {
+    binocle_bench_collision_run_tree(bench, 100000);
+  }
+  binocle_bench_collision_run_narrowphase(bench, 100000);
+  if (!bench->quick) {
+    binocle_bench_collision_run_narrowphase(bench, 1000000);
+  }
+}
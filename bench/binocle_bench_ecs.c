@@ -0,0 +1,155 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#include "binocle_bench.h"
+#include "binocle_ecs.h"
+#include "binocle_log.h"
+
+#define BINOCLE_BENCH_ECS_FRAMES (10)
+#define BINOCLE_BENCH_ECS_THREADS (4)
+
+typedef struct binocle_bench_position_t {
+  float x;
+  float y;
+} binocle_bench_position_t;
+
+typedef struct binocle_bench_velocity_t {
+  float x;
+  float y;
+} binocle_bench_velocity_t;
+
+static void binocle_bench_ecs_move(binocle_ecs_t *ecs, void *user_data, binocle_ecs_chunk_t *chunk, float delta) {
+  unsigned char *positions = chunk->columns[0];
+  unsigned char *velocities = chunk->columns[1];
+  for (uint64_t i = 0 ; i < chunk->count ; i++) {
+    binocle_bench_position_t *position = (binocle_bench_position_t *)(positions + i * chunk->strides[0]);
+    const binocle_bench_velocity_t *velocity = (const binocle_bench_velocity_t *)(velocities + i * chunk->strides[1]);
+    position->x += velocity->x * delta;
+    position->y += velocity->y * delta;
+  }
+}
+
+typedef struct binocle_bench_ecs_stop_t {
+  binocle_component_id_t velocity_component;
+  uint64_t visited;
+} binocle_bench_ecs_stop_t;
+
+// Removes the velocity of the entities it visits, which moves them to another archetype
+static void binocle_bench_ecs_stop(binocle_ecs_t *ecs, void *user_data, binocle_ecs_chunk_t *chunk, float delta) {
+  binocle_bench_ecs_stop_t *stop = user_data;
+  for (uint64_t i = 0 ; i < chunk->count ; i++) {
+    binocle_ecs_remove_components(ecs, chunk->entities[i], stop->velocity_component);
+  }
+  stop->visited += chunk->count;
+}
+
+static void binocle_bench_ecs_run(binocle_bench_t *bench, binocle_ecs_storage_t storage, uint64_t num_entities,
+                                  uint64_t num_threads) {
+  binocle_ecs_t ecs = binocle_ecs_new();
+  binocle_component_id_t position_component;
+  binocle_component_id_t velocity_component;
+  binocle_system_id_t move_system;
+  // The row storage scenarios keep their original names
+  const char *prefix = storage == BINOCLE_ECS_STORAGE_ARCHETYPES ? "archetypes/" : "";
+
+  binocle_ecs_set_storage(&ecs, storage);
+  binocle_ecs_set_num_threads(&ecs, num_threads);
+  binocle_ecs_create_component(&ecs, "position", sizeof(binocle_bench_position_t), &position_component);
+  binocle_ecs_create_component(&ecs, "velocity", sizeof(binocle_bench_velocity_t), &velocity_component);
+  binocle_ecs_create_chunk_system(&ecs, "move", NULL, binocle_bench_ecs_move, NULL, NULL, NULL, NULL,
+                                  num_threads > 1 ? BINOCLE_SYSTEM_FLAG_PARALLEL : BINOCLE_SYSTEM_FLAG_NORMAL,
+                                  &move_system);
+  binocle_ecs_watch(&ecs, move_system, position_component);
+  binocle_ecs_watch(&ecs, move_system, velocity_component);
+  binocle_ecs_initialize(&ecs);
+
+  binocle_bench_seed(bench, 0xEC5);
+  binocle_bench_start(bench, "ecs/%screate/%llu/%llut", prefix, (unsigned long long)num_entities,
+                      (unsigned long long)num_threads);
+  for (uint64_t i = 0 ; i < num_entities ; i++) {
+    binocle_entity_id_t entity;
+    binocle_bench_position_t position = {binocle_bench_randf(bench, 0, 1024), binocle_bench_randf(bench, 0, 1024)};
+    binocle_bench_velocity_t velocity = {binocle_bench_randf(bench, -64, 64), binocle_bench_randf(bench, -64, 64)};
+    binocle_ecs_create_entity(&ecs, &entity);
+    binocle_ecs_set_component(&ecs, entity, position_component, &position);
+    binocle_ecs_set_component(&ecs, entity, velocity_component, &velocity);
+    binocle_ecs_signal(&ecs, entity, BINOCLE_ENTITY_ADDED);
+  }
+  binocle_bench_stop(bench, num_entities);
+
+  // The first update subscribes the new entities to the systems
+  binocle_bench_start(bench, "ecs/%ssubscribe/%llu/%llut", prefix, (unsigned long long)num_entities,
+                      (unsigned long long)num_threads);
+  binocle_ecs_process(&ecs, 1.0f / 60.0f);
+  binocle_bench_stop(bench, num_entities);
+
+  binocle_bench_start(bench, "ecs/%sprocess/%llu/%llut", prefix, (unsigned long long)num_entities,
+                      (unsigned long long)num_threads);
+  for (int frame = 0 ; frame < BINOCLE_BENCH_ECS_FRAMES ; frame++) {
+    binocle_ecs_process(&ecs, 1.0f / 60.0f);
+  }
+  binocle_bench_stop(bench, num_entities * BINOCLE_BENCH_ECS_FRAMES);
+
+  binocle_ecs_free(&ecs);
+}
+
+// A chunk system that changes the archetype of all the entities it visits
+static void binocle_bench_ecs_run_remove(binocle_bench_t *bench, uint64_t num_entities) {
+  binocle_ecs_t ecs = binocle_ecs_new();
+  binocle_component_id_t position_component;
+  binocle_bench_ecs_stop_t stop = {0};
+  binocle_system_id_t stop_system;
+
+  binocle_ecs_set_storage(&ecs, BINOCLE_ECS_STORAGE_ARCHETYPES);
+  binocle_ecs_create_component(&ecs, "position", sizeof(binocle_bench_position_t), &position_component);
+  binocle_ecs_create_component(&ecs, "velocity", sizeof(binocle_bench_velocity_t), &stop.velocity_component);
+  binocle_ecs_create_chunk_system(&ecs, "stop", NULL, binocle_bench_ecs_stop, NULL, NULL, NULL, &stop,
+                                  BINOCLE_SYSTEM_FLAG_NORMAL, &stop_system);
+  binocle_ecs_watch(&ecs, stop_system, stop.velocity_component);
+  binocle_ecs_initialize(&ecs);
+
+  binocle_bench_seed(bench, 0xEC5);
+  for (uint64_t i = 0 ; i < num_entities ; i++) {
+    binocle_entity_id_t entity;
+    binocle_bench_position_t position = {binocle_bench_randf(bench, 0, 1024), binocle_bench_randf(bench, 0, 1024)};
+    binocle_bench_velocity_t velocity = {binocle_bench_randf(bench, -64, 64), binocle_bench_randf(bench, -64, 64)};
+    binocle_ecs_create_entity(&ecs, &entity);
+    binocle_ecs_set_component(&ecs, entity, position_component, &position);
+    binocle_ecs_set_component(&ecs, entity, stop.velocity_component, &velocity);
+    binocle_ecs_signal(&ecs, entity, BINOCLE_ENTITY_ADDED);
+  }
+
+  binocle_bench_start(bench, "ecs/archetypes/remove/%llu", (unsigned long long)num_entities);
+  binocle_ecs_process(&ecs, 1.0f / 60.0f);
+  binocle_bench_stop(bench, num_entities);
+
+  // Each entity must have been visited once and lost its velocity
+  uint64_t moving = 0;
+  for (binocle_entity_id_t entity = 0 ; entity < num_entities ; entity++) {
+    void *velocity;
+    if (binocle_ecs_get_component(&ecs, entity, stop.velocity_component, &velocity)) {
+      moving++;
+    }
+  }
+  if (stop.visited != num_entities || moving > 0) {
+    binocle_log_error("binocle_bench_ecs(): %llu entities visited and %llu still moving out of %llu",
+                      (unsigned long long)stop.visited, (unsigned long long)moving, (unsigned long long)num_entities);
+  }
+
+  binocle_ecs_free(&ecs);
+}
+
+void binocle_bench_ecs(binocle_bench_t *bench) {
+  static const uint64_t sizes[] = {10000, 100000, 1000000};
+  size_t num_sizes = bench->quick ? 2 : sizeof(sizes) / sizeof(sizes[0]);
+  for (size_t i = 0 ; i < num_sizes ; i++) {
+    binocle_bench_ecs_run(bench, BINOCLE_ECS_STORAGE_ROWS, sizes[i], 1);
+    binocle_bench_ecs_run(bench, BINOCLE_ECS_STORAGE_ROWS, sizes[i], BINOCLE_BENCH_ECS_THREADS);
+    binocle_bench_ecs_run(bench, BINOCLE_ECS_STORAGE_ARCHETYPES, sizes[i], 1);
+    binocle_bench_ecs_run(bench, BINOCLE_ECS_STORAGE_ARCHETYPES, sizes[i], BINOCLE_BENCH_ECS_THREADS);
+    binocle_bench_ecs_run_remove(bench, sizes[i]);
+  }
+}
@@ -0,0 +1,73 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#include "binocle_bench.h"
+#include "binocle_gd.h"
+#include "backend/binocle_color.h"
+#include "backend/binocle_vpct.h"
+#include <stdlib.h>
+
+#define BINOCLE_BENCH_GD_DRAWS (20000)
+#define BINOCLE_BENCH_GD_FRAMES (10)
+
+void binocle_bench_gd(binocle_bench_t *bench) {
+  binocle_gd *gd = &bench->gd;
+  binocle_vpct *vertices = malloc(sizeof(binocle_vpct) * 6 * BINOCLE_BENCH_GD_DRAWS);
+  float *depths = malloc(sizeof(float) * BINOCLE_BENCH_GD_DRAWS);
+  struct binocle_material **materials = malloc(sizeof(struct binocle_material *) * BINOCLE_BENCH_GD_DRAWS);
+
+  // Two triangles per draw, on a handful of layers so that the sort has to interleave the materials
+  binocle_bench_seed(bench, 0x6D);
+  sg_color color = binocle_color_white();
+  for (int i = 0 ; i < BINOCLE_BENCH_GD_DRAWS ; i++) {
+    float x = binocle_bench_randf(bench, 0.0f, 1280.0f);
+    float y = binocle_bench_randf(bench, 0.0f, 720.0f);
+    binocle_vpct *v = &vertices[i * 6];
+    v[0] = (binocle_vpct){.pos = {x, y}, .color = color, .tex = {0, 0}};
+    v[1] = (binocle_vpct){.pos = {x + 16, y}, .color = color, .tex = {1, 0}};
+    v[2] = (binocle_vpct){.pos = {x + 16, y + 16}, .color = color, .tex = {1, 1}};
+    v[3] = v[0];
+    v[4] = v[2];
+    v[5] = (binocle_vpct){.pos = {x, y + 16}, .color = color, .tex = {0, 1}};
+    depths[i] = (float)(binocle_bench_rand(bench) % 8);
+    materials[i] = (binocle_bench_rand(bench) % 4) == 0 ? bench->other_material : bench->material;
+  }
+
+  kmAABB2 viewport;
+  viewport.min.x = 0;
+  viewport.min.y = 0;
+  viewport.max.x = 1280;
+  viewport.max.y = 720;
+
+  binocle_bench_start(bench, "gd/record");
+  for (int frame = 0 ; frame < BINOCLE_BENCH_GD_FRAMES ; frame++) {
+    for (int i = 0 ; i < BINOCLE_BENCH_GD_DRAWS ; i++) {
+      binocle_gd_draw(gd, &vertices[i * 6], 6, materials[i], viewport, NULL, depths[i]);
+    }
+    binocle_bench_pause(bench);
+    binocle_gd_render_offscreen(gd);
+    sg_commit();
+    binocle_bench_resume(bench);
+  }
+  binocle_bench_stop(bench, BINOCLE_BENCH_GD_DRAWS * BINOCLE_BENCH_GD_FRAMES);
+
+  // Sorting, coalescing and uploading the commands recorded above
+  binocle_bench_start(bench, "gd/render_offscreen");
+  for (int frame = 0 ; frame < BINOCLE_BENCH_GD_FRAMES ; frame++) {
+    binocle_bench_pause(bench);
+    for (int i = 0 ; i < BINOCLE_BENCH_GD_DRAWS ; i++) {
+      binocle_gd_draw(gd, &vertices[i * 6], 6, materials[i], viewport, NULL, depths[i]);
+    }
+    binocle_bench_resume(bench);
+    binocle_gd_render_offscreen(gd);
+    sg_commit();
+  }
+  binocle_bench_stop(bench, BINOCLE_BENCH_GD_DRAWS * BINOCLE_BENCH_GD_FRAMES);
+
+  free(vertices);
+  free(depths);
+  free(materials);
+}
@@ -0,0 +1,59 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#include "binocle_bench.h"
+#include "binocle_color_wrap.h"
+#include "binocle_log.h"
+#include "binocle_lua.h"
+#include <stdlib.h>
+
+#define BINOCLE_BENCH_LUA_CALLS (1000000)
+
+// Lua's own allocator lives in a library that isn't rebuilt with the counting wrappers, so we pass it one that is
+static void *binocle_bench_lua_alloc(void *user_data, void *ptr, size_t old_size, size_t new_size) {
+  if (new_size == 0) {
+    free(ptr);
+    return NULL;
+  }
+  return realloc(ptr, new_size);
+}
+
+// The cheapest possible binding, to measure the cost of crossing from Lua to C
+static int binocle_bench_lua_noop(lua_State *L) {
+  return 0;
+}
+
+static void binocle_bench_lua_run(binocle_bench_t *bench, lua_State *L, const char *name, const char *script) {
+  if (luaL_loadstring(L, script) != 0) {
+    binocle_log_error("binocle_bench_lua(): %s", lua_tostring(L, -1));
+    lua_pop(L, 1);
+    return;
+  }
+  lua_pushinteger(L, BINOCLE_BENCH_LUA_CALLS);
+  binocle_bench_start(bench, "lua/%s", name);
+  if (lua_pcall(L, 1, 0, 0) != 0) {
+    binocle_bench_pause(bench);
+    binocle_log_error("binocle_bench_lua(): %s", lua_tostring(L, -1));
+    lua_pop(L, 1);
+    return;
+  }
+  binocle_bench_stop(bench, BINOCLE_BENCH_LUA_CALLS);
+}
+
+void binocle_bench_lua(binocle_bench_t *bench) {
+  lua_State *L = lua_newstate(binocle_bench_lua_alloc, NULL);
+  luaL_openlibs(L);
+  luaopen_color(L);
+  lua_register(L, "noop", binocle_bench_lua_noop);
+
+  binocle_bench_lua_run(bench, L, "loop", "local n = ... for i = 1, n do end");
+  binocle_bench_lua_run(bench, L, "noop", "local n = ... local f = noop for i = 1, n do f(i, 2, 3, 4) end");
+  // A real binding: it checks four numbers and creates a userdata with a metatable
+  binocle_bench_lua_run(bench, L, "color.new",
+                        "local n = ... local new = color.new for i = 1, n do new(1, 0.5, 0.25, 1) end");
+
+  lua_close(L);
+}
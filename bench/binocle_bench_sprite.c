@@ -0,0 +1,128 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#include "binocle_bench.h"
+#include "binocle_sprite.h"
+#include "backend/binocle_color.h"
+#include "backend/binocle_material.h"
+#include <stdlib.h>
+
+#define BINOCLE_BENCH_SPRITE_COUNT (20000)
+#define BINOCLE_BENCH_SPRITE_FRAMES (10)
+
+typedef struct binocle_bench_sprite_data {
+  kmVec2 *positions;
+  kmAABB2 *source_rectangles;
+  float *rotations;
+  float *depths;
+  binocle_material **materials;
+} binocle_bench_sprite_data;
+
+static const char *binocle_bench_sprite_sort_mode_name(binocle_sprite_sort_mode sort_mode) {
+  switch (sort_mode) {
+    case BINOCLE_SPRITE_SORT_MODE_DEFERRED:
+      return "deferred";
+    case BINOCLE_SPRITE_SORT_MODE_TEXTURE:
+      return "texture";
+    case BINOCLE_SPRITE_SORT_MODE_BACK_TO_FRONT:
+      return "back_to_front";
+    case BINOCLE_SPRITE_SORT_MODE_FRONT_TO_BACK:
+      return "front_to_back";
+    case BINOCLE_SPRITE_SORT_MODE_INSTANCED:
+      return "instanced";
+    default:
+      return "other";
+  }
+}
+
+static void binocle_bench_sprite_end_frame(binocle_bench_t *bench) {
+  // Turning the commands into draw calls is measured by the gd scenario
+  binocle_bench_pause(bench);
+  binocle_gd_render_offscreen(&bench->gd);
+  sg_commit();
+  binocle_bench_resume(bench);
+}
+
+static void binocle_bench_sprite_draw(binocle_bench_t *bench, const binocle_bench_sprite_data *data,
+                                      binocle_sprite_sort_mode sort_mode, kmAABB2 viewport) {
+  binocle_sprite_batch batch = binocle_sprite_batch_new();
+  batch.gd = &bench->gd;
+  sg_color white = binocle_color_white();
+
+  binocle_bench_start(bench, "sprite/draw/%s", binocle_bench_sprite_sort_mode_name(sort_mode));
+  for (int frame = 0 ; frame < BINOCLE_BENCH_SPRITE_FRAMES ; frame++) {
+    binocle_sprite_batch_begin(&batch, viewport, sort_mode, NULL, NULL);
+    for (int i = 0 ; i < BINOCLE_BENCH_SPRITE_COUNT ; i++) {
+      binocle_sprite_batch_draw(&batch, data->materials[i], &data->positions[i], NULL, &data->source_rectangles[i],
+                                NULL, data->rotations[i], NULL, white, data->depths[i]);
+    }
+    binocle_sprite_batch_end(&batch, viewport);
+    binocle_bench_sprite_end_frame(bench);
+  }
+  binocle_bench_stop(bench, BINOCLE_BENCH_SPRITE_COUNT * BINOCLE_BENCH_SPRITE_FRAMES);
+
+  binocle_sprite_batch_destroy(&batch);
+}
+
+static void binocle_bench_sprite_draw_many(binocle_bench_t *bench, const binocle_bench_sprite_data *data,
+                                           kmAABB2 viewport) {
+  binocle_sprite_batch batch = binocle_sprite_batch_new();
+  batch.gd = &bench->gd;
+
+  binocle_bench_start(bench, "sprite/draw_many/back_to_front");
+  for (int frame = 0 ; frame < BINOCLE_BENCH_SPRITE_FRAMES ; frame++) {
+    binocle_sprite_batch_begin(&batch, viewport, BINOCLE_SPRITE_SORT_MODE_BACK_TO_FRONT, NULL, NULL);
+    binocle_sprite_batch_draw_many(&batch, bench->material, BINOCLE_BENCH_SPRITE_COUNT, data->positions,
+                                   data->source_rectangles, NULL, data->rotations, NULL, NULL, data->depths);
+    binocle_sprite_batch_end(&batch, viewport);
+    binocle_bench_sprite_end_frame(bench);
+  }
+  binocle_bench_stop(bench, BINOCLE_BENCH_SPRITE_COUNT * BINOCLE_BENCH_SPRITE_FRAMES);
+
+  binocle_sprite_batch_destroy(&batch);
+}
+
+void binocle_bench_sprite(binocle_bench_t *bench) {
+  binocle_bench_sprite_data data;
+  data.positions = malloc(sizeof(kmVec2) * BINOCLE_BENCH_SPRITE_COUNT);
+  data.source_rectangles = malloc(sizeof(kmAABB2) * BINOCLE_BENCH_SPRITE_COUNT);
+  data.rotations = malloc(sizeof(float) * BINOCLE_BENCH_SPRITE_COUNT);
+  data.depths = malloc(sizeof(float) * BINOCLE_BENCH_SPRITE_COUNT);
+  data.materials = malloc(sizeof(binocle_material *) * BINOCLE_BENCH_SPRITE_COUNT);
+
+  // Some of the sprites fall outside of the viewport and get culled
+  binocle_bench_seed(bench, 0x5B817E);
+  for (int i = 0 ; i < BINOCLE_BENCH_SPRITE_COUNT ; i++) {
+    data.positions[i].x = binocle_bench_randf(bench, -128.0f, 1408.0f);
+    data.positions[i].y = binocle_bench_randf(bench, -128.0f, 848.0f);
+    float size = (float)(8 << (binocle_bench_rand(bench) % 4));
+    data.source_rectangles[i].min.x = 0;
+    data.source_rectangles[i].min.y = 0;
+    data.source_rectangles[i].max.x = size;
+    data.source_rectangles[i].max.y = size;
+    data.rotations[i] = (binocle_bench_rand(bench) % 4) == 0 ? binocle_bench_randf(bench, 0.0f, 6.28f) : 0.0f;
+    data.depths[i] = binocle_bench_randf(bench, 0.0f, 1.0f);
+    data.materials[i] = (binocle_bench_rand(bench) % 2) == 0 ? bench->material : bench->other_material;
+  }
+
+  kmAABB2 viewport;
+  viewport.min.x = 0;
+  viewport.min.y = 0;
+  viewport.max.x = 1280;
+  viewport.max.y = 720;
+
+  binocle_bench_sprite_draw(bench, &data, BINOCLE_SPRITE_SORT_MODE_DEFERRED, viewport);
+  binocle_bench_sprite_draw(bench, &data, BINOCLE_SPRITE_SORT_MODE_TEXTURE, viewport);
+  binocle_bench_sprite_draw(bench, &data, BINOCLE_SPRITE_SORT_MODE_BACK_TO_FRONT, viewport);
+  binocle_bench_sprite_draw(bench, &data, BINOCLE_SPRITE_SORT_MODE_INSTANCED, viewport);
+  binocle_bench_sprite_draw_many(bench, &data, viewport);
+
+  free(data.positions);
+  free(data.source_rectangles);
+  free(data.rotations);
+  free(data.depths);
+  free(data.materials);
+}
@@ -784,6 +784,7 @@ int main(int argc, char *argv[]) {
 #ifdef WITH_PHYSICS
   destroy_world();
 #endif
+  destroy_game();
   binocle_gd_destroy(&game_state->engine.gd);
   binocle_app_destroy(&app);
   binocle_sdl_exit();
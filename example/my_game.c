@@ -6,6 +6,7 @@
 #include "binocle_log.h"
 #include "binocle_memory.h"
 #include "binocle_sprite.h"
+#include "binocle_tilemap.h"
 #include "binocle_viewport_adapter.h"
 #include "cLDtk.h"
 #include "constants.h"
@@ -101,6 +102,39 @@ bool load_map(const char *filename, char **buffer, size_t *size) {
     }
   }
 
+  // Bake the auto-tiles into a tilemap so that they're uploaded once instead of every frame
+  kmAABB2 tile_rects[20 * 9];
+  for (int t = 0 ; t < 20 * 9 ; t++) {
+    tile_rects[t] = game_state->world.tiles[t].sprite->subtexture.rect;
+  }
+  // LDtk can stack several auto-tiles in a cell, so the tilemap gets as many layers as the deepest stack
+  uint32_t num_auto_tiles = collisions->autoTiles_data_ptr->count;
+  uint8_t *stack_depths = calloc(collisions->cWid * collisions->cHei, sizeof(uint8_t));
+  uint32_t layers = 1;
+  for (uint32_t t = 0 ; t < num_auto_tiles ; t++) {
+    struct autoTiles tile = collisions->autoTiles_data_ptr[t];
+    uint8_t *depth = &stack_depths[(tile.y / collisions->gridSize) * collisions->cWid + tile.x / collisions->gridSize];
+    if (*depth < BINOCLE_TILEMAP_MAX_LAYERS) {
+      (*depth)++;
+    }
+    if (*depth > layers) {
+      layers = *depth;
+    }
+  }
+  free(stack_depths);
+  game_state->world.tilemap = binocle_tilemap_new_layered(collisions->cWid, collisions->cHei, collisions->gridSize,
+                                                          collisions->gridSize, BINOCLE_TILEMAP_DEFAULT_CHUNK_SIZE,
+                                                          layers, game_state->world.tilemap_material);
+  binocle_tilemap_set_tileset(game_state->world.tilemap, tile_rects, 20 * 9);
+  // The first auto-tiles are drawn on top, so they're stacked last. LDtk rows go downwards.
+  for (uint32_t t = num_auto_tiles ; t-- > 0 ;) {
+    struct autoTiles tile = collisions->autoTiles_data_ptr[t];
+    if (!binocle_tilemap_push_tile(game_state->world.tilemap, tile.x / collisions->gridSize,
+                                   collisions->cHei - 1 - tile.y / collisions->gridSize, tile.t)) {
+      binocle_log_warning("More than %d auto-tiles stacked at %d, %d", BINOCLE_TILEMAP_MAX_LAYERS, tile.x, tile.y);
+    }
+  }
+
   // for (int i = 0; i < 20*9; i++) {
   //   game_state->world.tiles[i].tile_id = i;
   //   game_state->world.tiles[i].sprite =
@@ -128,6 +162,13 @@ void setup_game(game_state_t *gs) {
   entity_set_pos_grid(game_state->world.player, 10, 10);
 }
 
+void destroy_game() {
+  if (game_state->world.tilemap != NULL) {
+    binocle_tilemap_destroy(game_state->world.tilemap);
+    game_state->world.tilemap = NULL;
+  }
+}
+
 void entity_pre_update(entity_t *e, float dt) {
   // TODO: update cooldowns
 }
@@ -273,30 +314,14 @@ void update_game(float dt) {
   entity_post_update(&game_state->world.entities[0], dt);
 }
 
-void draw_tiles(struct layerInstances *layer, sg_image image, int offset) {
+void draw_map() {
   kmAABB2 viewport;
   viewport.min.x = 0;
   viewport.min.y = 0;
   viewport.max.x = DESIGN_WIDTH;
   viewport.max.y = DESIGN_HEIGHT;
 
-  kmVec2 scale;
-  scale.x = 1.0f;
-  scale.y = 1.0f;
-
-  sg_color white = binocle_color_white();
-
-  for(int y=layer->autoTiles_data_ptr->count ;y-- > 0;) {
-    struct autoTiles tiles = layer->autoTiles_data_ptr[y];
-    binocle_sprite_draw(game_state->world.tiles[tiles.t].sprite, &game_state->engine.gd,
-      tiles.x, 288-18-tiles.y, &viewport, 0, &scale, &game_state->camera, 0, &white);
-  }
-}
-
-void draw_map() {
-  const struct levels *level = ldtk_get_level("Level_0");
-  struct layerInstances *collisions = ldtk_get_layer("IntGrid",level->uid);
-  draw_tiles(collisions, game_state->world.tilemap_image, 18);
+  binocle_tilemap_draw(game_state->world.tilemap, &game_state->engine.gd, viewport, &game_state->camera, 0);
 }
 
 void draw_entity(entity_t *e) {
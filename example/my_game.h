@@ -120,6 +120,7 @@ typedef struct game_state_t {
       int tile_id;
       binocle_sprite *sprite;
     } tiles[256];
+    struct binocle_tilemap *tilemap;
     entity_t entities[MAX_ENTITIES];
     uint64_t num_entities;
     entity_t *player;
@@ -133,6 +134,7 @@ typedef struct game_state_t {
 } game_state_t;
 
 void setup_game(game_state_t *gs);
+void destroy_game();
 void update_game(float dt);
 void draw_game();
 entity_t *new_player();
@@ -26,4 +26,15 @@ binocle_material *binocle_material_new() {
 void binocle_material_destroy(binocle_material *material) {
   free(material);
   material = NULL;
-}
\ No newline at end of file
+}
+
+void binocle_material_get_albedo_size(binocle_material *material, int *width, int *height) {
+  if (material->albedo_size_texture.id != material->albedo_texture.id) {
+    sg_image_desc info = sg_query_image_desc(material->albedo_texture);
+    material->albedo_width = info.width;
+    material->albedo_height = info.height;
+    material->albedo_size_texture = material->albedo_texture;
+  }
+  *width = material->albedo_width;
+  *height = material->albedo_height;
+}
@@ -17,6 +17,12 @@ typedef struct binocle_material {
   sg_blend_state blend_mode;
   /// The albedo/diffuse texture
   sg_image albedo_texture;
+  /// The albedo texture whose size is cached in albedo_width and albedo_height
+  sg_image albedo_size_texture;
+  /// The cached width of the albedo texture. Use \ref binocle_material_get_albedo_size to read it.
+  int albedo_width;
+  /// The cached height of the albedo texture. Use \ref binocle_material_get_albedo_size to read it.
+  int albedo_height;
   /// The normal/specular texture
   sg_image normal_texture;
   /// The metallic texture
@@ -49,4 +55,13 @@ binocle_material *binocle_material_new();
  */
 void binocle_material_destroy(binocle_material *material);
 
+/**
+ * \brief Gets the size of the albedo texture
+ * The size is queried from the graphics backend only when the albedo texture changes and cached in the material.
+ * @param material the material
+ * @param width the width of the texture in pixels
+ * @param height the height of the texture in pixels
+ */
+void binocle_material_get_albedo_size(binocle_material *material, int *width, int *height);
+
 #endif //BINOCLE_MATERIAL_H
@@ -13,4 +13,65 @@ binocle_vpct binocle_vpct_new(kmVec2 pos, sg_color color, kmVec2 tex) {
       .tex = tex
   };
   return res;
+}
+
+static uint8_t binocle_vpct_pack_unorm8(float value) {
+  if (value <= 0.0f) {
+    return 0;
+  }
+  if (value >= 1.0f) {
+    return 255;
+  }
+  return (uint8_t)(value * 255.0f + 0.5f);
+}
+
+static uint16_t binocle_vpct_pack_unorm16(float value) {
+  if (value <= 0.0f) {
+    return 0;
+  }
+  if (value >= 1.0f) {
+    return 65535;
+  }
+  return (uint16_t)(value * 65535.0f + 0.5f);
+}
+
+binocle_vpct_packed binocle_vpct_packed_new(kmVec2 pos, sg_color color, kmVec2 tex) {
+  binocle_vpct_packed res = {
+    .pos = pos,
+    .color = {
+      binocle_vpct_pack_unorm8(color.r),
+      binocle_vpct_pack_unorm8(color.g),
+      binocle_vpct_pack_unorm8(color.b),
+      binocle_vpct_pack_unorm8(color.a),
+    },
+    .tex = {
+      binocle_vpct_pack_unorm16(tex.x),
+      binocle_vpct_pack_unorm16(tex.y),
+    },
+  };
+  return res;
+}
+
+binocle_vpct_packed binocle_vpct_pack(binocle_vpct vertex) {
+  return binocle_vpct_packed_new(vertex.pos, vertex.color, vertex.tex);
+}
+
+binocle_vpct_instance binocle_vpct_instance_new(kmVec2 position, kmVec2 size, kmVec2 origin, float rotation, float depth,
+                                                kmVec2 tex_tl, kmVec2 tex_br, sg_color color) {
+  binocle_vpct_instance res = {
+    .position = position,
+    .size = size,
+    .origin = origin,
+    .rotation = rotation,
+    .depth = depth,
+    .tex_tl = tex_tl,
+    .tex_br = tex_br,
+    .color = {
+      binocle_vpct_pack_unorm8(color.r),
+      binocle_vpct_pack_unorm8(color.g),
+      binocle_vpct_pack_unorm8(color.b),
+      binocle_vpct_pack_unorm8(color.a),
+    },
+  };
+  return res;
 }
\ No newline at end of file
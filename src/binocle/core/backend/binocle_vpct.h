@@ -28,6 +28,79 @@ typedef struct binocle_vpct {
  */
 binocle_vpct binocle_vpct_new(kmVec2 pos, sg_color color, kmVec2 tex);
 
+/**
+ * The compact vertex representation: position, RGBA8 color and normalized 16 bit texture coordinates.
+ * It takes 16 bytes instead of the 32 of \ref binocle_vpct. Texture coordinates are limited to the [0, 1] range.
+ */
+typedef struct binocle_vpct_packed {
+  kmVec2 pos;
+  uint8_t color[4];
+  uint16_t tex[2];
+} binocle_vpct_packed;
+
+/**
+ * The vertex formats that can be streamed to the GPU
+ */
+typedef enum binocle_vertex_format {
+  /// Full precision vertices, see \ref binocle_vpct
+  BINOCLE_VERTEX_FORMAT_VPCT = 0,
+  /// Compact vertices, see \ref binocle_vpct_packed
+  BINOCLE_VERTEX_FORMAT_PACKED,
+} binocle_vertex_format;
+
+/**
+ * \brief Creates a new compact vertex
+ * @param pos the position
+ * @param color the color
+ * @param tex the texture coordinates. They get clamped to the [0, 1] range.
+ * @return the compact vertex
+ */
+binocle_vpct_packed binocle_vpct_packed_new(kmVec2 pos, sg_color color, kmVec2 tex);
+
+/**
+ * \brief Converts a vertex to its compact representation
+ * @param vertex the vertex
+ * @return the compact vertex
+ */
+binocle_vpct_packed binocle_vpct_pack(binocle_vpct vertex);
+
+/**
+ * The data of a single sprite drawn with GPU instancing. The vertex shader expands a static unit quad into the sprite,
+ * so each sprite streams one of these (52 bytes) instead of four vertices.
+ * The corners of the sprite are position + rotate(corner * size - origin) with corner going from (0, 0) to (1, 1).
+ */
+typedef struct binocle_vpct_instance {
+  /// The position of the origin of the sprite
+  kmVec2 position;
+  /// The size of the sprite, already scaled
+  kmVec2 size;
+  /// The origin of the sprite relative to its top-left corner, already scaled
+  kmVec2 origin;
+  /// The rotation around the origin, in radians
+  float rotation;
+  /// The layer depth. It's not used by the GPU, it's kept here for whoever sorts the instances.
+  float depth;
+  /// The texture coordinates of the top-left and bottom-right corners
+  kmVec2 tex_tl;
+  kmVec2 tex_br;
+  uint8_t color[4];
+} binocle_vpct_instance;
+
+/**
+ * \brief Creates a new sprite instance
+ * @param position the position of the origin of the sprite
+ * @param size the size of the sprite
+ * @param origin the origin of the sprite relative to its top-left corner
+ * @param rotation the rotation in radians
+ * @param depth the layer depth
+ * @param tex_tl the texture coordinates of the top-left corner
+ * @param tex_br the texture coordinates of the bottom-right corner
+ * @param color the color. It gets converted to 8 bits per channel.
+ * @return the instance
+ */
+binocle_vpct_instance binocle_vpct_instance_new(kmVec2 position, kmVec2 size, kmVec2 origin, float rotation, float depth,
+                                                kmVec2 tex_tl, kmVec2 tex_br, sg_color color);
+
 typedef struct binocle_vpctn {
   kmVec3 pos;
   sg_color color;
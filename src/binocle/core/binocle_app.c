@@ -7,6 +7,7 @@
 #include "binocle_app.h"
 #include "binocle_asset.h"
 #include "binocle_memory.h"
+#include "binocle_profiler.h"
 #include "binocle_sdl.h"
 #include "sokol_gfx.h"
 #include <stdlib.h>
@@ -24,6 +25,10 @@ bool binocle_app_init(binocle_app *app, const binocle_app_desc_t *desc) {
   // Initialize time stuff
   stm_setup();
 
+#if defined(BINOCLE_PROFILER)
+  binocle_profiler_init(0);
+#endif
+
   // Hide the console on Windows
 #if defined(__WINDOWS__) && !defined(BINOCLE_SHOW_CONSOLE)
   const HWND windowHandle = GetConsoleWindow();
@@ -53,5 +58,8 @@ bool binocle_app_init(binocle_app *app, const binocle_app_desc_t *desc) {
 void binocle_app_destroy(binocle_app *app) {
   binocle_fs_destroy(&app->fs);
   SDL_free(app->assets_mount_path);
+#if defined(BINOCLE_PROFILER)
+  binocle_profiler_shutdown();
+#endif
   binocle_sdl_exit();
 }
\ No newline at end of file
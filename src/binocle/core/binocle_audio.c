@@ -6,6 +6,7 @@
 
 #include "binocle_log.h"
 #include "binocle_audio.h"
+#include "binocle_profiler.h"
 
 #define STB_VORBIS_IMPLEMENTATION
 
@@ -1513,6 +1514,7 @@ static ma_uint32 binocle_audio_read_audio_buffer_frames_in_mixing_format(binocle
 void binocle_audio_on_send_audio_data_to_device(ma_device *pDevice, void *pFramesOut, const void *pFramesInput, ma_uint32 frameCount) {
   (void) pDevice;
   binocle_audio *audio = (binocle_audio *) pDevice->pUserData;
+  BINOCLE_PROFILE_ZONE_BEGIN("audio_callback");
 
   // Init the output buffer to 0
   memset(pFramesOut, 0, frameCount * pDevice->playback.channels * ma_get_bytes_per_sample(pDevice->playback.format));
@@ -1595,6 +1597,7 @@ void binocle_audio_on_send_audio_data_to_device(ma_device *pDevice, void *pFrame
   }
 
   ma_mutex_unlock(&audio->lock);
+  BINOCLE_PROFILE_ZONE_END();
 }
 
 static void
@@ -77,6 +77,13 @@ kmMat4 *binocle_camera_get_transform_matrix(binocle_camera *camera);
  */
 kmMat4 *binocle_camera_get_inverse_transform_matrix(binocle_camera *camera);
 
+/**
+ * \brief Gets the area of the world seen by the camera
+ * @param camera The camera
+ * @return The bounds, with min being the world position of the top-left corner of the viewport and max the size
+ */
+kmAABB2 binocle_camera_get_bounds(binocle_camera *camera);
+
 /**
  * \brief Gets the viewport adapter associated to the camera
  * @param camera The camera
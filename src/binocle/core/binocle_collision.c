@@ -7,6 +7,7 @@
 #include "binocle_collision.h"
 #include "binocle_log.h"
 #include <stdlib.h>
+#include <string.h>
 
 #define DG_DYNARR_IMPLEMENTATION
 #include <dg/DG_dynarr.h>
@@ -230,6 +231,11 @@ binocle_collider binocle_collider_new() {
   res.hitbox = NULL;
   res.circle = NULL;
   da_init(res.grid_index);
+  res.cell_range.max_x = -1;
+  res.cell_range.max_y = -1;
+  res.layer = 1;
+  res.mask = UINT32_MAX;
+  res.tree_node = BINOCLE_AABB_TREE_NULL_NODE;
   return res;
 }
 
@@ -289,11 +295,205 @@ binocle_spatial_hash binocle_spatial_hash_new(float width, float height, uint32_
   return res;
 }
 
+binocle_spatial_hash binocle_spatial_hash_new_dense(float width, float height, uint32_t cell_size) {
+  binocle_spatial_hash res = {0};
+  res.mode = BINOCLE_SPATIAL_HASH_MODE_DENSE;
+  res.cell_size = cell_size;
+  res.inv_cell_size = 1.0f / cell_size;
+  res.grid_width = (uint32_t)ceilf(width * res.inv_cell_size);
+  res.grid_height = (uint32_t)ceilf(height * res.inv_cell_size);
+  if (res.grid_width == 0) {
+    res.grid_width = 1;
+  }
+  if (res.grid_height == 0) {
+    res.grid_height = 1;
+  }
+  res.grid_length = res.grid_width * res.grid_height;
+  res.cells = calloc(res.grid_length, sizeof(binocle_spatial_hash_dense_cell));
+  if (res.cells == NULL) {
+    binocle_log_error("binocle_spatial_hash_new_dense(): Cannot allocate %" PRIu32 " cells", res.grid_length);
+    res.grid_width = 0;
+    res.grid_height = 0;
+    res.grid_length = 0;
+  }
+  da_init(res.temp_arr);
+  return res;
+}
+
 void binocle_spatial_hash_destroy(binocle_spatial_hash *spatial_hash) {
   da_free(spatial_hash->temp_arr);
+  if (spatial_hash->mode == BINOCLE_SPATIAL_HASH_MODE_DENSE) {
+    for (uint32_t i = 0 ; i < spatial_hash->grid_length ; i++) {
+      free(spatial_hash->cells[i].colliders);
+    }
+    free(spatial_hash->cells);
+    spatial_hash->cells = NULL;
+    return;
+  }
+  for (khiter_t k = kh_begin(spatial_hash->grid) ; k != kh_end(spatial_hash->grid) ; k++) {
+    if (kh_exist(spatial_hash->grid, k)) {
+      da_free(kh_val(spatial_hash->grid, k).colliders);
+    }
+  }
   kh_destroy(spatial_hash_cell_map_t, spatial_hash->grid);
 }
 
+//
+// Dense grid
+//
+
+// The slot of a body that couldn't be stored in a cell
+#define BINOCLE_SPATIAL_HASH_NO_SLOT (UINT64_MAX)
+
+static int32_t binocle_spatial_hash_clamp_cell(float v, float inv_cell_size, uint32_t count) {
+  float c = floorf(v * inv_cell_size);
+  if (!(c > 0.0f)) {
+    return 0;
+  }
+  if (c > (float)(count - 1)) {
+    return (int32_t)count - 1;
+  }
+  return (int32_t)c;
+}
+
+static binocle_spatial_hash_cell_range binocle_spatial_hash_get_aabb_cell_range(binocle_spatial_hash *spatial_hash, float left, float bottom, float right, float top) {
+  binocle_spatial_hash_cell_range range;
+  if (spatial_hash->mode != BINOCLE_SPATIAL_HASH_MODE_DENSE) {
+    range.min_x = (int32_t)floorf(left * spatial_hash->inv_cell_size);
+    range.min_y = (int32_t)floorf(bottom * spatial_hash->inv_cell_size);
+    range.max_x = (int32_t)floorf(right * spatial_hash->inv_cell_size);
+    range.max_y = (int32_t)floorf(top * spatial_hash->inv_cell_size);
+    return range;
+  }
+  range.min_x = binocle_spatial_hash_clamp_cell(left, spatial_hash->inv_cell_size, spatial_hash->grid_width);
+  range.min_y = binocle_spatial_hash_clamp_cell(bottom, spatial_hash->inv_cell_size, spatial_hash->grid_height);
+  range.max_x = binocle_spatial_hash_clamp_cell(right, spatial_hash->inv_cell_size, spatial_hash->grid_width);
+  range.max_y = binocle_spatial_hash_clamp_cell(top, spatial_hash->inv_cell_size, spatial_hash->grid_height);
+  return range;
+}
+
+binocle_spatial_hash_cell_range binocle_spatial_hash_get_cell_range(binocle_spatial_hash *spatial_hash, binocle_collider *collider) {
+  return binocle_spatial_hash_get_aabb_cell_range(spatial_hash, binocle_collider_get_absolute_left(collider),
+                                                  binocle_collider_get_absolute_bottom(collider),
+                                                  binocle_collider_get_absolute_right(collider),
+                                                  binocle_collider_get_absolute_top(collider));
+}
+
+static bool binocle_spatial_hash_cell_range_contains(binocle_spatial_hash_cell_range range, int32_t x, int32_t y) {
+  return x >= range.min_x && x <= range.max_x && y >= range.min_y && y <= range.max_y;
+}
+
+// The slot of the collider in the cell at x, y, which must be part of its cell_range
+static uint64_t *binocle_spatial_hash_dense_slot(binocle_collider *collider, int32_t x, int32_t y) {
+  binocle_spatial_hash_cell_range *range = &collider->cell_range;
+  int32_t width = range->max_x - range->min_x + 1;
+  return &collider->grid_index.p[(y - range->min_y) * width + (x - range->min_x)];
+}
+
+static uint64_t binocle_spatial_hash_dense_cell_push(binocle_spatial_hash_dense_cell *cell, binocle_collider *collider) {
+  if (cell->count >= cell->capacity) {
+    uint32_t new_capacity = cell->capacity + cell->capacity / 2; // grow by x1.5
+    if (new_capacity < 4) {
+      new_capacity = 4;
+    }
+    binocle_collider **colliders = realloc(cell->colliders, sizeof(binocle_collider *) * new_capacity);
+    if (colliders == NULL) {
+      binocle_log_error("binocle_spatial_hash_dense_cell_push(): Cannot grow the cell to %" PRIu32 " colliders", new_capacity);
+      return BINOCLE_SPATIAL_HASH_NO_SLOT;
+    }
+    cell->colliders = colliders;
+    cell->capacity = new_capacity;
+  }
+  cell->colliders[cell->count] = collider;
+  return cell->count++;
+}
+
+static void binocle_spatial_hash_dense_cell_remove(binocle_spatial_hash_dense_cell *cell, int32_t x, int32_t y, uint64_t slot) {
+  if (slot == BINOCLE_SPATIAL_HASH_NO_SLOT) {
+    return;
+  }
+  // The last collider takes the place of the removed one, so its slot in this cell has to follow
+  uint32_t last = cell->count - 1;
+  if (slot != last) {
+    binocle_collider *moved = cell->colliders[last];
+    cell->colliders[slot] = moved;
+    *binocle_spatial_hash_dense_slot(moved, x, y) = slot;
+  }
+  cell->count--;
+}
+
+static void binocle_spatial_hash_dense_add_body(binocle_spatial_hash *spatial_hash, binocle_collider *collider) {
+  binocle_spatial_hash_cell_range range = binocle_spatial_hash_get_cell_range(spatial_hash, collider);
+  da_clear(collider->grid_index);
+  for (int32_t y = range.min_y ; y <= range.max_y ; y++) {
+    for (int32_t x = range.min_x ; x <= range.max_x ; x++) {
+      binocle_spatial_hash_dense_cell *cell = &spatial_hash->cells[y * spatial_hash->grid_width + x];
+      da_push(collider->grid_index, binocle_spatial_hash_dense_cell_push(cell, collider));
+    }
+  }
+  collider->cell_range = range;
+}
+
+static void binocle_spatial_hash_dense_remove_body(binocle_spatial_hash *spatial_hash, binocle_collider *collider) {
+  binocle_spatial_hash_cell_range range = collider->cell_range;
+  for (int32_t y = range.min_y ; y <= range.max_y ; y++) {
+    for (int32_t x = range.min_x ; x <= range.max_x ; x++) {
+      binocle_spatial_hash_dense_cell *cell = &spatial_hash->cells[y * spatial_hash->grid_width + x];
+      binocle_spatial_hash_dense_cell_remove(cell, x, y, *binocle_spatial_hash_dense_slot(collider, x, y));
+    }
+  }
+  da_clear(collider->grid_index);
+  collider->cell_range.min_x = 0;
+  collider->cell_range.min_y = 0;
+  collider->cell_range.max_x = -1;
+  collider->cell_range.max_y = -1;
+}
+
+static void binocle_spatial_hash_dense_update_body(binocle_spatial_hash *spatial_hash, binocle_collider *collider) {
+  binocle_spatial_hash_cell_range old_range = collider->cell_range;
+  if (old_range.max_x < old_range.min_x) {
+    binocle_spatial_hash_dense_add_body(spatial_hash, collider);
+    return;
+  }
+
+  binocle_spatial_hash_cell_range new_range = binocle_spatial_hash_get_cell_range(spatial_hash, collider);
+  if (memcmp(&old_range, &new_range, sizeof(binocle_spatial_hash_cell_range)) == 0) {
+    // Most colliders move less than a cell per frame
+    return;
+  }
+
+  // Leave the cells that aren't covered anymore
+  for (int32_t y = old_range.min_y ; y <= old_range.max_y ; y++) {
+    for (int32_t x = old_range.min_x ; x <= old_range.max_x ; x++) {
+      if (binocle_spatial_hash_cell_range_contains(new_range, x, y)) {
+        continue;
+      }
+      binocle_spatial_hash_dense_cell *cell = &spatial_hash->cells[y * spatial_hash->grid_width + x];
+      binocle_spatial_hash_dense_cell_remove(cell, x, y, *binocle_spatial_hash_dense_slot(collider, x, y));
+    }
+  }
+
+  // Enter the new cells, keeping the slots of the ones we were already in
+  da_clear(spatial_hash->temp_arr);
+  for (int32_t y = new_range.min_y ; y <= new_range.max_y ; y++) {
+    for (int32_t x = new_range.min_x ; x <= new_range.max_x ; x++) {
+      if (binocle_spatial_hash_cell_range_contains(old_range, x, y)) {
+        da_push(spatial_hash->temp_arr, *binocle_spatial_hash_dense_slot(collider, x, y));
+      } else {
+        binocle_spatial_hash_dense_cell *cell = &spatial_hash->cells[y * spatial_hash->grid_width + x];
+        da_push(spatial_hash->temp_arr, binocle_spatial_hash_dense_cell_push(cell, collider));
+      }
+    }
+  }
+  da_clear(collider->grid_index);
+  da_addn(collider->grid_index, spatial_hash->temp_arr.p, da_count(spatial_hash->temp_arr));
+  collider->cell_range = new_range;
+}
+
+//
+// Hash map grid
+//
+
 binocle_spatial_hash_cell binocle_spatial_hash_cell_new() {
   binocle_spatial_hash_cell res = {0};
   da_init(res.colliders);
@@ -308,6 +508,15 @@ kmVec2 binocle_spatial_hash_get_cell_coords(binocle_spatial_hash *spatial_hash,
 }
 
 void binocle_spatial_hash_add_body(binocle_spatial_hash *spatial_hash, binocle_collider *collider) {
+  if (spatial_hash->mode == BINOCLE_SPATIAL_HASH_MODE_DENSE) {
+    if (collider->circle == NULL && collider->hitbox == NULL) {
+      binocle_log_error("binocle_spatial_hash_add_body(): this collider has no shape");
+      return;
+    }
+    binocle_spatial_hash_dense_update_body(spatial_hash, collider);
+    return;
+  }
+
   kmVec2 p1;
   kmVec2 p2;
 
@@ -348,19 +557,34 @@ void binocle_spatial_hash_add_body(binocle_spatial_hash *spatial_hash, binocle_c
   }
   for (int x = p1.x; x <= p2.x; x++) {
     for (int y = p1.y; y <= p2.y; y++) {
-      // make sure we have allocated a cell
+      // binocle_spatial_hash_add_index() allocates the cell if needed
       binocle_spatial_hash_grid_key_t key = binocle_spatial_hash_get_key(x, y);
-      binocle_spatial_hash_cell *c = binocle_spatial_hash_cell_at_position(spatial_hash, x, y, true);
       binocle_spatial_hash_add_index(spatial_hash, collider, key);
     }
   }
+  collider->cell_range.min_x = (int32_t)p1.x;
+  collider->cell_range.min_y = (int32_t)p1.y;
+  collider->cell_range.max_x = (int32_t)p2.x;
+  collider->cell_range.max_y = (int32_t)p2.y;
 }
 
 void binocle_spatial_hash_remove_body(binocle_spatial_hash *spatial_hash, binocle_collider *collider) {
+  if (spatial_hash->mode == BINOCLE_SPATIAL_HASH_MODE_DENSE) {
+    binocle_spatial_hash_dense_remove_body(spatial_hash, collider);
+    return;
+  }
   binocle_spatial_hash_remove_indexes(spatial_hash, collider);
+  collider->cell_range.min_x = 0;
+  collider->cell_range.min_y = 0;
+  collider->cell_range.max_x = -1;
+  collider->cell_range.max_y = -1;
 }
 
 void binocle_spatial_hash_update_body(binocle_spatial_hash *spatial_hash, binocle_collider *collider) {
+  if (spatial_hash->mode == BINOCLE_SPATIAL_HASH_MODE_DENSE) {
+    binocle_spatial_hash_dense_update_body(spatial_hash, collider);
+    return;
+  }
   kmVec2 bottom_left;
   kmVec2 top_right;
   bottom_left.x = binocle_collider_get_absolute_left(collider);
@@ -368,6 +592,7 @@ void binocle_spatial_hash_update_body(binocle_spatial_hash *spatial_hash, binocl
   top_right.x = binocle_collider_get_absolute_right(collider);
   top_right.y = binocle_collider_get_absolute_top(collider);
   binocle_spatial_hash_update_indexes(spatial_hash, collider, binocle_spatial_hash_aabb_to_grid(spatial_hash, bottom_left, top_right));
+  collider->cell_range = binocle_spatial_hash_get_cell_range(spatial_hash, collider);
 }
 
 binocle_spatial_hash_cell *binocle_spatial_hash_cell_at_position(binocle_spatial_hash *spatial_hash, int x, int y, bool createCellIfEmpty) {
@@ -379,7 +604,7 @@ binocle_spatial_hash_cell *binocle_spatial_hash_cell_at_position(binocle_spatial
     // found
     cell = &kh_val(spatial_hash->grid, k);
   }
-  if (cell == NULL || da_count(cell->colliders) == 0) {
+  if (cell == NULL) {
     if (createCellIfEmpty) {
       int ret;
       k = kh_put(spatial_hash_cell_map_t, spatial_hash->grid, key, &ret);
@@ -399,7 +624,12 @@ void binocle_collider_add_grid_index(binocle_collider *collider, binocle_spatial
 }
 
 void binocle_spatial_hash_add_index(binocle_spatial_hash *spatial_hash, binocle_collider *collider, binocle_spatial_hash_grid_key_t cell_pos) {
-  khiter_t k = kh_get(spatial_hash_cell_map_t, spatial_hash->grid, cell_pos);
+  int ret;
+  khiter_t k = kh_put(spatial_hash_cell_map_t, spatial_hash->grid, cell_pos, &ret);
+  if (ret != 0) {
+    // The collider moved outside of the cells we have seen so far
+    kh_value(spatial_hash->grid, k) = binocle_spatial_hash_cell_new();
+  }
   binocle_spatial_hash_cell *cell = &kh_val(spatial_hash->grid, k);
   binocle_spatial_hash_cell_add_collider(cell, collider);
   binocle_collider_add_grid_index(collider, cell_pos);
@@ -411,10 +641,11 @@ void binocle_spatial_hash_remove_index(binocle_spatial_hash *spatial_hash, binoc
   if (k != kh_end(spatial_hash->grid)) {
     // found
     cell = &kh_val(spatial_hash->grid, k);
-    for (int i = da_count(cell->colliders) - 1 ; i > 0 ; i--) {
+    for (int i = da_count(cell->colliders) - 1 ; i >= 0 ; i--) {
       binocle_collider *coll = cell->colliders.p[i];
       if (coll == collider) {
         da_delete(cell->colliders, i);
+        break;
       }
     }
   }
@@ -429,6 +660,12 @@ void binocle_spatial_hash_remove_indexes(binocle_spatial_hash *spatial_hash, bin
 }
 
 void binocle_spatial_hash_update_indexes(binocle_spatial_hash *spatial_hash, binocle_collider *collider, binocle_grid_key_array_t *ar) {
+  if (da_count(collider->grid_index) == da_count(*ar) &&
+      memcmp(collider->grid_index.p, ar->p, sizeof(binocle_spatial_hash_grid_key_t) * da_count(*ar)) == 0) {
+    // Still in the same cells
+    return;
+  }
+
   for (int i = 0 ; i < da_count(collider->grid_index) ; i++) {
     binocle_spatial_hash_grid_key_t key = collider->grid_index.p[i];
     binocle_spatial_hash_remove_index(spatial_hash, collider, key);
@@ -458,10 +695,9 @@ binocle_grid_key_array_t *binocle_spatial_hash_aabb_to_grid(binocle_spatial_hash
   if (p1.y < spatial_hash->grid_y) {
     spatial_hash->grid_y = p1.y;
   }
+  // This is only a lookup, the cells get allocated when a collider is added to them
   for (int x = p1.x; x <= p2.x; x++) {
     for (int y = p1.y; y <= p2.y; y++) {
-      // make sure we have allocated a cell
-      binocle_spatial_hash_cell *c = binocle_spatial_hash_cell_at_position(spatial_hash, x, y, true);
       binocle_spatial_hash_grid_key_t key = binocle_spatial_hash_get_key(x, y);
       da_push(spatial_hash->temp_arr, key);
     }
@@ -474,21 +710,51 @@ binocle_spatial_hash_grid_key_t binocle_spatial_hash_get_key(int x, int y) {
   return (uint64_t) x << 32 | (uint64_t) (uint32_t) y;
 }
 
+// Two colliders can share several cells. Only the cell at the lowest corner of the cells they share reports them, so
+// that they show up once without having to remember what has been seen already.
+static bool binocle_spatial_hash_is_pair_cell(binocle_collider *a, binocle_collider *b, int32_t x, int32_t y) {
+  int32_t min_x = a->cell_range.min_x > b->cell_range.min_x ? a->cell_range.min_x : b->cell_range.min_x;
+  int32_t min_y = a->cell_range.min_y > b->cell_range.min_y ? a->cell_range.min_y : b->cell_range.min_y;
+  return x == min_x && y == min_y;
+}
+
 void binocle_spatial_hash_get_all_bodies_sharing_cells_with_body(binocle_spatial_hash *spatial_hash, binocle_collider *collider, binocle_collider_ptr_array_t *colliding_colliders, int layer_mask) {
   da_clear(*colliding_colliders);
 
+  if (spatial_hash->mode == BINOCLE_SPATIAL_HASH_MODE_DENSE) {
+    binocle_spatial_hash_cell_range range = collider->cell_range;
+    for (int32_t y = range.min_y ; y <= range.max_y ; y++) {
+      for (int32_t x = range.min_x ; x <= range.max_x ; x++) {
+        binocle_spatial_hash_dense_cell *cell = &spatial_hash->cells[y * spatial_hash->grid_width + x];
+        for (uint32_t j = 0 ; j < cell->count ; j++) {
+          binocle_collider *coll = cell->colliders[j];
+          if (coll == collider || (layer_mask != 0 && (coll->layer & (uint32_t)layer_mask) == 0) ||
+              !binocle_spatial_hash_is_pair_cell(collider, coll, x, y)) {
+            continue;
+          }
+          da_push(*colliding_colliders, coll);
+        }
+      }
+    }
+    return;
+  }
+
   for (int i = 0 ; i < da_count(collider->grid_index) ; i++) {
     binocle_spatial_hash_cell *cell = NULL;
-    khiter_t k = kh_get(spatial_hash_cell_map_t, spatial_hash->grid, collider->grid_index.p[i]);
+    binocle_spatial_hash_grid_key_t key = collider->grid_index.p[i];
+    khiter_t k = kh_get(spatial_hash_cell_map_t, spatial_hash->grid, key);
     if (k != kh_end(spatial_hash->grid)) {
       // found
       cell = &kh_val(spatial_hash->grid, k);
       if (da_count(cell->colliders) == 0) {
         continue;
       }
+      int32_t x = (int32_t)(key >> 32);
+      int32_t y = (int32_t)(uint32_t)key;
       for (int j = 0 ; j < da_count(cell->colliders) ; j++) {
         binocle_collider *coll = cell->colliders.p[j];
-        if (coll == collider /* || !Flags::IsFlagSet(layerMask, cbd->layer)*/) {
+        if (coll == collider || (layer_mask != 0 && (coll->layer & (uint32_t)layer_mask) == 0) ||
+            !binocle_spatial_hash_is_pair_cell(collider, coll, x, y)) {
           continue;
         }
         da_push(*colliding_colliders, coll);
@@ -499,7 +765,115 @@ void binocle_spatial_hash_get_all_bodies_sharing_cells_with_body(binocle_spatial
   }
 }
 
+// The broadphase rule shared by the spatial hash and the AABB tree: the layers must match and the boxes must overlap
+static bool binocle_collider_is_pair(binocle_collider *a, binocle_collider *b) {
+  if ((a->layer & b->mask) == 0 || (b->layer & a->mask) == 0) {
+    return false;
+  }
+  return binocle_collider_get_absolute_left(a) < binocle_collider_get_absolute_right(b) &&
+    binocle_collider_get_absolute_right(a) > binocle_collider_get_absolute_left(b) &&
+    binocle_collider_get_absolute_bottom(a) < binocle_collider_get_absolute_top(b) &&
+    binocle_collider_get_absolute_top(a) > binocle_collider_get_absolute_bottom(b);
+}
+
+static bool binocle_spatial_hash_accepts_pair(binocle_collider *a, binocle_collider *b, int32_t x, int32_t y) {
+  return binocle_spatial_hash_is_pair_cell(a, b, x, y) && binocle_collider_is_pair(a, b);
+}
+
+size_t binocle_spatial_hash_query_pairs(binocle_spatial_hash *spatial_hash, binocle_collider_pair *pairs, size_t max_pairs) {
+  size_t num_pairs = 0;
+  if (spatial_hash->mode == BINOCLE_SPATIAL_HASH_MODE_DENSE) {
+    for (uint32_t i = 0 ; i < spatial_hash->grid_length ; i++) {
+      binocle_spatial_hash_dense_cell *cell = &spatial_hash->cells[i];
+      if (cell->count < 2) {
+        continue;
+      }
+      int32_t x = (int32_t)(i % spatial_hash->grid_width);
+      int32_t y = (int32_t)(i / spatial_hash->grid_width);
+      for (uint32_t a = 0 ; a < cell->count ; a++) {
+        for (uint32_t b = a + 1 ; b < cell->count ; b++) {
+          if (!binocle_spatial_hash_accepts_pair(cell->colliders[a], cell->colliders[b], x, y)) {
+            continue;
+          }
+          if (num_pairs < max_pairs) {
+            pairs[num_pairs].a = cell->colliders[a];
+            pairs[num_pairs].b = cell->colliders[b];
+          }
+          num_pairs++;
+        }
+      }
+    }
+    return num_pairs;
+  }
+
+  for (khiter_t k = kh_begin(spatial_hash->grid) ; k != kh_end(spatial_hash->grid) ; k++) {
+    if (!kh_exist(spatial_hash->grid, k)) {
+      continue;
+    }
+    binocle_spatial_hash_cell *cell = &kh_val(spatial_hash->grid, k);
+    if (da_count(cell->colliders) < 2) {
+      continue;
+    }
+    binocle_spatial_hash_grid_key_t key = kh_key(spatial_hash->grid, k);
+    int32_t x = (int32_t)(key >> 32);
+    int32_t y = (int32_t)(uint32_t)key;
+    for (size_t a = 0 ; a < da_count(cell->colliders) ; a++) {
+      for (size_t b = a + 1 ; b < da_count(cell->colliders) ; b++) {
+        if (!binocle_spatial_hash_accepts_pair(cell->colliders.p[a], cell->colliders.p[b], x, y)) {
+          continue;
+        }
+        if (num_pairs < max_pairs) {
+          pairs[num_pairs].a = cell->colliders.p[a];
+          pairs[num_pairs].b = cell->colliders.p[b];
+        }
+        num_pairs++;
+      }
+    }
+  }
+  return num_pairs;
+}
+
+uint32_t binocle_spatial_hash_compact(binocle_spatial_hash *spatial_hash) {
+  uint32_t freed = 0;
+  if (spatial_hash->mode == BINOCLE_SPATIAL_HASH_MODE_DENSE) {
+    // The cells themselves are part of the grid, only the storage of the empty ones can go
+    for (uint32_t i = 0 ; i < spatial_hash->grid_length ; i++) {
+      binocle_spatial_hash_dense_cell *cell = &spatial_hash->cells[i];
+      if (cell->count == 0 && cell->colliders != NULL) {
+        free(cell->colliders);
+        cell->colliders = NULL;
+        cell->capacity = 0;
+        freed++;
+      }
+    }
+  } else {
+    for (khiter_t k = kh_begin(spatial_hash->grid) ; k != kh_end(spatial_hash->grid) ; k++) {
+      if (kh_exist(spatial_hash->grid, k) && da_count(kh_val(spatial_hash->grid, k).colliders) == 0) {
+        da_free(kh_val(spatial_hash->grid, k).colliders);
+        kh_del(spatial_hash_cell_map_t, spatial_hash->grid, k);
+        freed++;
+      }
+    }
+  }
+  da_free(spatial_hash->temp_arr);
+  da_init(spatial_hash->temp_arr);
+  return freed;
+}
+
 bool binocle_spatial_hash_is_body_sharing_any_cell(binocle_spatial_hash *spatial_hash, binocle_collider *collider) {
+  if (spatial_hash->mode == BINOCLE_SPATIAL_HASH_MODE_DENSE) {
+    binocle_spatial_hash_cell_range range = collider->cell_range;
+    for (int32_t y = range.min_y ; y <= range.max_y ; y++) {
+      for (int32_t x = range.min_x ; x <= range.max_x ; x++) {
+        // The collider itself is in the cell, so anything more means it's shared
+        if (spatial_hash->cells[y * spatial_hash->grid_width + x].count > 1) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
   for (int i = 0 ; i < da_count(collider->grid_index) ; i++) {
     binocle_spatial_hash_cell *cell = NULL;
     khiter_t k = kh_get(spatial_hash_cell_map_t, spatial_hash->grid, collider->grid_index.p[i]);
@@ -523,6 +897,818 @@ bool binocle_spatial_hash_is_body_sharing_any_cell(binocle_spatial_hash *spatial
   return false;
 }
 
+//
+// Ray casts
+//
+
+// Clips the ray against the slabs of a box. t_min and t_max are the part of the ray that is still inside.
+static bool binocle_collision_ray_clip_aabb(kmVec2 origin, kmVec2 direction, kmAABB2 aabb, float *t_min, float *t_max) {
+  const float o[2] = {origin.x, origin.y};
+  const float d[2] = {direction.x, direction.y};
+  const float min[2] = {aabb.min.x, aabb.min.y};
+  const float max[2] = {aabb.max.x, aabb.max.y};
+  for (int axis = 0 ; axis < 2 ; axis++) {
+    if (fabsf(d[axis]) < 1e-8f) {
+      // Parallel to the slab, it's either always inside or never
+      if (o[axis] < min[axis] || o[axis] > max[axis]) {
+        return false;
+      }
+      continue;
+    }
+    float inv_d = 1.0f / d[axis];
+    float t1 = (min[axis] - o[axis]) * inv_d;
+    float t2 = (max[axis] - o[axis]) * inv_d;
+    if (t1 > t2) {
+      float t = t1;
+      t1 = t2;
+      t2 = t;
+    }
+    if (t1 > *t_min) {
+      *t_min = t1;
+    }
+    if (t2 < *t_max) {
+      *t_max = t2;
+    }
+    if (*t_min > *t_max) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool binocle_collision_ray_clip_circle(kmVec2 origin, kmVec2 direction, kmVec2 center, float radius, float max_distance, float *distance) {
+  float mx = origin.x - center.x;
+  float my = origin.y - center.y;
+  float b = mx * direction.x + my * direction.y;
+  float c = mx * mx + my * my - radius * radius;
+  if (c > 0.0f && b > 0.0f) {
+    // Outside of the circle and pointing away from it
+    return false;
+  }
+  // r^2 - d^2, with d the distance of the center from the line of the ray. Getting it from the cross product instead of
+  // b * b - c avoids losing all the precision when the ray starts far away.
+  float cross = mx * direction.y - my * direction.x;
+  float discriminant = radius * radius - cross * cross;
+  if (discriminant < 0.0f) {
+    return false;
+  }
+  float t = -b - sqrtf(discriminant);
+  if (t < 0.0f) {
+    t = 0.0f;
+  }
+  if (t > max_distance) {
+    return false;
+  }
+  *distance = t;
+  return true;
+}
+
+bool binocle_collider_ray_cast(binocle_collider *collider, kmVec2 origin, kmVec2 direction, float max_distance, float *distance) {
+  if (collider->circle != NULL) {
+    return binocle_collision_ray_clip_circle(origin, direction,
+                                             binocle_collider_circle_get_absolute_position(collider->circle),
+                                             collider->circle->radius, max_distance, distance);
+  }
+
+  if (collider->hitbox != NULL) {
+    float t_min = 0.0f;
+    float t_max = max_distance;
+    if (!binocle_collision_ray_clip_aabb(origin, direction, collider->hitbox->aabb, &t_min, &t_max)) {
+      return false;
+    }
+    *distance = t_min;
+    return true;
+  }
+
+  return false;
+}
+
+bool binocle_collider_box_cast(binocle_collider *collider, kmAABB2 box, kmVec2 direction, float max_distance, float *distance) {
+  // The box touches the collider when its center enters the shape of the collider grown by the half size of the box,
+  // so this becomes a ray cast from the center of the box
+  kmVec2 origin;
+  origin.x = (box.min.x + box.max.x) * 0.5f;
+  origin.y = (box.min.y + box.max.y) * 0.5f;
+  float half_width = (box.max.x - box.min.x) * 0.5f;
+  float half_height = (box.max.y - box.min.y) * 0.5f;
+
+  if (collider->circle != NULL) {
+    // A box grown by a circle is a rounded box: two crossed boxes and a circle on each corner
+    kmVec2 center = binocle_collider_circle_get_absolute_position(collider->circle);
+    float radius = collider->circle->radius;
+    kmAABB2 parts[2];
+    parts[0].min.x = center.x - half_width - radius;
+    parts[0].min.y = center.y - half_height;
+    parts[0].max.x = center.x + half_width + radius;
+    parts[0].max.y = center.y + half_height;
+    parts[1].min.x = center.x - half_width;
+    parts[1].min.y = center.y - half_height - radius;
+    parts[1].max.x = center.x + half_width;
+    parts[1].max.y = center.y + half_height + radius;
+
+    bool hit = false;
+    float closest = max_distance;
+    for (int i = 0 ; i < 2 ; i++) {
+      float t_min = 0.0f;
+      float t_max = closest;
+      if (binocle_collision_ray_clip_aabb(origin, direction, parts[i], &t_min, &t_max)) {
+        closest = t_min;
+        hit = true;
+      }
+    }
+    for (int i = 0 ; i < 4 ; i++) {
+      kmVec2 corner;
+      corner.x = center.x + ((i & 1) != 0 ? half_width : -half_width);
+      corner.y = center.y + ((i & 2) != 0 ? half_height : -half_height);
+      float t;
+      if (binocle_collision_ray_clip_circle(origin, direction, corner, radius, closest, &t)) {
+        closest = t;
+        hit = true;
+      }
+    }
+    if (hit) {
+      *distance = closest;
+    }
+    return hit;
+  }
+
+  if (collider->hitbox != NULL) {
+    kmAABB2 aabb = collider->hitbox->aabb;
+    aabb.min.x -= half_width;
+    aabb.min.y -= half_height;
+    aabb.max.x += half_width;
+    aabb.max.y += half_height;
+    float t_min = 0.0f;
+    float t_max = max_distance;
+    if (!binocle_collision_ray_clip_aabb(origin, direction, aabb, &t_min, &t_max)) {
+      return false;
+    }
+    *distance = t_min;
+    return true;
+  }
+
+  return false;
+}
+
+//
+// Spatial hash casts
+//
+
+static void binocle_spatial_hash_get_cell_colliders(binocle_spatial_hash *spatial_hash, int32_t x, int32_t y, binocle_collider ***colliders, size_t *count) {
+  if (spatial_hash->mode == BINOCLE_SPATIAL_HASH_MODE_DENSE) {
+    binocle_spatial_hash_dense_cell *cell = &spatial_hash->cells[y * spatial_hash->grid_width + x];
+    *colliders = cell->colliders;
+    *count = cell->count;
+    return;
+  }
+  khiter_t k = kh_get(spatial_hash_cell_map_t, spatial_hash->grid, binocle_spatial_hash_get_key(x, y));
+  if (k == kh_end(spatial_hash->grid)) {
+    *colliders = NULL;
+    *count = 0;
+    return;
+  }
+  binocle_spatial_hash_cell *cell = &kh_val(spatial_hash->grid, k);
+  *colliders = cell->colliders.p;
+  *count = da_count(cell->colliders);
+}
+
+static bool binocle_spatial_hash_cell_ranges_overlap(binocle_spatial_hash_cell_range a, binocle_spatial_hash_cell_range b) {
+  return a.min_x <= b.max_x && a.max_x >= b.min_x && a.min_y <= b.max_y && a.max_y >= b.min_y;
+}
+
+// Keeps the closest max_hits hits sorted by distance
+static void binocle_spatial_hash_insert_hit(binocle_ray_hit *hits, size_t num_hits, size_t max_hits, binocle_collider *collider, float distance) {
+  size_t i = num_hits < max_hits ? num_hits : max_hits;
+  if (i == max_hits && (i == 0 || hits[i - 1].distance <= distance)) {
+    return;
+  }
+  if (i == max_hits) {
+    i--;
+  }
+  while (i > 0 && hits[i - 1].distance > distance) {
+    hits[i] = hits[i - 1];
+    i--;
+  }
+  hits[i].collider = collider;
+  hits[i].distance = distance;
+}
+
+// Sweeps a box along a direction, walking the cells in the order it crosses them. A ray is a box with no size.
+// The steps are the points where the center of the box crosses the grid lines, as in a DDA. Each step visits the cells
+// covered by the box during the step, which are as far along the direction as the cells of the previous step or further.
+// That's why a collider that overlaps the cells of the previous step has been tested already, and among the cells of the
+// current step it's tested only in the lowest corner of those it shares with them.
+// With closest_only, hits[0] holds the closest hit and the walk stops once the steps are further away than it.
+static size_t binocle_spatial_hash_cast(binocle_spatial_hash *spatial_hash, kmAABB2 box, kmVec2 direction, float max_distance, uint32_t layer_mask, bool closest_only, binocle_ray_hit *hits, size_t max_hits) {
+  if (!isfinite(max_distance)) {
+    binocle_log_error("binocle_spatial_hash_cast(): max_distance must be finite");
+    return 0;
+  }
+
+  float t_start = 0.0f;
+  float t_end = max_distance;
+  if (spatial_hash->mode == BINOCLE_SPATIAL_HASH_MODE_DENSE) {
+    // The cells of a dense grid cover a fixed area, there's no point in walking outside of it
+    kmVec2 center;
+    center.x = (box.min.x + box.max.x) * 0.5f;
+    center.y = (box.min.y + box.max.y) * 0.5f;
+    kmAABB2 bounds;
+    bounds.min.x = -(box.max.x - box.min.x) * 0.5f;
+    bounds.min.y = -(box.max.y - box.min.y) * 0.5f;
+    bounds.max.x = (float)spatial_hash->grid_width * spatial_hash->cell_size - bounds.min.x;
+    bounds.max.y = (float)spatial_hash->grid_height * spatial_hash->cell_size - bounds.min.y;
+    if (!binocle_collision_ray_clip_aabb(center, direction, bounds, &t_start, &t_end)) {
+      return 0;
+    }
+  }
+
+  // Where the center crosses the next vertical and horizontal grid lines
+  float cell_size = (float)spatial_hash->cell_size;
+  float center_x = (box.min.x + box.max.x) * 0.5f + direction.x * t_start;
+  float center_y = (box.min.y + box.max.y) * 0.5f + direction.y * t_start;
+  float cell_x = floorf(center_x * spatial_hash->inv_cell_size);
+  float cell_y = floorf(center_y * spatial_hash->inv_cell_size);
+  float t_next_x = INFINITY;
+  float t_delta_x = INFINITY;
+  if (direction.x != 0.0f) {
+    float line_x = (direction.x > 0.0f ? cell_x + 1.0f : cell_x) * cell_size;
+    t_next_x = t_start + (line_x - center_x) / direction.x;
+    t_delta_x = cell_size / fabsf(direction.x);
+  }
+  float t_next_y = INFINITY;
+  float t_delta_y = INFINITY;
+  if (direction.y != 0.0f) {
+    float line_y = (direction.y > 0.0f ? cell_y + 1.0f : cell_y) * cell_size;
+    t_next_y = t_start + (line_y - center_y) / direction.y;
+    t_delta_y = cell_size / fabsf(direction.y);
+  }
+
+  size_t num_hits = 0;
+  binocle_spatial_hash_cell_range previous = {0, 0, -1, -1};
+  float t_enter = t_start;
+  for (;;) {
+    if (closest_only && num_hits > 0 && hits[0].distance <= t_enter) {
+      break;
+    }
+    float t_exit = fminf(fminf(t_next_x, t_next_y), t_end);
+
+    // The cells covered by the box between t_enter and t_exit
+    float dx_enter = direction.x * t_enter;
+    float dy_enter = direction.y * t_enter;
+    float dx_exit = direction.x * t_exit;
+    float dy_exit = direction.y * t_exit;
+    binocle_spatial_hash_cell_range range = binocle_spatial_hash_get_aabb_cell_range(
+      spatial_hash, box.min.x + fminf(dx_enter, dx_exit), box.min.y + fminf(dy_enter, dy_exit),
+      box.max.x + fmaxf(dx_enter, dx_exit), box.max.y + fmaxf(dy_enter, dy_exit));
+
+    for (int32_t y = range.min_y ; y <= range.max_y ; y++) {
+      for (int32_t x = range.min_x ; x <= range.max_x ; x++) {
+        binocle_collider **colliders;
+        size_t count;
+        binocle_spatial_hash_get_cell_colliders(spatial_hash, x, y, &colliders, &count);
+        for (size_t i = 0 ; i < count ; i++) {
+          binocle_collider *collider = colliders[i];
+          binocle_spatial_hash_cell_range cells = collider->cell_range;
+          if ((layer_mask != 0 && (collider->layer & layer_mask) == 0) ||
+              binocle_spatial_hash_cell_ranges_overlap(cells, previous) ||
+              x != (cells.min_x > range.min_x ? cells.min_x : range.min_x) ||
+              y != (cells.min_y > range.min_y ? cells.min_y : range.min_y)) {
+            continue;
+          }
+          float limit = closest_only && num_hits > 0 ? hits[0].distance : max_distance;
+          float distance;
+          if (!binocle_collider_box_cast(collider, box, direction, limit, &distance)) {
+            continue;
+          }
+          if (closest_only) {
+            hits[0].collider = collider;
+            hits[0].distance = distance;
+            num_hits = 1;
+          } else {
+            binocle_spatial_hash_insert_hit(hits, num_hits, max_hits, collider, distance);
+            num_hits++;
+          }
+        }
+      }
+    }
+
+    if (t_exit >= t_end) {
+      break;
+    }
+    previous = range;
+    if (t_next_x < t_next_y) {
+      t_next_x += t_delta_x;
+    } else {
+      t_next_y += t_delta_y;
+    }
+    t_enter = t_exit;
+  }
+  return num_hits;
+}
+
+static kmAABB2 binocle_spatial_hash_point_box(kmVec2 point) {
+  kmAABB2 box;
+  box.min = point;
+  box.max = point;
+  return box;
+}
+
+bool binocle_spatial_hash_ray_cast(binocle_spatial_hash *spatial_hash, kmVec2 origin, kmVec2 direction, float max_distance, uint32_t layer_mask, binocle_collider **hit_collider, float *hit_distance) {
+  return binocle_spatial_hash_box_cast(spatial_hash, binocle_spatial_hash_point_box(origin), direction, max_distance,
+                                       layer_mask, hit_collider, hit_distance);
+}
+
+size_t binocle_spatial_hash_ray_cast_all(binocle_spatial_hash *spatial_hash, kmVec2 origin, kmVec2 direction, float max_distance, uint32_t layer_mask, binocle_ray_hit *hits, size_t max_hits) {
+  return binocle_spatial_hash_cast(spatial_hash, binocle_spatial_hash_point_box(origin), direction, max_distance,
+                                   layer_mask, false, hits, max_hits);
+}
+
+bool binocle_spatial_hash_box_cast(binocle_spatial_hash *spatial_hash, kmAABB2 box, kmVec2 direction, float max_distance, uint32_t layer_mask, binocle_collider **hit_collider, float *hit_distance) {
+  binocle_ray_hit hit;
+  if (binocle_spatial_hash_cast(spatial_hash, box, direction, max_distance, layer_mask, true, &hit, 1) == 0) {
+    return false;
+  }
+  *hit_collider = hit.collider;
+  *hit_distance = hit.distance;
+  return true;
+}
+
+size_t binocle_spatial_hash_box_cast_all(binocle_spatial_hash *spatial_hash, kmAABB2 box, kmVec2 direction, float max_distance, uint32_t layer_mask, binocle_ray_hit *hits, size_t max_hits) {
+  return binocle_spatial_hash_cast(spatial_hash, box, direction, max_distance, layer_mask, false, hits, max_hits);
+}
+
+size_t binocle_spatial_hash_ray_cast_batch(binocle_spatial_hash *spatial_hash, const binocle_ray *rays, size_t num_rays, uint32_t layer_mask, binocle_ray_hit *hits) {
+  size_t num_hits = 0;
+  for (size_t i = 0 ; i < num_rays ; i++) {
+    const binocle_ray *ray = &rays[i];
+    if (binocle_spatial_hash_cast(spatial_hash, binocle_spatial_hash_point_box(ray->origin), ray->direction,
+                                  ray->max_distance, layer_mask, true, &hits[i], 1) > 0) {
+      num_hits++;
+    } else {
+      hits[i].collider = NULL;
+      hits[i].distance = ray->max_distance;
+    }
+  }
+  return num_hits;
+}
+
+//
+// Dynamic AABB tree
+//
+
+static kmAABB2 binocle_collider_get_aabb(binocle_collider *collider) {
+  kmAABB2 aabb;
+  aabb.min.x = binocle_collider_get_absolute_left(collider);
+  aabb.min.y = binocle_collider_get_absolute_bottom(collider);
+  aabb.max.x = binocle_collider_get_absolute_right(collider);
+  aabb.max.y = binocle_collider_get_absolute_top(collider);
+  return aabb;
+}
+
+static kmAABB2 binocle_aabb_tree_union(kmAABB2 a, kmAABB2 b) {
+  kmAABB2 res;
+  res.min.x = fminf(a.min.x, b.min.x);
+  res.min.y = fminf(a.min.y, b.min.y);
+  res.max.x = fmaxf(a.max.x, b.max.x);
+  res.max.y = fmaxf(a.max.y, b.max.y);
+  return res;
+}
+
+// Half the perimeter, which is what the insertion minimizes
+static float binocle_aabb_tree_cost(kmAABB2 aabb) {
+  return (aabb.max.x - aabb.min.x) + (aabb.max.y - aabb.min.y);
+}
+
+static bool binocle_aabb_tree_contains(kmAABB2 outer, kmAABB2 inner) {
+  return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.max.x >= inner.max.x &&
+    outer.max.y >= inner.max.y;
+}
+
+static bool binocle_aabb_tree_overlaps(kmAABB2 a, kmAABB2 b) {
+  return a.min.x <= b.max.x && a.max.x >= b.min.x && a.min.y <= b.max.y && a.max.y >= b.min.y;
+}
+
+static bool binocle_aabb_tree_is_leaf(const binocle_aabb_tree_node *node) {
+  return node->child1 == BINOCLE_AABB_TREE_NULL_NODE;
+}
+
+binocle_aabb_tree binocle_aabb_tree_new(float margin) {
+  binocle_aabb_tree res = {0};
+  res.root = BINOCLE_AABB_TREE_NULL_NODE;
+  res.free_list = BINOCLE_AABB_TREE_NULL_NODE;
+  res.margin = margin > 0.0f ? margin : BINOCLE_AABB_TREE_DEFAULT_MARGIN;
+  return res;
+}
+
+void binocle_aabb_tree_destroy(binocle_aabb_tree *tree) {
+  free(tree->nodes);
+  free(tree->stack);
+  *tree = binocle_aabb_tree_new(tree->margin);
+}
+
+// Makes sure that the next count allocations don't fail
+static bool binocle_aabb_tree_reserve_nodes(binocle_aabb_tree *tree, int32_t count) {
+  if (tree->node_capacity - tree->node_count >= count) {
+    return true;
+  }
+  int32_t new_capacity = tree->node_capacity + tree->node_capacity / 2; // grow by x1.5
+  if (new_capacity < tree->node_count + count) {
+    new_capacity = tree->node_count + count;
+  }
+  if (new_capacity < 16) {
+    new_capacity = 16;
+  }
+  binocle_aabb_tree_node *nodes = realloc(tree->nodes, sizeof(binocle_aabb_tree_node) * new_capacity);
+  if (nodes == NULL) {
+    binocle_log_error("binocle_aabb_tree_reserve_nodes(): Cannot grow the tree to %" PRId32 " nodes", new_capacity);
+    return false;
+  }
+  // The new nodes go in front of the free list
+  for (int32_t i = tree->node_capacity ; i < new_capacity ; i++) {
+    nodes[i].parent = i + 1 < new_capacity ? i + 1 : tree->free_list;
+    nodes[i].height = -1;
+  }
+  tree->nodes = nodes;
+  tree->free_list = tree->node_capacity;
+  tree->node_capacity = new_capacity;
+  return true;
+}
+
+static int32_t binocle_aabb_tree_allocate_node(binocle_aabb_tree *tree) {
+  if (!binocle_aabb_tree_reserve_nodes(tree, 1)) {
+    return BINOCLE_AABB_TREE_NULL_NODE;
+  }
+
+  int32_t id = tree->free_list;
+  binocle_aabb_tree_node *node = &tree->nodes[id];
+  tree->free_list = node->parent;
+  node->parent = BINOCLE_AABB_TREE_NULL_NODE;
+  node->child1 = BINOCLE_AABB_TREE_NULL_NODE;
+  node->child2 = BINOCLE_AABB_TREE_NULL_NODE;
+  node->height = 0;
+  node->collider = NULL;
+  tree->node_count++;
+  return id;
+}
+
+static void binocle_aabb_tree_free_node(binocle_aabb_tree *tree, int32_t id) {
+  tree->nodes[id].parent = tree->free_list;
+  tree->nodes[id].height = -1;
+  tree->nodes[id].collider = NULL;
+  tree->free_list = id;
+  tree->node_count--;
+}
+
+static void binocle_aabb_tree_replace_child(binocle_aabb_tree *tree, int32_t parent, int32_t old_child, int32_t new_child) {
+  if (parent == BINOCLE_AABB_TREE_NULL_NODE) {
+    tree->root = new_child;
+  } else if (tree->nodes[parent].child1 == old_child) {
+    tree->nodes[parent].child1 = new_child;
+  } else {
+    tree->nodes[parent].child2 = new_child;
+  }
+}
+
+// Rotates the taller grandchild of a up, if a is unbalanced, and returns the node that took its place
+static int32_t binocle_aabb_tree_balance(binocle_aabb_tree *tree, int32_t ia) {
+  binocle_aabb_tree_node *a = &tree->nodes[ia];
+  if (binocle_aabb_tree_is_leaf(a) || a->height < 2) {
+    return ia;
+  }
+
+  int32_t ib = a->child1;
+  int32_t ic = a->child2;
+  binocle_aabb_tree_node *b = &tree->nodes[ib];
+  binocle_aabb_tree_node *c = &tree->nodes[ic];
+  int32_t balance = c->height - b->height;
+
+  if (balance > 1) {
+    // Rotate c up
+    int32_t i_f = c->child1;
+    int32_t i_g = c->child2;
+    binocle_aabb_tree_node *f = &tree->nodes[i_f];
+    binocle_aabb_tree_node *g = &tree->nodes[i_g];
+    c->child1 = ia;
+    c->parent = a->parent;
+    a->parent = ic;
+    binocle_aabb_tree_replace_child(tree, c->parent, ia, ic);
+    if (f->height > g->height) {
+      c->child2 = i_f;
+      a->child2 = i_g;
+      g->parent = ia;
+      a->aabb = binocle_aabb_tree_union(b->aabb, g->aabb);
+      c->aabb = binocle_aabb_tree_union(a->aabb, f->aabb);
+      a->height = 1 + (b->height > g->height ? b->height : g->height);
+      c->height = 1 + (a->height > f->height ? a->height : f->height);
+    } else {
+      c->child2 = i_g;
+      a->child2 = i_f;
+      f->parent = ia;
+      a->aabb = binocle_aabb_tree_union(b->aabb, f->aabb);
+      c->aabb = binocle_aabb_tree_union(a->aabb, g->aabb);
+      a->height = 1 + (b->height > f->height ? b->height : f->height);
+      c->height = 1 + (a->height > g->height ? a->height : g->height);
+    }
+    return ic;
+  }
+
+  if (balance < -1) {
+    // Rotate b up
+    int32_t i_d = b->child1;
+    int32_t i_e = b->child2;
+    binocle_aabb_tree_node *d = &tree->nodes[i_d];
+    binocle_aabb_tree_node *e = &tree->nodes[i_e];
+    b->child1 = ia;
+    b->parent = a->parent;
+    a->parent = ib;
+    binocle_aabb_tree_replace_child(tree, b->parent, ia, ib);
+    if (d->height > e->height) {
+      b->child2 = i_d;
+      a->child1 = i_e;
+      e->parent = ia;
+      a->aabb = binocle_aabb_tree_union(c->aabb, e->aabb);
+      b->aabb = binocle_aabb_tree_union(a->aabb, d->aabb);
+      a->height = 1 + (c->height > e->height ? c->height : e->height);
+      b->height = 1 + (a->height > d->height ? a->height : d->height);
+    } else {
+      b->child2 = i_e;
+      a->child1 = i_d;
+      d->parent = ia;
+      a->aabb = binocle_aabb_tree_union(c->aabb, d->aabb);
+      b->aabb = binocle_aabb_tree_union(a->aabb, e->aabb);
+      a->height = 1 + (c->height > d->height ? c->height : d->height);
+      b->height = 1 + (a->height > e->height ? a->height : e->height);
+    }
+    return ib;
+  }
+
+  return ia;
+}
+
+// Walks up from index, rebalancing and refitting the boxes of the ancestors
+static void binocle_aabb_tree_refit(binocle_aabb_tree *tree, int32_t index) {
+  while (index != BINOCLE_AABB_TREE_NULL_NODE) {
+    index = binocle_aabb_tree_balance(tree, index);
+    binocle_aabb_tree_node *node = &tree->nodes[index];
+    binocle_aabb_tree_node *child1 = &tree->nodes[node->child1];
+    binocle_aabb_tree_node *child2 = &tree->nodes[node->child2];
+    node->height = 1 + (child1->height > child2->height ? child1->height : child2->height);
+    node->aabb = binocle_aabb_tree_union(child1->aabb, child2->aabb);
+    index = node->parent;
+  }
+}
+
+// The caller has to make sure that a node can be allocated for the new parent of the leaf, so that this can't fail
+static void binocle_aabb_tree_insert_leaf(binocle_aabb_tree *tree, int32_t leaf) {
+  if (tree->root == BINOCLE_AABB_TREE_NULL_NODE) {
+    tree->root = leaf;
+    tree->nodes[leaf].parent = BINOCLE_AABB_TREE_NULL_NODE;
+    return;
+  }
+
+  // Look for the sibling that makes the tree grow the least
+  kmAABB2 leaf_aabb = tree->nodes[leaf].aabb;
+  int32_t index = tree->root;
+  while (!binocle_aabb_tree_is_leaf(&tree->nodes[index])) {
+    binocle_aabb_tree_node *node = &tree->nodes[index];
+    float area = binocle_aabb_tree_cost(node->aabb);
+    float combined_area = binocle_aabb_tree_cost(binocle_aabb_tree_union(node->aabb, leaf_aabb));
+    // The cost of making a new parent for this node and the leaf
+    float cost = 2.0f * combined_area;
+    // The cost of pushing the leaf further down, which grows this node anyway
+    float inheritance_cost = 2.0f * (combined_area - area);
+
+    float costs[2];
+    int32_t children[2] = {node->child1, node->child2};
+    for (int i = 0 ; i < 2 ; i++) {
+      binocle_aabb_tree_node *child = &tree->nodes[children[i]];
+      float child_area = binocle_aabb_tree_cost(binocle_aabb_tree_union(child->aabb, leaf_aabb));
+      if (binocle_aabb_tree_is_leaf(child)) {
+        costs[i] = child_area + inheritance_cost;
+      } else {
+        costs[i] = (child_area - binocle_aabb_tree_cost(child->aabb)) + inheritance_cost;
+      }
+    }
+
+    if (cost < costs[0] && cost < costs[1]) {
+      break;
+    }
+    index = costs[0] < costs[1] ? children[0] : children[1];
+  }
+
+  int32_t sibling = index;
+  int32_t new_parent = binocle_aabb_tree_allocate_node(tree);
+  int32_t old_parent = tree->nodes[sibling].parent;
+  binocle_aabb_tree_node *parent = &tree->nodes[new_parent];
+  parent->parent = old_parent;
+  parent->aabb = binocle_aabb_tree_union(leaf_aabb, tree->nodes[sibling].aabb);
+  parent->height = tree->nodes[sibling].height + 1;
+  parent->child1 = sibling;
+  parent->child2 = leaf;
+  binocle_aabb_tree_replace_child(tree, old_parent, sibling, new_parent);
+  tree->nodes[sibling].parent = new_parent;
+  tree->nodes[leaf].parent = new_parent;
+
+  binocle_aabb_tree_refit(tree, tree->nodes[leaf].parent);
+}
+
+static void binocle_aabb_tree_remove_leaf(binocle_aabb_tree *tree, int32_t leaf) {
+  if (leaf == tree->root) {
+    tree->root = BINOCLE_AABB_TREE_NULL_NODE;
+    return;
+  }
+
+  int32_t parent = tree->nodes[leaf].parent;
+  int32_t grand_parent = tree->nodes[parent].parent;
+  int32_t sibling = tree->nodes[parent].child1 == leaf ? tree->nodes[parent].child2 : tree->nodes[parent].child1;
+
+  // The sibling takes the place of the parent
+  binocle_aabb_tree_replace_child(tree, grand_parent, parent, sibling);
+  tree->nodes[sibling].parent = grand_parent;
+  binocle_aabb_tree_free_node(tree, parent);
+  binocle_aabb_tree_refit(tree, grand_parent);
+}
+
+static kmAABB2 binocle_aabb_tree_fatten(binocle_aabb_tree *tree, kmAABB2 aabb) {
+  aabb.min.x -= tree->margin;
+  aabb.min.y -= tree->margin;
+  aabb.max.x += tree->margin;
+  aabb.max.y += tree->margin;
+  return aabb;
+}
+
+bool binocle_aabb_tree_add_body(binocle_aabb_tree *tree, binocle_collider *collider) {
+  if (collider->circle == NULL && collider->hitbox == NULL) {
+    binocle_log_error("binocle_aabb_tree_add_body(): this collider has no shape");
+    return false;
+  }
+  if (collider->tree_node != BINOCLE_AABB_TREE_NULL_NODE) {
+    binocle_log_error("binocle_aabb_tree_add_body(): this collider is in a tree already");
+    return false;
+  }
+  // The leaf and its parent
+  if (!binocle_aabb_tree_reserve_nodes(tree, 2)) {
+    return false;
+  }
+  int32_t leaf = binocle_aabb_tree_allocate_node(tree);
+  tree->nodes[leaf].aabb = binocle_aabb_tree_fatten(tree, binocle_collider_get_aabb(collider));
+  tree->nodes[leaf].collider = collider;
+  binocle_aabb_tree_insert_leaf(tree, leaf);
+  collider->tree_node = leaf;
+  return true;
+}
+
+void binocle_aabb_tree_remove_body(binocle_aabb_tree *tree, binocle_collider *collider) {
+  int32_t leaf = collider->tree_node;
+  if (leaf == BINOCLE_AABB_TREE_NULL_NODE) {
+    return;
+  }
+  binocle_aabb_tree_remove_leaf(tree, leaf);
+  binocle_aabb_tree_free_node(tree, leaf);
+  collider->tree_node = BINOCLE_AABB_TREE_NULL_NODE;
+}
+
+bool binocle_aabb_tree_update_body(binocle_aabb_tree *tree, binocle_collider *collider) {
+  int32_t leaf = collider->tree_node;
+  if (leaf == BINOCLE_AABB_TREE_NULL_NODE) {
+    return binocle_aabb_tree_add_body(tree, collider);
+  }
+  kmAABB2 aabb = binocle_collider_get_aabb(collider);
+  if (binocle_aabb_tree_contains(tree->nodes[leaf].aabb, aabb)) {
+    return false;
+  }
+  // Removing the leaf frees the node of its parent, so inserting it again can't run out of nodes
+  binocle_aabb_tree_remove_leaf(tree, leaf);
+  tree->nodes[leaf].aabb = binocle_aabb_tree_fatten(tree, aabb);
+  binocle_aabb_tree_insert_leaf(tree, leaf);
+  return true;
+}
+
+static bool binocle_aabb_tree_push(binocle_aabb_tree *tree, int32_t *count, int32_t node) {
+  if (*count >= tree->stack_capacity) {
+    int32_t new_capacity = tree->stack_capacity + tree->stack_capacity / 2; // grow by x1.5
+    if (new_capacity < 64) {
+      new_capacity = 64;
+    }
+    int32_t *stack = realloc(tree->stack, sizeof(int32_t) * new_capacity);
+    if (stack == NULL) {
+      binocle_log_error("binocle_aabb_tree_push(): Cannot grow the traversal stack to %" PRId32 " nodes", new_capacity);
+      return false;
+    }
+    tree->stack = stack;
+    tree->stack_capacity = new_capacity;
+  }
+  tree->stack[(*count)++] = node;
+  return true;
+}
+
+size_t binocle_aabb_tree_query_region(binocle_aabb_tree *tree, kmAABB2 region, uint32_t layer_mask, binocle_collider **colliders, size_t max_colliders) {
+  size_t num_colliders = 0;
+  int32_t count = 0;
+  if (tree->root != BINOCLE_AABB_TREE_NULL_NODE) {
+    binocle_aabb_tree_push(tree, &count, tree->root);
+  }
+  while (count > 0) {
+    binocle_aabb_tree_node *node = &tree->nodes[tree->stack[--count]];
+    if (!binocle_aabb_tree_overlaps(node->aabb, region)) {
+      continue;
+    }
+    if (binocle_aabb_tree_is_leaf(node)) {
+      binocle_collider *collider = node->collider;
+      if ((layer_mask != 0 && (collider->layer & layer_mask) == 0) ||
+          !binocle_aabb_tree_overlaps(binocle_collider_get_aabb(collider), region)) {
+        continue;
+      }
+      if (num_colliders < max_colliders) {
+        colliders[num_colliders] = collider;
+      }
+      num_colliders++;
+    } else {
+      binocle_aabb_tree_push(tree, &count, node->child1);
+      binocle_aabb_tree_push(tree, &count, node->child2);
+    }
+  }
+  return num_colliders;
+}
+
+size_t binocle_aabb_tree_query_pairs(binocle_aabb_tree *tree, binocle_collider_pair *pairs, size_t max_pairs) {
+  size_t num_pairs = 0;
+  for (int32_t leaf = 0 ; leaf < tree->node_capacity ; leaf++) {
+    binocle_aabb_tree_node *leaf_node = &tree->nodes[leaf];
+    if (leaf_node->height != 0) {
+      continue;
+    }
+    // Each pair is found from both of its leaves, only the one with the lower index reports it
+    kmAABB2 aabb = leaf_node->aabb;
+    int32_t count = 0;
+    binocle_aabb_tree_push(tree, &count, tree->root);
+    while (count > 0) {
+      int32_t index = tree->stack[--count];
+      binocle_aabb_tree_node *node = &tree->nodes[index];
+      if (!binocle_aabb_tree_overlaps(node->aabb, aabb)) {
+        continue;
+      }
+      if (binocle_aabb_tree_is_leaf(node)) {
+        if (index <= leaf || !binocle_collider_is_pair(leaf_node->collider, node->collider)) {
+          continue;
+        }
+        if (num_pairs < max_pairs) {
+          pairs[num_pairs].a = leaf_node->collider;
+          pairs[num_pairs].b = node->collider;
+        }
+        num_pairs++;
+      } else {
+        binocle_aabb_tree_push(tree, &count, node->child1);
+        binocle_aabb_tree_push(tree, &count, node->child2);
+      }
+    }
+  }
+  return num_pairs;
+}
+
+bool binocle_aabb_tree_ray_cast(binocle_aabb_tree *tree, kmVec2 origin, kmVec2 direction, float max_distance, uint32_t layer_mask, binocle_collider **hit_collider, float *hit_distance) {
+  binocle_collider *closest = NULL;
+  float closest_distance = max_distance;
+  int32_t count = 0;
+  if (tree->root != BINOCLE_AABB_TREE_NULL_NODE) {
+    binocle_aabb_tree_push(tree, &count, tree->root);
+  }
+  while (count > 0) {
+    binocle_aabb_tree_node *node = &tree->nodes[tree->stack[--count]];
+    // Everything beyond the closest hit so far can be skipped
+    float t_min = 0.0f;
+    float t_max = closest_distance;
+    if (!binocle_collision_ray_clip_aabb(origin, direction, node->aabb, &t_min, &t_max)) {
+      continue;
+    }
+    if (binocle_aabb_tree_is_leaf(node)) {
+      binocle_collider *collider = node->collider;
+      float distance;
+      if ((layer_mask == 0 || (collider->layer & layer_mask) != 0) &&
+          binocle_collider_ray_cast(collider, origin, direction, closest_distance, &distance)) {
+        closest = collider;
+        closest_distance = distance;
+      }
+    } else {
+      binocle_aabb_tree_push(tree, &count, node->child1);
+      binocle_aabb_tree_push(tree, &count, node->child2);
+    }
+  }
+  if (closest == NULL) {
+    return false;
+  }
+  *hit_collider = closest;
+  *hit_distance = closest_distance;
+  return true;
+}
+
+int32_t binocle_aabb_tree_get_height(const binocle_aabb_tree *tree) {
+  if (tree->root == BINOCLE_AABB_TREE_NULL_NODE) {
+    return 0;
+  }
+  return tree->nodes[tree->root].height;
+}
+
 bool binocle_collision_ray_cast_obb(
   kmVec3 ray_origin,
   kmVec3 ray_direction,
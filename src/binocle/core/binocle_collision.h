@@ -44,25 +44,96 @@ typedef uint64_t binocle_spatial_hash_grid_key_t;
 
 DA_TYPEDEF(binocle_spatial_hash_grid_key_t, binocle_grid_key_array_t)
 
+/**
+ * An inclusive range of cells of a spatial hash. It's empty when max_x is less than min_x.
+ */
+typedef struct binocle_spatial_hash_cell_range {
+  int32_t min_x;
+  int32_t min_y;
+  int32_t max_x;
+  int32_t max_y;
+} binocle_spatial_hash_cell_range;
+
 typedef struct binocle_collider {
   binocle_collider_circle *circle;
   binocle_collider_hitbox *hitbox;
+  /// The keys of the cells the collider is in. With a dense grid, the slot of the collider in each cell of cell_range
+  /// instead, row by row.
   binocle_grid_key_array_t grid_index;
+  /// The cells the collider is in
+  binocle_spatial_hash_cell_range cell_range;
+  /// The collision layers the collider belongs to, as a bitmask
+  uint32_t layer;
+  /// The collision layers the collider collides with, as a bitmask
+  uint32_t mask;
+  /// The leaf of the collider in an AABB tree, or BINOCLE_AABB_TREE_NULL_NODE
+  int32_t tree_node;
 } binocle_collider;
 
 DA_TYPEDEF(binocle_collider *, binocle_collider_ptr_array_t)
 
+/**
+ * Two colliders whose bounding boxes overlap
+ */
+typedef struct binocle_collider_pair {
+  binocle_collider *a;
+  binocle_collider *b;
+} binocle_collider_pair;
+
+/**
+ * A ray, as cast by binocle_spatial_hash_ray_cast_batch
+ */
+typedef struct binocle_ray {
+  kmVec2 origin;
+  /// The direction of the ray. This must be normalized.
+  kmVec2 direction;
+  /// The length of the ray
+  float max_distance;
+} binocle_ray;
+
+/**
+ * A collider hit by a ray or by a moving box
+ */
+typedef struct binocle_ray_hit {
+  /// The collider that has been hit, or NULL
+  binocle_collider *collider;
+  /// The distance travelled along the direction before touching the collider
+  float distance;
+} binocle_ray_hit;
+
 typedef struct binocle_spatial_hash_cell {
   binocle_collider_ptr_array_t colliders;
 } binocle_spatial_hash_cell;
 
+/**
+ * A cell of a dense grid. The colliders are kept packed, removing one moves the last one in its place.
+ */
+typedef struct binocle_spatial_hash_dense_cell {
+  binocle_collider **colliders;
+  uint32_t count;
+  uint32_t capacity;
+} binocle_spatial_hash_dense_cell;
+
+/**
+ * How a spatial hash stores its cells
+ */
+typedef enum binocle_spatial_hash_mode {
+  /// The cells live in a hash map and the grid grows to contain whatever gets added to it
+  BINOCLE_SPATIAL_HASH_MODE_HASH = 0,
+  /// The cells live in a flat array covering a fixed area. Colliders outside of it are kept in the cells on its border.
+  BINOCLE_SPATIAL_HASH_MODE_DENSE,
+} binocle_spatial_hash_mode;
+
 
 #define binocle_spatial_hash_func(key) (binocle_spatial_hash_grid_key_t)(key)
 #define binocle_spatial_hash_equal(a, b) ((a) == (b))
 KHASH_INIT(spatial_hash_cell_map_t, binocle_spatial_hash_grid_key_t, binocle_spatial_hash_cell, 1, binocle_spatial_hash_func, binocle_spatial_hash_equal)
 
 typedef struct binocle_spatial_hash {
+  binocle_spatial_hash_mode mode;
   khash_t(spatial_hash_cell_map_t) *grid;
+  /// The cells of a dense grid, grid_width * grid_height of them, indexed by y * grid_width + x
+  binocle_spatial_hash_dense_cell *cells;
   uint32_t cell_size;
   uint32_t grid_width;
   uint32_t grid_height;
@@ -73,6 +144,45 @@ typedef struct binocle_spatial_hash {
   binocle_grid_key_array_t temp_arr;
 } binocle_spatial_hash;
 
+/// The index of a node that doesn't exist
+#define BINOCLE_AABB_TREE_NULL_NODE (-1)
+/// The fattening of the AABBs of the leaves used when 0 is passed to binocle_aabb_tree_new
+#define BINOCLE_AABB_TREE_DEFAULT_MARGIN (4.0f)
+
+/**
+ * A node of an AABB tree. The leaves hold the colliders.
+ */
+typedef struct binocle_aabb_tree_node {
+  /// The box containing the children. For a leaf, the AABB of the collider grown by the margin of the tree.
+  kmAABB2 aabb;
+  binocle_collider *collider;
+  /// The parent of the node, or the next free node when the node isn't in use
+  int32_t parent;
+  int32_t child1;
+  int32_t child2;
+  /// Zero for a leaf, -1 for a free node
+  int32_t height;
+} binocle_aabb_tree_node;
+
+/**
+ * A dynamic AABB tree, also known as a bounding volume hierarchy. Unlike a spatial hash, its cost doesn't depend on the
+ * size of the colliders or of the world, so it's the better choice for levels that mix tiny and huge colliders.
+ * The leaves store a fattened AABB, so a collider that moves a little doesn't need to be reinserted, and the tree is
+ * kept balanced with rotations.
+ */
+typedef struct binocle_aabb_tree {
+  binocle_aabb_tree_node *nodes;
+  int32_t root;
+  int32_t node_count;
+  int32_t node_capacity;
+  int32_t free_list;
+  /// How much the AABB of each leaf is grown on each side
+  float margin;
+  /// The traversal stack used by the queries, kept around so that they don't allocate
+  int32_t *stack;
+  int32_t stack_capacity;
+} binocle_aabb_tree;
+
 binocle_collider_circle binocle_collider_circle_new(float radius, kmVec2 center);
 kmVec2 binocle_collider_circle_get_absolute_position(binocle_collider_circle *circle);
 float binocle_collider_circle_get_absolute_left(binocle_collider_circle *circle);
@@ -106,6 +216,19 @@ bool binocle_collide_hitbox_to_hitbox(binocle_collider_hitbox *hitbox_a, binocle
 
 binocle_collider binocle_collider_new();
 binocle_spatial_hash binocle_spatial_hash_new(float width, float height, uint32_t cell_size);
+
+/**
+ * \brief Creates a spatial hash that keeps its cells in a flat array
+ * The grid covers the area from (0, 0) to (width, height) and doesn't grow. Updating a collider that stays in the same
+ * cells costs nothing and moving it only touches the cells it entered or left, which makes this mode the better choice
+ * when lots of colliders move every frame in a bounded world.
+ * @param width the width of the area covered by the grid
+ * @param height the height of the area covered by the grid
+ * @param cell_size the size of a cell
+ * @return the spatial hash
+ */
+binocle_spatial_hash binocle_spatial_hash_new_dense(float width, float height, uint32_t cell_size);
+
 void binocle_spatial_hash_destroy(binocle_spatial_hash *spatial_hash);
 binocle_spatial_hash_cell binocle_spatial_hash_cell_new();
 kmVec2 binocle_spatial_hash_get_cell_coords(binocle_spatial_hash *spatial_hash, float x, float y);
@@ -120,7 +243,223 @@ void binocle_spatial_hash_remove_indexes(binocle_spatial_hash *spatial_hash, bin
 void binocle_spatial_hash_update_indexes(binocle_spatial_hash *spatial_hash, binocle_collider *collider, binocle_grid_key_array_t *ar);
 binocle_grid_key_array_t *binocle_spatial_hash_aabb_to_grid(binocle_spatial_hash *spatial_hash, kmVec2 min, kmVec2 max);
 uint64_t binocle_spatial_hash_get_key(int x, int y);
+
+/**
+ * \brief Gets the range of cells covered by a collider. With a dense grid, the range is clamped to the grid.
+ * @param spatial_hash the spatial hash
+ * @param collider the collider
+ * @return the range of cells
+ */
+binocle_spatial_hash_cell_range binocle_spatial_hash_get_cell_range(binocle_spatial_hash *spatial_hash, binocle_collider *collider);
+
+/**
+ * \brief Gets the colliders that share at least a cell with the given one
+ * Each collider is listed once, even when it shares several cells with the given one.
+ * @param spatial_hash the spatial hash
+ * @param collider the collider
+ * @param colliding_colliders the array that gets filled with the colliders. It's cleared first.
+ * @param layer_mask only the colliders in one of these layers are listed. Zero lists all of them.
+ */
 void binocle_spatial_hash_get_all_bodies_sharing_cells_with_body(binocle_spatial_hash *spatial_hash, binocle_collider *collider, binocle_collider_ptr_array_t *colliding_colliders, int layer_mask);
+
+/**
+ * \brief Finds all the pairs of colliders whose bounding boxes overlap
+ * Each pair is reported once. A pair is only reported if each collider's layer is in the other collider's mask. Nothing
+ * gets allocated: when there are more pairs than max_pairs, the first max_pairs are written and the return value tells
+ * how big the buffer should have been.
+ * @param spatial_hash the spatial hash
+ * @param pairs the buffer that receives the pairs
+ * @param max_pairs the number of pairs that fit in the buffer
+ * @return the number of pairs found, which can be more than max_pairs
+ */
+size_t binocle_spatial_hash_query_pairs(binocle_spatial_hash *spatial_hash, binocle_collider_pair *pairs, size_t max_pairs);
+
+/**
+ * \brief Releases the memory held by the empty cells
+ * The cells of the hash map are never freed while colliders move around, so a long session keeps growing the map.
+ * Call this every now and then, for instance when loading a level.
+ * @param spatial_hash the spatial hash
+ * @return the number of cells that have been freed
+ */
+uint32_t binocle_spatial_hash_compact(binocle_spatial_hash *spatial_hash);
+
+/**
+ * \brief Casts a ray against the shape of a collider
+ * @param collider the collider
+ * @param origin the origin of the ray
+ * @param direction the direction of the ray. This must be normalized.
+ * @param max_distance the length of the ray
+ * @param distance the distance from the origin to the hit point. It's zero when the origin is inside the collider.
+ * @return true if the ray hits the collider
+ */
+bool binocle_collider_ray_cast(binocle_collider *collider, kmVec2 origin, kmVec2 direction, float max_distance, float *distance);
+
+/**
+ * \brief Moves a box against the shape of a collider and finds when they first touch
+ * @param collider the collider
+ * @param box the box at the start of the movement
+ * @param direction the direction of the movement. This must be normalized.
+ * @param max_distance the length of the movement
+ * @param distance the distance the box travels before touching the collider. It's zero when they overlap at the start.
+ * @return true if the box touches the collider
+ */
+bool binocle_collider_box_cast(binocle_collider *collider, kmAABB2 box, kmVec2 direction, float max_distance, float *distance);
+
+/**
+ * \brief Finds the first collider hit by a ray
+ * The cells are walked in the order the ray crosses them and only the colliders in those cells are tested, each of them
+ * once. The walk stops as soon as no collider further along the ray can be closer than the one already found. With a
+ * dense grid, only the part of the ray inside the grid is walked.
+ * @param spatial_hash the spatial hash
+ * @param origin the origin of the ray
+ * @param direction the direction of the ray. This must be normalized.
+ * @param max_distance the length of the ray. This must be finite.
+ * @param layer_mask only the colliders in one of these layers can be hit. Zero means all of them.
+ * @param hit_collider the collider that has been hit
+ * @param hit_distance the distance from the origin to the hit point
+ * @return true if a collider has been hit
+ */
+bool binocle_spatial_hash_ray_cast(binocle_spatial_hash *spatial_hash, kmVec2 origin, kmVec2 direction, float max_distance, uint32_t layer_mask, binocle_collider **hit_collider, float *hit_distance);
+
+/**
+ * \brief Finds all the colliders hit by a ray, sorted by distance
+ * Nothing gets allocated: when there are more hits than max_hits, the closest max_hits are written and the return
+ * value tells how big the buffer should have been.
+ * @param spatial_hash the spatial hash
+ * @param origin the origin of the ray
+ * @param direction the direction of the ray. This must be normalized.
+ * @param max_distance the length of the ray. This must be finite.
+ * @param layer_mask only the colliders in one of these layers can be hit. Zero means all of them.
+ * @param hits the buffer that receives the hits
+ * @param max_hits the number of hits that fit in the buffer
+ * @return the number of colliders hit, which can be more than max_hits
+ */
+size_t binocle_spatial_hash_ray_cast_all(binocle_spatial_hash *spatial_hash, kmVec2 origin, kmVec2 direction, float max_distance, uint32_t layer_mask, binocle_ray_hit *hits, size_t max_hits);
+
+/**
+ * \brief Finds the first collider touched by a moving box
+ * It walks the cells swept by the box like binocle_spatial_hash_ray_cast does with a ray.
+ * @param spatial_hash the spatial hash
+ * @param box the box at the start of the movement
+ * @param direction the direction of the movement. This must be normalized.
+ * @param max_distance the length of the movement. This must be finite.
+ * @param layer_mask only the colliders in one of these layers can be touched. Zero means all of them.
+ * @param hit_collider the collider that has been touched
+ * @param hit_distance the distance the box travels before touching it
+ * @return true if a collider has been touched
+ */
+bool binocle_spatial_hash_box_cast(binocle_spatial_hash *spatial_hash, kmAABB2 box, kmVec2 direction, float max_distance, uint32_t layer_mask, binocle_collider **hit_collider, float *hit_distance);
+
+/**
+ * \brief Finds all the colliders touched by a moving box, sorted by distance
+ * The buffer works as in binocle_spatial_hash_ray_cast_all.
+ * @param spatial_hash the spatial hash
+ * @param box the box at the start of the movement
+ * @param direction the direction of the movement. This must be normalized.
+ * @param max_distance the length of the movement. This must be finite.
+ * @param layer_mask only the colliders in one of these layers can be touched. Zero means all of them.
+ * @param hits the buffer that receives the hits
+ * @param max_hits the number of hits that fit in the buffer
+ * @return the number of colliders touched, which can be more than max_hits
+ */
+size_t binocle_spatial_hash_box_cast_all(binocle_spatial_hash *spatial_hash, kmAABB2 box, kmVec2 direction, float max_distance, uint32_t layer_mask, binocle_ray_hit *hits, size_t max_hits);
+
+/**
+ * \brief Finds the first collider hit by each of many rays
+ * This is meant for things like the line of sight checks of lots of agents. Rays that start close to each other are
+ * faster when they are next to each other in the array, as they walk the same cells.
+ * @param spatial_hash the spatial hash
+ * @param rays the rays
+ * @param num_rays the number of rays
+ * @param layer_mask only the colliders in one of these layers can be hit. Zero means all of them.
+ * @param hits the hit of each ray. The collider is NULL for the rays that didn't hit anything.
+ * @return the number of rays that hit a collider
+ */
+size_t binocle_spatial_hash_ray_cast_batch(binocle_spatial_hash *spatial_hash, const binocle_ray *rays, size_t num_rays, uint32_t layer_mask, binocle_ray_hit *hits);
+
+/**
+ * \brief Creates an empty AABB tree
+ * @param margin how much the AABB of each collider is grown, so that small movements don't change the tree. Zero means
+ * BINOCLE_AABB_TREE_DEFAULT_MARGIN.
+ * @return the tree
+ */
+binocle_aabb_tree binocle_aabb_tree_new(float margin);
+
+/**
+ * \brief Releases the memory of an AABB tree
+ * The colliders are left in the tree, binocle_aabb_tree_remove_body has to be called on those that are going to be
+ * reused in a different tree.
+ * @param tree the tree
+ */
+void binocle_aabb_tree_destroy(binocle_aabb_tree *tree);
+
+/**
+ * \brief Adds a collider to an AABB tree
+ * The collider must have been created with binocle_collider_new and can be in a single tree at a time.
+ * @param tree the tree
+ * @param collider the collider
+ * @return true if the collider has been added
+ */
+bool binocle_aabb_tree_add_body(binocle_aabb_tree *tree, binocle_collider *collider);
+
+/**
+ * \brief Removes a collider from an AABB tree
+ * @param tree the tree
+ * @param collider the collider
+ */
+void binocle_aabb_tree_remove_body(binocle_aabb_tree *tree, binocle_collider *collider);
+
+/**
+ * \brief Updates an AABB tree after a collider moved or changed size
+ * The collider is only reinserted when it left the fattened AABB of its leaf.
+ * @param tree the tree
+ * @param collider the collider
+ * @return true if the collider has been reinserted
+ */
+bool binocle_aabb_tree_update_body(binocle_aabb_tree *tree, binocle_collider *collider);
+
+/**
+ * \brief Finds the colliders that overlap a region
+ * Nothing gets allocated: when there are more colliders than max_colliders, the first max_colliders are written and the
+ * return value tells how big the buffer should have been.
+ * @param tree the tree
+ * @param region the region
+ * @param layer_mask only the colliders in one of these layers are listed. Zero lists all of them.
+ * @param colliders the buffer that receives the colliders
+ * @param max_colliders the number of colliders that fit in the buffer
+ * @return the number of colliders found, which can be more than max_colliders
+ */
+size_t binocle_aabb_tree_query_region(binocle_aabb_tree *tree, kmAABB2 region, uint32_t layer_mask, binocle_collider **colliders, size_t max_colliders);
+
+/**
+ * \brief Finds all the pairs of colliders whose bounding boxes overlap
+ * It follows the same rules as binocle_spatial_hash_query_pairs.
+ * @param tree the tree
+ * @param pairs the buffer that receives the pairs
+ * @param max_pairs the number of pairs that fit in the buffer
+ * @return the number of pairs found, which can be more than max_pairs
+ */
+size_t binocle_aabb_tree_query_pairs(binocle_aabb_tree *tree, binocle_collider_pair *pairs, size_t max_pairs);
+
+/**
+ * \brief Finds the first collider hit by a ray
+ * @param tree the tree
+ * @param origin the origin of the ray
+ * @param direction the direction of the ray. This must be normalized.
+ * @param max_distance the length of the ray
+ * @param layer_mask only the colliders in one of these layers can be hit. Zero means all of them.
+ * @param hit_collider the collider that has been hit
+ * @param hit_distance the distance from the origin to the hit point
+ * @return true if a collider has been hit
+ */
+bool binocle_aabb_tree_ray_cast(binocle_aabb_tree *tree, kmVec2 origin, kmVec2 direction, float max_distance, uint32_t layer_mask, binocle_collider **hit_collider, float *hit_distance);
+
+/**
+ * \brief Gets the height of an AABB tree, which tells how well balanced it is
+ * @param tree the tree
+ * @return the height of the root, zero for an empty tree
+ */
+int32_t binocle_aabb_tree_get_height(const binocle_aabb_tree *tree);
 bool binocle_spatial_hash_is_body_sharing_any_cell(binocle_spatial_hash *spatial_hash, binocle_collider *collider);
 
 /**
@@ -0,0 +1,260 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#include "binocle_collision_batch.h"
+#include "binocle_collision.h"
+
+// Define BINOCLE_COLLISION_BATCH_NO_SIMD to build the scalar version everywhere
+#if !defined(BINOCLE_COLLISION_BATCH_NO_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BINOCLE_COLLISION_BATCH_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define BINOCLE_COLLISION_BATCH_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+#define BINOCLE_COLLISION_BATCH_LANES (4)
+
+//
+// Four lanes wide vectors. Each backend provides the same few operations, so that the tests are written only once.
+//
+
+#if defined(BINOCLE_COLLISION_BATCH_SSE2)
+
+typedef __m128 binocle_v4;
+typedef __m128 binocle_v4_mask;
+
+static inline binocle_v4 binocle_v4_gather(const float *p, const uint32_t *i) {
+  return _mm_setr_ps(p[i[0]], p[i[1]], p[i[2]], p[i[3]]);
+}
+static inline binocle_v4 binocle_v4_add(binocle_v4 a, binocle_v4 b) { return _mm_add_ps(a, b); }
+static inline binocle_v4 binocle_v4_sub(binocle_v4 a, binocle_v4 b) { return _mm_sub_ps(a, b); }
+static inline binocle_v4 binocle_v4_mul(binocle_v4 a, binocle_v4 b) { return _mm_mul_ps(a, b); }
+static inline binocle_v4 binocle_v4_min(binocle_v4 a, binocle_v4 b) { return _mm_min_ps(a, b); }
+static inline binocle_v4 binocle_v4_max(binocle_v4 a, binocle_v4 b) { return _mm_max_ps(a, b); }
+static inline binocle_v4_mask binocle_v4_lt(binocle_v4 a, binocle_v4 b) { return _mm_cmplt_ps(a, b); }
+static inline binocle_v4_mask binocle_v4_and(binocle_v4_mask a, binocle_v4_mask b) { return _mm_and_ps(a, b); }
+static inline uint32_t binocle_v4_get_bits(binocle_v4_mask m) { return (uint32_t)_mm_movemask_ps(m); }
+
+#elif defined(BINOCLE_COLLISION_BATCH_NEON)
+
+typedef float32x4_t binocle_v4;
+typedef uint32x4_t binocle_v4_mask;
+
+static inline binocle_v4 binocle_v4_gather(const float *p, const uint32_t *i) {
+  float32x4_t v = vld1q_dup_f32(&p[i[0]]);
+  v = vld1q_lane_f32(&p[i[1]], v, 1);
+  v = vld1q_lane_f32(&p[i[2]], v, 2);
+  return vld1q_lane_f32(&p[i[3]], v, 3);
+}
+static inline binocle_v4 binocle_v4_add(binocle_v4 a, binocle_v4 b) { return vaddq_f32(a, b); }
+static inline binocle_v4 binocle_v4_sub(binocle_v4 a, binocle_v4 b) { return vsubq_f32(a, b); }
+static inline binocle_v4 binocle_v4_mul(binocle_v4 a, binocle_v4 b) { return vmulq_f32(a, b); }
+static inline binocle_v4 binocle_v4_min(binocle_v4 a, binocle_v4 b) { return vminq_f32(a, b); }
+static inline binocle_v4 binocle_v4_max(binocle_v4 a, binocle_v4 b) { return vmaxq_f32(a, b); }
+static inline binocle_v4_mask binocle_v4_lt(binocle_v4 a, binocle_v4 b) { return vcltq_f32(a, b); }
+static inline binocle_v4_mask binocle_v4_and(binocle_v4_mask a, binocle_v4_mask b) { return vandq_u32(a, b); }
+static inline uint32_t binocle_v4_get_bits(binocle_v4_mask m) {
+  static const uint32_t bits[BINOCLE_COLLISION_BATCH_LANES] = {1, 2, 4, 8};
+  uint32x4_t b = vandq_u32(m, vld1q_u32(bits));
+#if defined(__aarch64__) || defined(_M_ARM64)
+  return vaddvq_u32(b);
+#else
+  uint32x2_t s = vadd_u32(vget_low_u32(b), vget_high_u32(b));
+  return vget_lane_u32(vpadd_u32(s, s), 0);
+#endif
+}
+
+#else
+
+typedef struct binocle_v4 {
+  float v[BINOCLE_COLLISION_BATCH_LANES];
+} binocle_v4;
+
+typedef struct binocle_v4_mask {
+  uint32_t v[BINOCLE_COLLISION_BATCH_LANES];
+} binocle_v4_mask;
+
+static inline binocle_v4 binocle_v4_gather(const float *p, const uint32_t *i) {
+  binocle_v4 res;
+  for (int lane = 0 ; lane < BINOCLE_COLLISION_BATCH_LANES ; lane++) res.v[lane] = p[i[lane]];
+  return res;
+}
+
+static inline binocle_v4 binocle_v4_add(binocle_v4 a, binocle_v4 b) {
+  for (int i = 0 ; i < BINOCLE_COLLISION_BATCH_LANES ; i++) a.v[i] += b.v[i];
+  return a;
+}
+
+static inline binocle_v4 binocle_v4_sub(binocle_v4 a, binocle_v4 b) {
+  for (int i = 0 ; i < BINOCLE_COLLISION_BATCH_LANES ; i++) a.v[i] -= b.v[i];
+  return a;
+}
+
+static inline binocle_v4 binocle_v4_mul(binocle_v4 a, binocle_v4 b) {
+  for (int i = 0 ; i < BINOCLE_COLLISION_BATCH_LANES ; i++) a.v[i] *= b.v[i];
+  return a;
+}
+
+static inline binocle_v4 binocle_v4_min(binocle_v4 a, binocle_v4 b) {
+  for (int i = 0 ; i < BINOCLE_COLLISION_BATCH_LANES ; i++) a.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i];
+  return a;
+}
+
+static inline binocle_v4 binocle_v4_max(binocle_v4 a, binocle_v4 b) {
+  for (int i = 0 ; i < BINOCLE_COLLISION_BATCH_LANES ; i++) a.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i];
+  return a;
+}
+
+static inline binocle_v4_mask binocle_v4_lt(binocle_v4 a, binocle_v4 b) {
+  binocle_v4_mask res;
+  for (int i = 0 ; i < BINOCLE_COLLISION_BATCH_LANES ; i++) res.v[i] = (uint32_t)(a.v[i] < b.v[i]);
+  return res;
+}
+
+static inline binocle_v4_mask binocle_v4_and(binocle_v4_mask a, binocle_v4_mask b) {
+  for (int i = 0 ; i < BINOCLE_COLLISION_BATCH_LANES ; i++) a.v[i] &= b.v[i];
+  return a;
+}
+
+static inline uint32_t binocle_v4_get_bits(binocle_v4_mask m) {
+  uint32_t res = 0;
+  for (int i = 0 ; i < BINOCLE_COLLISION_BATCH_LANES ; i++) res |= m.v[i] << i;
+  return res;
+}
+
+#endif
+
+static size_t binocle_collision_batch_count_bits(uint32_t word) {
+  size_t count = 0;
+  while (word != 0) {
+    word &= word - 1;
+    count++;
+  }
+  return count;
+}
+
+void binocle_collision_batch_get_index_pairs(const binocle_collider_pair *pairs, size_t num_pairs,
+                                             const binocle_collider *colliders,
+                                             binocle_collision_index_pair *index_pairs) {
+  for (size_t i = 0 ; i < num_pairs ; i++) {
+    index_pairs[i].a = (uint32_t)(pairs[i].a - colliders);
+    index_pairs[i].b = (uint32_t)(pairs[i].b - colliders);
+  }
+}
+
+//
+// The pairs are processed 32 at a time, one word of the hit mask, and each word is filled four lanes at a time. The
+// shapes are gathered straight into the vectors, as the indices of the pairs can point anywhere. The lanes past the
+// last pair repeat it, and their bits are masked away.
+//
+
+static inline uint32_t binocle_collision_batch_get_indices(const binocle_collision_index_pair *pairs, size_t count,
+                                                           uint32_t *a, uint32_t *b) {
+  size_t lanes = count < BINOCLE_COLLISION_BATCH_LANES ? count : BINOCLE_COLLISION_BATCH_LANES;
+  for (size_t lane = 0 ; lane < BINOCLE_COLLISION_BATCH_LANES ; lane++) {
+    const binocle_collision_index_pair *pair = &pairs[lane < lanes ? lane : lanes - 1];
+    a[lane] = pair->a;
+    b[lane] = pair->b;
+  }
+  return (1u << lanes) - 1;
+}
+
+size_t binocle_collide_circles_to_circles_batch(binocle_circle_soa a, binocle_circle_soa b,
+                                                const binocle_collision_index_pair *pairs, size_t num_pairs,
+                                                uint32_t *hits) {
+  size_t count = 0;
+  for (size_t base = 0 ; base < num_pairs ; base += 32) {
+    size_t n = num_pairs - base < 32 ? num_pairs - base : 32;
+    uint32_t word = 0;
+    for (size_t i = 0 ; i < n ; i += BINOCLE_COLLISION_BATCH_LANES) {
+      uint32_t ia[BINOCLE_COLLISION_BATCH_LANES];
+      uint32_t ib[BINOCLE_COLLISION_BATCH_LANES];
+      uint32_t lanes = binocle_collision_batch_get_indices(&pairs[base + i], n - i, ia, ib);
+      // Squared distances, so that there's no square root
+      binocle_v4 dx = binocle_v4_sub(binocle_v4_gather(a.x, ia), binocle_v4_gather(b.x, ib));
+      binocle_v4 dy = binocle_v4_sub(binocle_v4_gather(a.y, ia), binocle_v4_gather(b.y, ib));
+      binocle_v4 r = binocle_v4_add(binocle_v4_gather(a.radius, ia), binocle_v4_gather(b.radius, ib));
+      binocle_v4 distance = binocle_v4_add(binocle_v4_mul(dx, dx), binocle_v4_mul(dy, dy));
+      word |= (binocle_v4_get_bits(binocle_v4_lt(distance, binocle_v4_mul(r, r))) & lanes) << i;
+    }
+    hits[base / 32] = word;
+    count += binocle_collision_batch_count_bits(word);
+  }
+  return count;
+}
+
+size_t binocle_collide_hitboxes_to_hitboxes_batch(binocle_hitbox_soa a, binocle_hitbox_soa b,
+                                                  const binocle_collision_index_pair *pairs, size_t num_pairs,
+                                                  uint32_t *hits) {
+  size_t count = 0;
+  for (size_t base = 0 ; base < num_pairs ; base += 32) {
+    size_t n = num_pairs - base < 32 ? num_pairs - base : 32;
+    uint32_t word = 0;
+    for (size_t i = 0 ; i < n ; i += BINOCLE_COLLISION_BATCH_LANES) {
+      uint32_t ia[BINOCLE_COLLISION_BATCH_LANES];
+      uint32_t ib[BINOCLE_COLLISION_BATCH_LANES];
+      uint32_t lanes = binocle_collision_batch_get_indices(&pairs[base + i], n - i, ia, ib);
+      binocle_v4_mask overlap_x = binocle_v4_and(
+        binocle_v4_lt(binocle_v4_gather(a.min_x, ia), binocle_v4_gather(b.max_x, ib)),
+        binocle_v4_lt(binocle_v4_gather(b.min_x, ib), binocle_v4_gather(a.max_x, ia)));
+      binocle_v4_mask overlap_y = binocle_v4_and(
+        binocle_v4_lt(binocle_v4_gather(a.min_y, ia), binocle_v4_gather(b.max_y, ib)),
+        binocle_v4_lt(binocle_v4_gather(b.min_y, ib), binocle_v4_gather(a.max_y, ia)));
+      word |= (binocle_v4_get_bits(binocle_v4_and(overlap_x, overlap_y)) & lanes) << i;
+    }
+    hits[base / 32] = word;
+    count += binocle_collision_batch_count_bits(word);
+  }
+  return count;
+}
+
+size_t binocle_collide_circles_to_hitboxes_batch(binocle_circle_soa circles, binocle_hitbox_soa hitboxes,
+                                                 const binocle_collision_index_pair *pairs, size_t num_pairs,
+                                                 uint32_t *hits) {
+  size_t count = 0;
+  for (size_t base = 0 ; base < num_pairs ; base += 32) {
+    size_t n = num_pairs - base < 32 ? num_pairs - base : 32;
+    uint32_t word = 0;
+    for (size_t i = 0 ; i < n ; i += BINOCLE_COLLISION_BATCH_LANES) {
+      uint32_t ic[BINOCLE_COLLISION_BATCH_LANES];
+      uint32_t ih[BINOCLE_COLLISION_BATCH_LANES];
+      uint32_t lanes = binocle_collision_batch_get_indices(&pairs[base + i], n - i, ic, ih);
+      // The closest point of the hitbox is the center of the circle clamped to the hitbox
+      binocle_v4 cx = binocle_v4_gather(circles.x, ic);
+      binocle_v4 cy = binocle_v4_gather(circles.y, ic);
+      binocle_v4 px = binocle_v4_max(binocle_v4_min(cx, binocle_v4_gather(hitboxes.max_x, ih)),
+                                     binocle_v4_gather(hitboxes.min_x, ih));
+      binocle_v4 py = binocle_v4_max(binocle_v4_min(cy, binocle_v4_gather(hitboxes.max_y, ih)),
+                                     binocle_v4_gather(hitboxes.min_y, ih));
+      binocle_v4 dx = binocle_v4_sub(cx, px);
+      binocle_v4 dy = binocle_v4_sub(cy, py);
+      binocle_v4 r = binocle_v4_gather(circles.radius, ic);
+      binocle_v4 distance = binocle_v4_add(binocle_v4_mul(dx, dx), binocle_v4_mul(dy, dy));
+      word |= (binocle_v4_get_bits(binocle_v4_lt(distance, binocle_v4_mul(r, r))) & lanes) << i;
+    }
+    hits[base / 32] = word;
+    count += binocle_collision_batch_count_bits(word);
+  }
+  return count;
+}
+
+size_t binocle_collision_batch_get_contacts(const uint32_t *hits, const binocle_collision_index_pair *pairs,
+                                            size_t num_pairs, binocle_collision_index_pair *contacts) {
+  size_t num_contacts = 0;
+  for (size_t base = 0 ; base < num_pairs ; base += 32) {
+    uint32_t word = hits[base / 32];
+    // Most words are empty when the broadphase is tight, so they are skipped as a whole
+    for (uint32_t bit = 0 ; word != 0 ; bit++, word >>= 1) {
+      if ((word & 1) != 0) {
+        contacts[num_contacts++] = pairs[base + bit];
+      }
+    }
+  }
+  return num_contacts;
+}
@@ -0,0 +1,115 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#ifndef BINOCLE_COLLISION_BATCH_H
+#define BINOCLE_COLLISION_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct binocle_collider;
+struct binocle_collider_pair;
+
+/// The number of 32 bit words of the hit mask of a batch of n pairs
+#define BINOCLE_COLLISION_BATCH_MASK_WORDS(n) (((n) + 31) / 32)
+
+/**
+ * The circles of a batch, as a structure of arrays. Element i of each array belongs to circle i.
+ */
+typedef struct binocle_circle_soa {
+  const float *x;
+  const float *y;
+  const float *radius;
+} binocle_circle_soa;
+
+/**
+ * The hitboxes of a batch, as a structure of arrays. Element i of each array belongs to hitbox i.
+ */
+typedef struct binocle_hitbox_soa {
+  const float *min_x;
+  const float *min_y;
+  const float *max_x;
+  const float *max_y;
+} binocle_hitbox_soa;
+
+/**
+ * A pair of shapes to test, as indices in the arrays of a batch
+ */
+typedef struct binocle_collision_index_pair {
+  uint32_t a;
+  uint32_t b;
+} binocle_collision_index_pair;
+
+/**
+ * \brief Converts the pairs found by a broadphase to indices in an array of colliders
+ * This works when all the colliders of the broadphase come from the same array, which is also the order of the
+ * structure of arrays passed to the batch functions.
+ * @param pairs the pairs found by the broadphase
+ * @param num_pairs the number of pairs
+ * @param colliders the array the colliders belong to
+ * @param index_pairs the pairs of indices. It must have room for num_pairs elements.
+ */
+void binocle_collision_batch_get_index_pairs(const struct binocle_collider_pair *pairs, size_t num_pairs,
+                                             const struct binocle_collider *colliders,
+                                             binocle_collision_index_pair *index_pairs);
+
+/**
+ * \brief Tests many pairs of circles at once
+ * Gives the same results as binocle_collide_circle_to_circle, four pairs at a time where SSE2 or NEON are available.
+ * @param a the circles the first index of each pair refers to
+ * @param b the circles the second index of each pair refers to. It can be the same as a.
+ * @param pairs the pairs to test
+ * @param num_pairs the number of pairs
+ * @param hits the hit mask. Bit i % 32 of word i / 32 is set if pair i collides. It must have room for
+ * BINOCLE_COLLISION_BATCH_MASK_WORDS(num_pairs) words.
+ * @return the number of pairs that collide
+ */
+size_t binocle_collide_circles_to_circles_batch(binocle_circle_soa a, binocle_circle_soa b,
+                                                const binocle_collision_index_pair *pairs, size_t num_pairs,
+                                                uint32_t *hits);
+
+/**
+ * \brief Tests many pairs of hitboxes at once
+ * Gives the same results as binocle_collide_hitbox_to_hitbox, four pairs at a time where SSE2 or NEON are available.
+ * @param a the hitboxes the first index of each pair refers to
+ * @param b the hitboxes the second index of each pair refers to. It can be the same as a.
+ * @param pairs the pairs to test
+ * @param num_pairs the number of pairs
+ * @param hits the hit mask, laid out as in binocle_collide_circles_to_circles_batch
+ * @return the number of pairs that collide
+ */
+size_t binocle_collide_hitboxes_to_hitboxes_batch(binocle_hitbox_soa a, binocle_hitbox_soa b,
+                                                  const binocle_collision_index_pair *pairs, size_t num_pairs,
+                                                  uint32_t *hits);
+
+/**
+ * \brief Tests many pairs of a circle and a hitbox at once
+ * A pair collides when the point of the hitbox closest to the center of the circle is inside the circle. Unlike
+ * binocle_collide_circle_to_hitbox, this also reports a circle that is entirely inside the hitbox.
+ * @param circles the circles the first index of each pair refers to
+ * @param hitboxes the hitboxes the second index of each pair refers to
+ * @param pairs the pairs to test
+ * @param num_pairs the number of pairs
+ * @param hits the hit mask, laid out as in binocle_collide_circles_to_circles_batch
+ * @return the number of pairs that collide
+ */
+size_t binocle_collide_circles_to_hitboxes_batch(binocle_circle_soa circles, binocle_hitbox_soa hitboxes,
+                                                 const binocle_collision_index_pair *pairs, size_t num_pairs,
+                                                 uint32_t *hits);
+
+/**
+ * \brief Gets the pairs of a batch that collide
+ * @param hits the hit mask filled by one of the batch functions
+ * @param pairs the pairs that have been tested
+ * @param num_pairs the number of pairs
+ * @param contacts the pairs that collide, in the same order. It must have room for as many elements as the count
+ * returned by the batch function.
+ * @return the number of pairs written to contacts
+ */
+size_t binocle_collision_batch_get_contacts(const uint32_t *hits, const binocle_collision_index_pair *pairs,
+                                            size_t num_pairs, binocle_collision_index_pair *contacts);
+
+#endif //BINOCLE_COLLISION_BATCH_H
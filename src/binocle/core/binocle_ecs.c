@@ -9,11 +9,112 @@
 #include <limits.h>
 #include <string.h>
 #include "binocle_sdl.h"
+#include "binocle_profiler.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
-#define BINOCLE_FOREACH_SPARSEINTSET(I, N, S) for(N = 0, I = (S)->dense ? (S)->dense[N] : 0; N < (S)->size; N++, I = (S)->dense[N])
-#define BINOCLE_FOREACH_DENSEINTSET(I, D) for(I = 0; I < (D)->capacity; I++) if(binocle_bits_is_set((D)->bytes, I))
+#define BINOCLE_FOREACH_SPARSEINTSET(I, N, S) for(N = 0; N < (S)->size && ((I = (S)->dense[N]), 1); N++)
+#define BINOCLE_FOREACH_DENSEINTSET(I, D) for(I = binocle_dense_integer_set_next(D, 0); I != UINT64_MAX; I = binocle_dense_integer_set_next(D, I + 1))
 #define BINOCLE_FOREACH_ARRAY(T, N, A, S) for(N = 0, T = A; N < S; N++, T++)
 
+typedef enum binocle_ecs_command_type_t {
+  BINOCLE_ECS_COMMAND_CREATE,
+  BINOCLE_ECS_COMMAND_SET,
+  BINOCLE_ECS_COMMAND_REMOVE,
+  BINOCLE_ECS_COMMAND_SIGNAL,
+  BINOCLE_ECS_COMMAND_CHANGED
+} binocle_ecs_command_type_t;
+
+/*
+ * A structural change recorded while the systems run in parallel. The component data, if any, follows the command
+ * and is padded to 8 bytes.
+ */
+typedef struct binocle_ecs_command_t {
+  binocle_ecs_command_type_t type;
+  binocle_entity_id_t entity;
+  uint64_t arg;
+  uint64_t size;
+} binocle_ecs_command_t;
+
+typedef struct binocle_ecs_command_buffer_t {
+  unsigned char *data;
+  uint64_t size;
+  uint64_t capacity;
+} binocle_ecs_command_buffer_t;
+
+typedef struct binocle_ecs_job_t {
+  uint64_t system;
+  uint64_t begin;
+  uint64_t end;
+  binocle_ecs_command_buffer_t commands;
+} binocle_ecs_job_t;
+
+typedef struct binocle_ecs_job_chunk_t {
+  uint64_t first_entity;
+  uint64_t count;
+  uint64_t first_column;
+} binocle_ecs_job_chunk_t;
+
+typedef struct binocle_ecs_system_schedule_t {
+  uint64_t level;
+
+  // The entities (or chunks of entities) to process during the current frame
+  binocle_entity_id_t *entities;
+  uint64_t num_entities;
+  uint64_t entities_capacity;
+  binocle_ecs_job_chunk_t *chunks;
+  uint64_t num_chunks;
+  uint64_t chunks_capacity;
+  void **columns;
+  uint64_t num_columns;
+  uint64_t columns_capacity;
+  size_t *strides;
+  uint64_t strides_capacity;
+} binocle_ecs_system_schedule_t;
+
+typedef struct binocle_ecs_scheduler_t {
+  binocle_ecs_t *ecs;
+
+  // Worker pool
+  uint64_t num_workers;
+  SDL_Thread **workers;
+  SDL_Mutex *mutex;
+  SDL_Condition *work_ready;
+  SDL_Condition *work_done;
+  uint64_t generation;
+  uint64_t busy_workers;
+  bool level_open;
+  bool quit;
+
+  // True while the jobs of a level are running and structural changes must be recorded
+  bool deferring;
+  float delta;
+
+  binocle_ecs_system_schedule_t *systems;
+  uint64_t num_levels;
+
+  binocle_ecs_job_t *jobs;
+  uint64_t num_jobs;
+  uint64_t jobs_capacity;
+  SDL_AtomicInt next_job;
+
+  // Commands recorded by threads that are not running a job
+  binocle_ecs_command_buffer_t orphan_commands;
+} binocle_ecs_scheduler_t;
+
+// The command buffer of the job running on the current thread
+static SDL_TLSID binocle_ecs_tls_commands;
+
+static bool binocle_ecs_allocate_entity(binocle_ecs_t *ecs, binocle_entity_id_t entity);
+static bool binocle_ecs_is_deferring(binocle_ecs_t *ecs);
+static bool binocle_ecs_record_command(binocle_ecs_t *ecs, binocle_ecs_command_type_t type, binocle_entity_id_t entity,
+                                       uint64_t arg, const void *data, uint64_t size);
+static void binocle_ecs_apply_commands(binocle_ecs_t *ecs, binocle_ecs_command_buffer_t *buffer);
+static bool binocle_ecs_scheduler_create(binocle_ecs_t *ecs);
+static bool binocle_ecs_scheduler_run(binocle_ecs_t *ecs, float delta);
+static void binocle_ecs_scheduler_destroy(binocle_ecs_t *ecs);
+
 bool binocle_sparse_integer_set_insert(binocle_sparse_integer_set_t *set, uint64_t i) {
   if (i >= set->capacity) {
     uint64_t new_capacity = (uint64_t) ((i + 1) * 1.5f);
@@ -59,17 +160,17 @@ bool binocle_sparse_integer_set_remove(binocle_sparse_integer_set_t *set, uint64
   }
   uint64_t a = set->sparse[i];
   uint64_t n = set->size - 1;
-  if (a <= n || set->dense[a] == i) {
+  if (a <= n && set->dense[a] == i) {
     uint64_t e = set->dense[n];
     set->size = n;
-    set->dense[n] = e;
+    set->dense[a] = e;
     set->sparse[e] = a;
   }
   return true;
 }
 
 bool binocle_sparse_integer_set_contains(binocle_sparse_integer_set_t *set, uint64_t i) {
-  if (i >= set->size) {
+  if (i >= set->capacity) {
     return false;
   }
   uint64_t a = set->sparse[i];
@@ -116,52 +217,358 @@ int binocle_bits_clear(unsigned char *bytes, unsigned int bit) {
 }
 
 
+static uint64_t binocle_ecs_count_trailing_zeros(uint64_t word) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+  unsigned long index;
+  _BitScanForward64(&index, word);
+  return index;
+#elif defined(__GNUC__) || defined(__clang__)
+  return (uint64_t) __builtin_ctzll(word);
+#else
+  uint64_t index = 0;
+  while (!(word & 1)) {
+    word >>= 1;
+    index++;
+  }
+  return index;
+#endif
+}
+
 bool binocle_dense_integer_set_contains(binocle_dense_integer_set_t *is, uint64_t i) {
-  return i < is->capacity && binocle_bits_is_set(is->bytes, i);
+  return i < is->capacity && (is->words[i >> 6] & ((uint64_t) 1 << (i & 63)));
 }
 
 uint64_t binocle_dense_integer_set_insert(binocle_dense_integer_set_t *is, uint64_t i) {
   if (i >= is->capacity) {
-    uint64_t new_capacity = (uint64_t) ((i + 1) * 1.5f);
-    uint64_t old_size = (is->capacity + 7) >> 3;
-    uint64_t new_size = (new_capacity + 7) >> 3;
-    if (is->bytes == NULL) {
-      is->bytes = malloc(new_size);
-    } else {
-      is->bytes = realloc(is->bytes, new_size);
+    uint64_t new_capacity = (((uint64_t) ((i + 1) * 1.5f)) + 63) & ~(uint64_t) 63;
+    uint64_t old_size = (is->capacity + 63) >> 6;
+    uint64_t new_size = new_capacity >> 6;
+    uint64_t *new_words = realloc(is->words, new_size * sizeof(uint64_t));
+    if (new_words == NULL) {
+      return 0;
     }
-    memset((unsigned char *)(is->bytes) + old_size, 0, new_size - old_size);
+    memset(new_words + old_size, 0, (new_size - old_size) * sizeof(uint64_t));
+    is->words = new_words;
     is->capacity = new_capacity;
   }
-  return binocle_bits_set(is->bytes, i);
+  uint64_t mask = (uint64_t) 1 << (i & 63);
+  if (is->words[i >> 6] & mask) {
+    return 1;
+  }
+  is->words[i >> 6] |= mask;
+  is->count++;
+  is->members_dirty = true;
+  return 0;
 }
 
 uint64_t binocle_dense_integer_set_remove(binocle_dense_integer_set_t *is, uint64_t i) {
   if (i < is->capacity) {
-    return binocle_bits_clear(is->bytes, i);
+    uint64_t mask = (uint64_t) 1 << (i & 63);
+    if (is->words[i >> 6] & mask) {
+      is->words[i >> 6] &= ~mask;
+      is->count--;
+      is->members_dirty = true;
+      return 1;
+    }
   }
   return 0;
 }
 
 void binocle_dense_integer_set_clear(binocle_dense_integer_set_t *is) {
-  memset(is->bytes, 0, (is->capacity + 7) >> 3);
+  if (is->words != NULL) {
+    memset(is->words, 0, ((is->capacity + 63) >> 6) * sizeof(uint64_t));
+  }
+  is->count = 0;
+  is->members_dirty = true;
 }
 
 int binocle_dense_integer_set_is_empty(binocle_dense_integer_set_t *is) {
-  uint64_t n = (is->capacity + 7) >> 3, i = 0;
-  for (; i < n; i++) {
-    if (is->bytes[i]) {
-      return 0;
+  return is->count == 0;
+}
+
+uint64_t binocle_dense_integer_set_count(binocle_dense_integer_set_t *is) {
+  return is->count;
+}
+
+uint64_t binocle_dense_integer_set_next(binocle_dense_integer_set_t *is, uint64_t i) {
+  uint64_t num_words = (is->capacity + 63) >> 6;
+  uint64_t w = i >> 6;
+
+  if (i >= is->capacity) {
+    return UINT64_MAX;
+  }
+
+  // Mask out the bits below i in the first word, then skip empty words entirely
+  uint64_t word = is->words[w] & (~(uint64_t) 0 << (i & 63));
+  while (word == 0) {
+    if (++w >= num_words) {
+      return UINT64_MAX;
+    }
+    word = is->words[w];
+  }
+  return (w << 6) + binocle_ecs_count_trailing_zeros(word);
+}
+
+const uint64_t *binocle_dense_integer_set_members(binocle_dense_integer_set_t *is) {
+  uint64_t num_words = (is->capacity + 63) >> 6;
+  uint64_t n = 0;
+
+  if (!is->members_dirty) {
+    return is->members;
+  }
+
+  if (is->count > is->members_capacity) {
+    uint64_t new_capacity = (uint64_t) ((is->count + 1) * 1.5f);
+    uint64_t *new_members = realloc(is->members, new_capacity * sizeof(uint64_t));
+    if (new_members == NULL) {
+      return NULL;
+    }
+    is->members = new_members;
+    is->members_capacity = new_capacity;
+  }
+
+  for (uint64_t w = 0; w < num_words && n < is->count; w++) {
+    uint64_t word = is->words[w];
+    while (word != 0) {
+      is->members[n++] = (w << 6) + binocle_ecs_count_trailing_zeros(word);
+      // Clear the lowest set bit
+      word &= word - 1;
     }
   }
-  return 1;
+  is->members_dirty = false;
+  return is->members;
 }
 
 void binocle_dense_integer_set_free(binocle_dense_integer_set_t *is) {
-  free(is->bytes);
+  free(is->words);
+  free(is->members);
   memset(is, 0, sizeof(*is));
 }
 
+//
+// Archetypes
+//
+
+static size_t binocle_ecs_column_stride(binocle_component_t *c) {
+  // Tag components have no data but still need a valid address
+  return c->size > 0 ? c->size : 1;
+}
+
+static bool binocle_ecs_archetype_reserve(binocle_ecs_t *ecs, binocle_ecs_archetype_t *a, uint64_t count) {
+  if (count <= a->capacity) {
+    return true;
+  }
+  uint64_t new_capacity = (uint64_t) ((count + 1) * 1.5f);
+  binocle_entity_id_t *new_entities = realloc(a->entities, sizeof(binocle_entity_id_t) * new_capacity);
+  if (new_entities == NULL) {
+    return false;
+  }
+  a->entities = new_entities;
+  for (uint64_t i = 0; i < a->num_columns; i++) {
+    binocle_component_t *c = ecs->components + a->column_components[i];
+    void *new_column = realloc(a->columns[i], binocle_ecs_column_stride(c) * new_capacity);
+    if (new_column == NULL) {
+      return false;
+    }
+    a->columns[i] = new_column;
+  }
+  a->capacity = new_capacity;
+  return true;
+}
+
+static bool binocle_ecs_archetype_push_row(binocle_ecs_t *ecs, uint64_t archetype, binocle_entity_id_t entity) {
+  binocle_ecs_archetype_t *a = ecs->archetypes + archetype;
+  if (!binocle_ecs_archetype_reserve(ecs, a, a->count + 1)) {
+    return false;
+  }
+  uint64_t row = a->count++;
+  a->entities[row] = entity;
+  for (uint64_t i = 0; i < a->num_columns; i++) {
+    binocle_component_t *c = ecs->components + a->column_components[i];
+    size_t stride = binocle_ecs_column_stride(c);
+    memset((unsigned char *) a->columns[i] + stride * row, 0, stride);
+  }
+  ecs->locations[entity].archetype = archetype;
+  ecs->locations[entity].row = row;
+  return true;
+}
+
+static void binocle_ecs_archetype_remove_row(binocle_ecs_t *ecs, uint64_t archetype, uint64_t row) {
+  binocle_ecs_archetype_t *a = ecs->archetypes + archetype;
+  uint64_t last = a->count - 1;
+  if (row != last) {
+    // Swap the last row in place of the removed one to keep the columns packed
+    for (uint64_t i = 0; i < a->num_columns; i++) {
+      binocle_component_t *c = ecs->components + a->column_components[i];
+      size_t stride = binocle_ecs_column_stride(c);
+      memcpy((unsigned char *) a->columns[i] + stride * row, (unsigned char *) a->columns[i] + stride * last, stride);
+    }
+    binocle_entity_id_t moved = a->entities[last];
+    a->entities[row] = moved;
+    ecs->locations[moved].row = row;
+  }
+  a->count = last;
+}
+
+static void binocle_ecs_archetype_release_entity(binocle_ecs_t *ecs, binocle_entity_id_t entity) {
+  binocle_ecs_entity_location_t *loc = ecs->locations + entity;
+  if (loc->archetype == BINOCLE_ECS_INVALID_ARCHETYPE) {
+    return;
+  }
+  binocle_ecs_archetype_remove_row(ecs, loc->archetype, loc->row);
+  loc->archetype = BINOCLE_ECS_INVALID_ARCHETYPE;
+  loc->row = 0;
+}
+
+static bool binocle_ecs_archetype_ensure_locations(binocle_ecs_t *ecs, uint64_t count) {
+  if (count <= ecs->data_height_capacity) {
+    return true;
+  }
+  uint64_t new_capacity = (uint64_t) (count * 1.5f);
+  binocle_ecs_entity_location_t *new_locations = realloc(ecs->locations, sizeof(binocle_ecs_entity_location_t) * new_capacity);
+  if (new_locations == NULL) {
+    return false;
+  }
+  for (uint64_t i = ecs->data_height_capacity; i < new_capacity; i++) {
+    new_locations[i].archetype = BINOCLE_ECS_INVALID_ARCHETYPE;
+    new_locations[i].row = 0;
+  }
+  ecs->locations = new_locations;
+  ecs->data_height_capacity = new_capacity;
+  return true;
+}
+
+static void binocle_ecs_archetype_free(binocle_ecs_archetype_t *a) {
+  for (uint64_t i = 0; i < a->num_columns; i++) {
+    free(a->columns[i]);
+  }
+  free(a->columns);
+  free(a->column_components);
+  free(a->column_of);
+  free(a->entities);
+  free(a->add_edges);
+  free(a->remove_edges);
+  free(a->signature);
+  memset(a, 0, sizeof(*a));
+}
+
+uint64_t binocle_ecs_archetype_get_internal(binocle_ecs_t *ecs, const unsigned char *signature) {
+  binocle_ecs_archetype_t a;
+  uint64_t i;
+
+  for (i = 0; i < ecs->num_archetypes; i++) {
+    if (memcmp(ecs->archetypes[i].signature, signature, ecs->signature_width) == 0) {
+      return i;
+    }
+  }
+
+  memset(&a, 0, sizeof(a));
+  a.signature = malloc(ecs->signature_width > 0 ? ecs->signature_width : 1);
+  a.column_of = malloc(sizeof(uint64_t) * (ecs->num_components > 0 ? ecs->num_components : 1));
+  a.add_edges = malloc(sizeof(uint64_t) * (ecs->num_components > 0 ? ecs->num_components : 1));
+  a.remove_edges = malloc(sizeof(uint64_t) * (ecs->num_components > 0 ? ecs->num_components : 1));
+  a.column_components = malloc(sizeof(binocle_component_id_t) * (ecs->num_components > 0 ? ecs->num_components : 1));
+  a.columns = calloc(ecs->num_components > 0 ? ecs->num_components : 1, sizeof(void *));
+  if (a.signature == NULL || a.column_of == NULL || a.add_edges == NULL || a.remove_edges == NULL ||
+      a.column_components == NULL || a.columns == NULL) {
+    binocle_ecs_archetype_free(&a);
+    return BINOCLE_ECS_INVALID_ARCHETYPE;
+  }
+  memcpy(a.signature, signature, ecs->signature_width);
+  for (i = 0; i < ecs->num_components; i++) {
+    a.add_edges[i] = BINOCLE_ECS_INVALID_ARCHETYPE;
+    a.remove_edges[i] = BINOCLE_ECS_INVALID_ARCHETYPE;
+    if (binocle_bits_is_set(a.signature, i)) {
+      a.column_of[i] = a.num_columns;
+      a.column_components[a.num_columns++] = i;
+    } else {
+      a.column_of[i] = UINT64_MAX;
+    }
+  }
+
+  binocle_ecs_archetype_t *new_archetypes = realloc(ecs->archetypes, sizeof(*ecs->archetypes) * (ecs->num_archetypes + 1));
+  if (new_archetypes == NULL) {
+    binocle_ecs_archetype_free(&a);
+    return BINOCLE_ECS_INVALID_ARCHETYPE;
+  }
+  ecs->archetypes = new_archetypes;
+  ecs->archetypes[ecs->num_archetypes++] = a;
+  return ecs->num_archetypes - 1;
+}
+
+bool binocle_ecs_archetype_move_entity_internal(binocle_ecs_t *ecs, binocle_entity_id_t entity, uint64_t archetype) {
+  binocle_ecs_entity_location_t *loc = ecs->locations + entity;
+  uint64_t src_index = loc->archetype;
+  uint64_t src_row = loc->row;
+
+  if (src_index == archetype) {
+    return true;
+  }
+
+  binocle_ecs_archetype_t *dst = ecs->archetypes + archetype;
+  if (!binocle_ecs_archetype_reserve(ecs, dst, dst->count + 1)) {
+    return false;
+  }
+  binocle_ecs_archetype_t *src = ecs->archetypes + src_index;
+  uint64_t row = dst->count++;
+  dst->entities[row] = entity;
+  for (uint64_t i = 0; i < dst->num_columns; i++) {
+    binocle_component_id_t component = dst->column_components[i];
+    size_t stride = binocle_ecs_column_stride(ecs->components + component);
+    unsigned char *to = (unsigned char *) dst->columns[i] + stride * row;
+    uint64_t src_column = src->column_of[component];
+    if (src_column != UINT64_MAX) {
+      memcpy(to, (unsigned char *) src->columns[src_column] + stride * src_row, stride);
+    } else {
+      memset(to, 0, stride);
+    }
+  }
+
+  binocle_ecs_archetype_remove_row(ecs, src_index, src_row);
+  loc->archetype = archetype;
+  loc->row = row;
+  return true;
+}
+
+static uint64_t binocle_ecs_archetype_neighbour(binocle_ecs_t *ecs, uint64_t archetype, binocle_component_id_t component, bool add) {
+  binocle_ecs_archetype_t *a = ecs->archetypes + archetype;
+  uint64_t target = add ? a->add_edges[component] : a->remove_edges[component];
+  if (target != BINOCLE_ECS_INVALID_ARCHETYPE) {
+    return target;
+  }
+
+  unsigned char *signature = malloc(ecs->signature_width > 0 ? ecs->signature_width : 1);
+  if (signature == NULL) {
+    return BINOCLE_ECS_INVALID_ARCHETYPE;
+  }
+  memcpy(signature, a->signature, ecs->signature_width);
+  if (add) {
+    binocle_bits_set(signature, component);
+  } else {
+    binocle_bits_clear(signature, component);
+  }
+  target = binocle_ecs_archetype_get_internal(ecs, signature);
+  free(signature);
+  if (target == BINOCLE_ECS_INVALID_ARCHETYPE) {
+    return target;
+  }
+
+  // The archetypes array might have been reallocated
+  a = ecs->archetypes + archetype;
+  if (add) {
+    a->add_edges[component] = target;
+    ecs->archetypes[target].remove_edges[component] = archetype;
+  } else {
+    a->remove_edges[component] = target;
+    ecs->archetypes[target].add_edges[component] = archetype;
+  }
+  return target;
+}
+
+//
+// ECS
+//
+
 binocle_ecs_t binocle_ecs_new() {
   binocle_ecs_t res = {0};
   return res;
@@ -171,20 +578,43 @@ bool binocle_ecs_free(binocle_ecs_t *ecs) {
   uint64_t i;
   uint64_t j;
   binocle_component_t *component;
+  binocle_system_t *system;
 
   bool res = binocle_ecs_fix_data(ecs);
   if (!res) {
     return false;
   }
 
-  for (i = 0; i < ecs->next_entity_id; i++) {
-    for (j = 0; j < ecs->num_components; j++) {
-      binocle_ecs_remove_components(ecs, i, j);
+  binocle_ecs_scheduler_destroy(ecs);
+
+  if (ecs->deferred_commands != NULL) {
+    free(ecs->deferred_commands->data);
+    free(ecs->deferred_commands);
+    ecs->deferred_commands = NULL;
+  }
+
+  if (ecs->storage == BINOCLE_ECS_STORAGE_ARCHETYPES) {
+    for (i = 0; i < ecs->num_archetypes; i++) {
+      binocle_ecs_archetype_free(ecs->archetypes + i);
+    }
+    free(ecs->archetypes);
+    free(ecs->locations);
+    ecs->archetypes = NULL;
+    ecs->locations = NULL;
+    ecs->num_archetypes = 0;
+  } else {
+    for (i = 0; i < ecs->next_entity_id; i++) {
+      for (j = 0; j < ecs->num_components; j++) {
+        binocle_ecs_remove_components(ecs, i, j);
+      }
     }
   }
 
   free(ecs->data);
   binocle_sparse_integer_set_free(&ecs->free_entity_ids);
+  free(ecs->generations);
+  ecs->generations = NULL;
+  ecs->generations_capacity = 0;
   binocle_sparse_integer_set_free(&ecs->added);
   binocle_sparse_integer_set_free(&ecs->enabled);
   binocle_sparse_integer_set_free(&ecs->disabled);
@@ -196,17 +626,29 @@ bool binocle_ecs_free(binocle_ecs_t *ecs) {
   }
   free(ecs->components);
 
-  /*
-  BINOCLE_FOREACH_ARRAY(system, i, diana->systems, diana->num_systems) {
-    _system_free(diana, system);
+  BINOCLE_FOREACH_ARRAY(system, i, ecs->systems, ecs->num_systems) {
+    binocle_ecs_system_free(ecs, system);
+  }
+  free(ecs->systems);
+
+  return true;
+}
+
+bool binocle_ecs_set_storage(binocle_ecs_t *ecs, binocle_ecs_storage_t storage) {
+  if (ecs->initialized) {
+    return false;
   }
-  _free(diana, diana->systems);
 
-  BINOCLE_FOREACH_ARRAY(manager, i, diana->managers, diana->num_managers) {
-    _manager_free(diana, manager);
+  ecs->storage = storage;
+  return true;
+}
+
+bool binocle_ecs_set_num_threads(binocle_ecs_t *ecs, uint64_t num_threads) {
+  if (ecs->initialized) {
+    return false;
   }
-  _free(diana, diana->managers);
-*/
+
+  ecs->num_threads = num_threads;
   return true;
 }
 
@@ -214,6 +656,7 @@ bool binocle_ecs_initialize(binocle_ecs_t *ecs) {
   uint64_t extra_bytes = (ecs->num_components + 7) >> 3;
   uint64_t n;
   binocle_component_t *c;
+  binocle_system_t *s;
 
   if (ecs->initialized) {
     return false;
@@ -223,7 +666,37 @@ bool binocle_ecs_initialize(binocle_ecs_t *ecs) {
     c->offset += extra_bytes;
   }
 
+  BINOCLE_FOREACH_ARRAY(s, n, ecs->systems, ecs->num_systems) {
+    if (s->process_chunk == NULL) {
+      continue;
+    }
+    s->chunk_entities = malloc(sizeof(binocle_entity_id_t) * BINOCLE_ECS_CHUNK_CAPACITY);
+    s->chunk_columns = malloc(sizeof(void *) * (s->watch.size > 0 ? s->watch.size : 1));
+    s->chunk_strides = malloc(sizeof(size_t) * (s->watch.size > 0 ? s->watch.size : 1));
+    if (s->chunk_entities == NULL || s->chunk_columns == NULL || s->chunk_strides == NULL) {
+      return false;
+    }
+  }
+
   ecs->data_width += extra_bytes;
+  ecs->signature_width = extra_bytes;
+
+  if (ecs->storage == BINOCLE_ECS_STORAGE_ARCHETYPES) {
+    // The empty archetype always comes first and hosts the entities without components
+    unsigned char *empty = calloc(extra_bytes > 0 ? extra_bytes : 1, 1);
+    if (empty == NULL) {
+      return false;
+    }
+    uint64_t archetype = binocle_ecs_archetype_get_internal(ecs, empty);
+    free(empty);
+    if (archetype == BINOCLE_ECS_INVALID_ARCHETYPE) {
+      return false;
+    }
+  }
+
+  if (ecs->num_threads > 1 && !binocle_ecs_scheduler_create(ecs)) {
+    return false;
+  }
 
   ecs->initialized = true;
 
@@ -290,39 +763,83 @@ bool binocle_ecs_remove_components(binocle_ecs_t *ecs, binocle_entity_id_t entit
     return false;
   }
 
-  if ((!ecs->processing && entity >= ecs->data_height) ||
-      (ecs->processing && entity >= ecs->data_height_capacity + ecs->processing_data_height)) {
+  if (component >= ecs->num_components) {
     return false;
   }
 
-  if (component >= ecs->num_components) {
+  if (binocle_ecs_is_deferring(ecs)) {
+    return binocle_ecs_record_command(ecs, BINOCLE_ECS_COMMAND_REMOVE, entity, component, NULL, 0);
+  }
+
+  if ((!ecs->processing && entity >= ecs->data_height) ||
+      (ecs->processing && entity >= ecs->data_height_capacity + ecs->processing_data_height)) {
     return false;
   }
 
   entity_data = binocle_ecs_get_entity_data(ecs, entity);
   c = ecs->components + component;
 
+  if (c->flags & BINOCLE_COMPONENT_TRACK_CHANGES_BIT) {
+    binocle_dense_integer_set_remove(&c->changed, entity);
+  }
+
   return binocle_ecs_remove_component_i_internal(ecs, entity, component, 0);
 }
 
 
 bool binocle_ecs_create_entity(binocle_ecs_t *ecs, binocle_entity_id_t *entity_ptr) {
   binocle_entity_id_t r;
+  bool deferring;
+  bool parallel;
+
   if (!ecs->initialized) {
     return false;
   }
 
+  deferring = binocle_ecs_is_deferring(ecs);
+  parallel = ecs->scheduler != NULL && ecs->scheduler->deferring;
+  if (parallel) {
+    SDL_LockMutex(ecs->scheduler->mutex);
+  }
   if (binocle_sparse_integer_set_is_empty(&ecs->free_entity_ids)) {
     r = ecs->next_entity_id++;
   } else {
     r = binocle_sparse_integer_set_pop(&ecs->free_entity_ids);
   }
+  if (parallel) {
+    SDL_UnlockMutex(ecs->scheduler->mutex);
+  }
+  if (deferring) {
+    // The ID is reserved right away, the storage is allocated at the next sync point
+    if (!binocle_ecs_record_command(ecs, BINOCLE_ECS_COMMAND_CREATE, r, 0, NULL, 0)) {
+      return false;
+    }
+    *entity_ptr = r;
+    return true;
+  }
+
+  if (!binocle_ecs_allocate_entity(ecs, r)) {
+    return false;
+  }
+
+  *entity_ptr = r;
+  return true;
+}
 
+static bool binocle_ecs_allocate_entity(binocle_ecs_t *ecs, binocle_entity_id_t r) {
   ecs->data_height = ecs->data_height > (r + 1) ? ecs->data_height : (r + 1);
 
-  if (ecs->data_height > ecs->data_height_capacity) {
+  if (ecs->storage == BINOCLE_ECS_STORAGE_ARCHETYPES) {
+    // Archetype columns carry no pointer stability guarantees, so there is no need for a processing buffer
+    if (!binocle_ecs_archetype_ensure_locations(ecs, ecs->data_height)) {
+      return false;
+    }
+    if (!binocle_ecs_archetype_push_row(ecs, 0, r)) {
+      return false;
+    }
+  } else if (ecs->data_height > ecs->data_height_capacity) {
     if (ecs->processing) {
-      void *entity_data = malloc(ecs->data_width);
+      void *entity_data = calloc(1, ecs->data_width);
       if (entity_data == NULL) {
         return false;
       }
@@ -346,11 +863,67 @@ bool binocle_ecs_create_entity(binocle_ecs_t *ecs, binocle_entity_id_t *entity_p
     }
   }
 
-  *entity_ptr = r;
+  return true;
+}
+
+static uint32_t binocle_ecs_entity_generation(binocle_ecs_t *ecs, binocle_entity_id_t entity) {
+  // Generations are stored minus one so that IDs that have never been released need no storage
+  return (entity < ecs->generations_capacity ? ecs->generations[entity] : 0) + 1;
+}
+
+static bool binocle_ecs_release_entity_id(binocle_ecs_t *ecs, binocle_entity_id_t entity) {
+  if (entity >= ecs->generations_capacity) {
+    uint64_t new_capacity = (uint64_t) ((entity + 1) * 1.5f);
+    uint32_t *new_generations = realloc(ecs->generations, sizeof(uint32_t) * new_capacity);
+    if (new_generations == NULL) {
+      return false;
+    }
+    memset(new_generations + ecs->generations_capacity, 0,
+           sizeof(uint32_t) * (new_capacity - ecs->generations_capacity));
+    ecs->generations = new_generations;
+    ecs->generations_capacity = new_capacity;
+  }
+  // A recycled ID must not inherit the changes of the previous entity
+  for (uint64_t i = 0; i < ecs->num_components; i++) {
+    binocle_dense_integer_set_remove(&ecs->components[i].changed, entity);
+  }
+
+  // Invalidates all the handles to this entity
+  ecs->generations[entity]++;
+  return binocle_sparse_integer_set_insert(&ecs->free_entity_ids, entity);
+}
+
+binocle_entity_handle_t binocle_ecs_get_entity_handle(binocle_ecs_t *ecs, binocle_entity_id_t entity) {
+  if (entity >= ecs->next_entity_id || entity > BINOCLE_ENTITY_HANDLE_INDEX_MASK ||
+      binocle_sparse_integer_set_contains(&ecs->free_entity_ids, entity)) {
+    return BINOCLE_INVALID_ENTITY_HANDLE;
+  }
+  return ((uint64_t) binocle_ecs_entity_generation(ecs, entity) << BINOCLE_ENTITY_HANDLE_GENERATION_SHIFT) | entity;
+}
+
+bool binocle_ecs_is_entity_handle_valid(binocle_ecs_t *ecs, binocle_entity_handle_t handle) {
+  binocle_entity_id_t entity = handle & BINOCLE_ENTITY_HANDLE_INDEX_MASK;
+  uint32_t generation = (uint32_t) (handle >> BINOCLE_ENTITY_HANDLE_GENERATION_SHIFT);
+  return entity < ecs->next_entity_id && generation == binocle_ecs_entity_generation(ecs, entity);
+}
+
+bool binocle_ecs_get_entity_from_handle(binocle_ecs_t *ecs, binocle_entity_handle_t handle, binocle_entity_id_t *entity_ptr) {
+  if (!binocle_ecs_is_entity_handle_valid(ecs, handle)) {
+    return false;
+  }
+  *entity_ptr = handle & BINOCLE_ENTITY_HANDLE_INDEX_MASK;
   return true;
 }
 
 unsigned char *binocle_ecs_get_entity_data(binocle_ecs_t *ecs, binocle_entity_id_t entity) {
+  if (ecs->storage == BINOCLE_ECS_STORAGE_ARCHETYPES) {
+    // The component bits are shared by all the entities of an archetype
+    uint64_t archetype = ecs->locations[entity].archetype;
+    if (archetype == BINOCLE_ECS_INVALID_ARCHETYPE) {
+      archetype = 0;
+    }
+    return ecs->archetypes[archetype].signature;
+  }
   if (entity >= ecs->data_height_capacity) {
     return ecs->processing_data[entity - ecs->data_height_capacity];
   }
@@ -359,6 +932,18 @@ unsigned char *binocle_ecs_get_entity_data(binocle_ecs_t *ecs, binocle_entity_id
 
 bool binocle_ecs_remove_component_i_internal(binocle_ecs_t *ecs, binocle_entity_id_t entity,
                                              binocle_component_id_t component, uint64_t i) {
+  if (ecs->storage == BINOCLE_ECS_STORAGE_ARCHETYPES) {
+    uint64_t archetype = ecs->locations[entity].archetype;
+    if (archetype == BINOCLE_ECS_INVALID_ARCHETYPE || ecs->archetypes[archetype].column_of[component] == UINT64_MAX) {
+      return true;
+    }
+    uint64_t target = binocle_ecs_archetype_neighbour(ecs, archetype, component, false);
+    if (target == BINOCLE_ECS_INVALID_ARCHETYPE) {
+      return false;
+    }
+    return binocle_ecs_archetype_move_entity_internal(ecs, entity, target);
+  }
+
   unsigned char *entity_data = binocle_ecs_get_entity_data(ecs, entity);
   binocle_component_t *c = ecs->components + component;
 
@@ -377,6 +962,7 @@ void binocle_ecs_component_free(binocle_ecs_t *ecs, binocle_component_t *compone
   }
   free(component->data);
   binocle_sparse_integer_set_free(&component->free_data_indexes);
+  binocle_dense_integer_set_free(&component->changed);
   memset(component, 0, sizeof(*component));
 }
 
@@ -386,21 +972,61 @@ bool binocle_ecs_set_component(binocle_ecs_t *ecs, binocle_entity_id_t entity, b
     return false;
   }
 
+  if (component >= ecs->num_components) {
+    return false;
+  }
+
+  if (binocle_ecs_is_deferring(ecs)) {
+    // Overwriting an existing component does not change the layout and can be done right away
+    void *component_data;
+    if (entity < ecs->data_height && binocle_ecs_get_component_internal(ecs, entity, component, 0, &component_data)) {
+      if (data != NULL) {
+        memcpy(component_data, data, ecs->components[component].size);
+      }
+      return binocle_ecs_mark_changed(ecs, entity, component);
+    }
+    return binocle_ecs_record_command(ecs, BINOCLE_ECS_COMMAND_SET, entity, component, data,
+                                      ecs->components[component].size);
+  }
+
   if ((!ecs->processing && entity >= ecs->data_height) ||
       (ecs->processing && entity >= ecs->data_height_capacity + ecs->processing_data_height)) {
     return false;
   }
 
-  if (component >= ecs->num_components) {
+  if (!binocle_ecs_set_component_i_internal(ecs, entity, component, 0, data)) {
     return false;
   }
 
-  return binocle_ecs_set_component_i_internal(ecs, entity, component, 0, data);
+  return binocle_ecs_mark_changed(ecs, entity, component);
 }
 
 bool
 binocle_ecs_set_component_i_internal(binocle_ecs_t *ecs, binocle_entity_id_t entity, binocle_component_id_t component,
                                      uint64_t i, const void *data) {
+  if (ecs->storage == BINOCLE_ECS_STORAGE_ARCHETYPES) {
+    uint64_t archetype = ecs->locations[entity].archetype;
+    if (archetype == BINOCLE_ECS_INVALID_ARCHETYPE) {
+      return false;
+    }
+    if (ecs->archetypes[archetype].column_of[component] == UINT64_MAX) {
+      archetype = binocle_ecs_archetype_neighbour(ecs, archetype, component, true);
+      if (archetype == BINOCLE_ECS_INVALID_ARCHETYPE) {
+        return false;
+      }
+      if (!binocle_ecs_archetype_move_entity_internal(ecs, entity, archetype)) {
+        return false;
+      }
+    }
+    binocle_ecs_archetype_t *a = ecs->archetypes + archetype;
+    binocle_component_t *c = ecs->components + component;
+    if (data != NULL) {
+      memcpy((unsigned char *) a->columns[a->column_of[component]] + binocle_ecs_column_stride(c) * ecs->locations[entity].row,
+             data, c->size);
+    }
+    return true;
+  }
+
   unsigned char *entity_data = binocle_ecs_get_entity_data(ecs, entity);
   binocle_component_t *c = ecs->components + component;
   int defined = binocle_bits_set(entity_data, component);
@@ -433,49 +1059,127 @@ bool binocle_ecs_get_component(binocle_ecs_t *ecs, binocle_entity_id_t entity, b
   return binocle_ecs_get_component_internal(ecs, entity, component, 0, ptr);
 }
 
-bool
-binocle_ecs_get_component_internal(binocle_ecs_t *ecs, binocle_entity_id_t entity, binocle_component_id_t component,
-                                   uint64_t i, void **ptr) {
-  unsigned char *entity_data = binocle_ecs_get_entity_data(ecs, entity);
-  binocle_component_t *c = ecs->components + component;
-  void *component_data = NULL;
-
-  if (!binocle_bits_is_set(entity_data, component)) {
+bool binocle_ecs_get_component_mut(binocle_ecs_t *ecs, binocle_entity_id_t entity, binocle_component_id_t component,
+                                   void **ptr) {
+  if (!binocle_ecs_get_component(ecs, entity, component, ptr)) {
     return false;
   }
 
-  component_data = (void *) (entity_data + c->offset);
-
-  *ptr = component_data;
-
-  return true;
+  return binocle_ecs_mark_changed(ecs, entity, component);
 }
 
-//
-// Systems
-//
-
-bool binocle_ecs_create_system(binocle_ecs_t *ecs, const char *name,
-                               void (*starting)(struct binocle_ecs_t *, void *),
-                               void (*process)(struct binocle_ecs_t *, void *, binocle_entity_id_t, float),
-                               void (*ending)(struct binocle_ecs_t *, void *),
-                               void (*subscribed)(struct binocle_ecs_t *, void *, binocle_entity_id_t),
-                               void (*unsubscribed)(struct binocle_ecs_t *, void *, binocle_entity_id_t),
-                               void *user_data,
-                               uint64_t flags,
-                               uint64_t *system_ptr
-) {
-  binocle_system_t s;
-
+bool binocle_ecs_track_changes(binocle_ecs_t *ecs, binocle_component_id_t component) {
   if (ecs->initialized) {
     return false;
   }
 
-  memset(&s, 0, sizeof(s));
-  s.name = SDL_strdup(name);
-  s.starting = starting;
-  s.process = process;
-  s.ending = ending;
+  if (component >= ecs->num_components) {
+    return false;
+  }
+
+  ecs->components[component].flags |= BINOCLE_COMPONENT_TRACK_CHANGES_BIT;
+  return true;
+}
+
+bool binocle_ecs_mark_changed(binocle_ecs_t *ecs, binocle_entity_id_t entity, binocle_component_id_t component) {
+  binocle_component_t *c;
+
+  if (component >= ecs->num_components) {
+    return false;
+  }
+
+  c = ecs->components + component;
+  if (!(c->flags & BINOCLE_COMPONENT_TRACK_CHANGES_BIT)) {
+    return true;
+  }
+
+  // The changed set is shared by all the threads, so marks are applied at the sync point
+  if (binocle_ecs_is_deferring(ecs)) {
+    return binocle_ecs_record_command(ecs, BINOCLE_ECS_COMMAND_CHANGED, entity, component, NULL, 0);
+  }
+
+  binocle_dense_integer_set_insert(&c->changed, entity);
+  return true;
+}
+
+uint64_t binocle_ecs_get_changed(binocle_ecs_t *ecs, binocle_component_id_t component, const binocle_entity_id_t **entities) {
+  binocle_component_t *c;
+
+  *entities = NULL;
+  if (component >= ecs->num_components) {
+    return 0;
+  }
+
+  c = ecs->components + component;
+  *entities = binocle_dense_integer_set_members(&c->changed);
+  return *entities != NULL ? binocle_dense_integer_set_count(&c->changed) : 0;
+}
+
+void binocle_ecs_clear_changed(binocle_ecs_t *ecs, binocle_component_id_t component) {
+  if (component >= ecs->num_components) {
+    return;
+  }
+
+  binocle_dense_integer_set_clear(&ecs->components[component].changed);
+}
+
+bool
+binocle_ecs_get_component_internal(binocle_ecs_t *ecs, binocle_entity_id_t entity, binocle_component_id_t component,
+                                   uint64_t i, void **ptr) {
+  if (ecs->storage == BINOCLE_ECS_STORAGE_ARCHETYPES) {
+    binocle_ecs_entity_location_t *loc = ecs->locations + entity;
+    if (loc->archetype == BINOCLE_ECS_INVALID_ARCHETYPE) {
+      return false;
+    }
+    binocle_ecs_archetype_t *a = ecs->archetypes + loc->archetype;
+    uint64_t column = a->column_of[component];
+    if (column == UINT64_MAX) {
+      return false;
+    }
+    *ptr = (unsigned char *) a->columns[column] + binocle_ecs_column_stride(ecs->components + component) * loc->row;
+    return true;
+  }
+
+  unsigned char *entity_data = binocle_ecs_get_entity_data(ecs, entity);
+  binocle_component_t *c = ecs->components + component;
+  void *component_data = NULL;
+
+  if (!binocle_bits_is_set(entity_data, component)) {
+    return false;
+  }
+
+  component_data = (void *) (entity_data + c->offset);
+
+  *ptr = component_data;
+
+  return true;
+}
+
+//
+// Systems
+//
+
+bool binocle_ecs_create_system(binocle_ecs_t *ecs, const char *name,
+                               void (*starting)(struct binocle_ecs_t *, void *),
+                               void (*process)(struct binocle_ecs_t *, void *, binocle_entity_id_t, float),
+                               void (*ending)(struct binocle_ecs_t *, void *),
+                               void (*subscribed)(struct binocle_ecs_t *, void *, binocle_entity_id_t),
+                               void (*unsubscribed)(struct binocle_ecs_t *, void *, binocle_entity_id_t),
+                               void *user_data,
+                               uint64_t flags,
+                               uint64_t *system_ptr
+) {
+  binocle_system_t s;
+
+  if (ecs->initialized) {
+    return false;
+  }
+
+  memset(&s, 0, sizeof(s));
+  s.name = SDL_strdup(name);
+  s.starting = starting;
+  s.process = process;
+  s.ending = ending;
   s.subscribed = subscribed;
   s.unsubscribed = unsubscribed;
   s.user_data = user_data;
@@ -494,6 +1198,37 @@ bool binocle_ecs_create_system(binocle_ecs_t *ecs, const char *name,
   return true;
 }
 
+bool binocle_ecs_create_chunk_system(binocle_ecs_t *ecs, const char *name,
+                                     void (*starting)(struct binocle_ecs_t *, void *),
+                                     void (*process_chunk)(struct binocle_ecs_t *, void *, binocle_ecs_chunk_t *, float),
+                                     void (*ending)(struct binocle_ecs_t *, void *),
+                                     void (*subscribed)(struct binocle_ecs_t *, void *, binocle_entity_id_t),
+                                     void (*unsubscribed)(struct binocle_ecs_t *, void *, binocle_entity_id_t),
+                                     void *user_data,
+                                     uint64_t flags,
+                                     uint64_t *system_ptr
+) {
+  if (!binocle_ecs_create_system(ecs, name, starting, NULL, ending, subscribed, unsubscribed, user_data, flags,
+                                 system_ptr)) {
+    return false;
+  }
+  ecs->systems[*system_ptr].process_chunk = process_chunk;
+  return true;
+}
+
+void binocle_ecs_system_free(binocle_ecs_t *ecs, binocle_system_t *system) {
+  free((void *) system->name);
+  binocle_sparse_integer_set_free(&system->watch);
+  binocle_sparse_integer_set_free(&system->exclude);
+  binocle_sparse_integer_set_free(&system->reads);
+  binocle_sparse_integer_set_free(&system->writes);
+  binocle_dense_integer_set_free(&system->entities);
+  free(system->chunk_entities);
+  free(system->chunk_columns);
+  free(system->chunk_strides);
+  memset(system, 0, sizeof(*system));
+}
+
 bool binocle_ecs_watch(binocle_ecs_t *ecs, binocle_system_id_t system, binocle_component_id_t component) {
   if (ecs->initialized) {
     return false;
@@ -530,6 +1265,38 @@ bool binocle_ecs_exclude(binocle_ecs_t *ecs, binocle_system_id_t system, binocle
   return true;
 }
 
+bool binocle_ecs_read(binocle_ecs_t *ecs, binocle_system_id_t system, binocle_component_id_t component) {
+  if (ecs->initialized) {
+    return false;
+  }
+
+  if (system >= ecs->num_systems) {
+    return false;
+  }
+
+  if (component >= ecs->num_components) {
+    return false;
+  }
+
+  return binocle_sparse_integer_set_insert(&ecs->systems[system].reads, component);
+}
+
+bool binocle_ecs_write(binocle_ecs_t *ecs, binocle_system_id_t system, binocle_component_id_t component) {
+  if (ecs->initialized) {
+    return false;
+  }
+
+  if (system >= ecs->num_systems) {
+    return false;
+  }
+
+  if (component >= ecs->num_components) {
+    return false;
+  }
+
+  return binocle_sparse_integer_set_insert(&ecs->systems[system].writes, component);
+}
+
 bool binocle_ecs_signal(binocle_ecs_t *ecs, binocle_entity_id_t entity, binocle_entity_signal_t signal) {
   bool res = true;
 
@@ -537,6 +1304,10 @@ bool binocle_ecs_signal(binocle_ecs_t *ecs, binocle_entity_id_t entity, binocle_
     return false;
   }
 
+  if (binocle_ecs_is_deferring(ecs)) {
+    return binocle_ecs_record_command(ecs, BINOCLE_ECS_COMMAND_SIGNAL, entity, signal, NULL, 0);
+  }
+
   if ((!ecs->processing && entity >= ecs->data_height) ||
       (ecs->processing && entity >= ecs->data_height_capacity + ecs->processing_data_height)) {
     return false;
@@ -572,6 +1343,585 @@ bool binocle_ecs_signal(binocle_ecs_t *ecs, binocle_entity_id_t entity, binocle_
   return res;
 }
 
+static bool binocle_ecs_system_matches(binocle_system_t *system, const unsigned char *signature) {
+  uint64_t component, i;
+
+  BINOCLE_FOREACH_SPARSEINTSET(component, i, &system->watch) {
+    if (!binocle_bits_is_set((unsigned char *) signature, component)) {
+      return false;
+    }
+  }
+
+  BINOCLE_FOREACH_SPARSEINTSET(component, i, &system->exclude) {
+    if (binocle_bits_is_set((unsigned char *) signature, component)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+typedef bool (*binocle_ecs_chunk_visitor_t)(binocle_ecs_t *ecs, binocle_system_t *system, binocle_ecs_chunk_t *chunk,
+                                            void *user_data);
+
+static bool binocle_ecs_visit_row_chunk(binocle_ecs_t *ecs, binocle_system_t *system, binocle_ecs_chunk_t *chunk,
+                                        binocle_ecs_chunk_visitor_t visit, void *user_data) {
+  uint64_t component, i;
+  unsigned char *entity_data = binocle_ecs_get_entity_data(ecs, chunk->entities[0]);
+
+  BINOCLE_FOREACH_SPARSEINTSET(component, i, &system->watch) {
+    chunk->columns[i] = entity_data + ecs->components[component].offset;
+    chunk->strides[i] = ecs->data_width;
+  }
+  return visit(ecs, system, chunk, user_data);
+}
+
+static bool binocle_ecs_visit_chunks(binocle_ecs_t *ecs, binocle_system_t *system, binocle_ecs_chunk_visitor_t visit,
+                                     void *user_data) {
+  binocle_ecs_chunk_t chunk;
+  binocle_entity_id_t entity;
+  const uint64_t *members;
+  uint64_t num_members, n;
+  uint64_t component, i, a;
+
+  chunk.count = 0;
+  chunk.entities = system->chunk_entities;
+  chunk.num_columns = system->watch.size;
+  chunk.columns = system->chunk_columns;
+  chunk.strides = system->chunk_strides;
+
+  if (ecs->storage == BINOCLE_ECS_STORAGE_ARCHETYPES) {
+    for (a = 0; a < ecs->num_archetypes; a++) {
+      binocle_ecs_archetype_t *archetype = ecs->archetypes + a;
+      uint64_t row = 0;
+      if (archetype->count == 0 || !binocle_ecs_system_matches(system, archetype->signature)) {
+        continue;
+      }
+      while (row < archetype->count) {
+        // Entities that are not enabled yet live in the archetype but are not subscribed to the system
+        while (row < archetype->count && !binocle_dense_integer_set_contains(&system->entities, archetype->entities[row])) {
+          row++;
+        }
+        uint64_t start = row;
+        while (row < archetype->count && row - start < BINOCLE_ECS_CHUNK_CAPACITY &&
+               binocle_dense_integer_set_contains(&system->entities, archetype->entities[row])) {
+          row++;
+        }
+        if (row == start) {
+          continue;
+        }
+        BINOCLE_FOREACH_SPARSEINTSET(component, i, &system->watch) {
+          size_t stride = binocle_ecs_column_stride(ecs->components + component);
+          chunk.columns[i] = (unsigned char *) archetype->columns[archetype->column_of[component]] + stride * start;
+          chunk.strides[i] = stride;
+        }
+        chunk.entities = archetype->entities + start;
+        chunk.count = row - start;
+        if (!visit(ecs, system, &chunk, user_data)) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // Rows of consecutive entities are contiguous in memory, except for those spawned while processing
+  members = binocle_dense_integer_set_members(&system->entities);
+  num_members = binocle_dense_integer_set_count(&system->entities);
+  for (n = 0; n < num_members; n++) {
+    entity = members[n];
+    if (chunk.count > 0 && (entity != system->chunk_entities[chunk.count - 1] + 1 ||
+                            chunk.count == BINOCLE_ECS_CHUNK_CAPACITY ||
+                            entity >= ecs->data_height_capacity)) {
+      if (!binocle_ecs_visit_row_chunk(ecs, system, &chunk, visit, user_data)) {
+        return false;
+      }
+      chunk.count = 0;
+    }
+    system->chunk_entities[chunk.count++] = entity;
+  }
+  if (chunk.count > 0) {
+    return binocle_ecs_visit_row_chunk(ecs, system, &chunk, visit, user_data);
+  }
+  return true;
+}
+
+static bool binocle_ecs_run_chunk(binocle_ecs_t *ecs, binocle_system_t *system, binocle_ecs_chunk_t *chunk,
+                                  void *user_data) {
+  system->process_chunk(ecs, system->user_data, chunk, *(float *) user_data);
+  return true;
+}
+
+static void binocle_ecs_process_entities(binocle_ecs_t *ecs, binocle_system_t *system, float delta) {
+  const uint64_t *members;
+  uint64_t num_members, n;
+
+  BINOCLE_PROFILE_COUNTER(BINOCLE_PROFILER_COUNTER_ENTITIES, binocle_dense_integer_set_count(&system->entities));
+  if (system->process_chunk != NULL) {
+    // Moving an entity to another archetype reallocates the archetypes and swaps the rows being visited
+    bool defer = ecs->storage == BINOCLE_ECS_STORAGE_ARCHETYPES && !binocle_ecs_is_deferring(ecs);
+    if (defer) {
+      ecs->deferring = true;
+    }
+    binocle_ecs_visit_chunks(ecs, system, binocle_ecs_run_chunk, &delta);
+    if (defer) {
+      ecs->deferring = false;
+      if (ecs->deferred_commands != NULL) {
+        binocle_ecs_apply_commands(ecs, ecs->deferred_commands);
+      }
+    }
+    return;
+  }
+
+  // Subscriptions only change before the systems run, so the packed array stays valid during the loop
+  members = binocle_dense_integer_set_members(&system->entities);
+  num_members = binocle_dense_integer_set_count(&system->entities);
+  for (n = 0; n < num_members; n++) {
+    system->process(ecs, system->user_data, members[n], delta);
+  }
+}
+
+//
+// Scheduler
+//
+
+static bool binocle_ecs_system_declared(binocle_system_t *system) {
+  return !binocle_sparse_integer_set_is_empty(&system->reads) || !binocle_sparse_integer_set_is_empty(&system->writes);
+}
+
+static bool binocle_ecs_writes_overlap(binocle_system_t *writer, binocle_system_t *other) {
+  uint64_t component, i;
+
+  BINOCLE_FOREACH_SPARSEINTSET(component, i, &writer->writes) {
+    if (binocle_sparse_integer_set_contains(&other->writes, component) ||
+        binocle_sparse_integer_set_contains(&other->reads, component) ||
+        binocle_sparse_integer_set_contains(&other->watch, component)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool binocle_ecs_systems_conflict(binocle_system_t *a, binocle_system_t *b) {
+  // Systems that did not declare their accesses could touch anything
+  if (!binocle_ecs_system_declared(a) || !binocle_ecs_system_declared(b)) {
+    return true;
+  }
+  return binocle_ecs_writes_overlap(a, b) || binocle_ecs_writes_overlap(b, a);
+}
+
+static void *binocle_ecs_command_buffer_push(binocle_ecs_command_buffer_t *buffer, uint64_t size) {
+  if (buffer->size + size > buffer->capacity) {
+    uint64_t new_capacity = (uint64_t) ((buffer->size + size) * 1.5f);
+    unsigned char *new_data = realloc(buffer->data, new_capacity);
+    if (new_data == NULL) {
+      return NULL;
+    }
+    buffer->data = new_data;
+    buffer->capacity = new_capacity;
+  }
+  void *ptr = buffer->data + buffer->size;
+  buffer->size += size;
+  return ptr;
+}
+
+static bool binocle_ecs_is_deferring(binocle_ecs_t *ecs) {
+  return ecs->deferring || (ecs->scheduler != NULL && ecs->scheduler->deferring);
+}
+
+static bool binocle_ecs_record_command(binocle_ecs_t *ecs, binocle_ecs_command_type_t type, binocle_entity_id_t entity,
+                                       uint64_t arg, const void *data, uint64_t size) {
+  binocle_ecs_scheduler_t *s = ecs->scheduler;
+  binocle_ecs_command_buffer_t *buffer = SDL_GetTLS(&binocle_ecs_tls_commands);
+  uint64_t padded_size = data != NULL ? (size + 7) & ~(uint64_t) 7 : 0;
+
+  // A chunk system running on the calling thread outside of the worker pool
+  if (buffer == NULL && !(s != NULL && s->deferring)) {
+    if (ecs->deferred_commands == NULL) {
+      ecs->deferred_commands = calloc(1, sizeof(binocle_ecs_command_buffer_t));
+      if (ecs->deferred_commands == NULL) {
+        return false;
+      }
+    }
+    buffer = ecs->deferred_commands;
+  }
+  bool orphan = buffer == NULL;
+
+  // Threads that are not running a job share a single buffer
+  if (orphan) {
+    SDL_LockMutex(s->mutex);
+    buffer = &s->orphan_commands;
+  }
+  binocle_ecs_command_t *command = binocle_ecs_command_buffer_push(buffer, sizeof(binocle_ecs_command_t) + padded_size);
+  if (command != NULL) {
+    command->type = type;
+    command->entity = entity;
+    command->arg = arg;
+    command->size = data != NULL ? size : UINT64_MAX;
+    if (data != NULL) {
+      memcpy(command + 1, data, size);
+    }
+  }
+  if (orphan) {
+    SDL_UnlockMutex(s->mutex);
+  }
+  return command != NULL;
+}
+
+static void binocle_ecs_apply_commands(binocle_ecs_t *ecs, binocle_ecs_command_buffer_t *buffer) {
+  uint64_t offset = 0;
+
+  while (offset < buffer->size) {
+    binocle_ecs_command_t *command = (binocle_ecs_command_t *) (buffer->data + offset);
+    const void *data = command->size != UINT64_MAX ? (const void *) (command + 1) : NULL;
+    switch (command->type) {
+      case BINOCLE_ECS_COMMAND_CREATE:
+        binocle_ecs_allocate_entity(ecs, command->entity);
+        break;
+      case BINOCLE_ECS_COMMAND_SET:
+        binocle_ecs_set_component(ecs, command->entity, command->arg, data);
+        break;
+      case BINOCLE_ECS_COMMAND_REMOVE:
+        binocle_ecs_remove_components(ecs, command->entity, command->arg);
+        break;
+      case BINOCLE_ECS_COMMAND_SIGNAL:
+        binocle_ecs_signal(ecs, command->entity, (binocle_entity_signal_t) command->arg);
+        break;
+      case BINOCLE_ECS_COMMAND_CHANGED:
+        binocle_ecs_mark_changed(ecs, command->entity, command->arg);
+        break;
+    }
+    offset += sizeof(binocle_ecs_command_t) + (data != NULL ? (command->size + 7) & ~(uint64_t) 7 : 0);
+  }
+  buffer->size = 0;
+}
+
+static bool binocle_ecs_scheduler_push_job(binocle_ecs_scheduler_t *s, uint64_t system, uint64_t begin, uint64_t end) {
+  if (s->num_jobs >= s->jobs_capacity) {
+    uint64_t new_capacity = (uint64_t) ((s->num_jobs + 1) * 1.5f);
+    binocle_ecs_job_t *new_jobs = realloc(s->jobs, sizeof(binocle_ecs_job_t) * new_capacity);
+    if (new_jobs == NULL) {
+      return false;
+    }
+    memset(new_jobs + s->jobs_capacity, 0, sizeof(binocle_ecs_job_t) * (new_capacity - s->jobs_capacity));
+    s->jobs = new_jobs;
+    s->jobs_capacity = new_capacity;
+  }
+  // The command buffers of the job slots are kept around and reused by the next frames
+  binocle_ecs_job_t *job = s->jobs + s->num_jobs++;
+  job->system = system;
+  job->begin = begin;
+  job->end = end;
+  return true;
+}
+
+static bool binocle_ecs_schedule_reserve(void **array, uint64_t *capacity, uint64_t count, size_t size) {
+  if (count <= *capacity) {
+    return true;
+  }
+  uint64_t new_capacity = (uint64_t) ((count + 1) * 1.5f);
+  void *new_array = realloc(*array, size * new_capacity);
+  if (new_array == NULL) {
+    return false;
+  }
+  *array = new_array;
+  *capacity = new_capacity;
+  return true;
+}
+
+static bool binocle_ecs_scheduler_gather_chunk(binocle_ecs_t *ecs, binocle_system_t *system, binocle_ecs_chunk_t *chunk,
+                                               void *user_data) {
+  binocle_ecs_system_schedule_t *schedule = user_data;
+
+  if (!binocle_ecs_schedule_reserve((void **) &schedule->entities, &schedule->entities_capacity,
+                                    schedule->num_entities + chunk->count, sizeof(binocle_entity_id_t)) ||
+      !binocle_ecs_schedule_reserve((void **) &schedule->chunks, &schedule->chunks_capacity,
+                                    schedule->num_chunks + 1, sizeof(binocle_ecs_job_chunk_t)) ||
+      !binocle_ecs_schedule_reserve((void **) &schedule->columns, &schedule->columns_capacity,
+                                    schedule->num_columns + chunk->num_columns, sizeof(void *)) ||
+      !binocle_ecs_schedule_reserve((void **) &schedule->strides, &schedule->strides_capacity,
+                                    schedule->num_columns + chunk->num_columns, sizeof(size_t))) {
+    return false;
+  }
+
+  binocle_ecs_job_chunk_t *job_chunk = schedule->chunks + schedule->num_chunks++;
+  job_chunk->first_entity = schedule->num_entities;
+  job_chunk->count = chunk->count;
+  job_chunk->first_column = schedule->num_columns;
+
+  memcpy(schedule->entities + schedule->num_entities, chunk->entities, sizeof(binocle_entity_id_t) * chunk->count);
+  memcpy(schedule->columns + schedule->num_columns, chunk->columns, sizeof(void *) * chunk->num_columns);
+  memcpy(schedule->strides + schedule->num_columns, chunk->strides, sizeof(size_t) * chunk->num_columns);
+  schedule->num_entities += chunk->count;
+  schedule->num_columns += chunk->num_columns;
+  return true;
+}
+
+static bool binocle_ecs_scheduler_gather(binocle_ecs_t *ecs, uint64_t system_id) {
+  binocle_ecs_scheduler_t *s = ecs->scheduler;
+  binocle_system_t *system = ecs->systems + system_id;
+  binocle_ecs_system_schedule_t *schedule = s->systems + system_id;
+  bool parallel = (system->flags & BINOCLE_SYSTEM_PARALLEL_BIT) != 0;
+  const uint64_t *members;
+  uint64_t num_members;
+  uint64_t i;
+
+  schedule->num_entities = 0;
+  schedule->num_chunks = 0;
+  schedule->num_columns = 0;
+
+  if (system->process_chunk != NULL) {
+    if (!binocle_ecs_visit_chunks(ecs, system, binocle_ecs_scheduler_gather_chunk, schedule)) {
+      return false;
+    }
+    if (!parallel) {
+      return schedule->num_chunks == 0 || binocle_ecs_scheduler_push_job(s, system_id, 0, schedule->num_chunks);
+    }
+    for (i = 0; i < schedule->num_chunks; i++) {
+      if (!binocle_ecs_scheduler_push_job(s, system_id, i, i + 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  members = binocle_dense_integer_set_members(&system->entities);
+  num_members = binocle_dense_integer_set_count(&system->entities);
+  if (!binocle_ecs_schedule_reserve((void **) &schedule->entities, &schedule->entities_capacity, num_members,
+                                    sizeof(binocle_entity_id_t))) {
+    return false;
+  }
+  if (num_members > 0) {
+    memcpy(schedule->entities, members, sizeof(binocle_entity_id_t) * num_members);
+  }
+  schedule->num_entities = num_members;
+  if (!parallel) {
+    return schedule->num_entities == 0 || binocle_ecs_scheduler_push_job(s, system_id, 0, schedule->num_entities);
+  }
+  for (i = 0; i < schedule->num_entities; i += BINOCLE_ECS_CHUNK_CAPACITY) {
+    uint64_t end = i + BINOCLE_ECS_CHUNK_CAPACITY < schedule->num_entities ? i + BINOCLE_ECS_CHUNK_CAPACITY : schedule->num_entities;
+    if (!binocle_ecs_scheduler_push_job(s, system_id, i, end)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void binocle_ecs_scheduler_execute(binocle_ecs_scheduler_t *s, binocle_ecs_job_t *job) {
+  binocle_ecs_t *ecs = s->ecs;
+  binocle_system_t *system = ecs->systems + job->system;
+  binocle_ecs_system_schedule_t *schedule = s->systems + job->system;
+  uint64_t i;
+
+  BINOCLE_PROFILE_ZONE_BEGIN(system->name);
+  SDL_SetTLS(&binocle_ecs_tls_commands, &job->commands, NULL);
+  if (system->process_chunk != NULL) {
+    binocle_ecs_chunk_t chunk;
+    chunk.num_columns = system->watch.size;
+    for (i = job->begin; i < job->end; i++) {
+      binocle_ecs_job_chunk_t *job_chunk = schedule->chunks + i;
+      chunk.count = job_chunk->count;
+      BINOCLE_PROFILE_COUNTER(BINOCLE_PROFILER_COUNTER_ENTITIES, job_chunk->count);
+      chunk.entities = schedule->entities + job_chunk->first_entity;
+      chunk.columns = schedule->columns + job_chunk->first_column;
+      chunk.strides = schedule->strides + job_chunk->first_column;
+      system->process_chunk(ecs, system->user_data, &chunk, s->delta);
+    }
+  } else {
+    BINOCLE_PROFILE_COUNTER(BINOCLE_PROFILER_COUNTER_ENTITIES, job->end - job->begin);
+    for (i = job->begin; i < job->end; i++) {
+      system->process(ecs, system->user_data, schedule->entities[i], s->delta);
+    }
+  }
+  SDL_SetTLS(&binocle_ecs_tls_commands, NULL, NULL);
+  BINOCLE_PROFILE_ZONE_END();
+}
+
+static void binocle_ecs_scheduler_work(binocle_ecs_scheduler_t *s) {
+  int job;
+  while ((job = SDL_AddAtomicInt(&s->next_job, 1)) < (int) s->num_jobs) {
+    binocle_ecs_scheduler_execute(s, s->jobs + job);
+  }
+}
+
+static int SDLCALL binocle_ecs_scheduler_worker(void *data) {
+  binocle_ecs_scheduler_t *s = data;
+  uint64_t seen = 0;
+
+  SDL_LockMutex(s->mutex);
+  while (true) {
+    while (!s->quit && !(s->level_open && s->generation != seen)) {
+      SDL_WaitCondition(s->work_ready, s->mutex);
+    }
+    if (s->quit) {
+      break;
+    }
+    seen = s->generation;
+    s->busy_workers++;
+    SDL_UnlockMutex(s->mutex);
+    binocle_ecs_scheduler_work(s);
+    SDL_LockMutex(s->mutex);
+    s->busy_workers--;
+    SDL_BroadcastCondition(s->work_done);
+  }
+  SDL_UnlockMutex(s->mutex);
+  return 0;
+}
+
+static void binocle_ecs_scheduler_dispatch(binocle_ecs_scheduler_t *s) {
+  bool wake_workers = s->num_workers > 0 && s->num_jobs > 1;
+
+  SDL_SetAtomicInt(&s->next_job, 0);
+  if (wake_workers) {
+    SDL_LockMutex(s->mutex);
+    s->generation++;
+    s->level_open = true;
+    SDL_BroadcastCondition(s->work_ready);
+    SDL_UnlockMutex(s->mutex);
+  }
+
+  // The calling thread works on the jobs as well
+  binocle_ecs_scheduler_work(s);
+
+  if (wake_workers) {
+    SDL_LockMutex(s->mutex);
+    while (s->busy_workers > 0) {
+      SDL_WaitCondition(s->work_done, s->mutex);
+    }
+    // Workers that did not wake up in time must not touch the jobs of the next level
+    s->level_open = false;
+    SDL_UnlockMutex(s->mutex);
+  }
+}
+
+static bool binocle_ecs_scheduler_run(binocle_ecs_t *ecs, float delta) {
+  binocle_ecs_scheduler_t *s = ecs->scheduler;
+  binocle_system_t *system;
+  uint64_t level, i;
+
+  for (level = 0; level < s->num_levels; level++) {
+    BINOCLE_FOREACH_ARRAY(system, i, ecs->systems, ecs->num_systems) {
+      if (!(system->flags & BINOCLE_SYSTEM_PASSIVE_BIT) && s->systems[i].level == level && system->starting != NULL) {
+        system->starting(ecs, system->user_data);
+      }
+    }
+
+    s->num_jobs = 0;
+    BINOCLE_FOREACH_ARRAY(system, i, ecs->systems, ecs->num_systems) {
+      if (!(system->flags & BINOCLE_SYSTEM_PASSIVE_BIT) && s->systems[i].level == level) {
+        if (!binocle_ecs_scheduler_gather(ecs, i)) {
+          return false;
+        }
+      }
+    }
+
+    s->delta = delta;
+    s->deferring = true;
+    binocle_ecs_scheduler_dispatch(s);
+    s->deferring = false;
+
+    // Sync point: structural changes are applied in job order, regardless of the thread that ran them
+    for (i = 0; i < s->num_jobs; i++) {
+      binocle_ecs_apply_commands(ecs, &s->jobs[i].commands);
+    }
+    binocle_ecs_apply_commands(ecs, &s->orphan_commands);
+
+    BINOCLE_FOREACH_ARRAY(system, i, ecs->systems, ecs->num_systems) {
+      if (!(system->flags & BINOCLE_SYSTEM_PASSIVE_BIT) && s->systems[i].level == level && system->ending != NULL) {
+        system->ending(ecs, system->user_data);
+      }
+    }
+  }
+  return true;
+}
+
+static void binocle_ecs_scheduler_destroy(binocle_ecs_t *ecs) {
+  binocle_ecs_scheduler_t *s = ecs->scheduler;
+  uint64_t i;
+
+  if (s == NULL) {
+    return;
+  }
+
+  SDL_LockMutex(s->mutex);
+  s->quit = true;
+  SDL_BroadcastCondition(s->work_ready);
+  SDL_UnlockMutex(s->mutex);
+  for (i = 0; i < s->num_workers; i++) {
+    SDL_WaitThread(s->workers[i], NULL);
+  }
+  free(s->workers);
+
+  for (i = 0; i < s->jobs_capacity; i++) {
+    free(s->jobs[i].commands.data);
+  }
+  free(s->jobs);
+  free(s->orphan_commands.data);
+
+  for (i = 0; i < ecs->num_systems; i++) {
+    free(s->systems[i].entities);
+    free(s->systems[i].chunks);
+    free(s->systems[i].columns);
+    free(s->systems[i].strides);
+  }
+  free(s->systems);
+
+  SDL_DestroyCondition(s->work_done);
+  SDL_DestroyCondition(s->work_ready);
+  SDL_DestroyMutex(s->mutex);
+  free(s);
+  ecs->scheduler = NULL;
+}
+
+static bool binocle_ecs_scheduler_create(binocle_ecs_t *ecs) {
+  binocle_ecs_scheduler_t *s = calloc(1, sizeof(binocle_ecs_scheduler_t));
+  uint64_t i, j;
+
+  if (s == NULL) {
+    return false;
+  }
+  ecs->scheduler = s;
+  s->ecs = ecs;
+  s->mutex = SDL_CreateMutex();
+  s->work_ready = SDL_CreateCondition();
+  s->work_done = SDL_CreateCondition();
+  s->systems = calloc(ecs->num_systems > 0 ? ecs->num_systems : 1, sizeof(binocle_ecs_system_schedule_t));
+  s->workers = calloc(ecs->num_threads - 1, sizeof(SDL_Thread *));
+  if (s->mutex == NULL || s->work_ready == NULL || s->work_done == NULL || s->systems == NULL || s->workers == NULL) {
+    binocle_ecs_scheduler_destroy(ecs);
+    return false;
+  }
+
+  // Each system runs after all the earlier systems it conflicts with. Systems on the same level run in parallel.
+  for (j = 0; j < ecs->num_systems; j++) {
+    if (ecs->systems[j].flags & BINOCLE_SYSTEM_PASSIVE_BIT) {
+      continue;
+    }
+    for (i = 0; i < j; i++) {
+      if (ecs->systems[i].flags & BINOCLE_SYSTEM_PASSIVE_BIT) {
+        continue;
+      }
+      if (s->systems[i].level + 1 > s->systems[j].level && binocle_ecs_systems_conflict(ecs->systems + i, ecs->systems + j)) {
+        s->systems[j].level = s->systems[i].level + 1;
+      }
+    }
+    if (s->systems[j].level + 1 > s->num_levels) {
+      s->num_levels = s->systems[j].level + 1;
+    }
+  }
+
+  // Platforms without threads simply run all the jobs on the calling thread
+  for (i = 0; i < ecs->num_threads - 1; i++) {
+    s->workers[s->num_workers] = SDL_CreateThread(binocle_ecs_scheduler_worker, "binocle_ecs", s);
+    if (s->workers[s->num_workers] == NULL) {
+      break;
+    }
+    s->num_workers++;
+  }
+
+  return true;
+}
+
 bool binocle_ecs_process(binocle_ecs_t *ecs, float delta) {
   binocle_entity_id_t entity;
   uint64_t i;
@@ -582,6 +1932,7 @@ bool binocle_ecs_process(binocle_ecs_t *ecs, float delta) {
     return false;
   }
 
+  BINOCLE_PROFILE_ZONE_BEGIN("ecs_process");
   ecs->processing = true;
 
   binocle_sparse_integer_set_clear(&ecs->added);
@@ -606,37 +1957,50 @@ bool binocle_ecs_process(binocle_ecs_t *ecs, float delta) {
     BINOCLE_FOREACH_ARRAY(system, j, ecs->systems, ecs->num_systems) {
       binocle_ecs_unsubscribe(ecs, system, entity);
     }
-    for (j = 0; j < ecs->num_components; j++) {
-      binocle_ecs_remove_components(ecs, entity, j);
+    if (ecs->storage == BINOCLE_ECS_STORAGE_ARCHETYPES) {
+      binocle_ecs_archetype_release_entity(ecs, entity);
+    } else {
+      for (j = 0; j < ecs->num_components; j++) {
+        binocle_ecs_remove_components(ecs, entity, j);
+      }
     }
-    binocle_sparse_integer_set_insert(&ecs->free_entity_ids, entity);
+    binocle_ecs_release_entity_id(ecs, entity);
   }
   binocle_sparse_integer_set_clear(&ecs->removed);
 
-  BINOCLE_FOREACH_ARRAY(system, j, ecs->systems, ecs->num_systems) {
-    if (system->flags & BINOCLE_SYSTEM_PASSIVE_BIT) {
-      continue;
+  if (ecs->scheduler != NULL) {
+    if (!binocle_ecs_scheduler_run(ecs, delta)) {
+      ecs->processing = false;
+      BINOCLE_PROFILE_ZONE_END();
+      return false;
     }
+  } else {
+    BINOCLE_FOREACH_ARRAY(system, j, ecs->systems, ecs->num_systems) {
+      if (system->flags & BINOCLE_SYSTEM_PASSIVE_BIT) {
+        continue;
+      }
 
-    if (system->starting != NULL) {
-      system->starting(ecs, system->user_data);
-    }
-    BINOCLE_FOREACH_DENSEINTSET(entity, &system->entities) {
-        system->process(ecs, system->user_data, entity, delta);
+      BINOCLE_PROFILE_ZONE_BEGIN(system->name);
+      if (system->starting != NULL) {
+        system->starting(ecs, system->user_data);
+      }
+      binocle_ecs_process_entities(ecs, system, delta);
+      if (system->ending != NULL) {
+        system->ending(ecs, system->user_data);
       }
-    if (system->ending != NULL) {
-      system->ending(ecs, system->user_data);
+      BINOCLE_PROFILE_ZONE_END();
     }
   }
 
   ecs->processing = false;
 
-  return binocle_ecs_fix_data(ecs);
+  bool result = binocle_ecs_fix_data(ecs);
+  BINOCLE_PROFILE_ZONE_END();
+  return result;
 }
 
 bool binocle_ecs_process_system(binocle_ecs_t *ecs, binocle_system_id_t system, float delta) {
   binocle_system_t *s;
-  binocle_entity_id_t entity;
 
   if (!ecs->initialized) {
     return false;
@@ -651,9 +2015,7 @@ bool binocle_ecs_process_system(binocle_ecs_t *ecs, binocle_system_id_t system,
   if (s->starting != NULL) {
     s->starting(ecs, s->user_data);
   }
-  BINOCLE_FOREACH_DENSEINTSET(entity, &s->entities) {
-      s->process(ecs, s->user_data, entity, delta);
-    }
+  binocle_ecs_process_entities(ecs, s, delta);
   if (s->ending != NULL) {
     s->ending(ecs, s->user_data);
   }
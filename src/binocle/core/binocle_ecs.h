@@ -11,14 +11,20 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+/// Component bits positions
+#define BINOCLE_COMPONENT_TRACK_CHANGES_BIT 1
+
 /// System bits positions
 #define BINOCLE_SYSTEM_PASSIVE_BIT 1
+#define BINOCLE_SYSTEM_PARALLEL_BIT 2
 
 /// System flags
 #define BINOCLE_SYSTEM_FLAG_NORMAL  0
 #define BINOCLE_SYSTEM_FLAG_PASSIVE BINOCLE_SYSTEM_PASSIVE_BIT
+#define BINOCLE_SYSTEM_FLAG_PARALLEL BINOCLE_SYSTEM_PARALLEL_BIT
 
 struct binocle_ecs_t;
+struct binocle_ecs_scheduler_t;
 
 /**
  * \brief A signal that can be sent to an entity
@@ -30,8 +36,32 @@ typedef enum binocle_entity_signal_t {
   BINOCLE_ENTITY_REMOVED
 } binocle_entity_signal_t;
 
+/**
+ * \brief The layout used to store the component data of the entities
+ */
+typedef enum binocle_ecs_storage_t {
+  /// Each entity is a single row holding the component bits and every registered component (default)
+  BINOCLE_ECS_STORAGE_ROWS,
+  /// Entities sharing the same set of components are stored together, one contiguous column per component
+  BINOCLE_ECS_STORAGE_ARCHETYPES
+} binocle_ecs_storage_t;
+
+/// The maximum number of entities handed to a chunk system in a single call
+#define BINOCLE_ECS_CHUNK_CAPACITY 1024
+
+/// Entity handles bits
+#define BINOCLE_ENTITY_HANDLE_GENERATION_SHIFT 32
+#define BINOCLE_ENTITY_HANDLE_INDEX_MASK 0xFFFFFFFFull
+/// A handle that never refers to a live entity
+#define BINOCLE_INVALID_ENTITY_HANDLE 0
+
+/// Marks an archetype index that does not point to any archetype
+#define BINOCLE_ECS_INVALID_ARCHETYPE UINT64_MAX
+
 /// The entity itself, actually just an ID
 typedef uint64_t binocle_entity_id_t;
+/// A versioned reference to an entity: the entity ID in the lower 32 bits and its generation in the upper 32 bits
+typedef uint64_t binocle_entity_handle_t;
 /// The component itself, actually just an ID
 typedef uint64_t binocle_component_id_t;
 /// The system itself, actually just an ID
@@ -50,10 +80,19 @@ typedef struct binocle_sparse_integer_set_t {
 
 /**
  * \brief A dense integer set, used to save some memory space to represent the entities in use by a system
+ * The bits are stored in 64 bits words so that empty ranges can be skipped a word at a time. A sorted packed array of
+ * the members is rebuilt on demand after the set changes, so that iterating a set costs time proportional to the
+ * number of its members instead of the highest integer it contains.
  */
 typedef struct binocle_dense_integer_set_t {
-  unsigned char *bytes;
+  uint64_t *words;
   unsigned int capacity;
+  uint64_t count;
+
+  // Packed members, only valid when members_dirty is false
+  uint64_t *members;
+  uint64_t members_capacity;
+  bool members_dirty;
 } binocle_dense_integer_set_t;
 
 /**
@@ -68,8 +107,25 @@ typedef struct binocle_component_t {
   void **data;
   binocle_sparse_integer_set_t free_data_indexes;
   uint64_t next_data_index;
+
+  // Entities whose component has been written since the last call to binocle_ecs_clear_changed
+  binocle_dense_integer_set_t changed;
 } binocle_component_t;
 
+/**
+ * \brief A batch of entities handed to a chunk system
+ * Each column points to the data of the first entity of the chunk for one of the watched components, in the order
+ * they have been passed to \ref binocle_ecs_watch. The component of the i-th entity for column c is at
+ * (unsigned char *)columns[c] + i * strides[c].
+ */
+typedef struct binocle_ecs_chunk_t {
+  uint64_t count;
+  const binocle_entity_id_t *entities;
+  uint64_t num_columns;
+  void **columns;
+  size_t *strides;
+} binocle_ecs_chunk_t;
+
 /**
  * \brief A system
  */
@@ -82,11 +138,56 @@ typedef struct binocle_system_t {
   void (*ending)(struct binocle_ecs_t* ecs, void *user_data);
   void (*subscribed)(struct binocle_ecs_t *ecs, void *user_data, binocle_entity_id_t entity);
   void (*unsubscribed)(struct binocle_ecs_t *ecs, void *user_data, binocle_entity_id_t entity);
+  void (*process_chunk)(struct binocle_ecs_t *ecs, void *user_data, binocle_ecs_chunk_t *chunk, float delta);
   binocle_sparse_integer_set_t watch;
   binocle_sparse_integer_set_t exclude;
   binocle_dense_integer_set_t entities;
+
+  // Components accessed by the system, used by the scheduler to run systems in parallel
+  binocle_sparse_integer_set_t reads;
+  binocle_sparse_integer_set_t writes;
+
+  // Scratch buffers used to build the chunks of a chunk system
+  binocle_entity_id_t *chunk_entities;
+  void **chunk_columns;
+  size_t *chunk_strides;
 } binocle_system_t;
 
+/**
+ * \brief An archetype, i.e. the table of all the entities sharing the same set of components.
+ * Each component of the signature is stored in its own contiguous column, so that systems touching only a few
+ * components do not have to stride over the data of the others.
+ */
+typedef struct binocle_ecs_archetype_t {
+  // The component bits of this archetype, laid out like the first column of an entity row
+  unsigned char *signature;
+
+  // The columns, one for each component of the signature
+  uint64_t num_columns;
+  binocle_component_id_t *column_components;
+  void **columns;
+
+  // Maps a component ID to its column index, or UINT64_MAX if the component is not part of this archetype
+  uint64_t *column_of;
+
+  // The entity stored in each row
+  binocle_entity_id_t *entities;
+  uint64_t count;
+  uint64_t capacity;
+
+  // Cached archetypes to move to when adding or removing a component
+  uint64_t *add_edges;
+  uint64_t *remove_edges;
+} binocle_ecs_archetype_t;
+
+/**
+ * \brief The position of an entity in the archetype storage
+ */
+typedef struct binocle_ecs_entity_location_t {
+  uint64_t archetype;
+  uint64_t row;
+} binocle_ecs_entity_location_t;
+
 /**
  * \brief The ECS container
  */
@@ -94,10 +195,17 @@ typedef struct binocle_ecs_t {
   bool initialized;
   bool processing;
 
+  // The layout of the component data
+  binocle_ecs_storage_t storage;
+
   // Manage entity IDs, we actually reuse them when possible
   binocle_sparse_integer_set_t free_entity_ids;
   binocle_entity_id_t next_entity_id;
 
+  // Generation of each entity ID minus one, bumped every time the ID is released
+  uint32_t *generations;
+  uint64_t generations_capacity;
+
   // The actual entity data. The first column is bits of components defined, the rest are components
   uint64_t data_width;
   uint64_t data_height;
@@ -108,6 +216,12 @@ typedef struct binocle_ecs_t {
   uint64_t processing_data_height;
   void **processing_data;
 
+  // Archetype storage, only used with BINOCLE_ECS_STORAGE_ARCHETYPES. The first archetype is the empty one.
+  uint64_t signature_width;
+  uint64_t num_archetypes;
+  binocle_ecs_archetype_t *archetypes;
+  binocle_ecs_entity_location_t *locations;
+
   // Buffers for entity status changes and notifications
   struct binocle_sparse_integer_set_t added;
   struct binocle_sparse_integer_set_t enabled;
@@ -122,6 +236,15 @@ typedef struct binocle_ecs_t {
 
   uint64_t num_systems;
   binocle_system_t *systems;
+
+  // Number of threads used to run the systems, including the calling thread
+  uint64_t num_threads;
+  struct binocle_ecs_scheduler_t *scheduler;
+
+  // True while a chunk system visits the rows of the archetypes on the calling thread. Structural changes would move
+  // those rows, so they are recorded in deferred_commands and applied once the system is done.
+  bool deferring;
+  struct binocle_ecs_command_buffer_t *deferred_commands;
 } binocle_ecs_t;
 
 /**
@@ -235,6 +358,30 @@ void binocle_dense_integer_set_clear(binocle_dense_integer_set_t *is);
  */
 int binocle_dense_integer_set_is_empty(binocle_dense_integer_set_t *is);
 
+/**
+ * \brief Gets the number of integers in a dense integer set
+ * @param is the dense integer set
+ * @return the number of integers in the set
+ */
+uint64_t binocle_dense_integer_set_count(binocle_dense_integer_set_t *is);
+
+/**
+ * \brief Finds the first integer of a dense integer set that is greater or equal to a given value
+ * @param is the dense integer set
+ * @param i the value to start searching from
+ * @return the integer found or UINT64_MAX if there are no more integers
+ */
+uint64_t binocle_dense_integer_set_next(binocle_dense_integer_set_t *is, uint64_t i);
+
+/**
+ * \brief Gets the sorted array of the integers of a dense integer set
+ * The array is rebuilt only if the set has changed since the last call. It holds
+ * \ref binocle_dense_integer_set_count elements and is valid until the set is modified.
+ * @param is the dense integer set
+ * @return the array of integers, or NULL if the set is empty or the array could not be allocated
+ */
+const uint64_t *binocle_dense_integer_set_members(binocle_dense_integer_set_t *is);
+
 /**
  * Release all the resources allocated by a dense integer set
  * @param is the dense integer set
@@ -251,6 +398,36 @@ void binocle_dense_integer_set_free(binocle_dense_integer_set_t *is);
  */
 binocle_ecs_t binocle_ecs_new();
 
+/**
+ * \brief Sets the layout used to store the component data of the entities
+ * With BINOCLE_ECS_STORAGE_ARCHETYPES the entities with the same components are grouped in tables with one
+ * contiguous column per component. Setting or removing a component moves the entity to a different table, so
+ * the pointers returned by \ref binocle_ecs_get_component are only valid until the next component is added to or
+ * removed from any entity.
+ * \note The storage can only be changed before calling \ref binocle_ecs_initialize
+ * @param ecs the ECS instance
+ * @param storage the storage layout
+ * @return true if the storage layout has been changed
+ */
+bool binocle_ecs_set_storage(binocle_ecs_t *ecs, binocle_ecs_storage_t storage);
+
+/**
+ * \brief Sets the number of threads used by \ref binocle_ecs_process to run the systems
+ * With more than one thread, the systems that declared their accesses with \ref binocle_ecs_read and
+ * \ref binocle_ecs_write and do not conflict with each other run at the same time on a pool of worker threads.
+ * Systems that did not declare any access behave as a barrier and run alone, in registration order.
+ * Systems flagged with BINOCLE_SYSTEM_FLAG_PARALLEL also have their entities split in ranges processed by different
+ * threads, so their process callbacks must only touch the entity they are given.
+ * While the systems run in parallel, creating entities, sending signals, adding and removing components are recorded
+ * in command buffers and applied once all the systems sharing the same slot in the schedule are done. Setting a
+ * component that the entity already has is performed immediately.
+ * \note The number of threads can only be changed before calling \ref binocle_ecs_initialize
+ * @param ecs the ECS instance
+ * @param num_threads the number of threads. 0 or 1 runs everything on the calling thread (default)
+ * @return true if the number of threads has been changed
+ */
+bool binocle_ecs_set_num_threads(binocle_ecs_t *ecs, uint64_t num_threads);
+
 /**
  * \brief Initializes the data structures of the ECS
  * \note Once this function has been called you can no longer define new components or systems
@@ -282,6 +459,33 @@ bool binocle_ecs_fix_data(binocle_ecs_t *ecs);
  */
 bool binocle_ecs_create_entity(binocle_ecs_t *ecs, binocle_entity_id_t *entity_ptr);
 
+/**
+ * \brief Gets a versioned handle to an entity
+ * Unlike entity IDs, which are recycled once an entity has been removed, a handle stops being valid as soon as the
+ * entity it refers to is removed, so it can be safely stored by game code to reference other entities.
+ * @param ecs the ECS instance
+ * @param entity the entity ID
+ * @return the handle of the entity or BINOCLE_INVALID_ENTITY_HANDLE if the entity does not exist
+ */
+binocle_entity_handle_t binocle_ecs_get_entity_handle(binocle_ecs_t *ecs, binocle_entity_id_t entity);
+
+/**
+ * \brief Checks whether an entity handle still refers to the entity it has been created for
+ * @param ecs the ECS instance
+ * @param handle the entity handle
+ * @return true if the entity is still alive
+ */
+bool binocle_ecs_is_entity_handle_valid(binocle_ecs_t *ecs, binocle_entity_handle_t handle);
+
+/**
+ * \brief Gets the entity ID of a handle
+ * @param ecs the ECS instance
+ * @param handle the entity handle
+ * @param entity_ptr a pointer to the entity id that will be filled by this function
+ * @return true if the handle is valid and the entity ID has been written
+ */
+bool binocle_ecs_get_entity_from_handle(binocle_ecs_t *ecs, binocle_entity_handle_t handle, binocle_entity_id_t *entity_ptr);
+
 /**
  * \brief Gets the entity data for a given entity
  * @param ecs the ECS instance
@@ -330,6 +534,57 @@ bool binocle_ecs_set_component(binocle_ecs_t *ecs, binocle_entity_id_t entity, b
  */
 bool binocle_ecs_get_component(binocle_ecs_t *ecs, binocle_entity_id_t entity, binocle_component_id_t component, void ** ptr);
 
+/**
+ * \brief Gets a component from an entity with the intent of modifying it
+ * Works like \ref binocle_ecs_get_component but also marks the component as changed if it is being tracked.
+ * @param ecs the ECS instance
+ * @param entity the entity ID
+ * @param component the component ID
+ * @param ptr a pointer to the struct that will contain the data of the component requested
+ * @return true if the component has been found
+ */
+bool binocle_ecs_get_component_mut(binocle_ecs_t *ecs, binocle_entity_id_t entity, binocle_component_id_t component, void ** ptr);
+
+/**
+ * \brief Enables change tracking for a component
+ * Once enabled, \ref binocle_ecs_set_component, \ref binocle_ecs_get_component_mut and
+ * \ref binocle_ecs_mark_changed record the entities whose component has been written, so that
+ * \ref binocle_ecs_get_changed can list them without visiting every entity.
+ * \note Change tracking can only be enabled before calling \ref binocle_ecs_initialize
+ * @param ecs the ECS instance
+ * @param component the component ID
+ * @return true if change tracking has been enabled
+ */
+bool binocle_ecs_track_changes(binocle_ecs_t *ecs, binocle_component_id_t component);
+
+/**
+ * \brief Marks the component of an entity as changed
+ * Useful after writing a component through a pointer obtained elsewhere, e.g. from a chunk system.
+ * While systems run in parallel the mark is recorded and applied at the next sync point.
+ * @param ecs the ECS instance
+ * @param entity the entity ID
+ * @param component the component ID
+ * @return true if the component has been marked, or if it is not tracked
+ */
+bool binocle_ecs_mark_changed(binocle_ecs_t *ecs, binocle_entity_id_t entity, binocle_component_id_t component);
+
+/**
+ * \brief Gets the entities whose component has changed since the last call to \ref binocle_ecs_clear_changed
+ * @param ecs the ECS instance
+ * @param component the component ID
+ * @param entities a pointer that will be set to the sorted array of changed entities. The array is valid until the next
+ * change to the ECS.
+ * @return the number of changed entities
+ */
+uint64_t binocle_ecs_get_changed(binocle_ecs_t *ecs, binocle_component_id_t component, const binocle_entity_id_t **entities);
+
+/**
+ * \brief Forgets all the changes recorded for a component
+ * @param ecs the ECS instance
+ * @param component the component ID
+ */
+void binocle_ecs_clear_changed(binocle_ecs_t *ecs, binocle_component_id_t component);
+
 /**
  * \brief Releases the resources allocated for a component
  * @param ecs the ECS instance
@@ -370,6 +625,24 @@ bool binocle_ecs_set_component_i_internal(binocle_ecs_t *ecs, binocle_entity_id_
  */
 bool binocle_ecs_get_component_internal(binocle_ecs_t *ecs, binocle_entity_id_t entity, binocle_component_id_t component, uint64_t i, void ** ptr);
 
+/**
+ * \brief Finds the archetype with the given component bits, creating it if needed (Internal use only)
+ * @param ecs the ECS instance
+ * @param signature the component bits of the archetype
+ * @return the index of the archetype or BINOCLE_ECS_INVALID_ARCHETYPE if it could not be created
+ */
+uint64_t binocle_ecs_archetype_get_internal(binocle_ecs_t *ecs, const unsigned char *signature);
+
+/**
+ * \brief Moves an entity and its component data to another archetype (Internal use only)
+ * The components that are not part of the destination archetype are dropped and the new ones are zeroed.
+ * @param ecs the ECS instance
+ * @param entity the entity ID
+ * @param archetype the index of the destination archetype
+ * @return true if the entity has been moved
+ */
+bool binocle_ecs_archetype_move_entity_internal(binocle_ecs_t *ecs, binocle_entity_id_t entity, uint64_t archetype);
+
 /**
  * \brief Creates a new system
  * @param ecs the ECS instance
@@ -397,6 +670,47 @@ bool binocle_ecs_create_system(binocle_ecs_t *ecs, const char *name,
                                uint64_t *system_ptr
 );
 
+/**
+ * \brief Creates a new chunk system
+ * A chunk system works like a normal system but its process callback receives batches of up to
+ * BINOCLE_ECS_CHUNK_CAPACITY entities together with the base pointers and strides of the watched components, so that
+ * the body of the system can be written as a tight loop.
+ * With BINOCLE_ECS_STORAGE_ARCHETYPES each chunk is a run of rows of a single archetype and the strides are the
+ * component sizes. With BINOCLE_ECS_STORAGE_ROWS each chunk is a run of consecutive entity IDs and the stride is the
+ * width of an entity row.
+ * \note With BINOCLE_ECS_STORAGE_ARCHETYPES, adding or removing components and creating entities from within
+ * process_chunk are deferred until the system has visited all its chunks, as they would move the rows being visited.
+ * Until then the entities keep their old components.
+ * @param ecs the ECS instance
+ * @param name the name of the system
+ * @param starting the callback that will be called once the system is starting up
+ * @param process_chunk the callback that will be called for each chunk of entities at each update of the system
+ * @param ending the callback that will be called when the system is terminated
+ * @param subscribed the callback that will be called once an entity has been subscribed to this system
+ * @param unsubscribed the callback that will be called once an entity has been unsubscribed from this system
+ * @param user_data a pointer to user data that can be stored within the system
+ * @param flags the flags that specify the kind of system. See \ref binocle_ecs_create_system
+ * @param system_ptr a pointer to the system's ID. This function will write the system's ID into that pointer
+ * @return true if the system has been created
+ */
+bool binocle_ecs_create_chunk_system(binocle_ecs_t *ecs, const char *name,
+                                     void (*starting)(struct binocle_ecs_t*, void *),
+                                     void (*process_chunk)(struct binocle_ecs_t*, void *, binocle_ecs_chunk_t *, float),
+                                     void (*ending)(struct binocle_ecs_t*, void *),
+                                     void (*subscribed)(struct binocle_ecs_t*, void *, binocle_entity_id_t),
+                                     void (*unsubscribed)(struct binocle_ecs_t*, void *, binocle_entity_id_t),
+                                     void *user_data,
+                                     uint64_t flags,
+                                     uint64_t *system_ptr
+);
+
+/**
+ * \brief Releases the resources allocated for a system
+ * @param ecs the ECS instance
+ * @param system the actual system structure
+ */
+void binocle_ecs_system_free(binocle_ecs_t *ecs, binocle_system_t *system);
+
 /**
  * \brief Runs a system update
  * @param ecs the ECS instance
@@ -439,6 +753,25 @@ bool binocle_ecs_watch(binocle_ecs_t *ecs, binocle_system_id_t system, binocle_c
  */
 bool binocle_ecs_exclude(binocle_ecs_t *ecs, binocle_system_id_t system, binocle_component_id_t component);
 
+/**
+ * \brief Declares that a system reads a component
+ * The watched components of a system are always considered as read once any access has been declared.
+ * @param ecs the ECS instance
+ * @param system the system ID
+ * @param component the component ID
+ * @return true if the access has been declared
+ */
+bool binocle_ecs_read(binocle_ecs_t *ecs, binocle_system_id_t system, binocle_component_id_t component);
+
+/**
+ * \brief Declares that a system writes a component
+ * @param ecs the ECS instance
+ * @param system the system ID
+ * @param component the component ID
+ * @return true if the access has been declared
+ */
+bool binocle_ecs_write(binocle_ecs_t *ecs, binocle_system_id_t system, binocle_component_id_t component);
+
 /**
  * \brief Subscribes an entity to a system
  * @param ecs the ECS instance
@@ -4,6 +4,8 @@
 // All rights reserved.
 //
 
+#include <inttypes.h>
+#include <stddef.h>
 #include <string.h>
 #include "binocle_gd.h"
 #include "backend/binocle_vpct.h"
@@ -12,6 +14,7 @@
 #include "binocle_render_state.h"
 #include "binocle_camera.h"
 #include "binocle_log.h"
+#include "binocle_profiler.h"
 #include "binocle_model.h"
 #include "binocle_window.h"
 #include "binocle_sokol.h"
@@ -28,13 +31,8 @@ typedef struct binocle_gd_flat_shader_fs_params_t {
 } binocle_gd_flat_shader_fs_params_t;
 
 binocle_gd binocle_gd_new() {
+  // The recording arrays are allocated by the first draw calls and grow with the frames
   binocle_gd res = {0};
-  res.vertices = malloc(sizeof(binocle_vpct) * BINOCLE_GD_MAX_VERTICES);
-  res.commands = malloc(sizeof(binocle_gd_command_t) * BINOCLE_GD_MAX_COMMANDS);
-  memset(res.commands, 0, sizeof(binocle_gd_command_t) * BINOCLE_GD_MAX_COMMANDS);
-  res.flat_vertices = malloc(sizeof(binocle_vpct) * BINOCLE_GD_MAX_VERTICES);
-  res.flat_commands = malloc(sizeof(binocle_gd_command_t) * BINOCLE_GD_MAX_COMMANDS);
-  memset(res.flat_commands, 0, sizeof(binocle_gd_command_t) * BINOCLE_GD_MAX_COMMANDS);
   return res;
 }
 
@@ -49,6 +47,16 @@ void binocle_gd_destroy(binocle_gd *gd) {
     gd->commands = NULL;
   }
 
+  if (gd->packed_vertices != NULL) {
+    free(gd->packed_vertices);
+    gd->packed_vertices = NULL;
+  }
+
+  if (gd->instances != NULL) {
+    free(gd->instances);
+    gd->instances = NULL;
+  }
+
   if (gd->flat_vertices != NULL) {
     free(gd->flat_vertices);
     gd->flat_vertices = NULL;
@@ -59,9 +67,168 @@ void binocle_gd_destroy(binocle_gd *gd) {
     gd->flat_commands = NULL;
   }
 
+  if (gd->uniforms != NULL) {
+    free(gd->uniforms);
+    gd->uniforms = NULL;
+  }
+
+  if (gd->fs_uniforms != NULL) {
+    free(gd->fs_uniforms);
+    gd->fs_uniforms = NULL;
+  }
+
+  if (gd->offscreen.chunk_vbufs != NULL) {
+    free(gd->offscreen.chunk_vbufs);
+    gd->offscreen.chunk_vbufs = NULL;
+  }
+
+  if (gd->flat.chunk_vbufs != NULL) {
+    free(gd->flat.chunk_vbufs);
+    gd->flat.chunk_vbufs = NULL;
+  }
+
+  if (gd->instanced.chunk_vbufs != NULL) {
+    free(gd->instanced.chunk_vbufs);
+    gd->instanced.chunk_vbufs = NULL;
+  }
+
   // TODO: deinitialize the pipeline, pass and backend
 }
 
+void binocle_gd_set_vertex_format(binocle_gd *gd, binocle_vertex_format format) {
+  gd->vertex_format = format;
+}
+
+static size_t binocle_gd_vertex_size(binocle_vertex_format format) {
+  return format == BINOCLE_VERTEX_FORMAT_PACKED ? sizeof(binocle_vpct_packed) : sizeof(binocle_vpct);
+}
+
+static sg_vertex_layout_state binocle_gd_vertex_layout(binocle_vertex_format format) {
+  if (format == BINOCLE_VERTEX_FORMAT_PACKED) {
+    return (sg_vertex_layout_state){
+      .attrs = {
+        [0] = { .format = SG_VERTEXFORMAT_FLOAT2 }, // position
+        [1] = { .format = SG_VERTEXFORMAT_UBYTE4N }, // color
+        [2] = { .format = SG_VERTEXFORMAT_USHORT2N }, // texture uv
+      },
+    };
+  }
+  return (sg_vertex_layout_state){
+    .attrs = {
+      [0] = { .format = SG_VERTEXFORMAT_FLOAT2 }, // position
+      [1] = { .format = SG_VERTEXFORMAT_FLOAT4 }, // color
+      [2] = { .format = SG_VERTEXFORMAT_FLOAT2 }, // texture uv
+    },
+  };
+}
+
+// Returns NULL if the array can't grow, leaving it and its capacity untouched
+static void *binocle_gd_ensure_capacity(void *array, uint32_t *capacity, uint32_t needed, size_t element_size) {
+  if (needed <= *capacity) {
+    return array;
+  }
+  uint32_t new_capacity = *capacity < 64 ? 64 : *capacity;
+  while (new_capacity < needed) {
+    new_capacity += new_capacity / 2; // grow by x1.5
+  }
+  void *new_array = realloc(array, element_size * new_capacity);
+  if (new_array == NULL) {
+    binocle_log_error("binocle_gd_ensure_capacity(): Cannot grow an array to %" PRIu32 " elements", new_capacity);
+    return NULL;
+  }
+  *capacity = new_capacity;
+  return new_array;
+}
+
+static uint32_t binocle_gd_reserve_vertices(uint32_t *num_vertices, uint32_t vertex_count, uint32_t alignment,
+                                            uint32_t chunk_vertices) {
+  uint32_t base = (*num_vertices + alignment - 1) / alignment * alignment;
+  // A command never spans two chunks, so skip to the next one if it doesn't fit
+  if (base % chunk_vertices + vertex_count > chunk_vertices) {
+    base = (base / chunk_vertices + 1) * chunk_vertices;
+  }
+  *num_vertices = base + vertex_count;
+  return base;
+}
+
+static sg_buffer binocle_gd_get_chunk_vbuf(binocle_gd_gfx_t *gfx, uint32_t chunk, size_t chunk_size) {
+  if (chunk == 0) {
+    return gfx->vbuf;
+  }
+  if (chunk > gfx->num_chunk_vbufs) {
+    sg_buffer *new_chunk_vbufs = realloc(gfx->chunk_vbufs, sizeof(sg_buffer) * chunk);
+    if (new_chunk_vbufs == NULL) {
+      // Sokol skips the uploads and the draws that use an invalid buffer
+      binocle_log_error("binocle_gd_get_chunk_vbuf(): Cannot grow the vertex buffers to %" PRIu32, chunk);
+      return (sg_buffer){ .id = SG_INVALID_ID };
+    }
+    gfx->chunk_vbufs = new_chunk_vbufs;
+    for (uint32_t i = gfx->num_chunk_vbufs ; i < chunk ; i++) {
+      gfx->chunk_vbufs[i] = sg_make_buffer(&(sg_buffer_desc){
+        .type = SG_BUFFERTYPE_VERTEXBUFFER,
+        .usage = SG_USAGE_STREAM,
+        .size = chunk_size,
+      });
+    }
+    gfx->num_chunk_vbufs = chunk;
+  }
+  return gfx->chunk_vbufs[chunk - 1];
+}
+
+static size_t binocle_gd_upload_chunks(binocle_gd_gfx_t *gfx, const void *vertices, uint32_t num_vertices,
+                                       uint32_t chunk_vertices, size_t vertex_size) {
+  for (uint32_t chunk = 0 ; chunk * chunk_vertices < num_vertices ; chunk++) {
+    uint32_t first = chunk * chunk_vertices;
+    uint32_t count = num_vertices - first < chunk_vertices ? num_vertices - first : chunk_vertices;
+    sg_buffer vbuf = binocle_gd_get_chunk_vbuf(gfx, chunk, chunk_vertices * vertex_size);
+    sg_update_buffer(vbuf, &(sg_range){ .ptr = (const uint8_t *)vertices + first * vertex_size, .size = count * vertex_size });
+  }
+  return num_vertices * vertex_size;
+}
+
+static binocle_gd_command_t *binocle_gd_next_command(binocle_gd_command_t **commands, uint32_t *num_commands,
+                                                     uint32_t *capacity) {
+  binocle_gd_command_t *new_commands = binocle_gd_ensure_capacity(*commands, capacity, *num_commands + 1,
+                                                                  sizeof(binocle_gd_command_t));
+  if (new_commands == NULL) {
+    return NULL;
+  }
+  *commands = new_commands;
+  binocle_gd_command_t *cmd = &(*commands)[*num_commands];
+  (*num_commands)++;
+  return cmd;
+}
+
+static bool binocle_gd_push_vertices(binocle_gd *gd, uint32_t base, const binocle_vpct *vertices,
+                                     const binocle_vpct_packed *packed_vertices, uint32_t vertex_count) {
+  if (gd->vertex_format == BINOCLE_VERTEX_FORMAT_PACKED) {
+    binocle_vpct_packed *new_packed_vertices = binocle_gd_ensure_capacity(gd->packed_vertices,
+                                                                          &gd->packed_vertices_capacity,
+                                                                          gd->num_vertices,
+                                                                          sizeof(binocle_vpct_packed));
+    if (new_packed_vertices == NULL) {
+      return false;
+    }
+    gd->packed_vertices = new_packed_vertices;
+    if (packed_vertices != NULL) {
+      memcpy(&gd->packed_vertices[base], packed_vertices, sizeof(binocle_vpct_packed) * vertex_count);
+    } else {
+      for (uint32_t i = 0 ; i < vertex_count ; i++) {
+        gd->packed_vertices[base + i] = binocle_vpct_pack(vertices[i]);
+      }
+    }
+  } else {
+    binocle_vpct *new_vertices = binocle_gd_ensure_capacity(gd->vertices, &gd->vertices_capacity, gd->num_vertices,
+                                                            sizeof(binocle_vpct));
+    if (new_vertices == NULL) {
+      return false;
+    }
+    gd->vertices = new_vertices;
+    memcpy(&gd->vertices[base], vertices, sizeof(binocle_vpct) * vertex_count);
+  }
+  return true;
+}
+
 void binocle_gd_init(binocle_gd *gd, binocle_window *win) {
 #if defined(BINOCLE_GL)
   sg_desc desc = {
@@ -76,6 +243,17 @@ void binocle_gd_init(binocle_gd *gd, binocle_window *win) {
     .environment = environment,
     .logger.func = slog_func,
   };
+#else
+  // Headless builds such as the benchmarks run on the dummy backend and don't need a window
+  (void)win;
+  sg_desc desc = {
+    .environment.defaults = {
+      .color_format = SG_PIXELFORMAT_RGBA8,
+      .depth_format = SG_PIXELFORMAT_NONE,
+      .sample_count = 1,
+    },
+    .logger.func = slog_func,
+  };
 #endif
   sg_setup(&desc);
   assert(sg_isvalid());
@@ -133,16 +311,9 @@ void binocle_gd_setup_default_pipeline(binocle_gd *gd, uint32_t offscreen_width,
   // Pipeline state object for the offscreen rendered sprite
   gd->offscreen.pip = sg_make_pipeline(&(sg_pipeline_desc) {
     .label = "offscreen-pipeline",
-      .layout = {
-          .attrs = {
-              [0] = { .format = SG_VERTEXFORMAT_FLOAT2 }, // position
-              [1] = { .format = SG_VERTEXFORMAT_FLOAT4 }, // color
-              [2] = { .format = SG_VERTEXFORMAT_FLOAT2 }, // texture uv
-          },
-      },
+      .layout = binocle_gd_vertex_layout(gd->vertex_format),
       .shader = offscreen_shader,
-//      .index_type = SG_INDEXTYPE_UINT16,
-      .index_type = SG_INDEXTYPE_NONE,
+      .index_type = SG_INDEXTYPE_UINT32,
       // .depth = {
       //     .pixel_format = SG_PIXELFORMAT_NONE,
       //     .compare = SG_COMPAREFUNC_NEVER,
@@ -172,16 +343,46 @@ void binocle_gd_setup_default_pipeline(binocle_gd *gd, uint32_t offscreen_width,
   sg_buffer_desc vbuf_desc = {
     .type = SG_BUFFERTYPE_VERTEXBUFFER,
     .usage = SG_USAGE_STREAM,
-    .size = sizeof(binocle_vpct) * BINOCLE_GD_MAX_VERTICES,
+    .size = binocle_gd_vertex_size(gd->vertex_format) * BINOCLE_GD_CHUNK_VERTICES,
   };
   gd->offscreen.vbuf = sg_make_buffer(&vbuf_desc);
 
-  sg_buffer_desc ibuf_desc = {
+  // The index buffers never change, so we fill them once here. Indices are 32 bits because the vertex buffer holds
+  // more than 65536 vertices.
+  uint32_t *index_data = malloc(sizeof(uint32_t) * BINOCLE_GD_MAX_INDICES);
+  for (uint32_t i = 0 ; i < BINOCLE_GD_MAX_QUADS ; i++) {
+    /*
+      *  TL    TR
+      *   0----1
+      *   |   /|
+      *   |  / |
+      *   | /  |
+      *   |/   |
+      *   2----3
+      *  BL    BR
+      */
+    index_data[i * 6] = i * 4;
+    index_data[i * 6 + 1] = i * 4 + 1;
+    index_data[i * 6 + 2] = i * 4 + 2;
+    index_data[i * 6 + 3] = i * 4 + 1;
+    index_data[i * 6 + 4] = i * 4 + 3;
+    index_data[i * 6 + 5] = i * 4 + 2;
+  }
+  gd->offscreen.ibuf = sg_make_buffer(&(sg_buffer_desc){
     .type = SG_BUFFERTYPE_INDEXBUFFER,
-    .usage = SG_USAGE_STREAM,
-    .size = sizeof(uint16_t) * BINOCLE_GD_MAX_INDICES,
-  };
-  gd->offscreen.ibuf = sg_make_buffer(&ibuf_desc);
+    .data = (sg_range){ .ptr = index_data, .size = sizeof(uint32_t) * BINOCLE_GD_MAX_INDICES },
+    .label = "offscreen-quad-indices",
+  });
+
+  for (uint32_t i = 0 ; i < BINOCLE_GD_MAX_VERTICES ; i++) {
+    index_data[i] = i;
+  }
+  gd->linear_ibuf = sg_make_buffer(&(sg_buffer_desc){
+    .type = SG_BUFFERTYPE_INDEXBUFFER,
+    .data = (sg_range){ .ptr = index_data, .size = sizeof(uint32_t) * BINOCLE_GD_MAX_VERTICES },
+    .label = "offscreen-linear-indices",
+  });
+  free(index_data);
 
   gd->offscreen.bind = (sg_bindings){
       .vertex_buffers = {
@@ -293,63 +494,231 @@ void binocle_gd_setup_default_pipeline(binocle_gd *gd, uint32_t offscreen_width,
   });
 }
 
-void binocle_gd_draw(binocle_gd *gd, const struct binocle_vpct *vertices, size_t vertex_count, binocle_material material,
-                     kmAABB2 viewport, binocle_camera *camera, float depth) {
-  binocle_gd_command_t *cmd = &gd->commands[gd->num_commands];
-  cmd->num_vertices = vertex_count;
-  cmd->base_vertex = gd->num_vertices;
-  cmd->img = material.albedo_texture;
-  cmd->depth = depth;
-  if (sg_query_pipeline_state(material.pip) == SG_RESOURCESTATE_VALID) {
-    cmd->pip = material.pip;
-    memcpy(cmd->custom_fs_uniforms, material.custom_fs_uniforms, 1024);
-    cmd->shader_desc = material.shader_desc;
-  } else {
-    cmd->pip.id = 0;
+// Returned when a uniform block can't be stored. The commands using it are skipped.
+#define BINOCLE_GD_INVALID_UNIFORMS (UINT32_MAX)
+
+static uint32_t binocle_gd_hash_uniforms(const kmMat4 *projection, const kmMat4 *view_matrix) {
+  // FNV-1a over the words of both matrices
+  uint32_t hash = 2166136261u;
+  const kmMat4 *matrices[2] = {projection, view_matrix};
+  for (int m = 0 ; m < 2 ; m++) {
+    for (int i = 0 ; i < 16 ; i++) {
+      uint32_t word;
+      memcpy(&word, &matrices[m]->mat[i], sizeof(word));
+      hash = (hash ^ word) * 16777619u;
+    }
   }
+  return hash;
+}
 
-  kmMat4 *cameraTransformMatrix = NULL;
-  if (camera != NULL) {
-    cameraTransformMatrix = binocle_camera_get_transform_matrix(camera);
+static uint32_t binocle_gd_intern_uniforms(binocle_gd *gd, kmAABB2 viewport, const kmMat4 *view_matrix) {
+  if (!gd->projection_valid || memcmp(&gd->projection_viewport, &viewport, sizeof(kmAABB2)) != 0) {
+    gd->projection = binocle_math_create_orthographic_matrix_off_center(viewport.min.x, viewport.max.x,
+                                                                        viewport.min.y, viewport.max.y, -1000.0f,
+                                                                        1000.0f);
+    gd->projection_viewport = viewport;
+    gd->projection_valid = true;
+  }
+
+  // Consecutive draws usually share their camera, so the last block is checked before hashing
+  if (gd->num_uniforms > 0) {
+    binocle_gd_uniform_t *last = &gd->uniforms[gd->num_uniforms - 1];
+    if (memcmp(&last->projectionMatrix, &gd->projection, sizeof(kmMat4)) == 0 &&
+        memcmp(&last->viewMatrix, view_matrix, sizeof(kmMat4)) == 0) {
+      return gd->num_uniforms - 1;
+    }
+  }
+
+  // Draws that alternate between cameras, like the world and the UI, find the blocks recorded before
+  uint32_t *slot = &gd->uniforms_lookup[binocle_gd_hash_uniforms(&gd->projection, view_matrix) & (BINOCLE_GD_UNIFORMS_LOOKUP_SIZE - 1)];
+  if (*slot > 0) {
+    binocle_gd_uniform_t *found = &gd->uniforms[*slot - 1];
+    if (memcmp(&found->projectionMatrix, &gd->projection, sizeof(kmMat4)) == 0 &&
+        memcmp(&found->viewMatrix, view_matrix, sizeof(kmMat4)) == 0) {
+      return *slot - 1;
+    }
+  }
+
+  if (gd->num_uniforms >= gd->uniforms_capacity) {
+    uint32_t new_capacity = gd->uniforms_capacity == 0 ? 64 : gd->uniforms_capacity + gd->uniforms_capacity / 2; // grow by x1.5
+    binocle_gd_uniform_t *new_uniforms = realloc(gd->uniforms, sizeof(binocle_gd_uniform_t) * new_capacity);
+    if (new_uniforms == NULL) {
+      binocle_log_error("binocle_gd_intern_uniforms(): Cannot grow the uniform blocks to %" PRIu32, new_capacity);
+      return BINOCLE_GD_INVALID_UNIFORMS;
+    }
+    gd->uniforms = new_uniforms;
+    gd->uniforms_capacity = new_capacity;
+  }
+
+  binocle_gd_uniform_t *uniforms = &gd->uniforms[gd->num_uniforms];
+  uniforms->projectionMatrix = gd->projection;
+  uniforms->viewMatrix = *view_matrix;
+  kmMat4Identity(&uniforms->modelMatrix);
+  *slot = gd->num_uniforms + 1;
+  return gd->num_uniforms++;
+}
+
+static uint32_t binocle_gd_intern_fs_uniforms(binocle_gd *gd, const void *data, uint32_t size) {
+  if (gd->fs_uniforms_size > 0 && gd->fs_uniforms_last_size == size &&
+      memcmp(gd->fs_uniforms + gd->fs_uniforms_last_offset, data, size) == 0) {
+    return gd->fs_uniforms_last_offset;
+  }
+
+  // Keep every block 16 bytes aligned
+  uint32_t offset = (gd->fs_uniforms_size + 15) & ~15u;
+  if (offset + size > gd->fs_uniforms_capacity) {
+    uint32_t new_capacity = gd->fs_uniforms_capacity == 0 ? 4096 : gd->fs_uniforms_capacity + gd->fs_uniforms_capacity / 2;
+    if (new_capacity < offset + size) {
+      new_capacity = offset + size;
+    }
+    uint8_t *new_fs_uniforms = realloc(gd->fs_uniforms, new_capacity);
+    if (new_fs_uniforms == NULL) {
+      binocle_log_error("binocle_gd_intern_fs_uniforms(): Cannot grow the uniform blocks to %" PRIu32 " bytes", new_capacity);
+      return BINOCLE_GD_INVALID_UNIFORMS;
+    }
+    gd->fs_uniforms = new_fs_uniforms;
+    gd->fs_uniforms_capacity = new_capacity;
   }
 
-  cmd->uniforms.projectionMatrix = binocle_math_create_orthographic_matrix_off_center(viewport.min.x, viewport.max.x,
-                                                                                          viewport.min.y, viewport.max.y, -1000.0f,
-                                                                                          1000.0f);
-  kmMat4Identity(&cmd->uniforms.viewMatrix);
+  memcpy(gd->fs_uniforms + offset, data, size);
+  gd->fs_uniforms_size = offset + size;
+  gd->fs_uniforms_last_offset = offset;
+  gd->fs_uniforms_last_size = size;
+  return offset;
+}
+
+static void binocle_gd_reset_uniforms(binocle_gd *gd) {
+  // Both command lists reference the same uniform blocks, so they can only be dropped once both have been rendered
+  if (gd->num_commands == 0 && gd->flat_num_commands == 0) {
+    gd->num_uniforms = 0;
+    gd->fs_uniforms_size = 0;
+    memset(gd->uniforms_lookup, 0, sizeof(gd->uniforms_lookup));
+  }
+}
 
-  if (cameraTransformMatrix != NULL) {
-    kmMat4Multiply(&cmd->uniforms.viewMatrix, &cmd->uniforms.viewMatrix, cameraTransformMatrix);
+static void binocle_gd_record(binocle_gd *gd, const binocle_material *material, kmAABB2 viewport,
+                              const kmMat4 *view_matrix, float depth, const binocle_vpct *vertices,
+                              const binocle_vpct_packed *packed_vertices, uint32_t vertex_count, bool quads) {
+  // Draws that don't fit in a chunk are split into several commands, keeping whole quads and triangles together
+  uint32_t alignment = quads ? 4 : 3;
+  uint32_t max_vertices = BINOCLE_GD_CHUNK_VERTICES - BINOCLE_GD_CHUNK_VERTICES % alignment;
+  uint32_t fs_uniforms_size = 0;
+  uint32_t fs_uniforms_offset = 0;
+  sg_pipeline pip = { .id = SG_INVALID_ID };
+
+  if (sg_query_pipeline_state(material->pip) == SG_RESOURCESTATE_VALID) {
+    pip = material->pip;
+    fs_uniforms_size = material->shader_desc.fs.uniform_blocks[0].size;
+    fs_uniforms_offset = binocle_gd_intern_fs_uniforms(gd, material->custom_fs_uniforms, fs_uniforms_size);
   }
+  uint32_t uniforms = binocle_gd_intern_uniforms(gd, viewport, view_matrix);
 
-  kmMat4Identity(&cmd->uniforms.modelMatrix);
+  while (vertex_count > 0) {
+    uint32_t count = vertex_count < max_vertices ? vertex_count : max_vertices;
+    binocle_gd_command_t *cmd = binocle_gd_next_command(&gd->commands, &gd->num_commands, &gd->commands_capacity);
+    if (cmd == NULL) {
+      return;
+    }
+    cmd->img = material->albedo_texture;
+    cmd->depth = depth;
+    cmd->pip = pip;
+    cmd->fs_uniforms_size = fs_uniforms_size;
+    cmd->fs_uniforms_offset = fs_uniforms_offset;
+    cmd->uniforms = uniforms;
+    cmd->quads = quads;
+    cmd->instanced = false;
+    cmd->vbuf.id = SG_INVALID_ID;
+    cmd->num_vertices = count;
+    // The quad index buffer addresses whole quads, so their first vertex must sit on a multiple of 4
+    uint32_t num_vertices = gd->num_vertices;
+    cmd->base_vertex = binocle_gd_reserve_vertices(&gd->num_vertices, count, quads ? 4 : 1, BINOCLE_GD_CHUNK_VERTICES);
+
+    if (!binocle_gd_push_vertices(gd, cmd->base_vertex, vertices, packed_vertices, count)) {
+      // Drop the command, its vertices couldn't be stored
+      gd->num_vertices = num_vertices;
+      gd->num_commands--;
+      return;
+    }
 
-  gd->num_commands++;
+    if (vertices != NULL) {
+      vertices += count;
+    }
+    if (packed_vertices != NULL) {
+      packed_vertices += count;
+    }
+    vertex_count -= count;
+  }
+}
 
-  for (uint32_t i = 0 ; i < vertex_count ; i++) {
-    binocle_vpct *v = &gd->vertices[gd->num_vertices];
-    v->pos.x = vertices[i].pos.x;
-    v->pos.y = vertices[i].pos.y;
-    v->color.r = vertices[i].color.r;
-    v->color.g = vertices[i].color.g;
-    v->color.b = vertices[i].color.b;
-    v->color.a = vertices[i].color.a;
-    v->tex.x = vertices[i].tex.x;
-    v->tex.y = vertices[i].tex.y;
-    gd->num_vertices++;
+void binocle_gd_draw(binocle_gd *gd, const struct binocle_vpct *vertices, size_t vertex_count, const binocle_material *material,
+                     kmAABB2 viewport, binocle_camera *camera, float depth) {
+  kmMat4 view_matrix;
+  if (camera != NULL) {
+    view_matrix = *binocle_camera_get_transform_matrix(camera);
+  } else {
+    kmMat4Identity(&view_matrix);
   }
 
-//  LEGACY_binocle_backend_draw(vertices, vertex_count, material, viewport, cameraTransformMatrix);
+  binocle_gd_record(gd, material, viewport, &view_matrix, depth, vertices, NULL, vertex_count, false);
 }
 
 #define binocle_gd_command_lt(a, b) ((a).depth < (b).depth)
 KSORT_INIT(binocle_gd_sort_commands, binocle_gd_command_t, binocle_gd_command_lt)
 
+binocle_gd_stats_t binocle_gd_get_stats(binocle_gd *gd) {
+  return gd->stats;
+}
+
+void binocle_gd_reset_stats(binocle_gd *gd) {
+  memset(&gd->stats, 0, sizeof(gd->stats));
+}
+
+static bool binocle_gd_can_merge_commands(const binocle_gd_command_t *a, const binocle_gd_command_t *b,
+                                          uint32_t chunk_vertices) {
+  // The vertices of b must follow those of a in the same chunk, and the two must be drawn with the same state
+  if (a->instanced) {
+    chunk_vertices = BINOCLE_GD_CHUNK_INSTANCES;
+  }
+  return b->base_vertex == a->base_vertex + a->num_vertices &&
+         a->base_vertex / chunk_vertices == (b->base_vertex + b->num_vertices - 1) / chunk_vertices &&
+         a->quads == b->quads &&
+         a->instanced == b->instanced &&
+         a->vbuf.id == b->vbuf.id &&
+         a->img.id == b->img.id &&
+         a->pip.id == b->pip.id &&
+         a->uniforms == b->uniforms &&
+         (a->pip.id == SG_INVALID_ID || a->fs_uniforms_offset == b->fs_uniforms_offset);
+}
+
+static uint32_t binocle_gd_coalesce_commands(binocle_gd_command_t *commands, uint32_t num_commands,
+                                             uint32_t chunk_vertices) {
+  if (num_commands == 0) {
+    return 0;
+  }
+
+  uint32_t count = 1;
+  for (uint32_t i = 1 ; i < num_commands ; i++) {
+    binocle_gd_command_t *last = &commands[count - 1];
+    if (binocle_gd_can_merge_commands(last, &commands[i], chunk_vertices)) {
+      last->num_vertices += commands[i].num_vertices;
+    } else {
+      commands[count++] = commands[i];
+    }
+  }
+  return count;
+}
+
 void binocle_gd_render_offscreen(binocle_gd *gd) {
-  if (gd->num_vertices == 0) {
+  if (gd->num_commands == 0) {
     return;
   }
-  sg_update_buffer(gd->offscreen.vbuf, &(sg_range){ .ptr=gd->vertices, .size=gd->num_vertices * sizeof(binocle_vpct) });
+  BINOCLE_PROFILE_ZONE_BEGIN("gd_render_offscreen");
+  size_t bytes_uploaded = binocle_gd_upload_chunks(&gd->instanced, gd->instances, gd->num_instances, BINOCLE_GD_CHUNK_INSTANCES, sizeof(binocle_vpct_instance));
+  if (gd->vertex_format == BINOCLE_VERTEX_FORMAT_PACKED) {
+    bytes_uploaded += binocle_gd_upload_chunks(&gd->offscreen, gd->packed_vertices, gd->num_vertices, BINOCLE_GD_CHUNK_VERTICES, sizeof(binocle_vpct_packed));
+  } else {
+    bytes_uploaded += binocle_gd_upload_chunks(&gd->offscreen, gd->vertices, gd->num_vertices, BINOCLE_GD_CHUNK_VERTICES, sizeof(binocle_vpct));
+  }
 
   sg_begin_pass(&(sg_pass){
     .action = gd->offscreen.action,
@@ -358,27 +727,107 @@ void binocle_gd_render_offscreen(binocle_gd *gd) {
 
   ks_mergesort(binocle_gd_sort_commands, gd->num_commands, gd->commands, 0);
 
+  // Adjacent commands that share all their state become a single draw call
+  uint32_t num_commands = binocle_gd_coalesce_commands(gd->commands, gd->num_commands, BINOCLE_GD_CHUNK_VERTICES);
+  gd->stats.commands += gd->num_commands;
+  gd->stats.draw_calls += num_commands;
+  gd->stats.coalesced_draw_calls += gd->num_commands - num_commands;
+  gd->num_commands = num_commands;
+
+  // Only the state that differs from the previous command gets applied
+  sg_pipeline applied_pip = { .id = SG_INVALID_ID };
+  sg_image applied_img = { .id = SG_INVALID_ID };
+  bool applied_quads = false;
+  sg_buffer applied_vbuf = { .id = SG_INVALID_ID };
+  uint32_t applied_uniforms = 0;
+  uint32_t applied_fs_uniforms = 0;
+  uint64_t state_changes = 0;
+  uint64_t vertices = 0;
+
   for (uint32_t i = 0 ; i < gd->num_commands ; i++) {
     binocle_gd_command_t *cmd = &gd->commands[i];
+    bool custom_pipeline = !cmd->instanced && cmd->pip.id != SG_INVALID_ID;
+    if (cmd->uniforms == BINOCLE_GD_INVALID_UNIFORMS ||
+        (custom_pipeline && cmd->fs_uniforms_offset == BINOCLE_GD_INVALID_UNIFORMS)) {
+      // Its uniforms couldn't be stored
+      continue;
+    }
+    sg_pipeline pip = custom_pipeline ? cmd->pip : gd->offscreen.pip;
+    if (cmd->instanced) {
+      pip = gd->instanced.pip;
+    }
 
-    gd->offscreen.bind.fs.images[0] = cmd->img;
-    gd->offscreen.bind.vertex_buffers[0] = gd->offscreen.vbuf;
+    // Applying a pipeline resets the bindings and the uniforms
+    bool pipeline_changed = i == 0 || pip.id != applied_pip.id;
+    if (pipeline_changed) {
+      sg_apply_pipeline(pip);
+      applied_pip = pip;
+      state_changes++;
+    }
+
+    sg_buffer vbuf = cmd->vbuf;
+    uint32_t base_vertex = cmd->base_vertex;
+    if (vbuf.id == SG_INVALID_ID && !cmd->instanced) {
+      vbuf = binocle_gd_get_chunk_vbuf(&gd->offscreen, cmd->base_vertex / BINOCLE_GD_CHUNK_VERTICES, 0);
+      base_vertex = cmd->base_vertex % BINOCLE_GD_CHUNK_VERTICES;
+    }
+    if (cmd->instanced) {
+      // There's no base instance in sg_draw, so each instanced command binds the instance buffer at its first instance
+      uint32_t instance_chunk = cmd->base_vertex / BINOCLE_GD_CHUNK_INSTANCES;
+      uint32_t base_instance = cmd->base_vertex % BINOCLE_GD_CHUNK_INSTANCES;
+      gd->instanced.bind.fs.images[0] = cmd->img;
+      gd->instanced.bind.vertex_buffers[1] = binocle_gd_get_chunk_vbuf(&gd->instanced, instance_chunk, 0);
+      gd->instanced.bind.vertex_buffer_offsets[1] = (int)(base_instance * sizeof(binocle_vpct_instance));
+      sg_apply_bindings(&gd->instanced.bind);
+      state_changes++;
+    } else if (pipeline_changed || cmd->img.id != applied_img.id || cmd->quads != applied_quads || vbuf.id != applied_vbuf.id) {
+      gd->offscreen.bind.fs.images[0] = cmd->img;
+      gd->offscreen.bind.vertex_buffers[0] = vbuf;
+      gd->offscreen.bind.index_buffer = cmd->quads ? gd->offscreen.ibuf : gd->linear_ibuf;
+      sg_apply_bindings(&gd->offscreen.bind);
+      applied_img = cmd->img;
+      applied_quads = cmd->quads;
+      applied_vbuf = vbuf;
+      state_changes++;
+    }
+
+    if (pipeline_changed || cmd->uniforms != applied_uniforms) {
+      sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, &SG_RANGE(gd->uniforms[cmd->uniforms]));
+      applied_uniforms = cmd->uniforms;
+      state_changes++;
+    }
+
+    if (custom_pipeline && (pipeline_changed || cmd->fs_uniforms_offset != applied_fs_uniforms)) {
+      sg_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){.ptr = gd->fs_uniforms + cmd->fs_uniforms_offset, .size = cmd->fs_uniforms_size});
+      applied_fs_uniforms = cmd->fs_uniforms_offset;
+      state_changes++;
+    }
 
-    if (sg_query_pipeline_state(cmd->pip) == SG_RESOURCESTATE_VALID) {
-      sg_apply_pipeline(cmd->pip);
-      sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, &SG_RANGE(cmd->uniforms));
-      sg_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){.ptr = cmd->custom_fs_uniforms, .size = cmd->shader_desc.fs.uniform_blocks[0].size});
+    if (cmd->instanced) {
+      sg_draw(0, 6, cmd->num_vertices);
+      vertices += 6 * cmd->num_vertices;
+    } else if (cmd->quads) {
+      sg_draw(base_vertex / 4 * 6, cmd->num_vertices / 4 * 6, 1);
+      vertices += cmd->num_vertices;
     } else {
-      sg_apply_pipeline(gd->offscreen.pip);
-      sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, &SG_RANGE(cmd->uniforms));
+      sg_draw(base_vertex, cmd->num_vertices, 1);
+      vertices += cmd->num_vertices;
     }
-    sg_apply_bindings(&gd->offscreen.bind);
-    sg_draw(cmd->base_vertex, cmd->num_vertices, 1);
 
   }
   sg_end_pass();
+  gd->stats.state_changes += state_changes;
+  gd->stats.vertices += vertices;
+  gd->stats.bytes_uploaded += bytes_uploaded;
+  BINOCLE_PROFILE_COUNTER(BINOCLE_PROFILER_COUNTER_DRAWS, num_commands);
+  BINOCLE_PROFILE_COUNTER(BINOCLE_PROFILER_COUNTER_STATE_CHANGES, state_changes);
+  BINOCLE_PROFILE_COUNTER(BINOCLE_PROFILER_COUNTER_VERTICES, vertices);
+  BINOCLE_PROFILE_COUNTER(BINOCLE_PROFILER_COUNTER_BYTES_UPLOADED, bytes_uploaded);
   gd->num_commands = 0;
   gd->num_vertices = 0;
+  gd->num_instances = 0;
+  binocle_gd_reset_uniforms(gd);
+  BINOCLE_PROFILE_ZONE_END();
 }
 
 void binocle_gd_render_screen(binocle_gd *gd, struct binocle_window *window, float design_width, float design_height, kmAABB2 viewport, kmMat4 matrix, float scale) {
@@ -538,7 +987,7 @@ void binocle_gd_setup_flat_pipeline(binocle_gd *gd, const char *vs_src, const ch
   sg_buffer_desc vbuf_desc = {
     .type = SG_BUFFERTYPE_VERTEXBUFFER,
     .usage = SG_USAGE_STREAM,
-    .size = sizeof(binocle_vpct) * 4096,
+    .size = sizeof(binocle_vpct) * BINOCLE_GD_FLAT_CHUNK_VERTICES,
   };
   gd->flat.vbuf = sg_make_buffer(&vbuf_desc);
 
@@ -671,7 +1120,7 @@ void binocle_gd_set_render_target(sg_image render_target) {
 }
 
 void binocle_gd_draw_quad(binocle_gd *gd, sg_image image) {
-  static const GLfloat g_quad_vertex_buffer_data[] = {
+  static const float g_quad_vertex_buffer_data[] = {
       -1.0f, -1.0f,
       1.0f, -1.0f,
       -1.0f, 1.0f,
@@ -753,104 +1202,154 @@ void binocle_gd_draw_quad_to_screen(binocle_gd *gd, sg_shader shader, sg_image r
   sg_end_pass();
 }
 
-void binocle_gd_draw_flat(binocle_gd *gd, const struct binocle_vpct *vertices, size_t vertex_count,
-                     kmAABB2 viewport, binocle_camera *camera, kmMat4 *view_matrix, float depth) {
-  binocle_gd_command_t *cmd = &gd->flat_commands[gd->flat_num_commands];
+static binocle_vpct *binocle_gd_reserve_flat(binocle_gd *gd, kmAABB2 viewport, binocle_camera *camera, float depth,
+                                             uint32_t vertex_count) {
+  // Primitives are transformed on the CPU, so all the ones seen through the same camera share their uniforms and the
+  // coalescing pass in binocle_gd_render_flat merges them into a single draw
+  kmMat4 view_matrix;
+  if (camera != NULL) {
+    view_matrix = *binocle_camera_get_transform_matrix(camera);
+  } else {
+    kmMat4Identity(&view_matrix);
+  }
+
+  binocle_gd_command_t *cmd = binocle_gd_next_command(&gd->flat_commands, &gd->flat_num_commands, &gd->flat_commands_capacity);
+  if (cmd == NULL) {
+    return NULL;
+  }
+  uint32_t num_vertices = gd->flat_num_vertices;
   cmd->num_vertices = vertex_count;
-  cmd->base_vertex = gd->flat_num_vertices;
+  cmd->base_vertex = binocle_gd_reserve_vertices(&gd->flat_num_vertices, vertex_count, 1, BINOCLE_GD_FLAT_CHUNK_VERTICES);
   cmd->depth = depth;
-
-  kmMat4 *cameraTransformMatrix = NULL;
-  if (camera != NULL) {
-    cameraTransformMatrix = binocle_camera_get_transform_matrix(camera);
+  cmd->uniforms = binocle_gd_intern_uniforms(gd, viewport, &view_matrix);
+  cmd->quads = false;
+  cmd->instanced = false;
+  cmd->vbuf.id = SG_INVALID_ID;
+  cmd->img.id = SG_INVALID_ID;
+  cmd->pip.id = SG_INVALID_ID;
+  cmd->fs_uniforms_offset = 0;
+  cmd->fs_uniforms_size = 0;
+
+  binocle_vpct *new_flat_vertices = binocle_gd_ensure_capacity(gd->flat_vertices, &gd->flat_vertices_capacity,
+                                                               gd->flat_num_vertices, sizeof(binocle_vpct));
+  if (new_flat_vertices == NULL) {
+    // Drop the command, its vertices couldn't be stored
+    gd->flat_num_vertices = num_vertices;
+    gd->flat_num_commands--;
+    return NULL;
   }
+  gd->flat_vertices = new_flat_vertices;
+  return &gd->flat_vertices[cmd->base_vertex];
+}
 
-  cmd->uniforms.projectionMatrix = binocle_math_create_orthographic_matrix_off_center(viewport.min.x, viewport.max.x,
-                                                                                      viewport.min.y, viewport.max.y, -1000.0f,
-                                                                                      1000.0f);
-  kmMat4Identity(&cmd->uniforms.viewMatrix);
+static kmVec2 binocle_gd_transform_point(const kmMat4 *m, float x, float y) {
+  kmVec2 res;
+  res.x = m->mat[0] * x + m->mat[4] * y + m->mat[12];
+  res.y = m->mat[1] * x + m->mat[5] * y + m->mat[13];
+  return res;
+}
 
-  if (cameraTransformMatrix != NULL) {
-    kmMat4Multiply(&cmd->uniforms.viewMatrix, &cmd->uniforms.viewMatrix, cameraTransformMatrix);
-  }
+static binocle_vpct *binocle_gd_write_flat_quad(binocle_vpct *v, kmVec2 tl, kmVec2 tr, kmVec2 bl, kmVec2 br, sg_color col) {
+  v[0] = (binocle_vpct){ .pos = tl, .color = col };
+  v[1] = (binocle_vpct){ .pos = tr, .color = col };
+  v[2] = (binocle_vpct){ .pos = bl, .color = col };
+  v[3] = (binocle_vpct){ .pos = bl, .color = col };
+  v[4] = (binocle_vpct){ .pos = tr, .color = col };
+  v[5] = (binocle_vpct){ .pos = br, .color = col };
+  return v + 6;
+}
 
-  if (view_matrix != NULL) {
-    kmMat4Multiply(&cmd->uniforms.viewMatrix, &cmd->uniforms.viewMatrix, view_matrix);
-  }
+static binocle_vpct *binocle_gd_write_flat_rect(binocle_vpct *v, kmAABB2 rect, sg_color col) {
+  return binocle_gd_write_flat_quad(v,
+                                    (kmVec2){ .x = rect.min.x, .y = rect.min.y },
+                                    (kmVec2){ .x = rect.max.x, .y = rect.min.y },
+                                    (kmVec2){ .x = rect.min.x, .y = rect.max.y },
+                                    (kmVec2){ .x = rect.max.x, .y = rect.max.y },
+                                    col);
+}
 
-  kmMat4Identity(&cmd->uniforms.modelMatrix);
+void binocle_gd_draw_flat(binocle_gd *gd, const struct binocle_vpct *vertices, size_t vertex_count,
+                     kmAABB2 viewport, binocle_camera *camera, kmMat4 *view_matrix, float depth) {
+  uint32_t max_vertices = BINOCLE_GD_FLAT_CHUNK_VERTICES - BINOCLE_GD_FLAT_CHUNK_VERTICES % 3;
 
-  gd->flat_num_commands++;
+  while (vertex_count > 0) {
+    uint32_t count = vertex_count < max_vertices ? vertex_count : max_vertices;
+    binocle_vpct *v = binocle_gd_reserve_flat(gd, viewport, camera, depth, count);
+    if (v == NULL) {
+      return;
+    }
+    if (view_matrix != NULL) {
+      for (uint32_t i = 0 ; i < count ; i++) {
+        v[i] = vertices[i];
+        v[i].pos = binocle_gd_transform_point(view_matrix, vertices[i].pos.x, vertices[i].pos.y);
+      }
+    } else {
+      memcpy(v, vertices, sizeof(binocle_vpct) * count);
+    }
 
-  for (uint32_t i = 0 ; i < vertex_count ; i++) {
-    binocle_vpct *v = &gd->flat_vertices[gd->flat_num_vertices];
-    v->pos.x = vertices[i].pos.x;
-    v->pos.y = vertices[i].pos.y;
-    v->color.r = vertices[i].color.r;
-    v->color.g = vertices[i].color.g;
-    v->color.b = vertices[i].color.b;
-    v->color.a = vertices[i].color.a;
-    v->tex.x = vertices[i].tex.x;
-    v->tex.y = vertices[i].tex.y;
-    gd->flat_num_vertices++;
+    vertices += count;
+    vertex_count -= count;
   }
 }
 
 void binocle_gd_draw_rect(binocle_gd *gd, kmAABB2 rect, sg_color col, kmAABB2 viewport, binocle_camera *camera, kmMat4 *view_matrix, float depth) {
-  static binocle_vpct g_quad_vertex_buffer_data[6] = {0};
-  g_quad_vertex_buffer_data[0] = (binocle_vpct){
-    .pos = {.x = rect.min.x, .y = rect.min.y},
-    .color = {.r = col.r, .g = col.g, .b = col.b, .a = col.a}
-  };
-  g_quad_vertex_buffer_data[1] = (binocle_vpct){
-    .pos = {.x = rect.max.x, .y = rect.min.y},
-    .color = {.r = col.r, .g = col.g, .b = col.b, .a = col.a}
-  };
-  g_quad_vertex_buffer_data[2] = (binocle_vpct){
-    .pos = {.x = rect.min.x, .y = rect.max.y},
-    .color = {.r = col.r, .g = col.g, .b = col.b, .a = col.a}
-  };
-  g_quad_vertex_buffer_data[3] = (binocle_vpct){
-    .pos = {.x = rect.min.x, .y = rect.max.y},
-    .color = {.r = col.r, .g = col.g, .b = col.b, .a = col.a}
-  };
-  g_quad_vertex_buffer_data[4] = (binocle_vpct){
-    .pos = {.x = rect.max.x, .y = rect.min.y},
-    .color = {.r = col.r, .g = col.g, .b = col.b, .a = col.a}
-  };
-  g_quad_vertex_buffer_data[5] = (binocle_vpct){
-    .pos = {.x = rect.max.x, .y = rect.max.y},
-    .color = {.r = col.r, .g = col.g, .b = col.b, .a = col.a}
-  };
-
-  binocle_gd_draw_flat(gd, g_quad_vertex_buffer_data, 6, viewport, camera, view_matrix, depth);
+  binocle_vpct *v = binocle_gd_reserve_flat(gd, viewport, camera, depth, 6);
+  if (v == NULL) {
+    return;
+  }
+  if (view_matrix != NULL) {
+    binocle_gd_write_flat_quad(v,
+                               binocle_gd_transform_point(view_matrix, rect.min.x, rect.min.y),
+                               binocle_gd_transform_point(view_matrix, rect.max.x, rect.min.y),
+                               binocle_gd_transform_point(view_matrix, rect.min.x, rect.max.y),
+                               binocle_gd_transform_point(view_matrix, rect.max.x, rect.max.y),
+                               col);
+  } else {
+    binocle_gd_write_flat_rect(v, rect, col);
+  }
 }
 
 void binocle_gd_render_flat(binocle_gd *gd) {
   if (gd->flat_num_vertices == 0) {
     return;
   }
-  sg_update_buffer(gd->flat.vbuf, &(sg_range){ .ptr=gd->flat_vertices, .size=gd->flat_num_vertices * sizeof(binocle_vpct) });
+  binocle_gd_upload_chunks(&gd->flat, gd->flat_vertices, gd->flat_num_vertices, BINOCLE_GD_FLAT_CHUNK_VERTICES, sizeof(binocle_vpct));
 
   sg_begin_pass(&(sg_pass){
     .action = gd->flat.action,
     .attachments = gd->flat.attachments,
   });
 
+  uint32_t num_commands = binocle_gd_coalesce_commands(gd->flat_commands, gd->flat_num_commands, BINOCLE_GD_FLAT_CHUNK_VERTICES);
+  gd->stats.commands += gd->flat_num_commands;
+  gd->stats.draw_calls += num_commands;
+  gd->stats.coalesced_draw_calls += gd->flat_num_commands - num_commands;
+  gd->flat_num_commands = num_commands;
+
+  // All the flat commands share the same pipeline, the bindings only change with the chunk
+  sg_apply_pipeline(gd->flat.pip);
+
   for (uint32_t i = 0 ; i < gd->flat_num_commands ; i++) {
     binocle_gd_command_t *cmd = &gd->flat_commands[i];
+    uint32_t chunk = cmd->base_vertex / BINOCLE_GD_FLAT_CHUNK_VERTICES;
 
-    gd->flat.bind.vertex_buffers[0] = gd->flat.vbuf;
-
-    sg_apply_pipeline(gd->flat.pip);
-    sg_apply_bindings(&gd->flat.bind);
-    sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, SG_RANGE_REF(cmd->uniforms));
-    sg_draw(cmd->base_vertex, cmd->num_vertices, 1);
+    if (i == 0 || chunk != gd->flat_commands[i - 1].base_vertex / BINOCLE_GD_FLAT_CHUNK_VERTICES) {
+      gd->flat.bind.vertex_buffers[0] = binocle_gd_get_chunk_vbuf(&gd->flat, chunk, 0);
+      sg_apply_bindings(&gd->flat.bind);
+    }
+    if (cmd->uniforms == BINOCLE_GD_INVALID_UNIFORMS) {
+      continue;
+    }
+    if (i == 0 || cmd->uniforms != gd->flat_commands[i - 1].uniforms) {
+      sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, &SG_RANGE(gd->uniforms[cmd->uniforms]));
+    }
+    sg_draw(cmd->base_vertex % BINOCLE_GD_FLAT_CHUNK_VERTICES, cmd->num_vertices, 1);
 
   }
   sg_end_pass();
   gd->flat_num_commands = 0;
   gd->flat_num_vertices = 0;
+  binocle_gd_reset_uniforms(gd);
 }
 
 void binocle_gd_draw_rect_outline(binocle_gd *gd, kmAABB2 rect, sg_color col, kmAABB2 viewport, binocle_camera *camera, float depth) {
@@ -879,123 +1378,171 @@ void binocle_gd_draw_rect_outline(binocle_gd *gd, kmAABB2 rect, sg_color col, km
   rect_right.max.x = rect.max.x;
   rect_right.max.y = rect.max.y;
 
-  binocle_gd_draw_rect(gd, rect_bottom, col, viewport, camera, NULL, depth);
-  binocle_gd_draw_rect(gd, rect_top, col, viewport, camera, NULL, depth);
-  binocle_gd_draw_rect(gd, rect_left, col, viewport, camera, NULL, depth);
-  binocle_gd_draw_rect(gd, rect_right, col, viewport, camera, NULL, depth);
+  binocle_vpct *v = binocle_gd_reserve_flat(gd, viewport, camera, depth, 4 * 6);
+  if (v == NULL) {
+    return;
+  }
+  v = binocle_gd_write_flat_rect(v, rect_bottom, col);
+  v = binocle_gd_write_flat_rect(v, rect_top, col);
+  v = binocle_gd_write_flat_rect(v, rect_left, col);
+  binocle_gd_write_flat_rect(v, rect_right, col);
 }
 
 void binocle_gd_draw_line(binocle_gd *gd, kmVec2 start, kmVec2 end, sg_color col, kmAABB2 viewport, binocle_camera *camera, float depth) {
-
-  float angle = atan2f(end.y - start.y, end.x - start.x);
+  // The line is a quad one unit thick that extends from start to end on the left side of the direction
   float length = kmVec2DistanceBetween(&start, &end);
-  kmAABB2 rect;
-  rect.min.x = 0;
-  rect.min.y = 0;
-  rect.max.x = 1;
-  rect.max.y = 1;
-
-  kmMat4 viewMatrix;
-  kmMat4Identity(&viewMatrix);
-
-  kmMat4 trans;
-  kmMat4Translation(&trans, start.x, start.y, 0);
-
-  kmMat4 scale;
-  kmMat4Scaling(&scale, length, 1, 0); // y is the thickness of the line
-
-  kmMat4 rot;
-  kmMat4RotationZ(&rot, angle);
+  kmVec2 normal;
+  if (length > 0.0f) {
+    normal.x = -(end.y - start.y) / length;
+    normal.y = (end.x - start.x) / length;
+  } else {
+    normal.x = 0.0f;
+    normal.y = 1.0f;
+  }
 
-  kmMat4Multiply(&viewMatrix, &viewMatrix, &trans);
-  kmMat4Multiply(&viewMatrix, &viewMatrix, &rot);
-  kmMat4Multiply(&viewMatrix, &viewMatrix, &scale);
+  binocle_vpct *v = binocle_gd_reserve_flat(gd, viewport, camera, depth, 6);
+  if (v == NULL) {
+    return;
+  }
+  binocle_gd_write_flat_quad(v,
+                             start,
+                             end,
+                             (kmVec2){ .x = start.x + normal.x, .y = start.y + normal.y },
+                             (kmVec2){ .x = end.x + normal.x, .y = end.y + normal.y },
+                             col);
+}
 
-  binocle_gd_draw_rect(gd, rect, col, viewport, camera, &viewMatrix, depth);
+void binocle_gd_set_circle_segments(binocle_gd *gd, uint32_t segments) {
+  if (segments != 0 && segments < 3) {
+    segments = 3;
+  }
+  gd->circle_segments = segments;
 }
 
 void binocle_gd_draw_circle(binocle_gd *gd, kmVec2 center, float radius, sg_color col, kmAABB2 viewport, binocle_camera *camera, float depth) {
-  static binocle_vpct vertex_buffer_data[3 * 32] = {0};
-
-  int circle_segments = 32;
+  uint32_t circle_segments = gd->circle_segments != 0 ? gd->circle_segments : BINOCLE_GD_DEFAULT_CIRCLE_SEGMENTS;
+  // The whole fan must fit in a single chunk
+  if (circle_segments > BINOCLE_GD_FLAT_CHUNK_VERTICES / 3 + 2) {
+    circle_segments = BINOCLE_GD_FLAT_CHUNK_VERTICES / 3 + 2;
+  }
   float increment = M_PI * 2.0f / circle_segments;
-  float theta = 0.0f;
-
-  kmVec2 v0;
-  v0.x = cosf(theta) * radius + center.x;
-  v0.y = sinf(theta) * radius + center.y;
-  theta += increment;
-
-  int count = 0;
-  for( int i = 1; i < circle_segments - 1; i++ )
-  {
-    kmVec2 v1;
-    v1.x = cosf(theta) * radius + center.x;
-    v1.y = sinf(theta) * radius + center.y;
-
-    kmVec2 v2;
-    v2.x = cosf(theta + increment) * radius + center.x;
-    v2.y = sinf(theta + increment) * radius + center.y;
-
-    vertex_buffer_data[count] = (binocle_vpct){
-      .pos = {.x = v0.x, .y = v0.y},
-      .color = {.r = col.r, .g = col.g, .b = col.b, .a = col.a}
-    };
-    count++;
-    vertex_buffer_data[count] = (binocle_vpct){
-      .pos = {.x = v1.x, .y = v1.y},
-      .color = {.r = col.r, .g = col.g, .b = col.b, .a = col.a}
-    };
-    count++;
-    vertex_buffer_data[count] = (binocle_vpct){
-      .pos = {.x = v2.x, .y = v2.y},
-      .color = {.r = col.r, .g = col.g, .b = col.b, .a = col.a}
-    };
-    count++;
 
-    theta += increment;
+  // A fan of triangles that all start from the first point on the circumference
+  binocle_vpct *v = binocle_gd_reserve_flat(gd, viewport, camera, depth, (circle_segments - 2) * 3);
+  if (v == NULL) {
+    return;
+  }
+  binocle_vpct v0 = { .pos = { .x = radius + center.x, .y = center.y }, .color = col };
+  binocle_vpct v1 = { .pos = { .x = cosf(increment) * radius + center.x, .y = sinf(increment) * radius + center.y }, .color = col };
+  for (uint32_t i = 2 ; i < circle_segments ; i++) {
+    float theta = increment * i;
+    binocle_vpct v2 = { .pos = { .x = cosf(theta) * radius + center.x, .y = sinf(theta) * radius + center.y }, .color = col };
+    *v++ = v0;
+    *v++ = v1;
+    *v++ = v2;
+    v1 = v2;
   }
-  binocle_gd_draw_flat(gd, vertex_buffer_data, circle_segments * 3, viewport, camera, NULL, depth);
 }
 
 void binocle_gd_draw_with_state(binocle_gd *gd, const binocle_vpct *vertices, size_t vertex_count, binocle_render_state *render_state, float depth) {
-  binocle_gd_command_t *cmd = &gd->commands[gd->num_commands];
-  cmd->num_vertices = vertex_count;
-  cmd->base_vertex = gd->num_vertices;
-  cmd->img = render_state->material->albedo_texture;
-  cmd->depth = depth;
+  binocle_gd_record(gd, render_state->material, render_state->viewport, &render_state->transform, depth, vertices, NULL,
+                    vertex_count, false);
+}
+
+void binocle_gd_draw_quads_with_state(binocle_gd *gd, const binocle_vpct *vertices, size_t quad_count, binocle_render_state *render_state, float depth) {
+  binocle_gd_record(gd, render_state->material, render_state->viewport, &render_state->transform, depth, vertices, NULL,
+                    quad_count * 4, true);
+}
+
+void binocle_gd_draw_packed_quads_with_state(binocle_gd *gd, const binocle_vpct_packed *vertices, size_t quad_count, binocle_render_state *render_state, float depth) {
+  assert(gd->vertex_format == BINOCLE_VERTEX_FORMAT_PACKED);
+  binocle_gd_record(gd, render_state->material, render_state->viewport, &render_state->transform, depth, NULL, vertices,
+                    quad_count * 4, true);
+}
+
+void binocle_gd_draw_buffer(binocle_gd *gd, sg_buffer vbuf, size_t quad_count, const binocle_material *material,
+                            kmAABB2 viewport, binocle_camera *camera, kmVec2 offset, float depth) {
+  if (quad_count == 0) {
+    return;
+  }
+  assert(quad_count <= BINOCLE_GD_MAX_QUADS);
 
-  if (sg_query_pipeline_state(render_state->material->pip) == SG_RESOURCESTATE_VALID) {
-    cmd->pip = render_state->material->pip;
-    memcpy(cmd->custom_fs_uniforms, render_state->material->custom_fs_uniforms, 1024);
-    cmd->shader_desc = render_state->material->shader_desc;
+  kmMat4 view_matrix;
+  if (camera != NULL) {
+    view_matrix = *binocle_camera_get_transform_matrix(camera);
   } else {
-    cmd->pip.id = 0;
+    kmMat4Identity(&view_matrix);
+  }
+  if (offset.x != 0 || offset.y != 0) {
+    kmMat4 translation;
+    kmMat4Translation(&translation, offset.x, offset.y, 0);
+    kmMat4Multiply(&view_matrix, &view_matrix, &translation);
   }
 
-  kmMat4 cameraTransformMatrix = render_state->transform;
+  binocle_gd_command_t *cmd = binocle_gd_next_command(&gd->commands, &gd->num_commands, &gd->commands_capacity);
+  if (cmd == NULL) {
+    return;
+  }
+  cmd->img = material->albedo_texture;
+  cmd->depth = depth;
+  cmd->pip.id = SG_INVALID_ID;
+  cmd->fs_uniforms_size = 0;
+  cmd->fs_uniforms_offset = 0;
+  if (sg_query_pipeline_state(material->pip) == SG_RESOURCESTATE_VALID) {
+    cmd->pip = material->pip;
+    cmd->fs_uniforms_size = material->shader_desc.fs.uniform_blocks[0].size;
+    cmd->fs_uniforms_offset = binocle_gd_intern_fs_uniforms(gd, material->custom_fs_uniforms, cmd->fs_uniforms_size);
+  }
+  cmd->uniforms = binocle_gd_intern_uniforms(gd, viewport, &view_matrix);
+  cmd->quads = true;
+  cmd->instanced = false;
+  cmd->vbuf = vbuf;
+  cmd->base_vertex = 0;
+  cmd->num_vertices = quad_count * 4;
+}
 
-  cmd->uniforms.projectionMatrix = binocle_math_create_orthographic_matrix_off_center(render_state->viewport.min.x, render_state->viewport.max.x,
-                                                                                      render_state->viewport.min.y, render_state->viewport.max.y, -1000.0f,
-                                                                                      1000.0f);
-  kmMat4Identity(&cmd->uniforms.viewMatrix);
-  kmMat4Multiply(&cmd->uniforms.viewMatrix, &cmd->uniforms.viewMatrix, &cameraTransformMatrix);
+void binocle_gd_draw_instances(binocle_gd *gd, const binocle_vpct_instance *instances, size_t instance_count,
+                               binocle_render_state *render_state, float depth) {
+  if (sg_query_pipeline_state(gd->instanced.pip) != SG_RESOURCESTATE_VALID) {
+    binocle_log_error("Instanced sprites need the pipeline created by binocle_gd_setup_instanced_pipeline");
+    return;
+  }
 
-  kmMat4Identity(&cmd->uniforms.modelMatrix);
+  uint32_t uniforms = binocle_gd_intern_uniforms(gd, render_state->viewport, &render_state->transform);
 
-  gd->num_commands++;
+  while (instance_count > 0) {
+    uint32_t count = instance_count < BINOCLE_GD_CHUNK_INSTANCES ? instance_count : BINOCLE_GD_CHUNK_INSTANCES;
+    binocle_gd_command_t *cmd = binocle_gd_next_command(&gd->commands, &gd->num_commands, &gd->commands_capacity);
+    if (cmd == NULL) {
+      return;
+    }
+    cmd->img = render_state->material->albedo_texture;
+    cmd->depth = depth;
+    cmd->pip.id = SG_INVALID_ID;
+    cmd->fs_uniforms_size = 0;
+    cmd->fs_uniforms_offset = 0;
+    cmd->uniforms = uniforms;
+    cmd->quads = true;
+    cmd->instanced = true;
+    cmd->vbuf.id = SG_INVALID_ID;
+    cmd->num_vertices = count;
+    uint32_t num_instances = gd->num_instances;
+    cmd->base_vertex = binocle_gd_reserve_vertices(&gd->num_instances, count, 1, BINOCLE_GD_CHUNK_INSTANCES);
+
+    binocle_vpct_instance *new_instances = binocle_gd_ensure_capacity(gd->instances, &gd->instances_capacity,
+                                                                      gd->num_instances,
+                                                                      sizeof(binocle_vpct_instance));
+    if (new_instances == NULL) {
+      // Drop the command, its instances couldn't be stored
+      gd->num_instances = num_instances;
+      gd->num_commands--;
+      return;
+    }
+    gd->instances = new_instances;
+    memcpy(&gd->instances[cmd->base_vertex], instances, sizeof(binocle_vpct_instance) * count);
 
-  for (uint32_t i = 0 ; i < vertex_count ; i++) {
-    binocle_vpct *v = &gd->vertices[gd->num_vertices];
-    v->pos.x = vertices[i].pos.x;
-    v->pos.y = vertices[i].pos.y;
-    v->color.r = vertices[i].color.r;
-    v->color.g = vertices[i].color.g;
-    v->color.b = vertices[i].color.b;
-    v->color.a = vertices[i].color.a;
-    v->tex.x = vertices[i].tex.x;
-    v->tex.y = vertices[i].tex.y;
-    gd->num_vertices++;
+    instances += count;
+    instance_count -= count;
   }
 }
 
@@ -1280,18 +1827,15 @@ sg_shader binocle_gd_create_shader(sg_shader_desc desc) {
   return sg_make_shader(&desc);
 }
 
-sg_pipeline binocle_gd_create_offscreen_pipeline(sg_shader shader) {
+sg_pipeline binocle_gd_create_offscreen_pipeline(binocle_gd *gd, sg_shader shader) {
+  return binocle_gd_create_offscreen_pipeline_for_format(shader, gd->vertex_format);
+}
+
+sg_pipeline binocle_gd_create_offscreen_pipeline_for_format(sg_shader shader, binocle_vertex_format format) {
   sg_pipeline pip = sg_make_pipeline(&(sg_pipeline_desc) {
-    .layout = {
-      .attrs = {
-        [0] = { .format = SG_VERTEXFORMAT_FLOAT2 }, // position
-        [1] = { .format = SG_VERTEXFORMAT_FLOAT4 }, // color
-        [2] = { .format = SG_VERTEXFORMAT_FLOAT2 }, // texture uv
-      },
-    },
+    .layout = binocle_gd_vertex_layout(format),
     .shader = shader,
-//      .index_type = SG_INDEXTYPE_UINT16,
-    .index_type = SG_INDEXTYPE_NONE,
+    .index_type = SG_INDEXTYPE_UINT32,
     .depth = {
       .pixel_format = SG_PIXELFORMAT_NONE,
       .compare = SG_COMPAREFUNC_NEVER,
@@ -1318,3 +1862,72 @@ sg_pipeline binocle_gd_create_offscreen_pipeline(sg_shader shader) {
   return pip;
 }
 
+sg_shader_desc binocle_gd_create_instanced_shader_desc(const char *name, const char *shader_vs_src, const char *shader_fs_src) {
+  sg_shader_desc shader_desc = binocle_gd_create_offscreen_shader_desc(name, shader_vs_src, shader_fs_src);
+  shader_desc.attrs[0].name = "vertexCorner";
+  shader_desc.attrs[1].name = "instancePositionSize";
+  shader_desc.attrs[2].name = "instanceOriginRotation";
+  shader_desc.attrs[3].name = "instanceTCoord";
+  shader_desc.attrs[4].name = "instanceColor";
+  return shader_desc;
+}
+
+void binocle_gd_setup_instanced_pipeline(binocle_gd *gd, sg_shader shader) {
+  binocle_log_info("Setting up instanced pipeline");
+  gd->instanced.pip = sg_make_pipeline(&(sg_pipeline_desc) {
+    .label = "instanced-pipeline",
+    .layout = {
+      .buffers = {
+        [0] = { .stride = sizeof(kmVec2) },
+        [1] = { .stride = sizeof(binocle_vpct_instance), .step_func = SG_VERTEXSTEP_PER_INSTANCE },
+      },
+      .attrs = {
+        [0] = { .buffer_index = 0, .format = SG_VERTEXFORMAT_FLOAT2 }, // corner of the unit quad
+        [1] = { .buffer_index = 1, .offset = offsetof(binocle_vpct_instance, position), .format = SG_VERTEXFORMAT_FLOAT4 }, // position and size
+        [2] = { .buffer_index = 1, .offset = offsetof(binocle_vpct_instance, origin), .format = SG_VERTEXFORMAT_FLOAT4 }, // origin, rotation and depth
+        [3] = { .buffer_index = 1, .offset = offsetof(binocle_vpct_instance, tex_tl), .format = SG_VERTEXFORMAT_FLOAT4 }, // texture uv
+        [4] = { .buffer_index = 1, .offset = offsetof(binocle_vpct_instance, color), .format = SG_VERTEXFORMAT_UBYTE4N }, // color
+      },
+    },
+    .shader = shader,
+    .index_type = SG_INDEXTYPE_UINT32,
+    .colors = {
+      [0] = {
+        .pixel_format = SG_PIXELFORMAT_RGBA8,
+        .blend = {
+          .enabled = true,
+          .src_factor_rgb = SG_BLENDFACTOR_SRC_ALPHA,
+          .dst_factor_rgb = SG_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+        }
+      }
+    }
+  });
+  binocle_log_info("Done setting up instanced pipeline");
+
+  // The corners in the same top-left, top-right, bottom-left, bottom-right order used by the quad index buffer
+  float corners[] = {
+    0.0f, 0.0f,
+    1.0f, 0.0f,
+    0.0f, 1.0f,
+    1.0f, 1.0f,
+  };
+  gd->instanced.ibuf = gd->offscreen.ibuf;
+  gd->instanced.vbuf = sg_make_buffer(&(sg_buffer_desc){
+    .type = SG_BUFFERTYPE_VERTEXBUFFER,
+    .usage = SG_USAGE_STREAM,
+    .size = sizeof(binocle_vpct_instance) * BINOCLE_GD_CHUNK_INSTANCES,
+    .label = "instanced-instances",
+  });
+
+  gd->instanced.bind = (sg_bindings){
+    .vertex_buffers = {
+      [0] = sg_make_buffer(&(sg_buffer_desc){
+        .data = SG_RANGE(corners),
+        .label = "instanced-corners",
+      }),
+      [1] = gd->instanced.vbuf,
+    },
+    .index_buffer = gd->instanced.ibuf,
+  };
+  gd->instanced.bind.fs.samplers[0] = gd->offscreen.bind.fs.samplers[0];
+}
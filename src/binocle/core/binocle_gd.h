@@ -10,6 +10,7 @@
 #include "binocle_sdl.h"
 #include <kazmath/kazmath.h>
 #include "sokol_gfx.h"
+#include "backend/binocle_vpct.h"
 
 //#if defined(BINOCLE_GL)
 //#include "backend/binocle_backend_gl.h"
@@ -17,9 +18,18 @@
 //#include "backend/binocle_backend_metal.h"
 //#endif
 
+// Vertices and commands are recorded in arrays that grow as needed. They get uploaded in chunks of at most
+// BINOCLE_GD_CHUNK_VERTICES vertices, each one with its own GPU buffer, and no command spans two chunks.
 #define BINOCLE_GD_MAX_VERTICES (16535 * 6)
-#define BINOCLE_GD_MAX_INDICES (16535 * 6 * 3)
-#define BINOCLE_GD_MAX_COMMANDS (16535)
+#define BINOCLE_GD_MAX_QUADS (BINOCLE_GD_MAX_VERTICES / 4)
+#define BINOCLE_GD_MAX_INDICES (BINOCLE_GD_MAX_QUADS * 6)
+#define BINOCLE_GD_CHUNK_VERTICES (BINOCLE_GD_MAX_QUADS * 4)
+#define BINOCLE_GD_FLAT_CHUNK_VERTICES (4096)
+// Sprite instances are streamed the same way, in chunks of at most BINOCLE_GD_CHUNK_INSTANCES instances
+#define BINOCLE_GD_CHUNK_INSTANCES (65536)
+#define BINOCLE_GD_DEFAULT_CIRCLE_SEGMENTS (32)
+// The number of slots of the table used to find the uniform blocks already recorded in a frame. Must be a power of two.
+#define BINOCLE_GD_UNIFORMS_LOOKUP_SIZE (64)
 
 struct binocle_blend;
 struct binocle_camera;
@@ -45,6 +55,9 @@ typedef struct binocle_gd_gfx_t {
   sg_image render_target;
   sg_buffer vbuf;
   sg_buffer ibuf;
+  // The vertex buffers of the chunks after the first one, which uses vbuf. They're created when a frame first needs them.
+  sg_buffer *chunk_vbufs;
+  uint32_t num_chunk_vbufs;
 } binocle_gd_gfx_t;
 
 typedef struct binocle_gd_uniform_t {
@@ -53,16 +66,40 @@ typedef struct binocle_gd_uniform_t {
   kmMat4 modelMatrix;
 } binocle_gd_uniform_t;
 
+/**
+ * Counters of the work done by the graphics device. They keep growing until \ref binocle_gd_reset_stats is called.
+ */
+typedef struct binocle_gd_stats_t {
+  /// The number of commands recorded by the draw functions
+  uint64_t commands;
+  /// The number of draw calls actually issued
+  uint64_t draw_calls;
+  /// The number of draw calls saved by merging adjacent compatible commands
+  uint64_t coalesced_draw_calls;
+  /// The number of pipelines, bindings and uniform blocks applied
+  uint64_t state_changes;
+  /// The number of vertices drawn, counting each instance of an instanced draw
+  uint64_t vertices;
+  /// The number of bytes of vertex and instance data uploaded to the GPU
+  uint64_t bytes_uploaded;
+} binocle_gd_stats_t;
+
 typedef struct binocle_gd_command_t {
   sg_image img;
   uint32_t base_vertex;
   uint32_t num_vertices;
-  binocle_gd_uniform_t uniforms;
+  bool quads;
+  // Instanced commands draw a quad for each instance. base_vertex and num_vertices index binocle_gd.instances.
+  bool instanced;
+  // A persistent vertex buffer to draw from instead of the streamed vertices. SG_INVALID_ID for the streamed ones.
+  sg_buffer vbuf;
+  // Index of the vertex shader uniforms in binocle_gd.uniforms
+  uint32_t uniforms;
+  // Offset and size of the fragment shader uniforms of custom pipelines in binocle_gd.fs_uniforms
+  uint32_t fs_uniforms_offset;
+  uint32_t fs_uniforms_size;
   float depth;
   sg_pipeline pip;
-  sg_shader_desc shader_desc;
-  char custom_vs_uniforms[1024];
-  char custom_fs_uniforms[1024];
 } binocle_gd_command_t;
 
 /**
@@ -72,16 +109,57 @@ typedef struct binocle_gd {
   binocle_gd_gfx_t offscreen;
   binocle_gd_gfx_t display;
   binocle_gd_gfx_t flat;
+  // The pipeline of the instanced sprites. Its first vertex buffer holds the static unit quad, vbuf holds the instances.
+  binocle_gd_gfx_t instanced;
 
+  // Static index buffer that maps each element to the vertex with the same index. offscreen.ibuf holds the quad indices.
+  sg_buffer linear_ibuf;
+
+  // The format of the vertices streamed by the offscreen pass. Only one of the two vertex arrays is in use.
+  binocle_vertex_format vertex_format;
   struct binocle_vpct *vertices;
+  uint32_t vertices_capacity;
+  struct binocle_vpct_packed *packed_vertices;
+  uint32_t packed_vertices_capacity;
   uint32_t num_vertices;
   binocle_gd_command_t *commands;
   uint32_t num_commands;
+  uint32_t commands_capacity;
+
+  // The instances of the instanced sprites. Their commands are part of the offscreen command list.
+  struct binocle_vpct_instance *instances;
+  uint32_t num_instances;
+  uint32_t instances_capacity;
 
   struct binocle_vpct *flat_vertices;
   uint32_t flat_num_vertices;
+  uint32_t flat_vertices_capacity;
   binocle_gd_command_t *flat_commands;
   uint32_t flat_num_commands;
+  uint32_t flat_commands_capacity;
+
+  // Uniform blocks referenced by the commands of both lists. Commands with the same values share a block.
+  binocle_gd_uniform_t *uniforms;
+  uint32_t num_uniforms;
+  uint32_t uniforms_capacity;
+  // The blocks indexed by a hash of their matrices, stored as index + 1 so that zero is an empty slot. A newer block
+  // replaces the one in its slot, so the blocks used recently are the ones that get found.
+  uint32_t uniforms_lookup[BINOCLE_GD_UNIFORMS_LOOKUP_SIZE];
+  uint8_t *fs_uniforms;
+  uint32_t fs_uniforms_size;
+  uint32_t fs_uniforms_capacity;
+  uint32_t fs_uniforms_last_offset;
+  uint32_t fs_uniforms_last_size;
+
+  // The projection matrix is only rebuilt when the viewport changes
+  kmAABB2 projection_viewport;
+  kmMat4 projection;
+  bool projection_valid;
+
+  binocle_gd_stats_t stats;
+
+  // The number of segments used to approximate circles. Zero means BINOCLE_GD_DEFAULT_CIRCLE_SEGMENTS.
+  uint32_t circle_segments;
 } binocle_gd;
 
 /**
@@ -92,6 +170,31 @@ binocle_gd binocle_gd_new();
 
 void binocle_gd_destroy(binocle_gd *gd);
 
+/**
+ * \brief Selects the format of the vertices streamed by the offscreen pass
+ * \ref BINOCLE_VERTEX_FORMAT_PACKED halves the bandwidth needed to upload sprites, at the price of 8 bit colors and
+ * texture coordinates limited to the [0, 1] range. Both formats feed the same floating point attributes to the
+ * shaders, so the default shaders work with either.
+ * \note This must be called before \ref binocle_gd_setup_default_pipeline and before creating any pipeline with
+ * \ref binocle_gd_create_offscreen_pipeline
+ * @param gd the graphics device instance
+ * @param format the vertex format
+ */
+void binocle_gd_set_vertex_format(binocle_gd *gd, binocle_vertex_format format);
+
+/**
+ * \brief Gets the counters of the work done by the graphics device since the last call to \ref binocle_gd_reset_stats
+ * @param gd the graphics device instance
+ * @return the counters
+ */
+binocle_gd_stats_t binocle_gd_get_stats(binocle_gd *gd);
+
+/**
+ * \brief Resets the counters of the graphics device
+ * @param gd the graphics device instance
+ */
+void binocle_gd_reset_stats(binocle_gd *gd);
+
 /**
  * Initializes a graphic device
  * @param gd the pointer to the graphics device
@@ -126,7 +229,7 @@ kmMat4 binocle_gd_create_model_view_matrix(float x, float y, float scale,
  * @param camera the camera
  */
 void binocle_gd_draw(binocle_gd *gd, const struct binocle_vpct *vertices,
-                     size_t vertex_count, struct binocle_material material,
+                     size_t vertex_count, const struct binocle_material *material,
                      kmAABB2 viewport, struct binocle_camera *camera, float depth);
 
 /**
@@ -159,6 +262,7 @@ void binocle_gd_apply_shader(binocle_gd *gd, sg_shader shader);
  */
 void binocle_gd_apply_texture(struct sg_image texture);
 
+#if defined(BINOCLE_GL)
 GLuint binocle_gd_factor_to_gl_constant(enum sg_blend_factor blend_factor);
 
 /**
@@ -168,6 +272,7 @@ GLuint binocle_gd_factor_to_gl_constant(enum sg_blend_factor blend_factor);
  */
 GLuint
 binocle_gd_equation_to_gl_constant(enum sg_blend_op blend_equation);
+#endif
 
 /**
  * \brief Sets a uniform float value for the given shader
@@ -318,6 +423,14 @@ void binocle_gd_draw_line(binocle_gd *gd, kmVec2 start, kmVec2 end, struct sg_co
  */
 void binocle_gd_draw_circle(binocle_gd *gd, kmVec2 center, float radius, struct sg_color col, kmAABB2 viewport, struct binocle_camera *camera, float depth);
 
+/**
+ * \brief Sets the number of segments used by \ref binocle_gd_draw_circle
+ * @param gd the graphics device
+ * @param segments the number of segments. It's clamped to at least 3. Zero restores the default of
+ * BINOCLE_GD_DEFAULT_CIRCLE_SEGMENTS.
+ */
+void binocle_gd_set_circle_segments(binocle_gd *gd, uint32_t segments);
+
 /**
  * \brief Draws the graphic device's vertex buffer using the given render state
  * @param gd the graphics device instance
@@ -329,6 +442,67 @@ void binocle_gd_draw_circle(binocle_gd *gd, kmVec2 center, float radius, struct
 void binocle_gd_draw_with_state(binocle_gd *gd, const struct binocle_vpct *vertices, size_t vertex_count,
                                 struct binocle_render_state *render_state, float depth);
 
+/**
+ * \brief Draws a list of quads using the given render state
+ * Each quad is made of 4 vertices in top-left, top-right, bottom-left, bottom-right order and is drawn through the
+ * static quad index buffer, so there's no need to repeat the shared vertices.
+ * @param gd the graphics device instance
+ * @param vertices the buffer with the vertices to draw
+ * @param quad_count the number of quads
+ * @param render_state the render state
+ * @param depth the depth of the layer being drawn
+ */
+void binocle_gd_draw_quads_with_state(binocle_gd *gd, const struct binocle_vpct *vertices, size_t quad_count,
+                                      struct binocle_render_state *render_state, float depth);
+
+/**
+ * \brief Draws quads stored in a persistent vertex buffer
+ * This is meant for static geometry that's uploaded once and drawn every frame, like the chunks of a
+ * \ref binocle_tilemap. Nothing gets copied, the buffer must stay valid until the frame has been rendered.
+ * @param gd the graphics device instance
+ * @param vbuf the vertex buffer. The vertices must be in the vertex format of the graphics device, 4 per quad in
+ * top-left, top-right, bottom-left, bottom-right order.
+ * @param quad_count the number of quads, at most BINOCLE_GD_MAX_QUADS
+ * @param material the material
+ * @param viewport the viewport
+ * @param camera the camera. Can be NULL.
+ * @param offset the translation applied to the vertices before the camera, so that the geometry can be moved without
+ * touching the buffer
+ * @param depth the depth of the layer being drawn
+ */
+void binocle_gd_draw_buffer(binocle_gd *gd, sg_buffer vbuf, size_t quad_count, const struct binocle_material *material,
+                            kmAABB2 viewport, struct binocle_camera *camera, kmVec2 offset, float depth);
+
+/**
+ * \brief Draws a list of sprites with GPU instancing using the given render state
+ * Each sprite only streams its \ref binocle_vpct_instance and the quad is expanded by the vertex shader, which makes
+ * this the cheapest way to draw a large number of sprites that share a texture.
+ * The sprites are drawn with the pipeline set up by \ref binocle_gd_setup_instanced_pipeline, the shader of the
+ * material is ignored.
+ * @param gd the graphics device instance
+ * @param instances the sprites to draw
+ * @param instance_count the number of sprites
+ * @param render_state the render state
+ * @param depth the depth of the layer being drawn
+ */
+void binocle_gd_draw_instances(binocle_gd *gd, const struct binocle_vpct_instance *instances, size_t instance_count,
+                               struct binocle_render_state *render_state, float depth);
+
+/**
+ * \brief Draws a list of compact quads using the given render state
+ * Works like \ref binocle_gd_draw_quads_with_state but the vertices have already been converted to the compact
+ * format, so they're copied as they are.
+ * \note The graphics device must be using \ref BINOCLE_VERTEX_FORMAT_PACKED
+ * @param gd the graphics device instance
+ * @param vertices the buffer with the vertices to draw
+ * @param quad_count the number of quads
+ * @param render_state the render state
+ * @param depth the depth of the layer being drawn
+ */
+void binocle_gd_draw_packed_quads_with_state(binocle_gd *gd, const struct binocle_vpct_packed *vertices,
+                                             size_t quad_count, struct binocle_render_state *render_state,
+                                             float depth);
+
 /**
  * /brief Begins the screen pass. Multiple pipelines can be applied during this pass.
  * @param gd the graphics device instance
@@ -352,10 +526,36 @@ void binocle_gd_draw_test_cube(struct sg_shader *shader);
 void binocle_gd_setup_flat_pipeline(binocle_gd *gd, const char *vs_src, const char *fs_src);
 void binocle_gd_render_flat(binocle_gd *gd);
 
+/**
+ * \brief Creates the pipeline used by \ref binocle_gd_draw_instances
+ * \note This must be called after \ref binocle_gd_setup_default_pipeline
+ * @param gd the graphics device instance
+ * @param shader the instanced shader, usually created from \ref binocle_gd_create_instanced_shader_desc
+ */
+void binocle_gd_setup_instanced_pipeline(binocle_gd *gd, sg_shader shader);
+
+/**
+ * \brief Creates the description of a shader that draws instanced sprites
+ * The sources are expected to be compiled from assets/shaders/src/instanced.glsl or to use the same attributes and
+ * uniforms.
+ * @param name the name of the shader
+ * @param shader_vs_src the source of the vertex shader
+ * @param shader_fs_src the source of the fragment shader
+ * @return the shader description
+ */
+sg_shader_desc binocle_gd_create_instanced_shader_desc(const char *name, const char *shader_vs_src, const char *shader_fs_src);
+
 sg_shader_desc binocle_gd_create_offscreen_shader_desc(const char *name, const char *shader_vs_src, const char *shader_fs_src);
 size_t binocle_gd_compute_uniform_block_size(sg_shader_uniform_block_desc desc);
 void binocle_gd_add_uniform_to_shader_desc(sg_shader_desc *shader_desc, sg_shader_stage stage, size_t idx, const char *uniform_name, sg_uniform_type uniform_type);
 sg_shader binocle_gd_create_shader(sg_shader_desc desc);
-sg_pipeline binocle_gd_create_offscreen_pipeline(sg_shader shader);
+/**
+ * \brief Creates an offscreen pipeline for the vertex format selected with \ref binocle_gd_set_vertex_format
+ * @param gd the graphics device instance
+ * @param shader the shader of the pipeline
+ * @return the pipeline
+ */
+sg_pipeline binocle_gd_create_offscreen_pipeline(binocle_gd *gd, sg_shader shader);
+sg_pipeline binocle_gd_create_offscreen_pipeline_for_format(sg_shader shader, binocle_vertex_format format);
 
 #endif // BINOCLE_GD_H
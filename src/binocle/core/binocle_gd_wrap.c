@@ -172,6 +172,19 @@ int l_create_offscreen_shader_desc(lua_State *L) {
   return 1;
 }
 
+int l_create_instanced_shader_desc(lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  const char *vs = luaL_checkstring(L, 2);
+  const char *fs = luaL_checkstring(L, 3);
+  sg_shader_desc desc = binocle_gd_create_instanced_shader_desc(name, vs, fs);
+  l_binocle_shader_t *shader = lua_newuserdata(L, sizeof(l_binocle_shader_t));
+  lua_getfield(L, LUA_REGISTRYINDEX, "binocle_shader");
+  lua_setmetatable(L, -2);
+  SDL_memset(shader, 0, sizeof(*shader));
+  shader->shader_desc = desc;
+  return 1;
+}
+
 sg_shader_stage l_binocle_gd_convert_shader_stage(const char *stage_str) {
   sg_shader_stage stage = SG_SHADERSTAGE_VS;
   if (SDL_strcmp(stage_str, "VS") == 0) {
@@ -231,8 +244,16 @@ int l_binocle_gd_create_shader(lua_State *L) {
 }
 
 int l_binocle_gd_create_offscreen_pipeline(lua_State *L) {
-  l_binocle_shader_t *shader = luaL_checkudata(L, 1, "binocle_shader");
-  shader->pip = binocle_gd_create_offscreen_pipeline(shader->shader);
+  l_binocle_gd_t *gd = luaL_checkudata(L, 1, "binocle_gd");
+  l_binocle_shader_t *shader = luaL_checkudata(L, 2, "binocle_shader");
+  shader->pip = binocle_gd_create_offscreen_pipeline(gd->gd, shader->shader);
+  return 0;
+}
+
+int l_binocle_gd_setup_instanced_pipeline(lua_State *L) {
+  l_binocle_gd_t *gd = luaL_checkudata(L, 1, "binocle_gd");
+  l_binocle_shader_t *shader = luaL_checkudata(L, 2, "binocle_shader");
+  binocle_gd_setup_instanced_pipeline(gd->gd, shader->shader);
   return 0;
 }
 
@@ -272,6 +293,8 @@ static const struct luaL_Reg gd [] = {
   {"add_uniform_to_shader_desc", l_binocle_gd_add_uniform_to_shader_desc},
   {"create_shader", l_binocle_gd_create_shader},
   {"create_pipeline", l_binocle_gd_create_offscreen_pipeline},
+  {"create_instanced_shader_desc", l_create_instanced_shader_desc},
+  {"setup_instanced_pipeline", l_binocle_gd_setup_instanced_pipeline},
   {"begin_screen_pass", l_binocle_gd_begin_screen_pass},
   {"end_screen_pass", l_binocle_gd_end_screen_pass},
   {"commit", l_binocle_gd_commit},
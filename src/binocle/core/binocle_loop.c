@@ -0,0 +1,143 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#include "binocle_loop.h"
+#include "binocle_sdl.h"
+#include "binocle_window.h"
+
+static uint64_t binocle_loop_seconds_to_ticks(double seconds, uint64_t frequency) {
+  if (seconds <= 0.0) {
+    return 0;
+  }
+  return (uint64_t)(seconds * (double)frequency + 0.5);
+}
+
+static void binocle_loop_update_alpha(binocle_loop *loop) {
+  loop->alpha = (double)loop->accumulator_ticks / (double)loop->step_ticks;
+}
+
+binocle_loop binocle_loop_new(binocle_loop_desc desc) {
+  binocle_loop res = {0};
+  res.fixed_dt = desc.fixed_dt > 0.0 ? desc.fixed_dt : BINOCLE_LOOP_DEFAULT_FIXED_DT;
+  res.max_steps = desc.max_steps > 0 ? desc.max_steps : BINOCLE_LOOP_DEFAULT_MAX_STEPS;
+  res.frequency = SDL_GetPerformanceFrequency();
+  res.step_ticks = binocle_loop_seconds_to_ticks(res.fixed_dt, res.frequency);
+  if (res.step_ticks == 0) {
+    res.step_ticks = 1;
+  }
+  double max_frame_dt = desc.max_frame_dt > 0.0 ? desc.max_frame_dt : BINOCLE_LOOP_DEFAULT_MAX_FRAME_DT;
+  res.max_frame_ticks = binocle_loop_seconds_to_ticks(max_frame_dt, res.frequency);
+  double spin_time = desc.spin_time > 0.0 ? desc.spin_time : BINOCLE_LOOP_DEFAULT_SPIN_TIME;
+  res.spin_ticks = binocle_loop_seconds_to_ticks(spin_time, res.frequency);
+  binocle_loop_set_target_fps(&res, desc.target_fps);
+  return res;
+}
+
+void binocle_loop_set_target_fps(binocle_loop *loop, double fps) {
+  loop->target_frame_ticks = fps > 0.0 ? binocle_loop_seconds_to_ticks(1.0 / fps, loop->frequency) : 0;
+  // Start a new schedule from the next frame
+  loop->next_frame = 0;
+}
+
+void binocle_loop_reset(binocle_loop *loop) {
+  loop->accumulator_ticks = 0;
+  loop->alpha = 0.0;
+  loop->frame_start = 0;
+  loop->next_frame = 0;
+}
+
+void binocle_loop_begin_frame(binocle_loop *loop, struct binocle_window *window) {
+  if (window != NULL) {
+    binocle_window_begin_frame(window);
+  }
+
+  uint64_t now = SDL_GetPerformanceCounter();
+  uint64_t delta = loop->frame_start != 0 ? now - loop->frame_start : 0;
+  loop->frame_start = now;
+
+  // A frame that took too long, like after a breakpoint or while the window was being dragged, would otherwise have
+  // the simulation run a huge number of steps to catch up
+  if (delta > loop->max_frame_ticks) {
+    loop->dropped_ticks += delta - loop->max_frame_ticks;
+    delta = loop->max_frame_ticks;
+  }
+
+  loop->accumulator_ticks += delta;
+  loop->frame_dt = (double)delta / (double)loop->frequency;
+  loop->frame_steps = 0;
+  loop->dropped_time = (double)loop->dropped_ticks / (double)loop->frequency;
+  binocle_loop_update_alpha(loop);
+}
+
+bool binocle_loop_step(binocle_loop *loop) {
+  if (loop->accumulator_ticks < loop->step_ticks) {
+    binocle_loop_update_alpha(loop);
+    return false;
+  }
+
+  if (loop->frame_steps >= loop->max_steps) {
+    // The simulation can't keep up. We keep the fraction of a step that is left, so that alpha stays meaningful, and
+    // drop the rest instead of carrying it over to the next frames (the spiral of death).
+    uint64_t remainder = loop->accumulator_ticks % loop->step_ticks;
+    loop->dropped_ticks += loop->accumulator_ticks - remainder;
+    loop->dropped_time = (double)loop->dropped_ticks / (double)loop->frequency;
+    loop->accumulator_ticks = remainder;
+    binocle_loop_update_alpha(loop);
+    return false;
+  }
+
+  loop->accumulator_ticks -= loop->step_ticks;
+  loop->frame_steps++;
+  loop->steps++;
+  return true;
+}
+
+float binocle_loop_get_alpha(const binocle_loop *loop) {
+  return (float)loop->alpha;
+}
+
+void binocle_loop_end_frame(binocle_loop *loop, struct binocle_window *window) {
+  if (window != NULL) {
+    binocle_window_end_frame(window);
+  }
+  loop->frames++;
+
+#if !defined(__EMSCRIPTEN__)
+  // The browser paces the main loop on its own
+  if (loop->target_frame_ticks == 0) {
+    return;
+  }
+
+  // The deadlines follow a fixed schedule, so that the time a wait overshoots is taken off the next frame instead of
+  // adding up
+  uint64_t now = SDL_GetPerformanceCounter();
+  if (loop->next_frame == 0) {
+    loop->next_frame = loop->frame_start != 0 ? loop->frame_start : now;
+  }
+  loop->next_frame += loop->target_frame_ticks;
+  if (loop->next_frame <= now) {
+    // We are late already, there's no point in rushing the next frames to catch up
+    loop->next_frame = now;
+    return;
+  }
+  binocle_loop_wait_until(loop->next_frame, loop->spin_ticks);
+#endif
+}
+
+void binocle_loop_wait_until(uint64_t deadline, uint64_t spin_ticks) {
+  uint64_t frequency = SDL_GetPerformanceFrequency();
+  uint64_t now = SDL_GetPerformanceCounter();
+  while (now < deadline) {
+    uint64_t remaining = deadline - now;
+    if (remaining > spin_ticks) {
+      // The scheduler can wake us up late by a millisecond or more, so we sleep only until the spinning begins
+      SDL_DelayNS((Uint64)((double)(remaining - spin_ticks) * 1e9 / (double)frequency));
+    } else {
+      SDL_CPUPauseInstruction();
+    }
+    now = SDL_GetPerformanceCounter();
+  }
+}
@@ -0,0 +1,154 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#ifndef BINOCLE_LOOP_H
+#define BINOCLE_LOOP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct binocle_window;
+
+/// The simulation step used when 0 is passed in binocle_loop_desc, in seconds
+#define BINOCLE_LOOP_DEFAULT_FIXED_DT (1.0 / 60.0)
+/// The number of simulation steps a frame can run when 0 is passed in binocle_loop_desc
+#define BINOCLE_LOOP_DEFAULT_MAX_STEPS (5)
+/// The longest frame that gets simulated when 0 is passed in binocle_loop_desc, in seconds
+#define BINOCLE_LOOP_DEFAULT_MAX_FRAME_DT (0.25)
+/// The part of the wait that is spent spinning instead of sleeping when 0 is passed in binocle_loop_desc, in seconds
+#define BINOCLE_LOOP_DEFAULT_SPIN_TIME (0.002)
+
+/**
+ * The settings of a game loop. Any field left to zero gets its default value.
+ */
+typedef struct binocle_loop_desc {
+  /// The duration of a simulation step, in seconds
+  double fixed_dt;
+  /// The maximum number of simulation steps run in a single frame
+  uint32_t max_steps;
+  /// The longest frame duration that gets fed to the simulation, in seconds
+  double max_frame_dt;
+  /// The desired number of frames per second. Zero doesn't pace the frames, leaving it to vsync.
+  double target_fps;
+  /// How long before the end of the frame the wait stops sleeping and starts spinning, in seconds
+  double spin_time;
+} binocle_loop_desc;
+
+/**
+ * A game loop with a fixed simulation step. The time of each frame goes into an accumulator that is consumed in steps
+ * of fixed_dt, so that the simulation runs at the same rate and gives the same results whatever the frame rate is.
+ * Rendering then blends the last two simulation states using alpha.
+ *
+ * A typical frame looks like this:
+ *
+ *     binocle_loop_begin_frame(&loop, window);
+ *     while (binocle_loop_step(&loop)) {
+ *       update(loop.fixed_dt);
+ *     }
+ *     render(binocle_loop_get_alpha(&loop));
+ *     binocle_loop_end_frame(&loop, window);
+ *
+ * All the times are measured in ticks of SDL's performance counter and the accumulator is an integer, so it doesn't
+ * drift no matter how long the game runs.
+ */
+typedef struct binocle_loop {
+  /// The duration of a simulation step, in seconds
+  double fixed_dt;
+  /// The duration of the last frame, in seconds, after the clamp to max_frame_dt
+  double frame_dt;
+  /// How far the simulation is between the last step and the next one, between 0 and 1
+  double alpha;
+  /// The time that has been dropped since the loop started because the simulation couldn't keep up, in seconds
+  double dropped_time;
+
+  /// The number of simulation steps run since the loop started
+  uint64_t steps;
+  /// The number of simulation steps run in the current frame
+  uint32_t frame_steps;
+  /// The number of frames since the loop started
+  uint64_t frames;
+
+  uint32_t max_steps;
+  uint64_t frequency;
+  uint64_t step_ticks;
+  uint64_t max_frame_ticks;
+  uint64_t target_frame_ticks;
+  uint64_t spin_ticks;
+  uint64_t accumulator_ticks;
+  uint64_t dropped_ticks;
+  uint64_t frame_start;
+  uint64_t next_frame;
+} binocle_loop;
+
+/**
+ * \brief Creates a new game loop
+ * The timer starts with the first call to binocle_loop_begin_frame.
+ * @param desc the settings of the loop
+ * @return the loop
+ */
+binocle_loop binocle_loop_new(binocle_loop_desc desc);
+
+/**
+ * \brief Starts a new frame
+ * Measures the time since the previous frame, clamps it to max_frame_dt and adds it to the accumulator. It also calls
+ * binocle_window_begin_frame on the window, if one is given.
+ * @param loop the loop
+ * @param window the window, or NULL
+ */
+void binocle_loop_begin_frame(binocle_loop *loop, struct binocle_window *window);
+
+/**
+ * \brief Consumes a simulation step from the accumulator
+ * Call this in a while loop and update the simulation by fixed_dt each time it returns true. When the frame runs more
+ * than max_steps, the rest of the accumulated time is dropped so that a slow frame can't make the next ones slower
+ * and slower.
+ * @param loop the loop
+ * @return true if the simulation should be updated once more in this frame
+ */
+bool binocle_loop_step(binocle_loop *loop);
+
+/**
+ * \brief Gets how far the simulation is between its last step and the next one
+ * Render the state interpolated between the previous and the current step by this amount.
+ * @param loop the loop
+ * @return the interpolation factor, between 0 and 1
+ */
+float binocle_loop_get_alpha(const binocle_loop *loop);
+
+/**
+ * \brief Ends the current frame and waits for the next one, if a target frame rate has been set
+ * It calls binocle_window_end_frame on the window, if one is given. The wait sleeps for most of the remaining time and
+ * spins for the last spin_time seconds, as sleeping alone wakes up too late on most systems.
+ * @param loop the loop
+ * @param window the window, or NULL
+ */
+void binocle_loop_end_frame(binocle_loop *loop, struct binocle_window *window);
+
+/**
+ * \brief Sets the desired number of frames per second
+ * This replaces binocle_window_set_target_fps, whose target should be left to zero.
+ * @param loop the loop
+ * @param fps the frames per second. Zero doesn't pace the frames.
+ */
+void binocle_loop_set_target_fps(binocle_loop *loop, double fps);
+
+/**
+ * \brief Forgets the time accumulated so far
+ * Call this after something that blocked the loop for a long time, like loading a level, so that the simulation
+ * doesn't try to catch up with it.
+ * @param loop the loop
+ */
+void binocle_loop_reset(binocle_loop *loop);
+
+/**
+ * \brief Waits until the given value of SDL's performance counter
+ * Sleeps for most of the time and spins for the last spin_ticks.
+ * @param deadline the value of the performance counter to wait for
+ * @param spin_ticks how many ticks before the deadline to stop sleeping
+ */
+void binocle_loop_wait_until(uint64_t deadline, uint64_t spin_ticks);
+
+#endif //BINOCLE_LOOP_H
@@ -31,6 +31,7 @@
 #include "kazmath/lkazmath.h"
 #include "luasocket/luasocket.h"
 #include <sokol_time.h>
+#include "binocle_profiler.h"
 #include <stdlib.h>
 
 binocle_lua binocle_lua_new() {
@@ -142,7 +143,9 @@ bool binocle_lua_run_script(binocle_lua *lua, char *filename) {
   SDL_free(buffer);
 
   // We call the script with 0 arguments and expect 0 results
+  BINOCLE_PROFILE_ZONE_BEGIN("lua_run_script");
   int result = lua_pcall(lua->L, 0, 0, 0);
+  BINOCLE_PROFILE_ZONE_END();
   if (result) {
     binocle_log_error("Failed to run script: %s\n", lua_tostring(lua->L, -1));
     return false;
@@ -0,0 +1,342 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#include "binocle_profiler.h"
+#include "binocle_log.h"
+#include "binocle_sdl.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sokol_time.h>
+
+// Marks a zone that has been opened while the buffer was full, so that its end is ignored as well
+#define BINOCLE_PROFILER_DROPPED_ZONE (UINT32_MAX)
+
+typedef struct binocle_profiler_event_t {
+  const char *name;
+  uint64_t begin;
+  uint64_t end;
+} binocle_profiler_event_t;
+
+// The buffer of a thread. Only the thread that owns it writes to it, so recording doesn't need any lock.
+typedef struct binocle_profiler_thread_t {
+  SDL_ThreadID thread_id;
+  binocle_profiler_event_t *events;
+  uint32_t num_events;
+  uint32_t dropped_events;
+  // The indexes in events of the zones that are open
+  uint32_t stack[BINOCLE_PROFILER_MAX_DEPTH];
+  uint32_t depth;
+  // The zones opened past BINOCLE_PROFILER_MAX_DEPTH. They aren't on the stack, so they're closed first.
+  uint32_t overflow;
+  uint64_t counters[BINOCLE_PROFILER_COUNTER_MAX];
+  struct binocle_profiler_thread_t *next;
+} binocle_profiler_thread_t;
+
+typedef struct binocle_profiler_t {
+  bool initialized;
+  // Read by every thread that records, while the main thread may pause or resume the profiler
+  SDL_AtomicInt enabled;
+  uint32_t max_events;
+  uint64_t epoch;
+  // Protects the list of threads and the frames
+  SDL_Mutex *mutex;
+  binocle_profiler_thread_t *threads;
+  binocle_profiler_frame_stats *frames;
+  uint32_t num_frames;
+  uint32_t frames_capacity;
+  uint64_t frame_index;
+  uint64_t frame_begin;
+  binocle_profiler_frame_stats last_frame;
+} binocle_profiler_t;
+
+static binocle_profiler_t binocle_profiler = {0};
+static SDL_TLSID binocle_profiler_tls_thread;
+// The init the buffer in binocle_profiler_tls_thread belongs to. The buffers of the other threads are freed on shutdown
+// while their slots still point to them, so a slot is only trusted when its generation is the current one.
+static SDL_TLSID binocle_profiler_tls_generation;
+static uintptr_t binocle_profiler_generation = 0;
+
+static const char *binocle_profiler_counter_names[BINOCLE_PROFILER_COUNTER_MAX] = {
+  "draws",
+  "state_changes",
+  "vertices",
+  "bytes_uploaded",
+  "entities",
+};
+
+bool binocle_profiler_init(uint32_t max_events_per_thread) {
+  if (binocle_profiler.initialized) {
+    return true;
+  }
+  memset(&binocle_profiler, 0, sizeof(binocle_profiler));
+  binocle_profiler.mutex = SDL_CreateMutex();
+  if (binocle_profiler.mutex == NULL) {
+    binocle_log_error("binocle_profiler_init(): Cannot create the mutex: %s", SDL_GetError());
+    return false;
+  }
+  binocle_profiler.max_events = max_events_per_thread > 0 ? max_events_per_thread : BINOCLE_PROFILER_DEFAULT_MAX_EVENTS;
+  binocle_profiler.epoch = stm_now();
+  binocle_profiler_generation++;
+  binocle_profiler.initialized = true;
+  SDL_SetAtomicInt(&binocle_profiler.enabled, 1);
+  return true;
+}
+
+void binocle_profiler_shutdown(void) {
+  if (!binocle_profiler.initialized) {
+    return;
+  }
+  SDL_SetAtomicInt(&binocle_profiler.enabled, 0);
+  binocle_profiler.initialized = false;
+  binocle_profiler_thread_t *thread = binocle_profiler.threads;
+  while (thread != NULL) {
+    binocle_profiler_thread_t *next = thread->next;
+    free(thread->events);
+    free(thread);
+    thread = next;
+  }
+  free(binocle_profiler.frames);
+  SDL_DestroyMutex(binocle_profiler.mutex);
+  memset(&binocle_profiler, 0, sizeof(binocle_profiler));
+  SDL_SetTLS(&binocle_profiler_tls_thread, NULL, NULL);
+  SDL_SetTLS(&binocle_profiler_tls_generation, NULL, NULL);
+}
+
+void binocle_profiler_set_enabled(bool enabled) {
+  SDL_SetAtomicInt(&binocle_profiler.enabled, enabled && binocle_profiler.initialized ? 1 : 0);
+}
+
+bool binocle_profiler_is_enabled(void) {
+  return SDL_GetAtomicInt(&binocle_profiler.enabled) != 0;
+}
+
+static binocle_profiler_thread_t *binocle_profiler_get_current_thread(void) {
+  if ((uintptr_t)SDL_GetTLS(&binocle_profiler_tls_generation) != binocle_profiler_generation) {
+    // The buffer has been freed by a shutdown
+    return NULL;
+  }
+  return SDL_GetTLS(&binocle_profiler_tls_thread);
+}
+
+static binocle_profiler_thread_t *binocle_profiler_get_thread(void) {
+  binocle_profiler_thread_t *thread = binocle_profiler_get_current_thread();
+  if (thread != NULL) {
+    return thread;
+  }
+
+  // First time this thread records something
+  thread = calloc(1, sizeof(binocle_profiler_thread_t));
+  if (thread == NULL) {
+    return NULL;
+  }
+  thread->events = malloc(sizeof(binocle_profiler_event_t) * binocle_profiler.max_events);
+  if (thread->events == NULL) {
+    free(thread);
+    return NULL;
+  }
+  thread->thread_id = SDL_GetCurrentThreadID();
+  SDL_LockMutex(binocle_profiler.mutex);
+  thread->next = binocle_profiler.threads;
+  binocle_profiler.threads = thread;
+  SDL_UnlockMutex(binocle_profiler.mutex);
+  SDL_SetTLS(&binocle_profiler_tls_thread, thread, NULL);
+  SDL_SetTLS(&binocle_profiler_tls_generation, (void *)binocle_profiler_generation, NULL);
+  return thread;
+}
+
+void binocle_profiler_begin_zone(const char *name) {
+  if (SDL_GetAtomicInt(&binocle_profiler.enabled) == 0) {
+    return;
+  }
+  binocle_profiler_thread_t *thread = binocle_profiler_get_thread();
+  if (thread == NULL) {
+    return;
+  }
+  if (thread->depth >= BINOCLE_PROFILER_MAX_DEPTH) {
+    thread->dropped_events++;
+    thread->overflow++;
+    return;
+  }
+  if (thread->num_events >= binocle_profiler.max_events) {
+    thread->dropped_events++;
+    thread->stack[thread->depth++] = BINOCLE_PROFILER_DROPPED_ZONE;
+    return;
+  }
+  binocle_profiler_event_t *event = &thread->events[thread->num_events];
+  event->name = name;
+  event->begin = stm_now();
+  event->end = 0;
+  thread->stack[thread->depth++] = thread->num_events;
+  thread->num_events++;
+}
+
+void binocle_profiler_end_zone(void) {
+  if (!binocle_profiler.initialized) {
+    return;
+  }
+  // Zones opened before the profiler got disabled are still closed, so the stack stays balanced
+  binocle_profiler_thread_t *thread = binocle_profiler_get_current_thread();
+  if (thread == NULL) {
+    return;
+  }
+  if (thread->overflow > 0) {
+    thread->overflow--;
+    return;
+  }
+  if (thread->depth == 0) {
+    return;
+  }
+  uint32_t index = thread->stack[--thread->depth];
+  if (index != BINOCLE_PROFILER_DROPPED_ZONE && index < thread->num_events) {
+    thread->events[index].end = stm_now();
+  }
+}
+
+void binocle_profiler_add_counter(binocle_profiler_counter counter, uint64_t value) {
+  if (SDL_GetAtomicInt(&binocle_profiler.enabled) == 0) {
+    return;
+  }
+  binocle_profiler_thread_t *thread = binocle_profiler_get_thread();
+  if (thread == NULL) {
+    return;
+  }
+  thread->counters[counter] += value;
+}
+
+void binocle_profiler_begin_frame(void) {
+  if (SDL_GetAtomicInt(&binocle_profiler.enabled) == 0) {
+    return;
+  }
+  binocle_profiler.frame_begin = stm_now();
+  binocle_profiler_begin_zone("frame");
+}
+
+void binocle_profiler_end_frame(void) {
+  if (SDL_GetAtomicInt(&binocle_profiler.enabled) == 0) {
+    return;
+  }
+  binocle_profiler_end_zone();
+
+  binocle_profiler_frame_stats stats = {0};
+  stats.frame = binocle_profiler.frame_index++;
+  stats.begin_us = stm_us(stm_diff(binocle_profiler.frame_begin, binocle_profiler.epoch));
+  stats.duration_us = stm_us(stm_since(binocle_profiler.frame_begin));
+
+  SDL_LockMutex(binocle_profiler.mutex);
+  for (binocle_profiler_thread_t *thread = binocle_profiler.threads ; thread != NULL ; thread = thread->next) {
+    for (int i = 0 ; i < BINOCLE_PROFILER_COUNTER_MAX ; i++) {
+      stats.counters[i] += thread->counters[i];
+      thread->counters[i] = 0;
+    }
+  }
+  // Frames are capped like the zones of a thread
+  if (binocle_profiler.num_frames < binocle_profiler.max_events) {
+    if (binocle_profiler.num_frames >= binocle_profiler.frames_capacity) {
+      uint32_t new_capacity = binocle_profiler.frames_capacity + binocle_profiler.frames_capacity / 2; // grow by x1.5
+      if (new_capacity < 64) {
+        new_capacity = 64;
+      }
+      binocle_profiler_frame_stats *frames = realloc(binocle_profiler.frames,
+                                                     sizeof(binocle_profiler_frame_stats) * new_capacity);
+      if (frames != NULL) {
+        binocle_profiler.frames = frames;
+        binocle_profiler.frames_capacity = new_capacity;
+      }
+    }
+    if (binocle_profiler.num_frames < binocle_profiler.frames_capacity) {
+      binocle_profiler.frames[binocle_profiler.num_frames++] = stats;
+    }
+  }
+  SDL_UnlockMutex(binocle_profiler.mutex);
+
+  binocle_profiler.last_frame = stats;
+}
+
+binocle_profiler_frame_stats binocle_profiler_get_last_frame(void) {
+  return binocle_profiler.last_frame;
+}
+
+void binocle_profiler_clear(void) {
+  if (!binocle_profiler.initialized) {
+    return;
+  }
+  SDL_LockMutex(binocle_profiler.mutex);
+  for (binocle_profiler_thread_t *thread = binocle_profiler.threads ; thread != NULL ; thread = thread->next) {
+    // Open zones would end up pointing to the wrong events
+    thread->depth = 0;
+    thread->overflow = 0;
+    thread->num_events = 0;
+    thread->dropped_events = 0;
+  }
+  binocle_profiler.num_frames = 0;
+  SDL_UnlockMutex(binocle_profiler.mutex);
+}
+
+static void binocle_profiler_write_string(SDL_IOStream *file, const char *str) {
+  SDL_WriteU8(file, '"');
+  for (const char *c = str ; *c != '\0' ; c++) {
+    if (*c == '"' || *c == '\\') {
+      SDL_WriteU8(file, '\\');
+    }
+    if ((unsigned char)*c >= 0x20) {
+      SDL_WriteU8(file, (Uint8)*c);
+    }
+  }
+  SDL_WriteU8(file, '"');
+}
+
+bool binocle_profiler_save_chrome_trace(const char *filename) {
+  if (!binocle_profiler.initialized) {
+    return false;
+  }
+  SDL_IOStream *file = SDL_IOFromFile(filename, "wb");
+  if (file == NULL) {
+    binocle_log_error("binocle_profiler_save_chrome_trace(): Cannot open %s: %s", filename, SDL_GetError());
+    return false;
+  }
+
+  SDL_LockMutex(binocle_profiler.mutex);
+  bool first = true;
+  SDL_IOprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  for (binocle_profiler_thread_t *thread = binocle_profiler.threads ; thread != NULL ; thread = thread->next) {
+    uint32_t num_events = thread->num_events;
+    for (uint32_t i = 0 ; i < num_events ; i++) {
+      const binocle_profiler_event_t *event = &thread->events[i];
+      if (event->end == 0) {
+        continue;
+      }
+      SDL_IOprintf(file, "%s\n{\"name\":", first ? "" : ",");
+      binocle_profiler_write_string(file, event->name);
+      SDL_IOprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%" SDL_PRIu64 ",\"ts\":%.3f,\"dur\":%.3f}",
+                   (Uint64)thread->thread_id, stm_us(stm_diff(event->begin, binocle_profiler.epoch)),
+                   stm_us(stm_diff(event->end, event->begin)));
+      first = false;
+    }
+    if (thread->dropped_events > 0) {
+      binocle_log_warning("binocle_profiler_save_chrome_trace(): %u zones have been dropped on thread %" SDL_PRIu64,
+                          thread->dropped_events, (Uint64)thread->thread_id);
+    }
+  }
+  for (uint32_t i = 0 ; i < binocle_profiler.num_frames ; i++) {
+    const binocle_profiler_frame_stats *frame = &binocle_profiler.frames[i];
+    SDL_IOprintf(file, "%s\n{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{",
+                 first ? "" : ",", frame->begin_us);
+    for (int c = 0 ; c < BINOCLE_PROFILER_COUNTER_MAX ; c++) {
+      SDL_IOprintf(file, "%s\"%s\":%" SDL_PRIu64, c == 0 ? "" : ",", binocle_profiler_counter_names[c],
+                   (Uint64)frame->counters[c]);
+    }
+    SDL_IOprintf(file, "}}");
+    first = false;
+  }
+  SDL_IOprintf(file, "\n]}\n");
+  SDL_UnlockMutex(binocle_profiler.mutex);
+
+  if (!SDL_CloseIO(file)) {
+    binocle_log_error("binocle_profiler_save_chrome_trace(): Error writing %s: %s", filename, SDL_GetError());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,148 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#ifndef BINOCLE_PROFILER_H
+#define BINOCLE_PROFILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// The maximum number of zones that can be open at the same time on a thread
+#define BINOCLE_PROFILER_MAX_DEPTH (32)
+/// The number of zones recorded by each thread when 0 is passed to binocle_profiler_init
+#define BINOCLE_PROFILER_DEFAULT_MAX_EVENTS (65536)
+
+/**
+ * The per-frame counters
+ */
+typedef enum binocle_profiler_counter {
+  /// The draw calls issued by the graphics device
+  BINOCLE_PROFILER_COUNTER_DRAWS = 0,
+  /// The pipelines, bindings and uniforms applied by the graphics device
+  BINOCLE_PROFILER_COUNTER_STATE_CHANGES,
+  /// The vertices drawn by the graphics device
+  BINOCLE_PROFILER_COUNTER_VERTICES,
+  /// The bytes of vertex data uploaded to the GPU
+  BINOCLE_PROFILER_COUNTER_BYTES_UPLOADED,
+  /// The entities processed by the systems of the ECS
+  BINOCLE_PROFILER_COUNTER_ENTITIES,
+  BINOCLE_PROFILER_COUNTER_MAX,
+} binocle_profiler_counter;
+
+/**
+ * The statistics of a frame
+ */
+typedef struct binocle_profiler_frame_stats {
+  /// The index of the frame since the profiler has been initialized
+  uint64_t frame;
+  /// The time the frame started at, in microseconds since the profiler has been initialized
+  double begin_us;
+  /// The time between binocle_profiler_begin_frame and binocle_profiler_end_frame
+  double duration_us;
+  /// The counters, indexed by \ref binocle_profiler_counter
+  uint64_t counters[BINOCLE_PROFILER_COUNTER_MAX];
+} binocle_profiler_frame_stats;
+
+/*
+ * The instrumentation macros used by the engine. They compile to nothing unless BINOCLE_PROFILER is defined, so that
+ * the release builds don't pay anything for them.
+ */
+#if defined(BINOCLE_PROFILER)
+#define BINOCLE_PROFILE_ZONE_BEGIN(name) binocle_profiler_begin_zone(name)
+#define BINOCLE_PROFILE_ZONE_END() binocle_profiler_end_zone()
+#define BINOCLE_PROFILE_COUNTER(counter, value) binocle_profiler_add_counter(counter, value)
+#define BINOCLE_PROFILE_FRAME_BEGIN() binocle_profiler_begin_frame()
+#define BINOCLE_PROFILE_FRAME_END() binocle_profiler_end_frame()
+#else
+#define BINOCLE_PROFILE_ZONE_BEGIN(name) ((void)0)
+#define BINOCLE_PROFILE_ZONE_END() ((void)0)
+#define BINOCLE_PROFILE_COUNTER(counter, value) ((void)0)
+#define BINOCLE_PROFILE_FRAME_BEGIN() ((void)0)
+#define BINOCLE_PROFILE_FRAME_END() ((void)0)
+#endif
+
+/**
+ * \brief Initializes the profiler and starts recording
+ * The timer of sokol_time must have been set up already, as binocle_app_init does.
+ * @param max_events_per_thread the number of zones each thread can record before the profiler starts dropping them.
+ * Zero means BINOCLE_PROFILER_DEFAULT_MAX_EVENTS.
+ * @return true if everything went fine
+ */
+bool binocle_profiler_init(uint32_t max_events_per_thread);
+
+/**
+ * \brief Releases the buffers of the profiler
+ * No other thread may be recording, since their buffers are freed.
+ */
+void binocle_profiler_shutdown(void);
+
+/**
+ * \brief Pauses or resumes the recording of zones and counters
+ * It can be called while other threads are recording. They see the change at their next zone.
+ * @param enabled true to record
+ */
+void binocle_profiler_set_enabled(bool enabled);
+
+/**
+ * \brief Tells whether the profiler is recording
+ * @return true if the profiler is initialized and recording
+ */
+bool binocle_profiler_is_enabled(void);
+
+/**
+ * \brief Opens a zone on the current thread
+ * Zones can be nested and each one must be closed by \ref binocle_profiler_end_zone on the same thread.
+ * @param name the name of the zone. Only the pointer is stored, so it must stay valid until the trace is saved or
+ * cleared. String literals are the way to go. The zones of the ECS systems use the names of the systems, so save the
+ * trace before destroying the ECS.
+ */
+void binocle_profiler_begin_zone(const char *name);
+
+/**
+ * \brief Closes the last zone opened on the current thread
+ */
+void binocle_profiler_end_zone(void);
+
+/**
+ * \brief Adds a value to one of the counters of the current frame
+ * @param counter the counter
+ * @param value the value to add
+ */
+void binocle_profiler_add_counter(binocle_profiler_counter counter, uint64_t value);
+
+/**
+ * \brief Starts a new frame. It also opens a zone that spans the whole frame.
+ */
+void binocle_profiler_begin_frame(void);
+
+/**
+ * \brief Ends the current frame, collecting the counters of all the threads
+ * It must be called on the thread that called \ref binocle_profiler_begin_frame while the other threads aren't
+ * updating the counters.
+ */
+void binocle_profiler_end_frame(void);
+
+/**
+ * \brief Gets the statistics of the last frame that has been ended
+ * @return the statistics
+ */
+binocle_profiler_frame_stats binocle_profiler_get_last_frame(void);
+
+/**
+ * \brief Throws away all the zones and frames recorded so far
+ */
+void binocle_profiler_clear(void);
+
+/**
+ * \brief Saves the zones and the frame counters recorded so far in the Chrome trace event format
+ * The file can be opened with chrome://tracing or https://ui.perfetto.dev
+ * Zones that are still open are left out.
+ * @param filename the name of the JSON file
+ * @return true if the file has been written
+ */
+bool binocle_profiler_save_chrome_trace(const char *filename);
+
+#endif //BINOCLE_PROFILER_H
@@ -13,10 +13,14 @@
   #endif
 #elif defined(BINOCLE_METAL)
   #define SOKOL_METAL
+#else
+  // Builds without a graphics backend, like the benchmarks, run headless
+  #define SOKOL_DUMMY_BACKEND
 #endif
 #include "sokol_log.h"
 #include "sokol_gfx.h"
 
+#if defined(BINOCLE_GL)
 GLuint binocle_sokol_tex_id(sg_image img_id) {
   SOKOL_ASSERT(img_id.id != SG_INVALID_ID);
   _sg_image_t* img = _sg_lookup_image(&_sg.pools, img_id.id);
@@ -25,3 +29,4 @@ GLuint binocle_sokol_tex_id(sg_image img_id) {
   SOKOL_ASSERT(0 != img->gl.tex[img->cmn.active_slot]);
   return img->gl.tex[img->cmn.active_slot];
 }
+#endif
@@ -6,20 +6,22 @@
 
 #include <string.h>
 #include <limits.h>
+#include <float.h>
+#include <math.h>
 #include "binocle_sprite.h"
 #include "binocle_subtexture.h"
 #include "backend/binocle_material.h"
 #include "binocle_gd.h"
 #include "backend/binocle_vpct.h"
 #include "binocle_log.h"
+#include "binocle_profiler.h"
 #include "binocle_camera.h"
 #include <ksort/ksort.h>
 
-#define BINOCLE_SPRITE_VERTEX_COUNT 6
-
-#define batch_item_lt(a, b) ((a).sort_key < (b).sort_key)
+// The number of sprites that binocle_sprite_batch_draw_many prepares at a time
+#define BINOCLE_SPRITE_DRAW_MANY_BLOCK (64)
 
-KSORT_INIT(sort_sprite_batch_item, binocle_sprite_batch_item, batch_item_lt)
+#define BINOCLE_SPRITE_VERTEX_COUNT 6
 
 KSORT_INIT_GENERIC(float)
 
@@ -86,7 +88,8 @@ binocle_sprite_draw(binocle_sprite *sprite, binocle_gd *gd, int64_t x, int64_t y
     h = sprite->subtexture.rect.max.y;
   }
 
-  sg_image_desc info = sg_query_image_desc(sprite->material->albedo_texture);
+  int texture_width, texture_height;
+  binocle_material_get_albedo_size(sprite->material, &texture_width, &texture_height);
 
   // TL
   vertices[0].pos.x =
@@ -94,46 +97,46 @@ binocle_sprite_draw(binocle_sprite *sprite, binocle_gd *gd, int64_t x, int64_t y
   vertices[0].pos.y =
     (-sprite->origin.y * scale->y + h * scale->y) * cosf(rotation) - sprite->origin.x * scale->x * sinf(rotation) + y;
   vertices[0].color = *color;
-  vertices[0].tex.x = s->rect.min.x / info.width;
-  vertices[0].tex.y = (s->rect.min.y + s->rect.max.y) / info.height;
+  vertices[0].tex.x = s->rect.min.x / texture_width;
+  vertices[0].tex.y = (s->rect.min.y + s->rect.max.y) / texture_height;
   // TR
   vertices[1].pos.x = (-sprite->origin.x * scale->x + w * scale->x) * cosf(rotation) -
                       (-sprite->origin.y * scale->y + h * scale->y) * sinf(rotation) + x;
   vertices[1].pos.y = (-sprite->origin.y * scale->y + h * scale->y) * cosf(rotation) +
                       (-sprite->origin.x * scale->x + w * scale->x) * sinf(rotation) + y;
   vertices[1].color = *color;
-  vertices[1].tex.x = (s->rect.min.x + s->rect.max.x) / info.width;
-  vertices[1].tex.y = (s->rect.min.y + s->rect.max.y) / info.height;
+  vertices[1].tex.x = (s->rect.min.x + s->rect.max.x) / texture_width;
+  vertices[1].tex.y = (s->rect.min.y + s->rect.max.y) / texture_height;
   // BL
   vertices[2].pos.x = -sprite->origin.x * scale->x * cosf(rotation) + sprite->origin.y * scale->y * sinf(rotation) + x;
   vertices[2].pos.y = -sprite->origin.y * scale->y * cosf(rotation) - sprite->origin.x * scale->x * sinf(rotation) + y;
   vertices[2].color = *color;
-  vertices[2].tex.x = s->rect.min.x / info.width;
-  vertices[2].tex.y = s->rect.min.y / info.height;
+  vertices[2].tex.x = s->rect.min.x / texture_width;
+  vertices[2].tex.y = s->rect.min.y / texture_height;
   // TR
   vertices[3].pos.x = (-sprite->origin.x * scale->x + w * scale->x) * cosf(rotation) -
                       (-sprite->origin.y * scale->y + h * scale->y) * sinf(rotation) + x;
   vertices[3].pos.y = (-sprite->origin.y * scale->y + h * scale->y) * cosf(rotation) +
                       (-sprite->origin.x * scale->x + w * scale->x) * sinf(rotation) + y;
   vertices[3].color = *color;
-  vertices[3].tex.x = (s->rect.min.x + s->rect.max.x) / info.width;
-  vertices[3].tex.y = (s->rect.min.y + s->rect.max.y) / info.height;
+  vertices[3].tex.x = (s->rect.min.x + s->rect.max.x) / texture_width;
+  vertices[3].tex.y = (s->rect.min.y + s->rect.max.y) / texture_height;
   // BR
   vertices[4].pos.x =
     (-sprite->origin.x * scale->x + w * scale->x) * cosf(rotation) + sprite->origin.y * scale->y * sinf(rotation) + x;
   vertices[4].pos.y =
     -sprite->origin.y * scale->y * cosf(rotation) + (-sprite->origin.x * scale->x + w * scale->x) * sinf(rotation) + y;
   vertices[4].color = *color;
-  vertices[4].tex.x = (s->rect.min.x + s->rect.max.x) / info.width;
-  vertices[4].tex.y = s->rect.min.y / info.height;
+  vertices[4].tex.x = (s->rect.min.x + s->rect.max.x) / texture_width;
+  vertices[4].tex.y = s->rect.min.y / texture_height;
   // BL
   vertices[5].pos.x = -sprite->origin.x * scale->x * cosf(rotation) + sprite->origin.y * scale->y * sinf(rotation) + x;
   vertices[5].pos.y = -sprite->origin.y * scale->y * cosf(rotation) - sprite->origin.x * scale->x * sinf(rotation) + y;
   vertices[5].color = *color;
-  vertices[5].tex.x = s->rect.min.x / info.width;
-  vertices[5].tex.y = s->rect.min.y / info.height;
+  vertices[5].tex.x = s->rect.min.x / texture_width;
+  vertices[5].tex.y = s->rect.min.y / texture_height;
 
-  binocle_gd_draw(gd, vertices, BINOCLE_SPRITE_VERTEX_COUNT, *sprite->material, *viewport, camera, depth);
+  binocle_gd_draw(gd, vertices, BINOCLE_SPRITE_VERTEX_COUNT, sprite->material, *viewport, camera, depth);
 }
 
 void binocle_sprite_draw_with_sprite_batch(binocle_sprite_batch *sprite_batch, binocle_sprite *sprite, binocle_gd *gd,
@@ -647,6 +650,38 @@ binocle_sprite_batch_item_set(binocle_sprite_batch_item *item, float x, float y,
   item->material = material;
 }
 
+void
+binocle_sprite_batch_item_set_packed(binocle_sprite_batch_item *item, float x, float y, float dx, float dy, float w,
+                                     float h, float sin, float cos, sg_color color, kmVec2 tex_coord_tl,
+                                     kmVec2 tex_coord_br, float depth, binocle_material *material) {
+  item->packed_vertices[0] = binocle_vpct_packed_new(
+    (kmVec2){.x = x + dx * cos - dy * sin, .y = y + dx * sin + dy * cos}, color,
+    (kmVec2){.x = tex_coord_tl.x, .y = tex_coord_tl.y});
+  item->packed_vertices[1] = binocle_vpct_packed_new(
+    (kmVec2){.x = x + (dx + w) * cos - dy * sin, .y = y + (dx + w) * sin + dy * cos}, color,
+    (kmVec2){.x = tex_coord_br.x, .y = tex_coord_tl.y});
+  item->packed_vertices[2] = binocle_vpct_packed_new(
+    (kmVec2){.x = x + dx * cos - (dy + h) * sin, .y = y + dx * sin + (dy + h) * cos}, color,
+    (kmVec2){.x = tex_coord_tl.x, .y = tex_coord_br.y});
+  item->packed_vertices[3] = binocle_vpct_packed_new(
+    (kmVec2){.x = x + (dx + w) * cos - (dy + h) * sin, .y = y + (dx + w) * sin + (dy + h) * cos}, color,
+    (kmVec2){.x = tex_coord_br.x, .y = tex_coord_br.y});
+
+  item->sort_key = depth;
+  item->material = material;
+}
+
+void
+binocle_sprite_batch_item_set_instance(binocle_sprite_batch_item *item, float x, float y, float dx, float dy, float w,
+                                       float h, float rotation, sg_color color, kmVec2 tex_coord_tl,
+                                       kmVec2 tex_coord_br, float depth, binocle_material *material) {
+  item->instance = binocle_vpct_instance_new((kmVec2){.x = x, .y = y}, (kmVec2){.x = w, .y = h},
+                                             (kmVec2){.x = -dx, .y = -dy}, rotation, depth, tex_coord_tl,
+                                             tex_coord_br, color);
+  item->sort_key = depth;
+  item->material = material;
+}
+
 //
 // Sprite Batcher
 //
@@ -654,18 +689,19 @@ binocle_sprite_batch_item_set(binocle_sprite_batch_item *item, float x, float y,
 binocle_sprite_batcher binocle_sprite_batcher_new() {
   binocle_sprite_batcher res = {0};
   res.initial_batch_size = 256;
-  res.max_batch_size = ULONG_MAX / 6; // 6 = 4 vertices unique and 2 shared, per quad
+  res.max_batch_size = BINOCLE_GD_MAX_QUADS;
   res.batch_item_list = malloc(sizeof(binocle_sprite_batch_item) * res.initial_batch_size);
   res.batch_item_list_size = 0;
   res.batch_item_list_capacity = res.initial_batch_size;
-  res.initial_vertex_array_size = 256 * 6;
-  res.index = malloc(sizeof(uint64_t) * res.initial_vertex_array_size);
-  res.index_size = 0;
-  res.index_capacity = res.initial_vertex_array_size;
+  res.initial_vertex_array_size = 256 * 4;
   res.vertex_array = malloc(sizeof(binocle_vpct) * res.initial_vertex_array_size);
   res.vertex_array_size = 0;
   res.vertex_array_capacity = res.initial_vertex_array_size;
 
+  res.sort_entries = malloc(sizeof(binocle_sprite_batch_sort_entry) * res.initial_batch_size);
+  res.sort_entries_scratch = malloc(sizeof(binocle_sprite_batch_sort_entry) * res.initial_batch_size);
+  res.sort_entries_capacity = res.initial_batch_size;
+
   binocle_sprite_batcher_ensure_array_capacity(&res, 256);
 
   return res;
@@ -685,51 +721,109 @@ binocle_sprite_batch_item *binocle_sprite_batcher_create_batch_item(binocle_spri
 }
 
 void binocle_sprite_batcher_ensure_array_capacity(binocle_sprite_batcher *batcher, uint64_t num_batch_items) {
-  uint64_t needed_capacity = 6 * num_batch_items;
-  if (needed_capacity <= batcher->index_capacity) {
+  // 4 vertices per quad, the shared ones are resolved by the quad index buffer of binocle_gd
+  uint64_t needed_capacity = 4 * num_batch_items;
+  if (needed_capacity <= batcher->vertex_array_capacity) {
     // Short circuit out of here because we have enough capacity.
     return;
   }
 
-  batcher->index = realloc(batcher->index, sizeof(uint64_t) * needed_capacity);
-  batcher->index_capacity = needed_capacity;
-
-  uint64_t start = batcher->index_size / 6;
-  for (uint64_t i = start; i < num_batch_items; i++) {
-    /*
-      *  TL    TR
-      *   0----1 0,1,2,3 = index offsets for vertex indices
-      *   |   /| TL,TR,BL,BR are vertex references in SpriteBatchItem.
-      *   |  / |
-      *   | /  |
-      *   |/   |
-      *   2----3
-      *  BL    BR
-      */
-    // Triangle 1
-    batcher->index[(i * 6)] = i * 4;
-    batcher->index[(i * 6 + 1)] = i * 4 + 1;
-    batcher->index[(i * 6 + 2)] = i * 4 + 2;
-    // Triangle 2
-    batcher->index[(i * 6 + 3)] = i * 4 + 1;
-    batcher->index[(i * 6 + 4)] = i * 4 + 3;
-    batcher->index[(i * 6 + 5)] = i * 4 + 2;
-    batcher->index_size += 6;
-  }
-
   batcher->vertex_array = realloc(batcher->vertex_array, sizeof(binocle_vpct) * needed_capacity);
+  if (batcher->packed_vertex_array != NULL) {
+    batcher->packed_vertex_array = realloc(batcher->packed_vertex_array, sizeof(binocle_vpct_packed) * needed_capacity);
+  }
+  if (batcher->instance_array != NULL) {
+    batcher->instance_array = realloc(batcher->instance_array, sizeof(binocle_vpct_instance) * num_batch_items);
+  }
   batcher->vertex_array_capacity = needed_capacity;
 }
 
+static uint32_t binocle_sprite_batcher_sort_key(float depth) {
+  uint32_t bits;
+  // Adding zero turns -0 into +0 so that both get the same key
+  depth += 0.0f;
+  memcpy(&bits, &depth, sizeof(bits));
+  // Flip all the bits of negative numbers and only the sign of positive ones so that the
+  // unsigned order matches the float order
+  return bits ^ ((bits & 0x80000000u) ? 0xFFFFFFFFu : 0x80000000u);
+}
+
+void binocle_sprite_batcher_sort(binocle_sprite_batcher *batcher) {
+  uint64_t count = batcher->batch_item_list_size;
+  uint64_t histogram[4][256] = {0};
+  bool sorted = true;
+
+  if (count > batcher->sort_entries_capacity) {
+    uint64_t new_capacity = batcher->batch_item_list_capacity;
+    batcher->sort_entries = realloc(batcher->sort_entries, sizeof(binocle_sprite_batch_sort_entry) * new_capacity);
+    batcher->sort_entries_scratch = realloc(batcher->sort_entries_scratch, sizeof(binocle_sprite_batch_sort_entry) * new_capacity);
+    batcher->sort_entries_capacity = new_capacity;
+  }
+
+  // Build the keys and the histograms of all the passes in a single sweep over the items
+  binocle_sprite_batch_sort_entry *src = batcher->sort_entries;
+  for (uint64_t i = 0; i < count; i++) {
+    uint32_t key = binocle_sprite_batcher_sort_key(batcher->batch_item_list[i].sort_key);
+    src[i].key = key;
+    src[i].index = (uint32_t)i;
+    histogram[0][key & 0xFF]++;
+    histogram[1][(key >> 8) & 0xFF]++;
+    histogram[2][(key >> 16) & 0xFF]++;
+    histogram[3][key >> 24]++;
+    if (i > 0 && key < src[i - 1].key) {
+      sorted = false;
+    }
+  }
+
+  if (sorted) {
+    return;
+  }
+
+  // LSD radix sort, one byte per pass. Each pass is stable, which keeps the submission order of equal keys.
+  binocle_sprite_batch_sort_entry *dst = batcher->sort_entries_scratch;
+  for (int pass = 0; pass < 4; pass++) {
+    uint32_t shift = pass * 8;
+    uint64_t offset = 0;
+
+    // All the keys share this byte, nothing to reorder
+    if (histogram[pass][(src[0].key >> shift) & 0xFF] == count) {
+      continue;
+    }
+
+    for (int b = 0; b < 256; b++) {
+      uint64_t n = histogram[pass][b];
+      histogram[pass][b] = offset;
+      offset += n;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+      dst[histogram[pass][(src[i].key >> shift) & 0xFF]++] = src[i];
+    }
+
+    binocle_sprite_batch_sort_entry *tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+
+  // Make sure the result ends up in sort_entries
+  if (src != batcher->sort_entries) {
+    batcher->sort_entries_scratch = batcher->sort_entries;
+    batcher->sort_entries = src;
+  }
+}
+
 void binocle_sprite_batcher_draw_batch(binocle_sprite_batcher *batcher, binocle_sprite_sort_mode sort_mode,
                                        binocle_render_state *render_state, binocle_gd *gd) {
   if (batcher->batch_item_list_size == 0) {
     // Nothing to do
     return;
   }
+  BINOCLE_PROFILE_ZONE_BEGIN("sprite_batcher_draw_batch");
 
   // sort the batch items
-  ks_mergesort(sort_sprite_batch_item, batcher->batch_item_list_size, batcher->batch_item_list, 0);
+  binocle_sprite_batcher_sort(batcher);
+
+  // Instanced items hold one instance each instead of four vertices
+  bool instanced = sort_mode == BINOCLE_SPRITE_SORT_MODE_INSTANCED;
 
   // Determine how many iterations through the drawing code we need to make
   uint64_t batch_index = 0;
@@ -749,59 +843,79 @@ void binocle_sprite_batcher_draw_batch(binocle_sprite_batcher *batcher, binocle_
     }
 
     binocle_sprite_batcher_ensure_array_capacity(batcher, num_batches_to_process);
+    if (instanced && batcher->instance_array == NULL) {
+      batcher->instance_array = malloc(sizeof(binocle_vpct_instance) * batcher->vertex_array_capacity / 4);
+    } else if (!instanced && batcher->vertex_format == BINOCLE_VERTEX_FORMAT_PACKED && batcher->packed_vertex_array == NULL) {
+      batcher->packed_vertex_array = malloc(sizeof(binocle_vpct_packed) * batcher->vertex_array_capacity);
+    }
 
     // Draw the batches
     for (int i = 0; i < num_batches_to_process; i++) {
+      // gather the items in sorted order
+      binocle_sprite_batch_item *item = &batcher->batch_item_list[batcher->sort_entries[batch_index].index];
+
       // if the texture changed, we need to flush and bind the new texture
       bool should_flush = false;
 
-      if (batcher->batch_item_list[batch_index].material != NULL && material == NULL) {
+      if (item->material != NULL && material == NULL) {
         should_flush = true;
-      } else if (batcher->batch_item_list[batch_index].material == NULL && material != NULL) {
+      } else if (item->material == NULL && material != NULL) {
         should_flush = true;
-      } else if (batcher->batch_item_list[batch_index].material == NULL && material == NULL) {
+      } else if (item->material == NULL && material == NULL) {
         should_flush = false;
-      } else if (batcher->batch_item_list[batch_index].sort_key != depth) {
+      } else if (item->sort_key != depth) {
         should_flush = true;
       } else {
-        should_flush = batcher->batch_item_list[batch_index].material != material;
+        should_flush = item->material != material;
       }
       if (should_flush) {
-        binocle_sprite_batcher_flush_vertex_array(batcher, start_index, index, material, render_state, gd, depth);
+        if (instanced) {
+          binocle_sprite_batcher_flush_instance_array(batcher, start_index, index, material, render_state, gd, depth);
+        } else {
+          binocle_sprite_batcher_flush_vertex_array(batcher, start_index, index, material, render_state, gd, depth);
+        }
 
-        material = batcher->batch_item_list[batch_index].material;
-        depth = batcher->batch_item_list[batch_index].sort_key;
+        material = item->material;
+        depth = item->sort_key;
         start_index = 0;
         index = 0;
       }
 
-      binocle_sprite_batch_item *item = &batcher->batch_item_list[batch_index];
       // store the SpriteBatchItem data in our vertexArray
-      batcher->vertex_array[index] = item->vertex_tl;
-      index = index + 1;
-      batcher->vertex_array[index] = item->vertex_tr;
-      index = index + 1;
-      batcher->vertex_array[index] = item->vertex_bl;
-      index = index + 1;
-      batcher->vertex_array[index] = item->vertex_tr;
-      index = index + 1;
-      batcher->vertex_array[index] = item->vertex_br;
-      index = index + 1;
-      batcher->vertex_array[index] = item->vertex_bl;
-      index = index + 1;
+      if (instanced) {
+        batcher->instance_array[index] = item->instance;
+        index = index + 1;
+      } else if (batcher->vertex_format == BINOCLE_VERTEX_FORMAT_PACKED) {
+        memcpy(&batcher->packed_vertex_array[index], item->packed_vertices, sizeof(item->packed_vertices));
+        index = index + 4;
+      } else {
+        batcher->vertex_array[index] = item->vertex_tl;
+        index = index + 1;
+        batcher->vertex_array[index] = item->vertex_tr;
+        index = index + 1;
+        batcher->vertex_array[index] = item->vertex_bl;
+        index = index + 1;
+        batcher->vertex_array[index] = item->vertex_br;
+        index = index + 1;
+      }
 
       // Release the texture.
       item->material = NULL;
       batch_index += 1;
     }
     // flush the remaining vertexArray data
-    binocle_sprite_batcher_flush_vertex_array(batcher, start_index, index, material, render_state, gd, depth);
+    if (instanced) {
+      binocle_sprite_batcher_flush_instance_array(batcher, start_index, index, material, render_state, gd, depth);
+    } else {
+      binocle_sprite_batcher_flush_vertex_array(batcher, start_index, index, material, render_state, gd, depth);
+    }
     // Update our batch count to continue the process of culling down
     // large batches
     batch_count -= num_batches_to_process;
   }
   // return items to the pool.
   batcher->batch_item_list_size = 0;
+  BINOCLE_PROFILE_ZONE_END();
 }
 
 void binocle_sprite_batcher_flush_vertex_array(binocle_sprite_batcher *batcher, uint64_t start, uint64_t end,
@@ -814,7 +928,22 @@ void binocle_sprite_batcher_flush_vertex_array(binocle_sprite_batcher *batcher,
   uint64_t vertex_count = end - start;
   render_state->material = material;
 
-  binocle_gd_draw_with_state(gd, batcher->vertex_array, vertex_count, render_state, depth);
+  if (batcher->vertex_format == BINOCLE_VERTEX_FORMAT_PACKED) {
+    binocle_gd_draw_packed_quads_with_state(gd, batcher->packed_vertex_array + start, vertex_count / 4, render_state, depth);
+  } else {
+    binocle_gd_draw_quads_with_state(gd, batcher->vertex_array + start, vertex_count / 4, render_state, depth);
+  }
+}
+
+void binocle_sprite_batcher_flush_instance_array(binocle_sprite_batcher *batcher, uint64_t start, uint64_t end,
+                                                 binocle_material *material, binocle_render_state *render_state,
+                                                 binocle_gd *gd, float depth) {
+  if (start == end) {
+    return;
+  }
+
+  render_state->material = material;
+  binocle_gd_draw_instances(gd, batcher->instance_array + start, end - start, render_state, depth);
 }
 
 //
@@ -843,26 +972,56 @@ binocle_sprite_batch binocle_sprite_batch_new() {
   res.origin_rect.max.x = 0;
   res.origin_rect.max.y = 0;
   res.sort_mode = BINOCLE_SPRITE_SORT_MODE_IMMEDIATE;
-  res.cull_rect.min.x = 0;
-  res.cull_rect.min.y = 0;
-  res.cull_rect.max.x = 0;
-  res.cull_rect.max.y = 0;
-  res.vertex_to_cull_tl.x = 0;
-  res.vertex_to_cull_tl.y = 0;
-  res.vertex_to_cull_tr.x = 0;
-  res.vertex_to_cull_tr.y = 0;
-  res.vertex_to_cull_bl.x = 0;
-  res.vertex_to_cull_bl.y = 0;
-  res.vertex_to_cull_br.x = 0;
-  res.vertex_to_cull_br.y = 0;
+  // Don't cull anything until the first begin computes the real rectangle
+  res.cull_rect.min.x = -FLT_MAX;
+  res.cull_rect.min.y = -FLT_MAX;
+  res.cull_rect.max.x = FLT_MAX;
+  res.cull_rect.max.y = FLT_MAX;
+  res.culled_count = 0;
   return res;
 }
 
+void binocle_sprite_batch_destroy(binocle_sprite_batch *batch) {
+  binocle_sprite_batcher *batcher = &batch->batcher;
+  free(batcher->batch_item_list);
+  free(batcher->vertex_array);
+  free(batcher->packed_vertex_array);
+  free(batcher->instance_array);
+  free(batcher->sort_entries);
+  free(batcher->sort_entries_scratch);
+  memset(batcher, 0, sizeof(*batcher));
+}
+
 void binocle_sprite_batch_compute_cull_rectangle(binocle_sprite_batch *batch, kmAABB2 viewport) {
-  batch->cull_rect.min.x = viewport.min.x;
-  batch->cull_rect.min.y = viewport.min.y;
-  batch->cull_rect.max.x = viewport.max.x;
-  batch->cull_rect.max.y = viewport.max.y;
+  kmMat4 inverse;
+  if (kmMat4Inverse(&inverse, &batch->matrix) == NULL) {
+    // Nothing sensible to cull against, let everything through
+    batch->cull_rect.min.x = -FLT_MAX;
+    batch->cull_rect.min.y = -FLT_MAX;
+    batch->cull_rect.max.x = FLT_MAX;
+    batch->cull_rect.max.y = FLT_MAX;
+    return;
+  }
+
+  // The projection maps viewport.min to viewport.max, so those are the corners of the visible area in view space
+  kmVec3 corners[4] = {
+    {viewport.min.x, viewport.min.y, 0},
+    {viewport.max.x, viewport.min.y, 0},
+    {viewport.min.x, viewport.max.y, 0},
+    {viewport.max.x, viewport.max.y, 0},
+  };
+  batch->cull_rect.min.x = FLT_MAX;
+  batch->cull_rect.min.y = FLT_MAX;
+  batch->cull_rect.max.x = -FLT_MAX;
+  batch->cull_rect.max.y = -FLT_MAX;
+  for (int i = 0 ; i < 4 ; i++) {
+    kmVec3 world;
+    kmVec3MultiplyMat4(&world, &corners[i], &inverse);
+    batch->cull_rect.min.x = fminf(batch->cull_rect.min.x, world.x);
+    batch->cull_rect.min.y = fminf(batch->cull_rect.min.y, world.y);
+    batch->cull_rect.max.x = fmaxf(batch->cull_rect.max.x, world.x);
+    batch->cull_rect.max.y = fmaxf(batch->cull_rect.max.y, world.y);
+  }
 }
 
 void binocle_sprite_batch_begin(binocle_sprite_batch *batch, kmAABB2 viewport, binocle_sprite_sort_mode sort_mode,
@@ -875,7 +1034,12 @@ void binocle_sprite_batch_begin(binocle_sprite_batch *batch, kmAABB2 viewport, b
   }
   batch->render_state.transform = batch->matrix;
   batch->sort_mode = sort_mode;
+  if (batch->gd != NULL) {
+    // The items must be built in the same format the graphics device streams
+    batch->batcher.vertex_format = batch->gd->vertex_format;
+  }
   binocle_sprite_batch_compute_cull_rectangle(batch, viewport);
+  batch->culled_count = 0;
   if (batch->sort_mode == BINOCLE_SPRITE_SORT_MODE_IMMEDIATE) {
     binocle_sprite_batch_setup(batch, viewport);
   }
@@ -894,59 +1058,19 @@ void binocle_sprite_batch_setup(binocle_sprite_batch *batch, kmAABB2 viewport) {
   batch->render_state.viewport = viewport;
 }
 
-void binocle_sprite_batch_draw_internal(binocle_sprite_batch *batch, binocle_material *material, kmAABB2 *source_rectangle,
-                                        sg_color color, float rotation, float depth, bool auto_flush) {
-  sg_image_desc info = sg_query_image_desc(material->albedo_texture);
-
-  // Cull geometry outside the viewport
-  batch->vertex_to_cull_tl.x =
-    batch->origin_rect.min.x + -batch->scaled_origin.x * cosf(rotation) - -batch->scaled_origin.y * sinf(rotation);
-  batch->vertex_to_cull_tl.y =
-    batch->origin_rect.min.y + -batch->scaled_origin.x * sinf(rotation) + -batch->scaled_origin.y * cosf(rotation);
-
-  batch->vertex_to_cull_tr.x =
-    batch->origin_rect.min.x + (-batch->scaled_origin.x + batch->origin_rect.max.x) * cosf(rotation) -
-    -batch->scaled_origin.y * sinf(rotation);
-  batch->vertex_to_cull_tr.y =
-    batch->origin_rect.min.y + (-batch->scaled_origin.x + batch->origin_rect.max.x) * sinf(rotation) +
-    -batch->scaled_origin.y * cosf(rotation);
-
-  batch->vertex_to_cull_bl.x = batch->origin_rect.min.x + -batch->scaled_origin.x * cosf(rotation) -
-                               (-batch->scaled_origin.y + batch->origin_rect.max.y) * sinf(rotation);
-  batch->vertex_to_cull_bl.y = batch->origin_rect.min.y + -batch->scaled_origin.x * sinf(rotation) +
-                               (-batch->scaled_origin.y + batch->origin_rect.max.y) * cosf(rotation);
-
-  batch->vertex_to_cull_br.x =
-    batch->origin_rect.min.x + (-batch->scaled_origin.x + batch->origin_rect.max.x) * cosf(rotation) -
-    (-batch->scaled_origin.y + batch->origin_rect.max.y) * sinf(rotation);
-  batch->vertex_to_cull_br.y =
-    batch->origin_rect.min.y + (-batch->scaled_origin.x + batch->origin_rect.max.x) * sinf(rotation) +
-    (-batch->scaled_origin.y + batch->origin_rect.max.y) * cosf(rotation);
-
-  if (source_rectangle != NULL) {
-    batch->temp_rect.min.x = source_rectangle->min.x;
-    batch->temp_rect.min.y = source_rectangle->min.y;
-    batch->temp_rect.max.x = source_rectangle->max.x;
-    batch->temp_rect.max.y = source_rectangle->max.y;
-  } else {
-    batch->temp_rect.min.x = 0.0f;
-    batch->temp_rect.min.y = 0.0f;
-    batch->temp_rect.max.x = info.width;
-    batch->temp_rect.max.y = info.height;
-  }
-
-  batch->tex_coord_tl.x = batch->temp_rect.min.x / info.width;
-  batch->tex_coord_tl.y = batch->temp_rect.min.y / info.height;
-  batch->tex_coord_br.x = (batch->temp_rect.min.x + batch->temp_rect.max.x) / info.width;
-  batch->tex_coord_br.y = (batch->temp_rect.min.y + batch->temp_rect.max.y) / info.height;
-
-  binocle_sprite_batch_item *item = binocle_sprite_batcher_create_batch_item(&batch->batcher);
-  binocle_sprite_batch_item_set(item, batch->origin_rect.min.x, batch->origin_rect.min.y,
-                                -batch->scaled_origin.x, -batch->scaled_origin.y, batch->origin_rect.max.x,
-                                batch->origin_rect.max.y,
-                                sinf(rotation), cosf(rotation), color, batch->tex_coord_tl,
-                                batch->tex_coord_br, depth, material);
+static bool binocle_sprite_batch_is_visible(const binocle_sprite_batch *batch, float x, float y, float dx, float dy,
+                                            float w, float h) {
+  // Whatever the rotation, the sprite stays within the circle centered on its origin that reaches its farthest corner,
+  // so we can reject it before doing any trig.
+  float extent_x = fmaxf(fabsf(dx), fabsf(dx + w));
+  float extent_y = fmaxf(fabsf(dy), fabsf(dy + h));
+  float radius = sqrtf(extent_x * extent_x + extent_y * extent_y);
+  return x + radius >= batch->cull_rect.min.x && x - radius <= batch->cull_rect.max.x &&
+         y + radius >= batch->cull_rect.min.y && y - radius <= batch->cull_rect.max.y;
+}
 
+static void binocle_sprite_batch_apply_sort_key(binocle_sprite_batch *batch, binocle_sprite_batch_item *item,
+                                                float depth) {
   // set SortKey based on SpriteSortMode.
   switch (batch->sort_mode) {
     // Comparison of Texture objects.
@@ -955,7 +1079,8 @@ void binocle_sprite_batch_draw_internal(binocle_sprite_batch *batch, binocle_mat
       break;
     }
       // Comparison of Depth
-    case BINOCLE_SPRITE_SORT_MODE_FRONT_TO_BACK: {
+    case BINOCLE_SPRITE_SORT_MODE_FRONT_TO_BACK:
+    case BINOCLE_SPRITE_SORT_MODE_INSTANCED: {
       item->sort_key = depth;
       break;
     }
@@ -973,6 +1098,60 @@ void binocle_sprite_batch_draw_internal(binocle_sprite_batch *batch, binocle_mat
     default:
       break;
   }
+}
+
+void binocle_sprite_batch_draw_internal(binocle_sprite_batch *batch, binocle_material *material, kmAABB2 *source_rectangle,
+                                        sg_color color, float rotation, float depth, bool auto_flush) {
+  // Cull geometry outside the viewport
+  if (!binocle_sprite_batch_is_visible(batch, batch->origin_rect.min.x, batch->origin_rect.min.y,
+                                       -batch->scaled_origin.x, -batch->scaled_origin.y, batch->origin_rect.max.x,
+                                       batch->origin_rect.max.y)) {
+    batch->culled_count++;
+    return;
+  }
+
+  int texture_width, texture_height;
+  binocle_material_get_albedo_size(material, &texture_width, &texture_height);
+
+  if (source_rectangle != NULL) {
+    batch->temp_rect.min.x = source_rectangle->min.x;
+    batch->temp_rect.min.y = source_rectangle->min.y;
+    batch->temp_rect.max.x = source_rectangle->max.x;
+    batch->temp_rect.max.y = source_rectangle->max.y;
+  } else {
+    batch->temp_rect.min.x = 0.0f;
+    batch->temp_rect.min.y = 0.0f;
+    batch->temp_rect.max.x = texture_width;
+    batch->temp_rect.max.y = texture_height;
+  }
+
+  batch->tex_coord_tl.x = batch->temp_rect.min.x / texture_width;
+  batch->tex_coord_tl.y = batch->temp_rect.min.y / texture_height;
+  batch->tex_coord_br.x = (batch->temp_rect.min.x + batch->temp_rect.max.x) / texture_width;
+  batch->tex_coord_br.y = (batch->temp_rect.min.y + batch->temp_rect.max.y) / texture_height;
+
+  binocle_sprite_batch_item *item = binocle_sprite_batcher_create_batch_item(&batch->batcher);
+  if (batch->sort_mode == BINOCLE_SPRITE_SORT_MODE_INSTANCED) {
+    binocle_sprite_batch_item_set_instance(item, batch->origin_rect.min.x, batch->origin_rect.min.y,
+                                           -batch->scaled_origin.x, -batch->scaled_origin.y, batch->origin_rect.max.x,
+                                           batch->origin_rect.max.y,
+                                           rotation, color, batch->tex_coord_tl,
+                                           batch->tex_coord_br, depth, material);
+  } else if (batch->batcher.vertex_format == BINOCLE_VERTEX_FORMAT_PACKED) {
+    binocle_sprite_batch_item_set_packed(item, batch->origin_rect.min.x, batch->origin_rect.min.y,
+                                         -batch->scaled_origin.x, -batch->scaled_origin.y, batch->origin_rect.max.x,
+                                         batch->origin_rect.max.y,
+                                         sinf(rotation), cosf(rotation), color, batch->tex_coord_tl,
+                                         batch->tex_coord_br, depth, material);
+  } else {
+    binocle_sprite_batch_item_set(item, batch->origin_rect.min.x, batch->origin_rect.min.y,
+                                  -batch->scaled_origin.x, -batch->scaled_origin.y, batch->origin_rect.max.x,
+                                  batch->origin_rect.max.y,
+                                  sinf(rotation), cosf(rotation), color, batch->tex_coord_tl,
+                                  batch->tex_coord_br, depth, material);
+  }
+
+  binocle_sprite_batch_apply_sort_key(batch, item, depth);
 
   if (auto_flush) {
     binocle_sprite_batch_flush_if_needed(batch);
@@ -987,6 +1166,169 @@ void binocle_sprite_batch_flush_if_needed(binocle_sprite_batch *batch) {
   }
 }
 
+void binocle_sprite_batch_draw_many(binocle_sprite_batch *batch, binocle_material *material, size_t count,
+                                    const kmVec2 *positions, const kmAABB2 *source_rectangles, const kmVec2 *origins,
+                                    const float *rotations, const kmVec2 *scales, const sg_color *colors,
+                                    const float *depths) {
+  binocle_sprite_batcher *batcher = &batch->batcher;
+  int texture_width, texture_height;
+  binocle_material_get_albedo_size(material, &texture_width, &texture_height);
+  kmAABB2 whole_texture = {.min = {.x = 0, .y = 0}, .max = {.x = texture_width, .y = texture_height}};
+  sg_color white = binocle_color_white();
+
+  // Make room for all the sprites at once instead of growing one item at a time
+  uint64_t needed_size = batcher->batch_item_list_size + count;
+  if (needed_size > batcher->batch_item_list_capacity) {
+    uint64_t new_size = batcher->batch_item_list_capacity + batcher->batch_item_list_capacity / 2; // grow by x1.5
+    if (new_size < needed_size) {
+      new_size = needed_size;
+    }
+    new_size = (new_size + 63) & (~63); // grow in chunks of 64.
+    batcher->batch_item_list = realloc(batcher->batch_item_list, sizeof(binocle_sprite_batch_item) * new_size);
+    batcher->batch_item_list_capacity = new_size;
+  }
+
+  // The sprites are prepared one block at a time, in separate passes over plain float arrays that the compiler can
+  // vectorize. Only the sprites that survive culling get to the trig and vertex generation passes.
+  uint32_t index[BINOCLE_SPRITE_DRAW_MANY_BLOCK];
+  float x[BINOCLE_SPRITE_DRAW_MANY_BLOCK];
+  float y[BINOCLE_SPRITE_DRAW_MANY_BLOCK];
+  float dx[BINOCLE_SPRITE_DRAW_MANY_BLOCK];
+  float dy[BINOCLE_SPRITE_DRAW_MANY_BLOCK];
+  float w[BINOCLE_SPRITE_DRAW_MANY_BLOCK];
+  float h[BINOCLE_SPRITE_DRAW_MANY_BLOCK];
+  float sin_rotation[BINOCLE_SPRITE_DRAW_MANY_BLOCK];
+  float cos_rotation[BINOCLE_SPRITE_DRAW_MANY_BLOCK];
+  // The corners in top-left, top-right, bottom-left, bottom-right order
+  float corner_x[4][BINOCLE_SPRITE_DRAW_MANY_BLOCK];
+  float corner_y[4][BINOCLE_SPRITE_DRAW_MANY_BLOCK];
+
+  for (size_t start = 0 ; start < count ; start += BINOCLE_SPRITE_DRAW_MANY_BLOCK) {
+    size_t block_size = count - start < BINOCLE_SPRITE_DRAW_MANY_BLOCK ? count - start : BINOCLE_SPRITE_DRAW_MANY_BLOCK;
+
+    // Size and corner offsets, same as binocle_sprite_batch_draw_vector_scale
+    size_t visible = 0;
+    for (size_t i = 0 ; i < block_size ; i++) {
+      size_t n = start + i;
+      const kmAABB2 *rect = source_rectangles != NULL ? &source_rectangles[n] : &whole_texture;
+      float scale_x = scales != NULL ? scales[n].x : 1.0f;
+      float scale_y = scales != NULL ? scales[n].y : 1.0f;
+      float sprite_w = truncf(rect->max.x * scale_x);
+      float sprite_h = truncf(rect->max.y * scale_y);
+      float sprite_dx = origins != NULL ? -origins[n].x * scale_x : 0.0f;
+      float sprite_dy = origins != NULL ? -origins[n].y * scale_y : 0.0f;
+      if (!binocle_sprite_batch_is_visible(batch, positions[n].x, positions[n].y, sprite_dx, sprite_dy, sprite_w,
+                                           sprite_h)) {
+        batch->culled_count++;
+        continue;
+      }
+      index[visible] = (uint32_t)n;
+      x[visible] = positions[n].x;
+      y[visible] = positions[n].y;
+      dx[visible] = sprite_dx;
+      dy[visible] = sprite_dy;
+      w[visible] = sprite_w;
+      h[visible] = sprite_h;
+      visible++;
+    }
+
+    if (rotations != NULL) {
+      for (size_t i = 0 ; i < visible ; i++) {
+        sin_rotation[i] = sinf(rotations[index[i]]);
+        cos_rotation[i] = cosf(rotations[index[i]]);
+      }
+    } else {
+      for (size_t i = 0 ; i < visible ; i++) {
+        sin_rotation[i] = 0.0f;
+        cos_rotation[i] = 1.0f;
+      }
+    }
+
+    // All four corners of every sprite in one pass, same math as binocle_sprite_batch_item_set
+    if (batch->sort_mode != BINOCLE_SPRITE_SORT_MODE_INSTANCED) {
+      for (size_t i = 0 ; i < visible ; i++) {
+        float left_cos = dx[i] * cos_rotation[i];
+        float left_sin = dx[i] * sin_rotation[i];
+        float right_cos = (dx[i] + w[i]) * cos_rotation[i];
+        float right_sin = (dx[i] + w[i]) * sin_rotation[i];
+        float top_cos = dy[i] * cos_rotation[i];
+        float top_sin = dy[i] * sin_rotation[i];
+        float bottom_cos = (dy[i] + h[i]) * cos_rotation[i];
+        float bottom_sin = (dy[i] + h[i]) * sin_rotation[i];
+        corner_x[0][i] = x[i] + left_cos - top_sin;
+        corner_y[0][i] = y[i] + left_sin + top_cos;
+        corner_x[1][i] = x[i] + right_cos - top_sin;
+        corner_y[1][i] = y[i] + right_sin + top_cos;
+        corner_x[2][i] = x[i] + left_cos - bottom_sin;
+        corner_y[2][i] = y[i] + left_sin + bottom_cos;
+        corner_x[3][i] = x[i] + right_cos - bottom_sin;
+        corner_y[3][i] = y[i] + right_sin + bottom_cos;
+      }
+    }
+
+    for (size_t i = 0 ; i < visible ; i++) {
+      uint32_t n = index[i];
+      const kmAABB2 *rect = source_rectangles != NULL ? &source_rectangles[n] : &whole_texture;
+      kmVec2 tex_coord_tl = {.x = rect->min.x / texture_width, .y = rect->min.y / texture_height};
+      kmVec2 tex_coord_br = {
+        .x = (rect->min.x + rect->max.x) / texture_width,
+        .y = (rect->min.y + rect->max.y) / texture_height
+      };
+      sg_color color = colors != NULL ? colors[n] : white;
+      float depth = depths != NULL ? depths[n] : 0.0f;
+
+      binocle_sprite_batch_item *item = &batcher->batch_item_list[batcher->batch_item_list_size];
+      batcher->batch_item_list_size++;
+      if (batch->sort_mode == BINOCLE_SPRITE_SORT_MODE_INSTANCED) {
+        binocle_sprite_batch_item_set_instance(item, x[i], y[i], dx[i], dy[i], w[i], h[i],
+                                               rotations != NULL ? rotations[n] : 0.0f, color, tex_coord_tl,
+                                               tex_coord_br, depth, material);
+      } else if (batcher->vertex_format == BINOCLE_VERTEX_FORMAT_PACKED) {
+        item->packed_vertices[0] = binocle_vpct_packed_new((kmVec2){.x = corner_x[0][i], .y = corner_y[0][i]}, color,
+                                                           (kmVec2){.x = tex_coord_tl.x, .y = tex_coord_tl.y});
+        item->packed_vertices[1] = binocle_vpct_packed_new((kmVec2){.x = corner_x[1][i], .y = corner_y[1][i]}, color,
+                                                           (kmVec2){.x = tex_coord_br.x, .y = tex_coord_tl.y});
+        item->packed_vertices[2] = binocle_vpct_packed_new((kmVec2){.x = corner_x[2][i], .y = corner_y[2][i]}, color,
+                                                           (kmVec2){.x = tex_coord_tl.x, .y = tex_coord_br.y});
+        item->packed_vertices[3] = binocle_vpct_packed_new((kmVec2){.x = corner_x[3][i], .y = corner_y[3][i]}, color,
+                                                           (kmVec2){.x = tex_coord_br.x, .y = tex_coord_br.y});
+        item->sort_key = depth;
+        item->material = material;
+      } else {
+        item->vertex_tl.pos.x = corner_x[0][i];
+        item->vertex_tl.pos.y = corner_y[0][i];
+        item->vertex_tl.color = color;
+        item->vertex_tl.tex.x = tex_coord_tl.x;
+        item->vertex_tl.tex.y = tex_coord_tl.y;
+
+        item->vertex_tr.pos.x = corner_x[1][i];
+        item->vertex_tr.pos.y = corner_y[1][i];
+        item->vertex_tr.color = color;
+        item->vertex_tr.tex.x = tex_coord_br.x;
+        item->vertex_tr.tex.y = tex_coord_tl.y;
+
+        item->vertex_bl.pos.x = corner_x[2][i];
+        item->vertex_bl.pos.y = corner_y[2][i];
+        item->vertex_bl.color = color;
+        item->vertex_bl.tex.x = tex_coord_tl.x;
+        item->vertex_bl.tex.y = tex_coord_br.y;
+
+        item->vertex_br.pos.x = corner_x[3][i];
+        item->vertex_br.pos.y = corner_y[3][i];
+        item->vertex_br.color = color;
+        item->vertex_br.tex.x = tex_coord_br.x;
+        item->vertex_br.tex.y = tex_coord_br.y;
+
+        item->sort_key = depth;
+        item->material = material;
+      }
+      binocle_sprite_batch_apply_sort_key(batch, item, depth);
+    }
+  }
+
+  binocle_sprite_batch_flush_if_needed(batch);
+}
+
 void binocle_sprite_batch_draw(binocle_sprite_batch *batch, binocle_material *material, kmVec2 *position,
                                kmAABB2 *destination_rectangle,
                                kmAABB2 *source_rectangle, kmVec2 *origin,
@@ -1030,10 +1372,11 @@ void binocle_sprite_batch_draw_vector_scale(binocle_sprite_batch *batch, binocle
                                             kmAABB2 *source_rectangle, sg_color color,
                                             float rotation, kmVec2 origin, kmVec2 scale,
                                             float layer_depth) {
-  sg_image_desc info = sg_query_image_desc(material->albedo_texture);
+  int texture_width, texture_height;
+  binocle_material_get_albedo_size(material, &texture_width, &texture_height);
 
-  float w = info.width * scale.x;
-  float h = info.height * scale.y;
+  float w = texture_width * scale.x;
+  float h = texture_height * scale.y;
   if (source_rectangle != NULL) {
     w = source_rectangle->max.x * scale.x;
     h = source_rectangle->max.y * scale.y;
@@ -1074,7 +1417,8 @@ binocle_sprite_batch_draw_noscale(binocle_sprite_batch *batch, binocle_material
                                   kmAABB2 *source_rectangle, sg_color color,
                                   float rotation, kmVec2 origin,
                                   float layer_depth) {
-  sg_image_desc info = sg_query_image_desc(material->albedo_texture);
+  int texture_width, texture_height;
+  binocle_material_get_albedo_size(material, &texture_width, &texture_height);
 
   batch->origin_rect.min.x = destination_rectangle.min.x;
   batch->origin_rect.min.y = destination_rectangle.min.y;
@@ -1088,7 +1432,7 @@ binocle_sprite_batch_draw_noscale(binocle_sprite_batch *batch, binocle_material
   } else {
     batch->scaled_origin.x =
       origin.x * (destination_rectangle.max.x /
-                  info.width);
+                  texture_width);
   }
 
   if (source_rectangle != NULL && source_rectangle->max.y != 0) {
@@ -1098,7 +1442,7 @@ binocle_sprite_batch_draw_noscale(binocle_sprite_batch *batch, binocle_material
   } else {
     batch->scaled_origin.y =
       origin.y * (destination_rectangle.max.y /
-                  info.width);
+                  texture_width);
   }
 
   binocle_sprite_batch_draw_internal(batch, material, source_rectangle, color, rotation,
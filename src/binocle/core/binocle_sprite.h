@@ -36,7 +36,10 @@ typedef enum binocle_sprite_sort_mode
   /// Same as \see binocle_sprite_batch_end, except sprites are sorted by depth in back-to-front order prior to drawing.
   BINOCLE_SPRITE_SORT_MODE_BACK_TO_FRONT,
   /// Same as \see binocle_sprite_batch_end, except sprites are sorted by depth in front-to-back order prior to drawing.
-  BINOCLE_SPRITE_SORT_MODE_FRONT_TO_BACK
+  BINOCLE_SPRITE_SORT_MODE_FRONT_TO_BACK,
+  /// Same as \see BINOCLE_SPRITE_SORT_MODE_FRONT_TO_BACK, except sprites are drawn with GPU instancing. Each sprite
+  /// only stores a \see binocle_vpct_instance instead of four vertices. Needs \see binocle_gd_setup_instanced_pipeline.
+  BINOCLE_SPRITE_SORT_MODE_INSTANCED
 } binocle_sprite_sort_mode;
 
 /**
@@ -176,13 +179,32 @@ typedef struct binocle_sprite {
  */
 typedef struct binocle_sprite_batch_item {
   struct binocle_material *material;
-  binocle_vpct vertex_tl;
-  binocle_vpct vertex_tr;
-  binocle_vpct vertex_bl;
-  binocle_vpct vertex_br;
+  union {
+    struct {
+      binocle_vpct vertex_tl;
+      binocle_vpct vertex_tr;
+      binocle_vpct vertex_bl;
+      binocle_vpct vertex_br;
+    };
+    /// The vertices in top-left, top-right, bottom-left, bottom-right order when the batcher uses compact vertices
+    binocle_vpct_packed packed_vertices[4];
+    /// The sprite when the batch is using \see BINOCLE_SPRITE_SORT_MODE_INSTANCED
+    binocle_vpct_instance instance;
+  };
   float sort_key;
 } binocle_sprite_batch_item;
 
+/**
+ * An entry of the sort order of the sprite batcher.
+ * Sorting these instead of the whole batch items keeps the data moved around by the sort small.
+ */
+typedef struct binocle_sprite_batch_sort_entry {
+  /// The sort key of the item, mapped to an unsigned integer that sorts in the same order as the float
+  uint32_t key;
+  /// The index of the item in the batch item list
+  uint32_t index;
+} binocle_sprite_batch_sort_entry;
+
 /**
  * The sprite batcher
  */
@@ -193,12 +215,15 @@ typedef struct binocle_sprite_batcher {
   binocle_sprite_batch_item *batch_item_list;
   uint64_t batch_item_list_size;
   uint64_t batch_item_list_capacity;
-  uint64_t *index;
-  uint64_t index_size;
-  uint64_t index_capacity;
+  binocle_vertex_format vertex_format;
   binocle_vpct *vertex_array;
+  binocle_vpct_packed *packed_vertex_array;
+  binocle_vpct_instance *instance_array;
   uint64_t vertex_array_size;
   uint64_t vertex_array_capacity;
+  binocle_sprite_batch_sort_entry *sort_entries;
+  binocle_sprite_batch_sort_entry *sort_entries_scratch;
+  uint64_t sort_entries_capacity;
 } binocle_sprite_batcher;
 
 /**
@@ -216,11 +241,10 @@ typedef struct binocle_sprite_batch {
   kmVec2 scaled_origin;
   kmAABB2 origin_rect;
   binocle_sprite_sort_mode sort_mode;
+  /// The area of the world that's visible through the viewport. min and max are the corners.
   kmAABB2 cull_rect;
-  kmVec2 vertex_to_cull_tl;
-  kmVec2 vertex_to_cull_tr;
-  kmVec2 vertex_to_cull_bl;
-  kmVec2 vertex_to_cull_br;
+  /// The number of sprites that have been skipped because they were outside cull_rect since the last begin
+  uint64_t culled_count;
 } binocle_sprite_batch;
 
 /**
@@ -467,6 +491,20 @@ binocle_sprite_batch_item binocle_sprite_batch_item_new();
  */
 void binocle_sprite_batch_item_set(binocle_sprite_batch_item *item, float x, float y, float dx, float dy, float w, float h, float sin, float cos, sg_color color, kmVec2 tex_coord_tl, kmVec2 tex_coord_br, float depth, struct binocle_material *material);
 
+/**
+ * \brief Sets the values of a sprite batch item using compact vertices
+ * Same as \ref binocle_sprite_batch_item_set but the vertices are converted to \ref binocle_vpct_packed right away,
+ * so that drawing the batch only needs to copy them.
+ */
+void binocle_sprite_batch_item_set_packed(binocle_sprite_batch_item *item, float x, float y, float dx, float dy, float w, float h, float sin, float cos, sg_color color, kmVec2 tex_coord_tl, kmVec2 tex_coord_br, float depth, struct binocle_material *material);
+
+/**
+ * \brief Sets the values of a sprite batch item drawn with GPU instancing
+ * Same as \ref binocle_sprite_batch_item_set but only the \ref binocle_vpct_instance is stored, the vertices are
+ * computed by the GPU. The rotation is given as an angle in radians instead of its sin and cos components.
+ */
+void binocle_sprite_batch_item_set_instance(binocle_sprite_batch_item *item, float x, float y, float dx, float dy, float w, float h, float rotation, sg_color color, kmVec2 tex_coord_tl, kmVec2 tex_coord_br, float depth, struct binocle_material *material);
+
 /**
  * \brief Creates a new sprite batcher
  * @return the sprite batcher
@@ -488,6 +526,14 @@ binocle_sprite_batch_item *binocle_sprite_batcher_create_batch_item(binocle_spri
  */
 void binocle_sprite_batcher_ensure_array_capacity(binocle_sprite_batcher *batcher, uint64_t num_batch_items);
 
+/**
+ * \brief Sorts the batch items of the sprite batcher by their sort key
+ * Items with the same sort key keep the order in which they have been added.
+ * The result is stored in batcher->sort_entries and the batch items themselves aren't moved.
+ * @param batcher the sprite batcher
+ */
+void binocle_sprite_batcher_sort(binocle_sprite_batcher *batcher);
+
 /**
  * \brief Tells the sprite batcher to draw its batch of items
  * @param batcher the sprite batcher
@@ -509,6 +555,18 @@ void binocle_sprite_batcher_draw_batch(binocle_sprite_batcher *batcher, binocle_
  */
 void binocle_sprite_batcher_flush_vertex_array(binocle_sprite_batcher *batcher, uint64_t start, uint64_t end, struct binocle_material *material, struct binocle_render_state *render_state, struct binocle_gd *gd, float depth);
 
+/**
+ * \brief Tells the sprite batcher to flush an array of instances
+ * @param batcher the sprite batcher
+ * @param start the index of the instance to start from
+ * @param end the index of the last instance
+ * @param material the material to use
+ * @param render_state the current render state
+ * @param gd the graphics device
+ * @param depth the depth of the layer being flushed
+ */
+void binocle_sprite_batcher_flush_instance_array(binocle_sprite_batcher *batcher, uint64_t start, uint64_t end, struct binocle_material *material, struct binocle_render_state *render_state, struct binocle_gd *gd, float depth);
+
 /**
  * \brief Creates a new sprite batch
  * @return the sprite batch
@@ -516,7 +574,15 @@ void binocle_sprite_batcher_flush_vertex_array(binocle_sprite_batcher *batcher,
 binocle_sprite_batch binocle_sprite_batch_new();
 
 /**
- * \brief Computes the cull rectangle of a prite batch
+ * \brief Releases the memory of a sprite batch
+ * @param batch the sprite batch
+ */
+void binocle_sprite_batch_destroy(binocle_sprite_batch *batch);
+
+/**
+ * \brief Computes the cull rectangle of a sprite batch
+ * The corners of the viewport are brought back to world space through the inverse of the transform matrix of the
+ * batch, so the matrix must be set before calling this.
  * @param batch the sprite batch
  * @param viewport the viewport
  */
@@ -565,6 +631,27 @@ void binocle_sprite_batch_draw_internal(binocle_sprite_batch *batch, struct bino
  */
 void binocle_sprite_batch_flush_if_needed(binocle_sprite_batch *batch);
 
+/**
+ * \brief Draws many sprites sharing the same material in the batch
+ * Each array holds one entry per sprite. This is the same as calling \ref binocle_sprite_batch_draw_vector_scale for
+ * each sprite, but it works on whole blocks of sprites at once and the texture size is only looked up once.
+ * All the arrays but positions can be NULL to use the default value for every sprite.
+ * @param batch the sprite batch
+ * @param material the material
+ * @param count the number of sprites
+ * @param positions the positions
+ * @param source_rectangles the source rectangles in pixels. Defaults to the whole texture.
+ * @param origins the origins, relative to the bottom-left corner of the sprite. Defaults to (0, 0).
+ * @param rotations the rotation angles in radians. Defaults to 0.
+ * @param scales the scales. Defaults to (1, 1).
+ * @param colors the colors. Defaults to white.
+ * @param depths the depths of the sprites. Defaults to 0.
+ */
+void binocle_sprite_batch_draw_many(binocle_sprite_batch *batch, struct binocle_material *material, size_t count,
+                                    const kmVec2 *positions, const kmAABB2 *source_rectangles, const kmVec2 *origins,
+                                    const float *rotations, const kmVec2 *scales, const sg_color *colors,
+                                    const float *depths);
+
 /**
  * \brief Draws a sprite in the batch
  * @param batch the sprite batch
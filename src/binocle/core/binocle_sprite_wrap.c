@@ -138,6 +138,8 @@ binocle_sprite_sort_mode l_binocle_sprite_sort_mode_convert(const char *mode) {
     return BINOCLE_SPRITE_SORT_MODE_IMMEDIATE;
   } else if (SDL_strcmp(mode, "BINOCLE_SPRITE_SORT_MODE_TEXTURE") == 0) {
     return BINOCLE_SPRITE_SORT_MODE_TEXTURE;
+  } else if (SDL_strcmp(mode, "BINOCLE_SPRITE_SORT_MODE_INSTANCED") == 0) {
+    return BINOCLE_SPRITE_SORT_MODE_INSTANCED;
   }
   return BINOCLE_SPRITE_SORT_MODE_DEFERRED;
 }
@@ -173,6 +175,33 @@ int l_binocle_sprite_batch_draw(lua_State *L) {
   return 1;
 }
 
+int l_binocle_sprite_batch_draw_many(lua_State *L) {
+  l_binocle_sprite_batch_t *sprite_batch = luaL_checkudata(L, 1, "binocle_sprite_batch");
+  l_binocle_material_t *material = luaL_checkudata(L, 2, "binocle_material");
+  luaL_checktype(L, 3, LUA_TTABLE);
+  float depth = lua_tonumber(L, 4);
+  // The positions come packed in a single table as { x1, y1, x2, y2, ... }
+  size_t count = lua_objlen(L, 3) / 2;
+  if (count == 0) {
+    return 0;
+  }
+  kmVec2 *positions = SDL_malloc(sizeof(kmVec2) * count);
+  float *depths = SDL_malloc(sizeof(float) * count);
+  for (size_t i = 0 ; i < count ; i++) {
+    lua_rawgeti(L, 3, (int)(i * 2 + 1));
+    lua_rawgeti(L, 3, (int)(i * 2 + 2));
+    positions[i].x = lua_tonumber(L, -2);
+    positions[i].y = lua_tonumber(L, -1);
+    lua_pop(L, 2);
+    depths[i] = depth;
+  }
+  binocle_sprite_batch_draw_many(sprite_batch->sprite_batch, material->material, count, positions, NULL, NULL, NULL,
+                                 NULL, NULL, depths);
+  SDL_free(depths);
+  SDL_free(positions);
+  return 0;
+}
+
 int l_binocle_sprite_batch_set_sort_mode(lua_State *L) {
   l_binocle_sprite_batch_t *sprite_batch = luaL_checkudata(L, 1, "binocle_sprite_batch");
   const char *sort_mode = luaL_checkstring(L, 2);
@@ -186,6 +215,7 @@ static const struct luaL_Reg sprite_batch [] = {
   {"begin", l_binocle_sprite_batch_begin},
   {"finish", l_binocle_sprite_batch_end},
   {"draw", l_binocle_sprite_batch_draw},
+  {"draw_many", l_binocle_sprite_batch_draw_many},
   {"set_sort_mode", l_binocle_sprite_batch_set_sort_mode},
   {NULL, NULL}
 };
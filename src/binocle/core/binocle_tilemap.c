@@ -0,0 +1,251 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#include "binocle_tilemap.h"
+#include "binocle_camera.h"
+#include "binocle_gd.h"
+#include "backend/binocle_material.h"
+#include "backend/binocle_vpct.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The quads of a whole chunk must fit in a single draw
+#define BINOCLE_TILEMAP_MAX_CHUNK_SIZE (128)
+
+binocle_tilemap *binocle_tilemap_new(uint32_t width, uint32_t height, float tile_width, float tile_height,
+                                     uint32_t chunk_size, struct binocle_material *material) {
+  return binocle_tilemap_new_layered(width, height, tile_width, tile_height, chunk_size, 1, material);
+}
+
+binocle_tilemap *binocle_tilemap_new_layered(uint32_t width, uint32_t height, float tile_width, float tile_height,
+                                             uint32_t chunk_size, uint32_t layers, struct binocle_material *material) {
+  binocle_tilemap *res = malloc(sizeof(binocle_tilemap));
+  memset(res, 0, sizeof(*res));
+  if (layers == 0) {
+    layers = 1;
+  }
+  if (layers > BINOCLE_TILEMAP_MAX_LAYERS) {
+    layers = BINOCLE_TILEMAP_MAX_LAYERS;
+  }
+  if (chunk_size == 0) {
+    chunk_size = BINOCLE_TILEMAP_DEFAULT_CHUNK_SIZE;
+  }
+  if (chunk_size > BINOCLE_TILEMAP_MAX_CHUNK_SIZE) {
+    chunk_size = BINOCLE_TILEMAP_MAX_CHUNK_SIZE;
+  }
+  while (chunk_size * chunk_size * layers > BINOCLE_TILEMAP_MAX_CHUNK_SIZE * BINOCLE_TILEMAP_MAX_CHUNK_SIZE) {
+    chunk_size--;
+  }
+  res->width = width;
+  res->height = height;
+  res->tile_width = tile_width;
+  res->tile_height = tile_height;
+  res->material = material;
+  res->layers = layers;
+  res->chunk_size = chunk_size;
+  res->chunks_x = (width + chunk_size - 1) / chunk_size;
+  res->chunks_y = (height + chunk_size - 1) / chunk_size;
+
+  res->tiles = malloc(sizeof(int32_t) * width * height * layers);
+  for (uint32_t i = 0 ; i < width * height * layers ; i++) {
+    res->tiles[i] = BINOCLE_TILEMAP_EMPTY_TILE;
+  }
+
+  res->chunks = malloc(sizeof(binocle_tilemap_chunk) * res->chunks_x * res->chunks_y);
+  for (uint32_t i = 0 ; i < res->chunks_x * res->chunks_y ; i++) {
+    res->chunks[i].vbuf.id = SG_INVALID_ID;
+    res->chunks[i].num_quads = 0;
+    res->chunks[i].dirty = true;
+    res->chunks[i].update_frame = 0;
+  }
+
+  // Big enough for a full chunk in either vertex format
+  res->scratch = malloc(sizeof(binocle_vpct) * 4 * chunk_size * chunk_size * layers);
+  return res;
+}
+
+void binocle_tilemap_destroy(binocle_tilemap *tilemap) {
+  for (uint32_t i = 0 ; i < tilemap->chunks_x * tilemap->chunks_y ; i++) {
+    if (tilemap->chunks[i].vbuf.id != SG_INVALID_ID) {
+      sg_destroy_buffer(tilemap->chunks[i].vbuf);
+    }
+  }
+  free(tilemap->chunks);
+  free(tilemap->tiles);
+  free(tilemap->tile_rects);
+  free(tilemap->scratch);
+  free(tilemap);
+}
+
+static void binocle_tilemap_mark_all_dirty(binocle_tilemap *tilemap) {
+  for (uint32_t i = 0 ; i < tilemap->chunks_x * tilemap->chunks_y ; i++) {
+    tilemap->chunks[i].dirty = true;
+  }
+}
+
+void binocle_tilemap_set_tileset(binocle_tilemap *tilemap, const kmAABB2 *tile_rects, uint32_t num_tile_rects) {
+  tilemap->tile_rects = realloc(tilemap->tile_rects, sizeof(kmAABB2) * num_tile_rects);
+  memcpy(tilemap->tile_rects, tile_rects, sizeof(kmAABB2) * num_tile_rects);
+  tilemap->num_tile_rects = num_tile_rects;
+  binocle_tilemap_mark_all_dirty(tilemap);
+}
+
+void binocle_tilemap_set_position(binocle_tilemap *tilemap, kmVec2 position) {
+  tilemap->position = position;
+}
+
+void binocle_tilemap_set_layer_tile(binocle_tilemap *tilemap, uint32_t x, uint32_t y, uint32_t layer, int32_t tile) {
+  if (x >= tilemap->width || y >= tilemap->height || layer >= tilemap->layers) {
+    return;
+  }
+  int32_t *cell = &tilemap->tiles[(y * tilemap->width + x) * tilemap->layers + layer];
+  if (*cell == tile) {
+    return;
+  }
+  *cell = tile;
+  tilemap->chunks[(y / tilemap->chunk_size) * tilemap->chunks_x + x / tilemap->chunk_size].dirty = true;
+}
+
+bool binocle_tilemap_push_tile(binocle_tilemap *tilemap, uint32_t x, uint32_t y, int32_t tile) {
+  if (x >= tilemap->width || y >= tilemap->height) {
+    return false;
+  }
+  int32_t *cell = &tilemap->tiles[(y * tilemap->width + x) * tilemap->layers];
+  for (uint32_t layer = 0 ; layer < tilemap->layers ; layer++) {
+    if (cell[layer] == BINOCLE_TILEMAP_EMPTY_TILE) {
+      binocle_tilemap_set_layer_tile(tilemap, x, y, layer, tile);
+      return true;
+    }
+  }
+  return false;
+}
+
+int32_t binocle_tilemap_get_layer_tile(binocle_tilemap *tilemap, uint32_t x, uint32_t y, uint32_t layer) {
+  if (x >= tilemap->width || y >= tilemap->height || layer >= tilemap->layers) {
+    return BINOCLE_TILEMAP_EMPTY_TILE;
+  }
+  return tilemap->tiles[(y * tilemap->width + x) * tilemap->layers + layer];
+}
+
+void binocle_tilemap_set_tile(binocle_tilemap *tilemap, uint32_t x, uint32_t y, int32_t tile) {
+  binocle_tilemap_set_layer_tile(tilemap, x, y, 0, tile);
+}
+
+int32_t binocle_tilemap_get_tile(binocle_tilemap *tilemap, uint32_t x, uint32_t y) {
+  return binocle_tilemap_get_layer_tile(tilemap, x, y, 0);
+}
+
+static void binocle_tilemap_build_chunk(binocle_tilemap *tilemap, binocle_gd *gd, binocle_tilemap_chunk *chunk,
+                                        uint32_t cx, uint32_t cy, uint32_t frame) {
+  bool packed = gd->vertex_format == BINOCLE_VERTEX_FORMAT_PACKED;
+  size_t vertex_size = packed ? sizeof(binocle_vpct_packed) : sizeof(binocle_vpct);
+  binocle_vpct *vertices = tilemap->scratch;
+  binocle_vpct_packed *packed_vertices = tilemap->scratch;
+  int texture_width, texture_height;
+  binocle_material_get_albedo_size(tilemap->material, &texture_width, &texture_height);
+  sg_color white = binocle_color_white();
+
+  uint32_t x_start = cx * tilemap->chunk_size;
+  uint32_t y_start = cy * tilemap->chunk_size;
+  uint32_t x_end = x_start + tilemap->chunk_size < tilemap->width ? x_start + tilemap->chunk_size : tilemap->width;
+  uint32_t y_end = y_start + tilemap->chunk_size < tilemap->height ? y_start + tilemap->chunk_size : tilemap->height;
+
+  uint32_t num_quads = 0;
+  for (uint32_t y = y_start ; y < y_end ; y++) {
+    for (uint32_t x = x_start ; x < x_end ; x++) {
+      int32_t *cell = &tilemap->tiles[(y * tilemap->width + x) * tilemap->layers];
+      for (uint32_t layer = 0 ; layer < tilemap->layers ; layer++) {
+        int32_t tile = cell[layer];
+        if (tile < 0 || (uint32_t)tile >= tilemap->num_tile_rects) {
+          continue;
+        }
+        kmAABB2 rect = tilemap->tile_rects[tile];
+        float left = x * tilemap->tile_width;
+        float bottom = y * tilemap->tile_height;
+        float right = left + tilemap->tile_width;
+        float top = bottom + tilemap->tile_height;
+        float u0 = rect.min.x / texture_width;
+        float v0 = rect.min.y / texture_height;
+        float u1 = (rect.min.x + rect.max.x) / texture_width;
+        float v1 = (rect.min.y + rect.max.y) / texture_height;
+
+        // Top-left, top-right, bottom-left, bottom-right, as expected by the quad index buffer
+        binocle_vpct quad[4] = {
+          binocle_vpct_new((kmVec2){.x = left, .y = top}, white, (kmVec2){.x = u0, .y = v1}),
+          binocle_vpct_new((kmVec2){.x = right, .y = top}, white, (kmVec2){.x = u1, .y = v1}),
+          binocle_vpct_new((kmVec2){.x = left, .y = bottom}, white, (kmVec2){.x = u0, .y = v0}),
+          binocle_vpct_new((kmVec2){.x = right, .y = bottom}, white, (kmVec2){.x = u1, .y = v0}),
+        };
+        for (int i = 0 ; i < 4 ; i++) {
+          if (packed) {
+            packed_vertices[num_quads * 4 + i] = binocle_vpct_pack(quad[i]);
+          } else {
+            vertices[num_quads * 4 + i] = quad[i];
+          }
+        }
+        num_quads++;
+      }
+    }
+  }
+
+  if (num_quads > 0) {
+    if (chunk->vbuf.id == SG_INVALID_ID) {
+      chunk->vbuf = sg_make_buffer(&(sg_buffer_desc){
+        .type = SG_BUFFERTYPE_VERTEXBUFFER,
+        .usage = SG_USAGE_DYNAMIC,
+        .size = vertex_size * 4 * tilemap->chunk_size * tilemap->chunk_size * tilemap->layers,
+        .label = "tilemap-chunk",
+      });
+    }
+    sg_update_buffer(chunk->vbuf, &(sg_range){ .ptr = tilemap->scratch, .size = vertex_size * 4 * num_quads });
+    chunk->update_frame = frame;
+  }
+  chunk->num_quads = num_quads;
+  chunk->dirty = false;
+}
+
+void binocle_tilemap_draw(binocle_tilemap *tilemap, binocle_gd *gd, kmAABB2 viewport, binocle_camera *camera,
+                          float depth) {
+  uint32_t cx_start = 0;
+  uint32_t cy_start = 0;
+  uint32_t cx_end = tilemap->chunks_x;
+  uint32_t cy_end = tilemap->chunks_y;
+
+  if (camera != NULL) {
+    // The bounds store the size in max, and it can be negative depending on the orientation of the camera
+    kmAABB2 bounds = binocle_camera_get_bounds(camera);
+    float chunk_width = tilemap->tile_width * tilemap->chunk_size;
+    float chunk_height = tilemap->tile_height * tilemap->chunk_size;
+    float min_x = (fminf(bounds.min.x, bounds.min.x + bounds.max.x) - tilemap->position.x) / chunk_width;
+    float max_x = (fmaxf(bounds.min.x, bounds.min.x + bounds.max.x) - tilemap->position.x) / chunk_width;
+    float min_y = (fminf(bounds.min.y, bounds.min.y + bounds.max.y) - tilemap->position.y) / chunk_height;
+    float max_y = (fmaxf(bounds.min.y, bounds.min.y + bounds.max.y) - tilemap->position.y) / chunk_height;
+    if (max_x < 0 || max_y < 0 || min_x >= tilemap->chunks_x || min_y >= tilemap->chunks_y) {
+      return;
+    }
+    cx_start = min_x < 0 ? 0 : (uint32_t)min_x;
+    cy_start = min_y < 0 ? 0 : (uint32_t)min_y;
+    cx_end = max_x >= tilemap->chunks_x ? tilemap->chunks_x : (uint32_t)max_x + 1;
+    cy_end = max_y >= tilemap->chunks_y ? tilemap->chunks_y : (uint32_t)max_y + 1;
+  }
+
+  // The frame stats are those of the last committed frame
+  uint32_t frame = sg_query_frame_stats().frame_index + 1;
+  for (uint32_t cy = cy_start ; cy < cy_end ; cy++) {
+    for (uint32_t cx = cx_start ; cx < cx_end ; cx++) {
+      binocle_tilemap_chunk *chunk = &tilemap->chunks[cy * tilemap->chunks_x + cx];
+      // A chunk already uploaded this frame, for another camera, keeps its old tiles until the next one
+      if (chunk->dirty && (chunk->vbuf.id == SG_INVALID_ID || chunk->update_frame != frame)) {
+        binocle_tilemap_build_chunk(tilemap, gd, chunk, cx, cy, frame);
+      }
+      if (chunk->num_quads > 0) {
+        binocle_gd_draw_buffer(gd, chunk->vbuf, chunk->num_quads, tilemap->material, viewport, camera,
+                               tilemap->position, depth);
+      }
+    }
+  }
+}
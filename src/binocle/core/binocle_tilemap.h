@@ -0,0 +1,185 @@
+//
+// Binocle
+// Copyright (c) 2015-2019 Valerio Santinelli
+// All rights reserved.
+//
+
+#ifndef BINOCLE_TILEMAP_H
+#define BINOCLE_TILEMAP_H
+
+#include <kazmath/kazmath.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "sokol_gfx.h"
+
+#define BINOCLE_TILEMAP_DEFAULT_CHUNK_SIZE (32)
+#define BINOCLE_TILEMAP_EMPTY_TILE (-1)
+/// The most tiles that can be stacked in a cell
+#define BINOCLE_TILEMAP_MAX_LAYERS (8)
+
+struct binocle_camera;
+struct binocle_gd;
+struct binocle_material;
+
+/**
+ * A square block of tiles that's baked into its own vertex buffer
+ */
+typedef struct binocle_tilemap_chunk {
+  /// The vertices of the non empty tiles of the chunk. It's created the first time the chunk gets built.
+  sg_buffer vbuf;
+  /// The number of quads in vbuf
+  uint32_t num_quads;
+  /// Whether a tile changed since the chunk has been built
+  bool dirty;
+  /// The sokol frame in which vbuf has last been updated. A dynamic buffer can only be updated once per frame.
+  uint32_t update_frame;
+} binocle_tilemap_chunk;
+
+/**
+ * A static layer of tiles.
+ * The tiles are baked into persistent vertex buffers, one per chunk of chunk_size x chunk_size tiles, so drawing the
+ * map only costs one command per visible chunk. A chunk is only rebuilt when one of its tiles changes.
+ * Tile (0, 0) is the bottom-left one and sits at the position of the tilemap.
+ * Each cell can stack up to layers tiles, which are drawn from layer 0 upwards within the same chunk. The quads of a
+ * chunk have to fit in a single draw, so the chunks get smaller as the number of layers grows.
+ */
+typedef struct binocle_tilemap {
+  /// The number of tiles in each row
+  uint32_t width;
+  /// The number of rows
+  uint32_t height;
+  float tile_width;
+  float tile_height;
+  /// The world position of the bottom-left corner of the map
+  kmVec2 position;
+  /// The material used to draw the tiles. All the tiles come from its albedo texture.
+  struct binocle_material *material;
+  /// The number of tiles that can be stacked in each cell, at most BINOCLE_TILEMAP_MAX_LAYERS
+  uint32_t layers;
+  /// The tile indexes of each cell, row by row, with the layers of a cell next to each other.
+  /// BINOCLE_TILEMAP_EMPTY_TILE for the empty ones.
+  int32_t *tiles;
+  /// The rectangles of the tiles in the texture, in pixels. min is the position and max is the size, like in
+  /// \ref binocle_subtexture
+  kmAABB2 *tile_rects;
+  uint32_t num_tile_rects;
+  uint32_t chunk_size;
+  uint32_t chunks_x;
+  uint32_t chunks_y;
+  binocle_tilemap_chunk *chunks;
+  /// The vertices of the chunk being built
+  void *scratch;
+} binocle_tilemap;
+
+/**
+ * \brief Creates a new tilemap with all the tiles empty
+ * @param width the number of tiles in each row
+ * @param height the number of rows
+ * @param tile_width the width of a tile in world units
+ * @param tile_height the height of a tile in world units
+ * @param chunk_size the number of tiles on each side of a chunk. Zero means BINOCLE_TILEMAP_DEFAULT_CHUNK_SIZE.
+ * @param material the material used to draw the tiles
+ * @return the tilemap
+ */
+binocle_tilemap *binocle_tilemap_new(uint32_t width, uint32_t height, float tile_width, float tile_height,
+                                     uint32_t chunk_size, struct binocle_material *material);
+
+/**
+ * \brief Creates a new tilemap whose cells can stack several tiles, with all the tiles empty
+ * @param width the number of tiles in each row
+ * @param height the number of rows
+ * @param tile_width the width of a tile in world units
+ * @param tile_height the height of a tile in world units
+ * @param chunk_size the number of tiles on each side of a chunk. Zero means BINOCLE_TILEMAP_DEFAULT_CHUNK_SIZE. It's
+ * reduced when the tiles of a chunk with all its layers wouldn't fit in a single draw.
+ * @param layers the number of tiles that can be stacked in each cell, clamped to 1..BINOCLE_TILEMAP_MAX_LAYERS
+ * @param material the material used to draw the tiles
+ * @return the tilemap
+ */
+binocle_tilemap *binocle_tilemap_new_layered(uint32_t width, uint32_t height, float tile_width, float tile_height,
+                                             uint32_t chunk_size, uint32_t layers, struct binocle_material *material);
+
+/**
+ * \brief Releases the tilemap and its vertex buffers
+ * @param tilemap the tilemap
+ */
+void binocle_tilemap_destroy(binocle_tilemap *tilemap);
+
+/**
+ * \brief Sets the rectangles of the texture that the tile indexes refer to
+ * @param tilemap the tilemap
+ * @param tile_rects the rectangles in pixels, with min being the position and max the size. They're copied.
+ * @param num_tile_rects the number of rectangles
+ */
+void binocle_tilemap_set_tileset(binocle_tilemap *tilemap, const kmAABB2 *tile_rects, uint32_t num_tile_rects);
+
+/**
+ * \brief Moves the tilemap. The chunks are baked relative to the map and moved when drawn, so they aren't rebuilt.
+ * @param tilemap the tilemap
+ * @param position the world position of the bottom-left corner of the map
+ */
+void binocle_tilemap_set_position(binocle_tilemap *tilemap, kmVec2 position);
+
+/**
+ * \brief Sets the tile of a layer of a cell. The chunk containing it gets rebuilt the next time it's drawn.
+ * @param tilemap the tilemap
+ * @param x the column of the tile
+ * @param y the row of the tile, starting from the bottom
+ * @param layer the layer of the tile. Layer 0 is drawn first.
+ * @param tile the index of the tile in the tileset or BINOCLE_TILEMAP_EMPTY_TILE
+ */
+void binocle_tilemap_set_layer_tile(binocle_tilemap *tilemap, uint32_t x, uint32_t y, uint32_t layer, int32_t tile);
+
+/**
+ * \brief Stacks a tile on top of the ones of a cell, in its lowest empty layer
+ * @param tilemap the tilemap
+ * @param x the column of the tile
+ * @param y the row of the tile, starting from the bottom
+ * @param tile the index of the tile in the tileset
+ * @return false if the cell is out of the map or all its layers are taken
+ */
+bool binocle_tilemap_push_tile(binocle_tilemap *tilemap, uint32_t x, uint32_t y, int32_t tile);
+
+/**
+ * \brief Gets the tile of a layer of a cell
+ * @param tilemap the tilemap
+ * @param x the column of the tile
+ * @param y the row of the tile, starting from the bottom
+ * @param layer the layer of the tile
+ * @return the index of the tile in the tileset or BINOCLE_TILEMAP_EMPTY_TILE if it's empty or out of the map
+ */
+int32_t binocle_tilemap_get_layer_tile(binocle_tilemap *tilemap, uint32_t x, uint32_t y, uint32_t layer);
+
+/**
+ * \brief Sets the tile of layer 0 of a cell. The chunk containing it gets rebuilt the next time it's drawn.
+ * @param tilemap the tilemap
+ * @param x the column of the tile
+ * @param y the row of the tile, starting from the bottom
+ * @param tile the index of the tile in the tileset or BINOCLE_TILEMAP_EMPTY_TILE
+ */
+void binocle_tilemap_set_tile(binocle_tilemap *tilemap, uint32_t x, uint32_t y, int32_t tile);
+
+/**
+ * \brief Gets the tile of layer 0 of a cell
+ * @param tilemap the tilemap
+ * @param x the column of the tile
+ * @param y the row of the tile, starting from the bottom
+ * @return the index of the tile in the tileset or BINOCLE_TILEMAP_EMPTY_TILE if it's empty or out of the map
+ */
+int32_t binocle_tilemap_get_tile(binocle_tilemap *tilemap, uint32_t x, uint32_t y);
+
+/**
+ * \brief Draws the chunks of the tilemap that are visible from the camera
+ * Each visible chunk that isn't empty records a single command. Dirty chunks are rebuilt before being drawn.
+ * \note A chunk can only be rebuilt once per frame, so tiles changed after the tilemap has been drawn show up in the
+ * next frame.
+ * @param tilemap the tilemap
+ * @param gd the graphics device instance
+ * @param viewport the viewport
+ * @param camera the camera used to cull the chunks. If NULL, all the chunks get drawn.
+ * @param depth the depth of the layer
+ */
+void binocle_tilemap_draw(binocle_tilemap *tilemap, struct binocle_gd *gd, kmAABB2 viewport,
+                          struct binocle_camera *camera, float depth);
+
+#endif //BINOCLE_TILEMAP_H
@@ -179,7 +179,7 @@ void binocle_ttfont_draw_string(binocle_ttfont *font, const char *str, struct bi
     ++str;
   }
   font->vertexes_count = index;
-  binocle_gd_draw(gd, font->vertexes, font->vertexes_count, *font->material, viewport, camera, depth);
+  binocle_gd_draw(gd, font->vertexes, font->vertexes_count, font->material, viewport, camera, depth);
 }
 
 float binocle_ttfont_get_string_width(binocle_ttfont *font, const char *str) {
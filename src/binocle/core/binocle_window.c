@@ -8,6 +8,7 @@
 #include "backend/binocle_color.h"
 #include "binocle_log.h"
 #include "binocle_memory.h"
+#include "binocle_profiler.h"
 #include "binocle_sdl.h"
 #include <inttypes.h>
 #include <stdlib.h>
@@ -102,7 +103,7 @@ void binocle_window_create(binocle_window *win, char *title, uint32_t width, uin
 #endif
 #if defined(BINOCLE_GL)
   int flags = SDL_WINDOW_OPENGL;
-#elif defined(BINOCLE_METAL)
+#else
   int flags = 0;
 #endif
 
@@ -340,12 +341,15 @@ uint32_t binocle_window_get_frame_time(binocle_window *win) {
 }
 
 void binocle_window_begin_frame(binocle_window *win) {
+  BINOCLE_PROFILE_FRAME_BEGIN();
   win->current_time = SDL_GetTicks();
   win->update_time = win->current_time - win->previous_time;
   win->previous_time = win->current_time;
 }
 
 void binocle_window_end_frame(binocle_window *win) {
+  // The time spent waiting for the next frame isn't part of the frame
+  BINOCLE_PROFILE_FRAME_END();
   binocle_window_delay_framerate_if_needed(win);
 }
 
@@ -406,13 +410,15 @@ sg_swapchain binocle_window_get_swapchain(binocle_window *window) {
       // we just assume here that the GL framebuffer is always 0
       .framebuffer = 0,
     }
-#else
+#elif defined(BINOCLE_METAL)
     .color_format = SG_PIXELFORMAT_BGRA8,
     .metal = {
       .current_drawable = binocle_sokol_mtk_get_drawable(),
       //.depth_stencil_texture = binocle_sokol_mtk_get_depth_stencil_texture(),
       // .msaa_color_texture = binocle_sokol_mtk_get_msaa_color_texture(),
     }
+#else
+    .color_format = SG_PIXELFORMAT_RGBA8,
 #endif
   };
 }
\ No newline at end of file